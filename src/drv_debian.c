@@ -144,7 +144,8 @@ static int interface_deps(struct netcf *ncf, char ***slaves, const char *fmt, ..
         ERR_NOMEM(1, ncf);
     }
 
-    nmatches = aug_match(aug, path, &matches);
+    STAT_TIMED(ncf, NETCF_STAT_AUG_MATCH,
+               nmatches = aug_match(aug, path, &matches));
     ERR_COND_BAIL(nmatches < 0, ncf, EOTHER);
 
     if (!nmatches)
@@ -364,19 +365,14 @@ int drv_init(struct netcf *ncf) {
         goto error;
     }
 
-    // FIXME: Check for errors
-    xsltInit();
-    exsltStrRegister();
-    ncf->driver->get = parse_stylesheet(ncf, "debian-get.xsl");
-    ncf->driver->put = parse_stylesheet(ncf, "debian-put.xsl");
-    ERR_BAIL(ncf);
+    /* parsed by load_stylesheets when they are first needed */
+    ncf->driver->get_xsl = "debian-get.xsl";
+    ncf->driver->put_xsl = "debian-put.xsl";
 
     /* open a socket for interface ioctls */
     ncf->driver->ioctl_fd = init_ioctl_fd(ncf);
     if (ncf->driver->ioctl_fd < 0)
         goto error;
-    if (netlink_init(ncf) < 0)
-        goto error;
     return 0;
 
  error:
@@ -389,6 +385,7 @@ void drv_close(struct netcf *ncf) {
         return;
     xsltFreeStylesheet(ncf->driver->get);
     xsltFreeStylesheet(ncf->driver->put);
+    events_close(ncf);
     netlink_close(ncf);
     if (ncf->driver->ioctl_fd >= 0)
         close(ncf->driver->ioctl_fd);
@@ -398,7 +395,8 @@ void drv_close(struct netcf *ncf) {
 }
 
 void drv_entry(struct netcf *ncf) {
-    ncf->driver->load_augeas = 1;
+    if (NCF_CACHE_REFRESH(ncf, NETCF_CACHE_CONFIG))
+        ncf->driver->load_augeas = 1;
 }
 
 static int list_interface_ids(struct netcf *ncf,
@@ -457,6 +455,12 @@ struct netcf_if *drv_lookup_by_name(struct netcf *ncf, const char *name) {
     int found = 0;
     int r;
 
+    /* Found since the tree was last reread or saved */
+    nif = find_netcf_if(ncf, name);
+    if (nif != NULL && config_gen_current(ncf, nif->lookup_gen))
+        return nif;
+    unref(nif, netcf_if);
+
     results = list_interface_ids(ncf, 0, NULL, NETCF_IFACE_ACTIVE|NETCF_IFACE_INACTIVE);
     ERR_BAIL(ncf);
 
@@ -480,6 +484,7 @@ struct netcf_if *drv_lookup_by_name(struct netcf *ncf, const char *name) {
 
     nif = make_netcf_if(ncf, name_dup);
     ERR_BAIL(ncf);
+    nif->lookup_gen = ncf->config_gen;
     goto done;
 
  error:
@@ -720,6 +725,8 @@ char *drv_xml_desc(struct netcf_if *nif) {
     aug_xml = aug_get_xml(nif);
     ERR_BAIL(ncf);
 
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
     result = apply_stylesheet_to_string(ncf, ncf->driver->put, aug_xml);
 
  error:
@@ -732,7 +739,6 @@ char *drv_xml_desc(struct netcf_if *nif) {
 
 char *drv_xml_state(struct netcf_if *nif) {
     char *result = NULL;
-    int r, result_len;
     struct netcf *ncf;
     xmlDocPtr ncf_xml = NULL;
     xmlNodePtr root;
@@ -752,9 +758,8 @@ char *drv_xml_state(struct netcf_if *nif) {
     add_state_to_xml_doc(nif, ncf_xml);
     ERR_BAIL(ncf);
 
-    r = xsltSaveResultToString((xmlChar **)&result, &result_len,
-                               ncf_xml, ncf->driver->put);
-    ERR_NOMEM(r < 0, ncf);
+    result = xml_doc_to_string(ncf, ncf_xml);
+    ERR_BAIL(ncf);
 
  done:
     xmlFreeDoc(ncf_xml);
@@ -765,6 +770,20 @@ char *drv_xml_state(struct netcf_if *nif) {
     goto done;
 }
 
+/* return the live state of all toplevel interfaces matching FLAGS */
+char *drv_all_xml_state(struct netcf *ncf, unsigned int flags) {
+    return all_xml_state(ncf, flags);
+}
+
+int drv_get_event_fd(struct netcf *ncf) {
+    return events_get_fd(ncf);
+}
+
+int drv_read_events(struct netcf *ncf, struct netcf_event *events,
+                    int maxevents) {
+    return events_read(ncf, events, maxevents);
+}
+
 /* Report various status info about the interface as bits in
  * "flags". Returns 0 on success, -1 on failure
  */
@@ -783,6 +802,14 @@ error:
     return -1;
 }
 
+int drv_if_stats(struct netcf_if *nif, struct netcf_if_stats *stats) {
+    ERR_THROW(stats == NULL, nif->ncf, EOTHER,
+              "NULL pointer for stats in ncf_if_stats");
+    return if_stats(nif->ncf, nif->name, stats);
+error:
+    return -1;
+}
+
 /* Get the content of /interface/@name. Result must be freed with xmlFree()
  *
  * The name on VLAN interfaces is optional; if there is no
@@ -906,61 +933,114 @@ static void bond_setup(struct netcf *ncf, const char *name, bool alias) {
 }
 
 
-struct netcf_if *drv_define(struct netcf *ncf, const char *xml_str) {
-    struct netcf_if *result = NULL;
-    xmlDocPtr ncf_xml = NULL, aug_xml = NULL;
-    char *name = NULL;
-    int r;
-    struct augeas *aug = get_augeas(ncf);
+/* Parse, validate and transform the interface definition XML_STR into
+ * DEFN. None of this depends on the root */
+static int prepare_interface(struct netcf *ncf, const char *xml_str,
+                             struct if_defn *defn) {
+    defn->ncf_xml = parse_xml(ncf, xml_str);
+    ERR_BAIL(ncf);
 
+    rng_validate(ncf, defn->ncf_xml);
     ERR_BAIL(ncf);
 
-    ncf_xml = parse_xml(ncf, xml_str);
+    defn->name = device_name_from_xml(ncf, defn->ncf_xml);
+    ERR_COND_BAIL(defn->name == NULL, ncf, EINTERNAL);
+
+    load_stylesheets(ncf);
     ERR_BAIL(ncf);
+    defn->aug_xml = apply_stylesheet(ncf, ncf->driver->get, defn->ncf_xml);
+    ERR_BAIL(ncf);
+
+    return 0;
+ error:
+    return -1;
+}
 
-    rng_validate(ncf, ncf_xml);
+/* Put the prepared DEFN into the Augeas tree, without saving it */
+static int put_prepared_interface(struct netcf *ncf,
+                                  const struct if_defn *defn) {
+    get_augeas(ncf);
     ERR_BAIL(ncf);
 
-    name = device_name_from_xml(ncf, ncf_xml);
-    ERR_COND_BAIL(name == NULL, ncf, EINTERNAL);
+    rm_all_interfaces(ncf, defn->ncf_xml);
+    ERR_BAIL(ncf);
 
-    rm_all_interfaces(ncf, ncf_xml);
+    aug_put_xml(ncf, defn->aug_xml);
     ERR_BAIL(ncf);
 
-    aug_xml = apply_stylesheet(ncf, ncf->driver->get, ncf_xml);
+    bond_setup(ncf, defn->name, true);
     ERR_BAIL(ncf);
 
-    aug_put_xml(ncf, aug_xml);
+    return 0;
+ error:
+    return -1;
+}
+
+/* Put the definition of an interface from XML_STR into the Augeas tree
+ * without saving it, and return the name of the interface */
+static char *put_interface(struct netcf *ncf, const char *xml_str) {
+    struct if_defn defn;
+    char *name = NULL;
+
+    MEMZERO(&defn, 1);
+
+    prepare_interface(ncf, xml_str, &defn);
     ERR_BAIL(ncf);
 
-    bond_setup(ncf, name, true);
+    put_prepared_interface(ncf, &defn);
     ERR_BAIL(ncf);
 
-    r = aug_save(aug);
-    if (r < 0 && NCF_DEBUG(ncf)) {
-        fprintf(stderr, "Errors from aug_save:\n");
-        aug_print(aug, stderr, "/augeas//error");
-    }
-    ERR_THROW(r < 0, ncf, EOTHER, "aug_save failed");
+    name = defn.name;
+    defn.name = NULL;
+ error:
+    if_defn_clear(&defn);
+    return name;
+}
+
+struct netcf_if *drv_define(struct netcf *ncf, const char *xml_str) {
+    char *name = NULL;
+    struct netcf_if *result = NULL;
+
+    name = put_interface(ncf, xml_str);
+    ERR_BAIL(ncf);
+
+    save_augeas(ncf);
+    ERR_BAIL(ncf);
 
     result = make_netcf_if(ncf, name);
     ERR_BAIL(ncf);
 
- done:
-    xmlFreeDoc(ncf_xml);
-    xmlFreeDoc(aug_xml);
     return result;
  error:
+    if (result == NULL)
+        FREE(name);
     unref(result, netcf_if);
-    goto done;
+    return NULL;
+}
+
+char *drv_define_preview(struct netcf *ncf, const char *xml_str) {
+    char *name = NULL, *result = NULL;
+
+    name = put_interface(ncf, xml_str);
+    ERR_BAIL(ncf);
+
+    result = preview_augeas(ncf);
+ error:
+    FREE(name);
+    return result;
+}
+
+int drv_define_roots(struct netcf *ncf, int nxml, const char *const *xmls,
+                     int nroots, const char *const *roots, int nthreads,
+                     netcf_errcode_t *errcodes, char **errdetails) {
+    return define_roots(ncf, nxml, xmls, nroots, roots, nthreads, errcodes,
+                        errdetails, prepare_interface, put_prepared_interface);
 }
 
 int drv_undefine(struct netcf_if *nif) {
-    struct augeas *aug = NULL;
     struct netcf *ncf = nif->ncf;
-    int r;
 
-    aug = get_augeas(ncf);
+    get_augeas(ncf);
     ERR_BAIL(ncf);
 
     bond_setup(ncf, nif->name, false);
@@ -969,8 +1049,8 @@ int drv_undefine(struct netcf_if *nif) {
     rm_interface(ncf, nif->name);
     ERR_BAIL(ncf);
 
-    r = aug_save(aug);
-    ERR_COND_BAIL(r < 0, ncf, EOTHER);
+    save_augeas(ncf);
+    ERR_BAIL(ncf);
 
     return 0;
  error:
@@ -1030,6 +1110,10 @@ const char *drv_mac_string(struct netcf_if *nif) {
     char *path = NULL;
     int r;
 
+    /* The tree has not been reread or saved since we last looked */
+    if (config_gen_current(ncf, nif->mac_gen))
+        return nif->mac;
+
     r = aug_get_mac(ncf, nif->name, &mac);
     ERR_THROW(r < 0, ncf, EOTHER, "could not lookup MAC of %s", nif->name);
 
@@ -1042,6 +1126,7 @@ const char *drv_mac_string(struct netcf_if *nif) {
     } else {
         FREE(nif->mac);
     }
+    nif->mac_gen = ncf->config_gen;
     /* fallthrough intentional */
  error:
     FREE(path);
@@ -1052,16 +1137,15 @@ const char *drv_mac_string(struct netcf_if *nif) {
  * Bringing interfaces up/down
  */
 
-int drv_if_up(struct netcf_if *nif) {
+int drv_if_up(struct netcf_if *nif, int timeout_ms, unsigned int flags) {
     static const char *const ifup = IFUP;
     struct netcf *ncf = nif->ncf;
     int result = -1;
 
     run1(ncf, ifup, nif->name);
     ERR_BAIL(ncf);
-    ERR_THROW(!if_is_active(ncf, nif->name), ncf, EOTHER,
-              "interface %s failed to become active - "
-              "possible disconnected cable.", nif->name);
+    if_wait_active(ncf, nif->name, timeout_ms, flags);
+    ERR_BAIL(ncf);
     result = 0;
  error:
     return result;
@@ -1104,6 +1188,9 @@ drv_change_rollback(struct netcf *ncf, unsigned int flags)
     ERR_THROW(flags != 0, ncf, EOTHER, "unsupported flags value %d", flags);
     run1(ncf, NETCF_TRANSACTION, "change-rollback");
     ERR_BAIL(ncf);
+    /* The files we wrote were restored, most likely in place */
+    sync_flush(ncf);
+    ERR_BAIL(ncf);
     result = 0;
 error:
     return result;
@@ -1115,6 +1202,9 @@ drv_change_commit(struct netcf *ncf, unsigned int flags)
     int result = -1;
 
     ERR_THROW(flags != 0, ncf, EOTHER, "unsupported flags value %d", flags);
+    /* The changes must be on disk before the snapshot goes away */
+    sync_flush(ncf);
+    ERR_BAIL(ncf);
     run1(ncf, NETCF_TRANSACTION, "change-commit");
     ERR_BAIL(ncf);
     result = 0;
@@ -1135,6 +1225,8 @@ static int drv_get_aug(struct netcf *ncf, const char *ncf_xml, char **aug_xml) {
     rng_validate(ncf, ncf_doc);
     ERR_BAIL(ncf);
 
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
     *aug_xml = apply_stylesheet_to_string(ncf, ncf->driver->get, ncf_doc);
     ERR_BAIL(ncf);
 
@@ -1154,6 +1246,8 @@ static int drv_put_aug(struct netcf *ncf, const char *aug_xml, char **ncf_xml) {
     aug_doc = parse_xml(ncf, aug_xml);
     ERR_BAIL(ncf);
 
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
     *ncf_xml = apply_stylesheet_to_string(ncf, ncf->driver->put, aug_doc);
     ERR_BAIL(ncf);
 
@@ -1169,15 +1263,21 @@ static int drv_put_aug(struct netcf *ncf, const char *aug_xml, char **ncf_xml) {
  * Test interface
  */
 int ncf_get_aug(struct netcf *ncf, const char *ncf_xml, char **aug_xml) {
-    API_ENTRY(ncf);
+    int result;
 
-    return drv_get_aug(ncf, ncf_xml, aug_xml);
+    API_ENTRY(ncf);
+    result = drv_get_aug(ncf, ncf_xml, aug_xml);
+    API_EXIT(ncf);
+    return result;
 }
 
 int ncf_put_aug(struct netcf *ncf, const char *aug_xml, char **ncf_xml) {
-    API_ENTRY(ncf);
+    int result;
 
-    return drv_put_aug(ncf, aug_xml, ncf_xml);
+    API_ENTRY(ncf);
+    result = drv_put_aug(ncf, aug_xml, ncf_xml);
+    API_EXIT(ncf);
+    return result;
 }
 
 /*
@@ -29,11 +29,13 @@
 #include <internal.h>
 
 #include <err.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <spawn.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
 #include <dirent.h>
 #include <fnmatch.h>
 #include <wctype.h>
@@ -43,6 +45,7 @@
 #include <ifaddrs.h>
 #include <net/if.h>
 #include <net/if_dl.h>
+#include <net/route.h>
 #include <net/if_types.h>
 #include <net/ethernet.h>
 #include <sys/ioctl.h>
@@ -295,7 +298,9 @@ int drv_if_down(struct netcf_if *nif) {
     return setifflags(nif->name, -IFF_UP, nif->ncf->driver->ioctl_fd);
 }
 
-int drv_if_up(struct netcf_if *nif) {
+/* There are no link notifications to wait for here */
+int drv_if_up(struct netcf_if *nif, int timeout_ms ATTRIBUTE_UNUSED,
+              unsigned int flags ATTRIBUTE_UNUSED) {
     return setifflags(nif->name, IFF_UP, nif->ncf->driver->ioctl_fd);
 }
 
@@ -446,48 +451,102 @@ struct netcf_if *drv_define(struct netcf *ncf ATTRIBUTE_UNUSED,
     return NULL;
 }
 
+char *drv_define_preview(struct netcf *ncf,
+                         const char *xml_str ATTRIBUTE_UNUSED) {
+    char *result = NULL;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
+int drv_define_roots(struct netcf *ncf, int nxml ATTRIBUTE_UNUSED,
+                     const char *const *xmls ATTRIBUTE_UNUSED,
+                     int nroots ATTRIBUTE_UNUSED,
+                     const char *const *roots ATTRIBUTE_UNUSED,
+                     int nthreads ATTRIBUTE_UNUSED,
+                     netcf_errcode_t *errcodes ATTRIBUTE_UNUSED,
+                     char **errdetails ATTRIBUTE_UNUSED) {
+    int result = -1;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
 /*
  * remove all configurations for nif from rc.conf
  * We write everything less interface in question to a temp file and then
- * rename that temp file to rc.conf (bad? got any better idea?)
+ * rename that temp file to rc.conf, so that a crash leaves either the old
+ * or the new rc.conf in place
  */
 int drv_undefine(struct netcf_if *nif) {
-
-    FILE *fp, *fp_tmp;
+    struct netcf *ncf = nif->ncf;
+    char errbuf[128];
+    FILE *fp = NULL, *fp_tmp = NULL;
     char line[256];
-    char *line_ptr;
+    int r;
 
     /* read rc.conf */
     fp = fopen(PATH_RC_CONF, "r");
-    if (fp == NULL) {
-        printf("Could not open rc.conf\n");
-        return -1;
-    }
+    ERR_THROW_STRERROR(fp == NULL, ncf, EFILE, "could not open %s: %s",
+                       PATH_RC_CONF, errbuf);
 
     /* open tmp file for writing */
     fp_tmp = fopen(PATH_RC_CONF_TMP, "w");
-    if (fp_tmp == NULL) {
-        printf("Could not open tmp file\n");
-        return -1;
-    }
+    ERR_THROW_STRERROR(fp_tmp == NULL, ncf, EFILE, "could not open %s: %s",
+                       PATH_RC_CONF_TMP, errbuf);
 
     while (fgets(line, sizeof(line), fp) != NULL) {
-        line_ptr = line;
-
         /* if line is not a comment and has <interface>, process it */
         if (line[0] != '#' && strstr(line, nif->name))
             continue;
-        else
-            fputs(line, fp_tmp); /* copy this line to the tmp file */
+        r = fputs(line, fp_tmp); /* copy this line to the tmp file */
+        ERR_THROW_STRERROR(r == EOF, ncf, EFILE, "could not write %s: %s",
+                           PATH_RC_CONF_TMP, errbuf);
     }
+    ERR_THROW_STRERROR(ferror(fp), ncf, EFILE, "could not read %s: %s",
+                       PATH_RC_CONF, errbuf);
 
     fclose(fp);
-    fclose(fp_tmp);
+    fp = NULL;
+    /* The new contents have to be on disk before the rename makes them
+     * rc.conf, or a crash can leave an empty rc.conf behind */
+    if (ncf->durability != NETCF_DURABILITY_NONE) {
+        r = fflush(fp_tmp);
+        ERR_THROW_STRERROR(r == EOF, ncf, EFILE, "could not write %s: %s",
+                           PATH_RC_CONF_TMP, errbuf);
+        r = fsync(fileno(fp_tmp));
+        ERR_THROW_STRERROR(r < 0, ncf, EFILE, "could not sync %s: %s",
+                           PATH_RC_CONF_TMP, errbuf);
+    }
+    r = fclose(fp_tmp);
+    fp_tmp = NULL;
+    ERR_THROW_STRERROR(r == EOF, ncf, EFILE, "could not write %s: %s",
+                       PATH_RC_CONF_TMP, errbuf);
 
     /* Rename rc.conf.tmp to rc.conf */
-    rename(PATH_RC_CONF_TMP, PATH_RC_CONF);
+    r = rename(PATH_RC_CONF_TMP, PATH_RC_CONF);
+    ERR_THROW_STRERROR(r < 0, ncf, EFILE, "could not rename %s to %s: %s",
+                       PATH_RC_CONF_TMP, PATH_RC_CONF, errbuf);
+
+    sync_file_written(ncf, PATH_RC_CONF);
+    ERR_BAIL(ncf);
+    sync_end(ncf);
+    ERR_BAIL(ncf);
 
     return 0;
+
+error:
+    if (fp != NULL)
+        fclose(fp);
+    if (fp_tmp != NULL) {
+        fclose(fp_tmp);
+        unlink(PATH_RC_CONF_TMP);
+    }
+    return -1;
 }
 
 /*
@@ -519,6 +578,91 @@ int dhcp_lease_exists (struct netcf_if *nif) {
     return has_dhcp;
 }
 
+/*
+ * Look up the default route for IPv4 (INET == 0) or IPv6 (INET == 1)
+ * with a RTM_GET on a routing socket. Returns 1 and the gateway in BUF
+ * if the default route goes out through IFNAME, 0 if there is no default
+ * route or it goes through another interface, and -1 on error.
+ */
+static int default_gateway(const char *ifname, int inet,
+                           char *buf, size_t buflen) {
+    struct {
+        struct rt_msghdr hdr;
+        char             space[512];
+    } msg;
+    struct sockaddr_storage dst;
+    struct sockaddr_dl ifp_req;
+    struct sockaddr *sa, *gateway = NULL;
+    struct sockaddr_dl *ifp = NULL;
+    pid_t pid = getpid();
+    char *cp;
+    int s, len, seq = 1;
+    int family = inet ? AF_INET6 : AF_INET;
+    size_t salen = inet ? sizeof(struct sockaddr_in6)
+                        : sizeof(struct sockaddr_in);
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&dst, 0, sizeof(dst));
+    memset(&ifp_req, 0, sizeof(ifp_req));
+    dst.ss_family = family;
+    dst.ss_len = salen;
+    ifp_req.sdl_family = AF_LINK;
+    ifp_req.sdl_len = sizeof(ifp_req);
+
+    /* The all-zero destination and netmask are the default route; asking
+     * for RTA_IFP makes the kernel tell us the outgoing interface */
+    msg.hdr.rtm_type = RTM_GET;
+    msg.hdr.rtm_version = RTM_VERSION;
+    msg.hdr.rtm_flags = RTF_UP | RTF_GATEWAY;
+    msg.hdr.rtm_addrs = RTA_DST | RTA_NETMASK | RTA_IFP;
+    msg.hdr.rtm_seq = seq;
+    cp = msg.space;
+    memcpy(cp, &dst, salen);
+    cp += SA_SIZE((struct sockaddr *) &dst);
+    memcpy(cp, &dst, salen);
+    cp += SA_SIZE((struct sockaddr *) &dst);
+    memcpy(cp, &ifp_req, sizeof(ifp_req));
+    cp += SA_SIZE((struct sockaddr *) &ifp_req);
+    msg.hdr.rtm_msglen = cp - (char *) &msg;
+
+    s = socket(PF_ROUTE, SOCK_RAW, 0);
+    if (s < 0)
+        return -1;
+    if (write(s, &msg, msg.hdr.rtm_msglen) < 0) {
+        int saved_errno = errno;
+        close(s);
+        /* No default route */
+        return (saved_errno == ESRCH) ? 0 : -1;
+    }
+    do {
+        len = read(s, &msg, sizeof(msg));
+    } while (len > 0 && (msg.hdr.rtm_seq != seq || msg.hdr.rtm_pid != pid));
+    close(s);
+    if (len < 0)
+        return -1;
+
+    cp = msg.space;
+    for (int i=0; i < RTAX_MAX; i++) {
+        if (!(msg.hdr.rtm_addrs & (1 << i)))
+            continue;
+        sa = (struct sockaddr *) cp;
+        if (i == RTAX_GATEWAY)
+            gateway = sa;
+        else if (i == RTAX_IFP && sa->sa_family == AF_LINK)
+            ifp = (struct sockaddr_dl *) sa;
+        cp += SA_SIZE(sa);
+    }
+    if (gateway == NULL || gateway->sa_family != family || ifp == NULL)
+        return 0;
+    if (ifp->sdl_nlen != strlen(ifname)
+        || strncmp(ifp->sdl_data, ifname, ifp->sdl_nlen) != 0)
+        return 0;
+    if (getnameinfo(gateway, gateway->sa_len, buf, buflen,
+                    NULL, 0, NI_NUMERICHOST) != 0)
+        return -1;
+    return 1;
+}
+
 /*
  * print xml from interface state information
  *
@@ -541,6 +685,7 @@ void xml_print (struct netcf_if *nif, int interface_type, char *mac,
     xmlNsPtr ns = NULL;
     char interface[20];
     char vlan_tag_str[10];
+    char gateway[NI_MAXHOST];
 
     int has_dhcp = 0;
 
@@ -596,17 +741,19 @@ void xml_print (struct netcf_if *nif, int interface_type, char *mac,
     if (has_dhcp) {
         dhcp_node = xmlNewChild(protocol_node, ns, (xmlChar*)"dhcp", NULL);
     } else {
-        /* prefix and gateway are dummy for now. */
+        /* prefix is dummy for now. */
         ip_node = xmlNewChild(protocol_node, ns, (xmlChar*)"ip", NULL);
         xmlNewProp(ip_node, (xmlChar*)"address", (xmlChar*)addr_buf);
         /* prefix only possible with IPv6 */
         if (inet == 1)
             xmlNewProp(prefix_node, (xmlChar*)"prefix", (xmlChar*)"00");
 
-        /* gateway info is only for "ethernet" */
-        if (interface_type == 0) {
+        /* gateway info is only for "ethernet", and only if the default
+         * route actually goes through this interface */
+        if (interface_type == 0 &&
+            default_gateway(nif->name, inet, gateway, sizeof(gateway)) == 1) {
             route_node = xmlNewChild(protocol_node, ns, (xmlChar*)"route", NULL);
-            xmlNewProp(route_node, (xmlChar*)"gateway", (xmlChar*)"0.0.0.0");
+            xmlNewProp(route_node, (xmlChar*)"gateway", (xmlChar*)gateway);
         }
     }
 
@@ -856,6 +1003,36 @@ char *drv_xml_state(struct netcf_if *nif) {
     return NULL;
 }
 
+char *drv_all_xml_state(struct netcf *ncf,
+                        unsigned int flags ATTRIBUTE_UNUSED) {
+    char *result = NULL;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
+int drv_get_event_fd(struct netcf *ncf) {
+    int result = -1;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
+int drv_read_events(struct netcf *ncf,
+                    struct netcf_event *events ATTRIBUTE_UNUSED,
+                    int maxevents ATTRIBUTE_UNUSED) {
+    int result = -1;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
 int drv_if_status(struct netcf_if *nif, unsigned int *flags ATTRIBUTE_UNUSED) {
     int is_active;
 
@@ -871,6 +1048,45 @@ error:
     return -1;
 }
 
+/* The kernel keeps the counters of a link in the if_data of its AF_LINK
+ * address. It does not count dropped outgoing packets on all versions,
+ * and has no notion of duplex or queues there, so those are left 0. */
+int drv_if_stats(struct netcf_if *nif, struct netcf_if_stats *stats) {
+    struct ifaddrs *ifap = NULL, *ifa;
+    struct if_data *ifd = NULL;
+    int result = -1, r;
+
+    ERR_THROW(stats == NULL, nif->ncf, EOTHER,
+              "NULL pointer for stats in ncf_if_stats");
+    MEMZERO(stats, 1);
+
+    r = getifaddrs(&ifap);
+    ERR_THROW(r < 0, nif->ncf, EIOCTL, "failed to get interface addresses");
+    for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_LINK
+            && ifa->ifa_data != NULL && STREQ(ifa->ifa_name, nif->name)) {
+            ifd = ifa->ifa_data;
+            break;
+        }
+    }
+    ERR_THROW(ifd == NULL, nif->ncf, EOTHER,
+              "interface %s does not exist", nif->name);
+
+    stats->rx_bytes = ifd->ifi_ibytes;
+    stats->rx_packets = ifd->ifi_ipackets;
+    stats->rx_errors = ifd->ifi_ierrors;
+    stats->rx_dropped = ifd->ifi_iqdrops;
+    stats->tx_bytes = ifd->ifi_obytes;
+    stats->tx_packets = ifd->ifi_opackets;
+    stats->tx_errors = ifd->ifi_oerrors;
+    stats->speed = ifd->ifi_baudrate / 1000000;
+    result = 0;
+error:
+    if (ifap != NULL)
+        freeifaddrs(ifap);
+    return result;
+}
+
 /*
  * Return number of interfaces that match mac string
  * Return -1 on error
@@ -933,6 +1149,9 @@ drv_change_rollback(struct netcf *ncf, unsigned int flags)
     ERR_THROW(flags != 0, ncf, EOTHER, "unsupported flags value %d", flags);
     run1(ncf, NETCF_TRANSACTION, "change-rollback");
     ERR_BAIL(ncf);
+    /* The files we wrote were restored, most likely in place */
+    sync_flush(ncf);
+    ERR_BAIL(ncf);
     result = 0;
 error:
     return result;
@@ -944,6 +1163,9 @@ drv_change_commit(struct netcf *ncf, unsigned int flags)
     int result = -1;
 
     ERR_THROW(flags != 0, ncf, EOTHER, "unsupported flags value %d", flags);
+    /* The changes must be on disk before the snapshot goes away */
+    sync_flush(ncf);
+    ERR_BAIL(ncf);
     run1(ncf, NETCF_TRANSACTION, "change-commit");
     ERR_BAIL(ncf);
     result = 0;
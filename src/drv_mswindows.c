@@ -231,7 +231,8 @@ int drv_if_down(struct netcf_if *nif) {
     return -1;
 }
 
-int drv_if_up(struct netcf_if *nif) {
+int drv_if_up(struct netcf_if *nif, int timeout_ms ATTRIBUTE_UNUSED,
+              unsigned int flags ATTRIBUTE_UNUSED) {
     struct netcf *ncf = nif->ncf;
     char *exe_path;
     char *p;
@@ -260,6 +261,31 @@ error:
     return result;
 }
 
+char *drv_define_preview(struct netcf *ncf,
+                         const char *xml_str ATTRIBUTE_UNUSED) {
+    char *result = NULL;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
+int drv_define_roots(struct netcf *ncf, int nxml ATTRIBUTE_UNUSED,
+                     const char *const *xmls ATTRIBUTE_UNUSED,
+                     int nroots ATTRIBUTE_UNUSED,
+                     const char *const *roots ATTRIBUTE_UNUSED,
+                     int nthreads ATTRIBUTE_UNUSED,
+                     netcf_errcode_t *errcodes ATTRIBUTE_UNUSED,
+                     char **errdetails ATTRIBUTE_UNUSED) {
+    int result = -1;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
 int drv_undefine(struct netcf_if *nif) {
     int result = -1;
 
@@ -288,6 +314,36 @@ error:
     return result;
 }
 
+char *drv_all_xml_state(struct netcf *ncf,
+                        unsigned int flags ATTRIBUTE_UNUSED) {
+    char *result = NULL;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
+int drv_get_event_fd(struct netcf *ncf) {
+    int result = -1;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
+int drv_read_events(struct netcf *ncf,
+                    struct netcf_event *events ATTRIBUTE_UNUSED,
+                    int maxevents ATTRIBUTE_UNUSED) {
+    int result = -1;
+
+    ERR_THROW(1 == 1, ncf, EOTHER, "not implemented on this platform");
+
+error:
+    return result;
+}
+
 int drv_if_status(struct netcf_if *nif, unsigned int *flags ATTRIBUTE_UNUSED) {
     int result = -1;
 
@@ -297,6 +353,16 @@ error:
     return result;
 }
 
+int drv_if_stats(struct netcf_if *nif,
+                 struct netcf_if_stats *stats ATTRIBUTE_UNUSED) {
+    int result = -1;
+
+    ERR_THROW(1 == 1, nif->ncf, EOTHER, "not implemented on this platform");
+    result = 0;
+error:
+    return result;
+}
+
 int drv_lookup_by_mac_string(struct netcf *ncf,
 			     const char *mac ATTRIBUTE_UNUSED,
                              int maxifaces ATTRIBUTE_UNUSED,
@@ -55,8 +55,11 @@ static const char *const network_scripts_path =
 static const char *const ifcfg_path =
     "/files/etc/sysconfig/network-scripts/*";
 
+static const char *const network_scripts_dir =
+    "etc/sysconfig/network-scripts";
+
 /* Augeas should only load the files we are interested in */
-static const struct augeas_pv augeas_xfm_common_pv[] = {
+static const struct augeas_pv augeas_xfm_ifcfg_pv[] = {
     /* Ifcfg files */
     { "/augeas/load/Ifcfg/lens", "Sysconfig.lns" },
     { "/augeas/load/Ifcfg/incl",
@@ -68,7 +71,10 @@ static const struct augeas_pv augeas_xfm_common_pv[] = {
     { "/augeas/load/Ifcfg/excl[5]", "*.rpmorig" },
     { "/augeas/load/Ifcfg/excl[6]", "*.rpmsave" },
     { "/augeas/load/Ifcfg/excl[7]", "*.augnew" },
-    { "/augeas/load/Ifcfg/excl[8]", "*.augsave" },
+    { "/augeas/load/Ifcfg/excl[8]", "*.augsave" }
+};
+
+static const struct augeas_pv augeas_xfm_common_pv[] = {
     /* modprobe config */
     { "/augeas/load/Modprobe/lens", "Modprobe.lns" },
     { "/augeas/load/Modprobe/incl[1]", "/etc/modprobe.d/*" },
@@ -83,10 +89,155 @@ static const struct augeas_pv augeas_xfm_common_pv[] = {
     { "/augeas/load/Sysfs/incl", "/sys/class/net/*/address" }
 };
 
+static const struct augeas_xfm_table augeas_xfm_ifcfg =
+    { .size = ARRAY_CARDINALITY(augeas_xfm_ifcfg_pv),
+      .pv = augeas_xfm_ifcfg_pv };
+
 static const struct augeas_xfm_table augeas_xfm_common =
     { .size = ARRAY_CARDINALITY(augeas_xfm_common_pv),
       .pv = augeas_xfm_common_pv };
 
+/* Undo NARROW_AUGEAS and have Augeas load all the files we know about
+ * again. The files are only loaded by the next GET_AUGEAS.
+ */
+static int widen_augeas(struct netcf *ncf) {
+    struct driver *d = ncf->driver;
+
+    if (d->narrow_xfm == NULL)
+        return 0;
+    remove_augeas_xfm_table(ncf, d->narrow_xfm);
+    free_augeas_xfm_table(d->narrow_xfm);
+    d->narrow_xfm = NULL;
+    if (add_augeas_xfm_table(ncf, &augeas_xfm_ifcfg) < 0 ||
+        add_augeas_xfm_table(ncf, &augeas_xfm_common) < 0)
+        return -1;
+    return 0;
+}
+
+/* Return the Augeas handle with all files loaded, for the operations
+ * that look at more than the files NARROW_AUGEAS picked for one interface
+ */
+static struct augeas *get_wide_augeas(struct netcf *ncf) {
+    widen_augeas(ncf);
+    ERR_BAIL(ncf);
+    return get_augeas(ncf);
+ error:
+    return NULL;
+}
+
+static bool ifcfg_key_eq(const struct ifcfg_file *file, ifcfg_key_t key,
+                         const char *value) {
+    return file->keys[key] != NULL && STREQ(file->keys[key], value);
+}
+
+/* Have Augeas load only the ifcfg files that can matter for looking up or
+ * describing the interface NAME: ifcfg-NAME, the files of its bridge
+ * ports and bond slaves, and for each of those ifcfg-DEVICE. The files
+ * are picked with the ifcfg index, without loading anything else.
+ *
+ * This only works if the config for NAME is in ifcfg-NAME; otherwise we
+ * need the HWADDR and DEVICE fallbacks of FIND_IFCFG_PATH, which look at
+ * all files, and leave the load wide. FIND_IFCFG_PATH also widens the
+ * load if it turns out it needs those fallbacks after all.
+ */
+static int narrow_augeas(struct netcf *ncf, const char *name) {
+    struct driver *d = ncf->driver;
+    struct ifcfg_index *index;
+    struct augeas_xfm_table *table = NULL;
+    bool *sel = NULL;
+    const char **ports = NULL;
+    char *fname = NULL, **files = NULL;
+    int nfiles = 0, nports = 0, r, result = -1;
+
+    index = ifcfg_index_get(ncf, &d->ifcfg_index, network_scripts_dir,
+                            false);
+    ERR_BAIL(ncf);
+
+    r = xasprintf(&fname, "ifcfg-%s", name);
+    ERR_NOMEM(r < 0, ncf);
+    if (ifcfg_index_find(index, fname) == NULL) {
+        result = widen_augeas(ncf);
+        goto done;
+    }
+
+    r = ALLOC_N(sel, index->nfiles);
+    ERR_NOMEM(r < 0, ncf);
+    r = ALLOC_N(ports, index->nfiles);
+    ERR_NOMEM(r < 0, ncf);
+    /* The devices that are ports of bridge NAME, which may be bonds */
+    for (int i=0; i < index->nfiles; i++) {
+        const struct ifcfg_file *f = index->files + i;
+
+        if (ifcfg_key_eq(f, IFCFG_BRIDGE, name)
+            && f->keys[IFCFG_DEVICE] != NULL)
+            ports[nports++] = f->keys[IFCFG_DEVICE];
+    }
+    for (int i=0; i < index->nfiles; i++) {
+        const struct ifcfg_file *f = index->files + i;
+
+        sel[i] = STREQ(f->name, fname)
+            || ifcfg_key_eq(f, IFCFG_DEVICE, name)
+            || ifcfg_key_eq(f, IFCFG_BRIDGE, name)
+            || ifcfg_key_eq(f, IFCFG_MASTER, name);
+        /* Slaves of a bond that is a port of bridge NAME */
+        for (int j=0; !sel[i] && f->keys[IFCFG_MASTER] != NULL
+                 && j < nports; j++)
+            sel[i] = STREQ(f->keys[IFCFG_MASTER], ports[j]);
+    }
+    /* FIND_IFCFG_PATH looks for ifcfg-DEVICE of each of them */
+    for (int i=0; i < index->nfiles; i++) {
+        const char *dev = index->files[i].keys[IFCFG_DEVICE];
+        const struct ifcfg_file *f;
+
+        if (!sel[i] || dev == NULL)
+            continue;
+        FREE(fname);
+        r = xasprintf(&fname, "ifcfg-%s", dev);
+        ERR_NOMEM(r < 0, ncf);
+        f = ifcfg_index_find(index, fname);
+        if (f != NULL)
+            sel[f - index->files] = true;
+    }
+
+    r = ALLOC_N(files, index->nfiles);
+    ERR_NOMEM(r < 0, ncf);
+    for (int i=0; i < index->nfiles; i++) {
+        if (!sel[i])
+            continue;
+        r = xasprintf(files + nfiles, "/%s/%s", network_scripts_dir,
+                      index->files[i].name);
+        ERR_NOMEM(r < 0, ncf);
+        nfiles += 1;
+    }
+
+    table = make_augeas_xfm_table(ncf, "Ifcfg", "Sysconfig.lns",
+                                  nfiles, files);
+    ERR_BAIL(ncf);
+
+    if (d->narrow_xfm == NULL) {
+        remove_augeas_xfm_table(ncf, &augeas_xfm_ifcfg);
+        remove_augeas_xfm_table(ncf, &augeas_xfm_common);
+    } else {
+        remove_augeas_xfm_table(ncf, d->narrow_xfm);
+        free_augeas_xfm_table(d->narrow_xfm);
+        d->narrow_xfm = NULL;
+    }
+    r = add_augeas_xfm_table(ncf, table);
+    ERR_BAIL(ncf);
+    d->narrow_xfm = table;
+    table = NULL;
+    result = 0;
+
+ done:
+ error:
+    free_augeas_xfm_table(table);
+    free_matches(nfiles, &files);
+    FREE(ports);
+    FREE(sel);
+    FREE(fname);
+    return result;
+}
+
 /* Entries in a ifcfg file that tell us that the interface
  * is not a toplevel interface
  */
@@ -210,7 +361,8 @@ static char *find_ifcfg_path(struct netcf *ncf, const char *name) {
     r = xasprintf(&path, "%s/ifcfg-%s", network_scripts_path, name);
     ERR_NOMEM(r < 0, ncf);
 
-    nmatches = aug_match(aug, path, NULL);
+    STAT_TIMED(ncf, NETCF_STAT_AUG_MATCH,
+               nmatches = aug_match(aug, path, NULL));
     ERR_COND_BAIL(nmatches < 0, ncf, EOTHER);
 
     if (nmatches == 1)
@@ -218,6 +370,13 @@ static char *find_ifcfg_path(struct netcf *ncf, const char *name) {
 
     FREE(path);
 
+    /* The fallbacks have to look at all ifcfg files */
+    if (ncf->driver->narrow_xfm != NULL) {
+        get_wide_augeas(ncf);
+        ERR_BAIL(ncf);
+        return find_ifcfg_path(ncf, name);
+    }
+
     /* Now find the config by MAC, matching on HWADDR */
     r = aug_get_mac(ncf, name, &mac);
     ERR_COND_BAIL(r < 0, ncf, EOTHER);
@@ -247,7 +406,7 @@ static int uniq_ifcfg_paths(struct netcf *ncf,
     struct augeas *aug;
     int r;
     int ndevnames = 0;
-    const char **devnames = NULL;
+    char **devnames = NULL;
 
     aug = get_augeas(ncf);
     ERR_BAIL(ncf);
@@ -266,8 +425,12 @@ static int uniq_ifcfg_paths(struct netcf *ncf,
                 exists = 1;
                 break;
             }
-        if (!exists)
-            devnames[ndevnames++] = name;
+        if (!exists) {
+            /* FIND_IFCFG_PATH may reload the tree that NAME lives in */
+            devnames[ndevnames] = strdup(name);
+            ERR_NOMEM(devnames[ndevnames] == NULL, ncf);
+            ndevnames += 1;
+        }
     }
     qsort(devnames, ndevnames, sizeof(*devnames), cmpstrp);
 
@@ -279,11 +442,11 @@ static int uniq_ifcfg_paths(struct netcf *ncf,
         ERR_BAIL(ncf);
     }
 
-    FREE(devnames);
+    free_matches(ndevnames, &devnames);
     return ndevnames;
 
  error:
-    FREE(devnames);
+    free_matches(ndevnames, &devnames);
     free_matches(ndevnames, intf);
     return -1;
 }
@@ -313,7 +476,7 @@ static int list_ifcfg_paths(struct netcf *ncf, char ***intf) {
 static int list_interfaces(struct netcf *ncf, char ***intf) {
     int nint = 0, result = 0;
 
-    get_augeas(ncf);
+    get_wide_augeas(ncf);
     ERR_BAIL(ncf);
 
     /* Look in augeas for all interfaces */
@@ -347,6 +510,9 @@ int drv_init(struct netcf *ncf) {
 
     ncf->driver->ioctl_fd = -1;
 
+    r = add_augeas_xfm_table(ncf, &augeas_xfm_ifcfg);
+    if (r < 0)
+        goto error;
     r = add_augeas_xfm_table(ncf, &augeas_xfm_common);
     if (r < 0)
         goto error;
@@ -357,19 +523,14 @@ int drv_init(struct netcf *ncf) {
         goto error;
     }
 
-    // FIXME: Check for errors
-    xsltInit();
-    exsltStrRegister();
-    ncf->driver->get = parse_stylesheet(ncf, "redhat-get.xsl");
-    ncf->driver->put = parse_stylesheet(ncf, "redhat-put.xsl");
-    ERR_BAIL(ncf);
+    /* parsed by load_stylesheets when they are first needed */
+    ncf->driver->get_xsl = "redhat-get.xsl";
+    ncf->driver->put_xsl = "redhat-put.xsl";
 
     /* open a socket for interface ioctls */
     ncf->driver->ioctl_fd = init_ioctl_fd(ncf);
     if (ncf->driver->ioctl_fd < 0)
         goto error;
-    if (netlink_init(ncf) < 0)
-        goto error;
     return 0;
 
  error:
@@ -382,16 +543,20 @@ void drv_close(struct netcf *ncf) {
         return;
     xsltFreeStylesheet(ncf->driver->get);
     xsltFreeStylesheet(ncf->driver->put);
+    events_close(ncf);
     netlink_close(ncf);
     if (ncf->driver->ioctl_fd >= 0)
         close(ncf->driver->ioctl_fd);
     aug_close(ncf->driver->augeas);
     FREE(ncf->driver->augeas_xfm_tables);
+    free_augeas_xfm_table(ncf->driver->narrow_xfm);
+    ifcfg_index_free(ncf->driver->ifcfg_index);
     FREE(ncf->driver);
 }
 
 void drv_entry(struct netcf *ncf) {
-    ncf->driver->load_augeas = 1;
+    if (NCF_CACHE_REFRESH(ncf, NETCF_CACHE_CONFIG))
+        ncf->driver->load_augeas = 1;
 }
 
 static int list_interface_ids(struct netcf *ncf,
@@ -402,7 +567,7 @@ static int list_interface_ids(struct netcf *ncf,
     int nint = 0, nmatches = 0, nqualified = 0, result = 0, r;
     char **intf = NULL, **matches = NULL;
 
-    aug = get_augeas(ncf);
+    aug = get_wide_augeas(ncf);
     ERR_BAIL(ncf);
     nint = list_interfaces(ncf, &intf);
     ERR_BAIL(ncf);
@@ -462,6 +627,14 @@ struct netcf_if *drv_lookup_by_name(struct netcf *ncf, const char *name) {
     char *pathx = NULL;
     char *name_dup = NULL;
 
+    /* Found since the tree was last reread or saved */
+    nif = find_netcf_if(ncf, name);
+    if (nif != NULL && config_gen_current(ncf, nif->lookup_gen))
+        return nif;
+    unref(nif, netcf_if);
+
+    narrow_augeas(ncf, name);
+    ERR_BAIL(ncf);
     get_augeas(ncf);
     ERR_BAIL(ncf);
 
@@ -476,6 +649,7 @@ struct netcf_if *drv_lookup_by_name(struct netcf *ncf, const char *name) {
 
     nif = make_netcf_if(ncf, name_dup);
     ERR_BAIL(ncf);
+    nif->lookup_gen = ncf->config_gen;
     goto done;
 
  error:
@@ -529,16 +703,21 @@ static xmlDocPtr aug_get_xml(struct netcf *ncf, int nint, char **intf) {
     return NULL;
 }
 
-/* Write the XML doc in the simple Augeas format into the Augeas tree */
+/* Entries of the ifcfg files that redhat-get.xsl can write; a redefine
+ * leaves all others alone */
+static const char *const ifcfg_managed[] = {
+    "BONDING_OPTS", "BOOTPROTO", "BRIDGE", "DELAY", "DEVICE", "DHCPV6",
+    "GATEWAY", "HOTPLUG", "HWADDR", "IPADDR", "IPV6ADDR",
+    "IPV6ADDR_SECONDARIES", "IPV6INIT", "IPV6_AUTOCONF", "IPV6_DEFAULTGW",
+    "MASTER", "MTU", "NETMASK", "ONBOOT", "PEERDNS", "SLAVE", "STP",
+    "TYPE", "VLAN", NULL
+};
+
+/* Write the XML doc in the simple Augeas format into the Augeas tree,
+ * touching only the entries that differ from what is there already */
 static int aug_put_xml(struct netcf *ncf, xmlDocPtr xml) {
     xmlNodePtr forest;
-    char *path = NULL, *lpath = NULL, *label = NULL, *value = NULL;
-    struct augeas *aug = NULL;
     int result = -1;
-    int r;
-
-    aug = get_augeas(ncf);
-    ERR_BAIL(ncf);
 
     forest = xmlDocGetRootElement(xml);
     ERR_THROW(forest == NULL, ncf, EINTERNAL, "missing root element");
@@ -546,37 +725,11 @@ static int aug_put_xml(struct netcf *ncf, xmlDocPtr xml) {
               EINTERNAL, "expected root node labeled 'forest', not '%s'",
               forest->name);
     list_for_each(tree, forest->children) {
-        ERR_THROW(! xmlStrEqual(tree->name, BAD_CAST "tree"), ncf,
-                  EINTERNAL, "expected node labeled 'tree', not '%s'",
-                  tree->name);
-        path = xml_prop(tree, "path");
-        /* This is a little drastic, since it clears out the file entirely */
-        r = aug_rm(aug, path);
-        ERR_THROW(r < 0, ncf, EINTERNAL, "aug_rm of '%s' failed", path);
-        list_for_each(node, tree->children) {
-            label = xml_prop(node, "label");
-            value = xml_prop(node, "value");
-            r = xasprintf(&lpath, "%s/%s", path, label);
-            ERR_NOMEM(r < 0, ncf);
-
-            r = aug_set(aug, lpath, value);
-            ERR_THROW(r < 0, ncf, EOTHER,
-                      "aug_set of '%s' failed", lpath);
-            FREE(lpath);
-            xmlFree(label);
-            xmlFree(value);
-            label = value = NULL;
-        }
-        xmlFree(path);
-        path = NULL;
-
+        aug_put_tree(ncf, tree, NULL, ifcfg_managed);
+        ERR_BAIL(ncf);
     }
     result = 0;
  error:
-    xmlFree(label);
-    xmlFree(value);
-    xmlFree(path);
-    FREE(lpath);
     return result;
 }
 
@@ -614,9 +767,13 @@ char *drv_xml_desc(struct netcf_if *nif) {
     xmlDocPtr aug_xml = NULL;
 
     ncf = nif->ncf;
+    narrow_augeas(ncf, nif->name);
+    ERR_BAIL(ncf);
     aug_xml = aug_get_xml_for_nif(nif);
     ERR_BAIL(ncf);
 
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
     result = apply_stylesheet_to_string(ncf, ncf->driver->put, aug_xml);
 
  error:
@@ -629,7 +786,6 @@ char *drv_xml_desc(struct netcf_if *nif) {
 
 char *drv_xml_state(struct netcf_if *nif) {
     char *result = NULL;
-    int r, result_len;
     struct netcf *ncf;
     xmlDocPtr ncf_xml = NULL;
     xmlNodePtr root;
@@ -649,9 +805,8 @@ char *drv_xml_state(struct netcf_if *nif) {
     add_state_to_xml_doc(nif, ncf_xml);
     ERR_BAIL(ncf);
 
-    r = xsltSaveResultToString((xmlChar **)&result, &result_len,
-                               ncf_xml, ncf->driver->put);
-    ERR_NOMEM(r < 0, ncf);
+    result = xml_doc_to_string(ncf, ncf_xml);
+    ERR_BAIL(ncf);
 
  done:
     xmlFreeDoc(ncf_xml);
@@ -662,6 +817,20 @@ char *drv_xml_state(struct netcf_if *nif) {
     goto done;
 }
 
+/* return the live state of all toplevel interfaces matching FLAGS */
+char *drv_all_xml_state(struct netcf *ncf, unsigned int flags) {
+    return all_xml_state(ncf, flags);
+}
+
+int drv_get_event_fd(struct netcf *ncf) {
+    return events_get_fd(ncf);
+}
+
+int drv_read_events(struct netcf *ncf, struct netcf_event *events,
+                    int maxevents) {
+    return events_read(ncf, events, maxevents);
+}
+
 /* Report various status info about the interface as bits in
  * "flags". Returns 0 on success, -1 on failure
  */
@@ -680,6 +849,14 @@ error:
     return -1;
 }
 
+int drv_if_stats(struct netcf_if *nif, struct netcf_if_stats *stats) {
+    ERR_THROW(stats == NULL, nif->ncf, EOTHER,
+              "NULL pointer for stats in ncf_if_stats");
+    return if_stats(nif->ncf, nif->name, stats);
+error:
+    return -1;
+}
+
 /* Get the content of /interface/@name. Result must be freed with xmlFree()
  *
  * The name on VLAN interfaces is optional; if there is no
@@ -746,7 +923,7 @@ static int bridge_slaves(struct netcf *ncf, const char *name, char ***slaves) {
     struct augeas *aug = NULL;
     int r, nslaves = 0;
 
-    aug = get_augeas(ncf);
+    aug = get_wide_augeas(ncf);
     ERR_BAIL(ncf);
 
     nslaves = aug_fmt_match(ncf, slaves,
@@ -770,36 +947,43 @@ static int bridge_slaves(struct netcf *ncf, const char *name, char ***slaves) {
 
 
 /* For an interface NAME, remove the ifcfg-* files for that interface and
- * all its slaves. */
-static void rm_interface(struct netcf *ncf, const char *name) {
-    int r;
-    char *path = NULL;
+ * all its slaves, except for the ones that AUG_XML, which may be NULL,
+ * has a tree for. */
+static void rm_interface(struct netcf *ncf, const char *name,
+                         xmlDocPtr aug_xml) {
+    int r, nmatches = 0;
+    char **matches = NULL;
     struct augeas *aug = NULL;
 
-    aug = get_augeas(ncf);
+    aug = get_wide_augeas(ncf);
     ERR_BAIL(ncf);
 
     /* The last or clause catches slaves of a bond that are enslaved to
      * a bridge NAME */
-    r = xasprintf(&path,
+    nmatches = aug_fmt_match(ncf, &matches,
           "%s[ DEVICE = '%s' or BRIDGE = '%s' or MASTER = '%s' "
           "    or MASTER = ../*[BRIDGE = '%s']/DEVICE ]",
                   ifcfg_path, name, name, name, name);
-    ERR_NOMEM(r < 0, ncf);
+    ERR_BAIL(ncf);
 
-    r = aug_rm(aug, path);
-    ERR_COND_BAIL(r < 0, ncf, EOTHER);
+    for (int i=0; i < nmatches; i++) {
+        if (forest_has_tree(aug_xml, matches[i]))
+            continue;
+        r = aug_rm(aug, matches[i]);
+        ERR_COND_BAIL(r < 0, ncf, EOTHER);
+    }
  error:
-    FREE(path);
+    free_matches(nmatches, &matches);
 }
 
-/* Remove all interfaces and their slaves mentioned in NCF_XML.  We need to
- * remove interfaces one by one when we define an interface, since what
- * will become a subinterface may not be related to the new toplevel
- * interface, and calling RM_INTERFACE on the toplevel interface is
- * therefore not enough.
+/* Remove all interfaces and their slaves mentioned in NCF_XML that are
+ * not part of AUG_XML any more.  We need to remove interfaces one by one
+ * when we define an interface, since what will become a subinterface may
+ * not be related to the new toplevel interface, and calling RM_INTERFACE
+ * on the toplevel interface is therefore not enough.
  */
-static void rm_all_interfaces(struct netcf *ncf, xmlDocPtr ncf_xml) {
+static void rm_all_interfaces(struct netcf *ncf, xmlDocPtr ncf_xml,
+                              xmlDocPtr aug_xml) {
     xmlXPathContextPtr context = NULL;
 	xmlXPathObjectPtr obj = NULL;
 
@@ -816,7 +1000,7 @@ static void rm_all_interfaces(struct netcf *ncf, xmlDocPtr ncf_xml) {
     for (int i=0; i < ns->nodeNr; i++) {
         xmlChar *name = xmlGetProp(ns->nodeTab[i], BAD_CAST "name");
         ERR_NOMEM(name == NULL, ncf);
-        rm_interface(ncf, (char *) name);
+        rm_interface(ncf, (char *) name, aug_xml);
         xmlFree(name);
         ERR_BAIL(ncf);
 	}
@@ -860,71 +1044,127 @@ static void bond_setup(struct netcf *ncf, const char *name, bool alias) {
     return;
 }
 
-struct netcf_if *drv_define(struct netcf *ncf, const char *xml_str) {
-    xmlDocPtr ncf_xml = NULL, aug_xml = NULL;
-    char *name = NULL;
-    struct netcf_if *result = NULL;
-    int r;
-    struct augeas *aug = get_augeas(ncf);
+/* Parse, validate and transform the interface definition XML_STR into
+ * DEFN. None of this depends on the root */
+static int prepare_interface(struct netcf *ncf, const char *xml_str,
+                             struct if_defn *defn) {
+    defn->ncf_xml = parse_xml(ncf, xml_str);
+    ERR_BAIL(ncf);
 
+    rng_validate(ncf, defn->ncf_xml);
     ERR_BAIL(ncf);
 
-    ncf_xml = parse_xml(ncf, xml_str);
+    defn->name = device_name_from_xml(ncf, defn->ncf_xml);
+    ERR_COND_BAIL(defn->name == NULL, ncf, EINTERNAL);
+
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
+    defn->aug_xml = apply_stylesheet(ncf, ncf->driver->get, defn->ncf_xml);
     ERR_BAIL(ncf);
 
-    rng_validate(ncf, ncf_xml);
+    return 0;
+ error:
+    return -1;
+}
+
+/* Put the prepared DEFN into the Augeas tree, without saving it */
+static int put_prepared_interface(struct netcf *ncf,
+                                  const struct if_defn *defn) {
+    get_wide_augeas(ncf);
     ERR_BAIL(ncf);
 
-    name = device_name_from_xml(ncf, ncf_xml);
-    ERR_COND_BAIL(name == NULL, ncf, EINTERNAL);
+    /* Update the files that stay in place, then remove the ones the new
+     * config does not use anymore; files that do not change are not
+     * written */
+    aug_put_xml(ncf, defn->aug_xml);
+    ERR_BAIL(ncf);
 
-    rm_all_interfaces(ncf, ncf_xml);
+    rm_all_interfaces(ncf, defn->ncf_xml, defn->aug_xml);
     ERR_BAIL(ncf);
 
-    aug_xml = apply_stylesheet(ncf, ncf->driver->get, ncf_xml);
+    bond_setup(ncf, defn->name, true);
     ERR_BAIL(ncf);
 
-    aug_put_xml(ncf, aug_xml);
+    return 0;
+ error:
+    return -1;
+}
+
+/* Put the definition of an interface from XML_STR into the Augeas tree
+ * without saving it, and return the name of the interface */
+static char *put_interface(struct netcf *ncf, const char *xml_str) {
+    struct if_defn defn;
+    char *name = NULL;
+
+    MEMZERO(&defn, 1);
+
+    prepare_interface(ncf, xml_str, &defn);
     ERR_BAIL(ncf);
 
-    bond_setup(ncf, name, true);
+    put_prepared_interface(ncf, &defn);
     ERR_BAIL(ncf);
 
-    r = aug_save(aug);
-    if (r < 0 && NCF_DEBUG(ncf)) {
-        fprintf(stderr, "Errors from aug_save:\n");
-        aug_print(aug, stderr, "/augeas//error");
-    }
-    ERR_THROW(r < 0, ncf, EOTHER, "aug_save failed");
+    name = defn.name;
+    defn.name = NULL;
+ error:
+    if_defn_clear(&defn);
+    return name;
+}
+
+struct netcf_if *drv_define(struct netcf *ncf, const char *xml_str) {
+    char *name = NULL;
+    struct netcf_if *result = NULL;
+
+    name = put_interface(ncf, xml_str);
+    ERR_BAIL(ncf);
+
+    save_augeas(ncf);
+    ERR_BAIL(ncf);
 
     result = make_netcf_if(ncf, name);
     ERR_BAIL(ncf);
 
- done:
-    xmlFreeDoc(ncf_xml);
-    xmlFreeDoc(aug_xml);
     return result;
  error:
+    if (result == NULL)
+        FREE(name);
     unref(result, netcf_if);
-    goto done;
+    return NULL;
+}
+
+char *drv_define_preview(struct netcf *ncf, const char *xml_str) {
+    char *name = NULL, *result = NULL;
+
+    name = put_interface(ncf, xml_str);
+    ERR_BAIL(ncf);
+
+    result = preview_augeas(ncf);
+ error:
+    FREE(name);
+    return result;
+}
+
+int drv_define_roots(struct netcf *ncf, int nxml, const char *const *xmls,
+                     int nroots, const char *const *roots, int nthreads,
+                     netcf_errcode_t *errcodes, char **errdetails) {
+    return define_roots(ncf, nxml, xmls, nroots, roots, nthreads, errcodes,
+                        errdetails, prepare_interface, put_prepared_interface);
 }
 
 int drv_undefine(struct netcf_if *nif) {
-    struct augeas *aug = NULL;
     struct netcf *ncf = nif->ncf;
-    int r;
 
-    aug = get_augeas(ncf);
+    get_wide_augeas(ncf);
     ERR_BAIL(ncf);
 
     bond_setup(ncf, nif->name, false);
     ERR_BAIL(ncf);
 
-    rm_interface(ncf, nif->name);
+    rm_interface(ncf, nif->name, NULL);
     ERR_BAIL(ncf);
 
-    r = aug_save(aug);
-    ERR_COND_BAIL(r < 0, ncf, EOTHER);
+    save_augeas(ncf);
+    ERR_BAIL(ncf);
 
     return 0;
  error:
@@ -943,7 +1183,7 @@ int drv_lookup_by_mac_string(struct netcf *ncf, const char *mac,
 
     MEMZERO(ifaces, maxifaces);
 
-    get_augeas(ncf);
+    get_wide_augeas(ncf);
     ERR_BAIL(ncf);
 
     nmatches = aug_match_mac(ncf, mac, &matches);
@@ -993,6 +1233,14 @@ const char *drv_mac_string(struct netcf_if *nif) {
     char *path = NULL;
     int r;
 
+    /* The tree has not been reread or saved since we last looked */
+    if (config_gen_current(ncf, nif->mac_gen))
+        return nif->mac;
+
+    /* The addresses come from sysfs, which a narrowed load leaves out */
+    get_wide_augeas(ncf);
+    ERR_BAIL(ncf);
+
     r = aug_get_mac(ncf, nif->name, &mac);
     ERR_THROW(r < 0, ncf, EOTHER, "could not lookup MAC of %s", nif->name);
 
@@ -1005,6 +1253,7 @@ const char *drv_mac_string(struct netcf_if *nif) {
     } else {
         FREE(nif->mac);
     }
+    nif->mac_gen = ncf->config_gen;
     /* fallthrough intentional */
  error:
     FREE(path);
@@ -1015,13 +1264,18 @@ const char *drv_mac_string(struct netcf_if *nif) {
  * Bringing interfaces up/down
  */
 
-int drv_if_up(struct netcf_if *nif) {
+int drv_if_up(struct netcf_if *nif, int timeout_ms, unsigned int flags) {
     static const char *const ifup = "ifup";
     struct netcf *ncf = nif->ncf;
     char **slaves = NULL;
     int nslaves = 0;
     int result = -1;
 
+    /* The last lookup may have left the load narrowed to another
+     * interface, which need not have the ifcfg file of this one */
+    get_wide_augeas(ncf);
+    ERR_BAIL(ncf);
+
     if (is_bridge(ncf, nif->name)) {
         /* Bring up bridge slaves before the bridge */
         nslaves = bridge_slaves(ncf, nif->name, &slaves);
@@ -1034,9 +1288,8 @@ int drv_if_up(struct netcf_if *nif) {
     }
     run1(ncf, ifup, nif->name);
     ERR_BAIL(ncf);
-    ERR_THROW(!if_is_active(ncf, nif->name), ncf, EOTHER,
-              "interface %s failed to become active - "
-              "possible disconnected cable.", nif->name);
+    if_wait_active(ncf, nif->name, timeout_ms, flags);
+    ERR_BAIL(ncf);
     result = 0;
  error:
     free_matches(nslaves, &slaves);
@@ -1050,6 +1303,9 @@ int drv_if_down(struct netcf_if *nif) {
     int nslaves = 0;
     int result = -1;
 
+    get_wide_augeas(ncf);
+    ERR_BAIL(ncf);
+
     run1(ncf, ifdown, nif->name);
     ERR_BAIL(ncf);
     if (is_bridge(ncf, nif->name)) {
@@ -1093,6 +1349,9 @@ drv_change_rollback(struct netcf *ncf, unsigned int flags)
     ERR_THROW(flags != 0, ncf, EOTHER, "unsupported flags value %d", flags);
     run1(ncf, NETCF_TRANSACTION, "change-rollback");
     ERR_BAIL(ncf);
+    /* The files we wrote were restored, most likely in place */
+    sync_flush(ncf);
+    ERR_BAIL(ncf);
     result = 0;
 error:
     return result;
@@ -1104,6 +1363,9 @@ drv_change_commit(struct netcf *ncf, unsigned int flags)
     int result = -1;
 
     ERR_THROW(flags != 0, ncf, EOTHER, "unsupported flags value %d", flags);
+    /* The changes must be on disk before the snapshot goes away */
+    sync_flush(ncf);
+    ERR_BAIL(ncf);
     run1(ncf, NETCF_TRANSACTION, "change-commit");
     ERR_BAIL(ncf);
     result = 0;
@@ -1124,6 +1386,8 @@ static int drv_get_aug(struct netcf *ncf, const char *ncf_xml, char **aug_xml) {
     rng_validate(ncf, ncf_doc);
     ERR_BAIL(ncf);
 
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
     *aug_xml = apply_stylesheet_to_string(ncf, ncf->driver->get, ncf_doc);
     ERR_BAIL(ncf);
 
@@ -1143,6 +1407,8 @@ static int drv_put_aug(struct netcf *ncf, const char *aug_xml, char **ncf_xml) {
     aug_doc = parse_xml(ncf, aug_xml);
     ERR_BAIL(ncf);
 
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
     *ncf_xml = apply_stylesheet_to_string(ncf, ncf->driver->put, aug_doc);
     ERR_BAIL(ncf);
 
@@ -1158,15 +1424,21 @@ static int drv_put_aug(struct netcf *ncf, const char *aug_xml, char **ncf_xml) {
  * Test interface
  */
 int ncf_get_aug(struct netcf *ncf, const char *ncf_xml, char **aug_xml) {
-    API_ENTRY(ncf);
+    int result;
 
-    return drv_get_aug(ncf, ncf_xml, aug_xml);
+    API_ENTRY(ncf);
+    result = drv_get_aug(ncf, ncf_xml, aug_xml);
+    API_EXIT(ncf);
+    return result;
 }
 
 int ncf_put_aug(struct netcf *ncf, const char *aug_xml, char **ncf_xml) {
-    API_ENTRY(ncf);
+    int result;
 
-    return drv_put_aug(ncf, aug_xml, ncf_xml);
+    API_ENTRY(ncf);
+    result = drv_put_aug(ncf, aug_xml, ncf_xml);
+    API_EXIT(ncf);
+    return result;
 }
 
 /*
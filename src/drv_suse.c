@@ -35,7 +35,6 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <dirent.h>
 
 
 #include "safe-alloc.h"
@@ -65,6 +64,9 @@ static const char *const aug_files =
 static const char *const network_scripts_path =
     "/etc/sysconfig/network";
 
+static const char *const network_scripts_dir =
+    "etc/sysconfig/network";
+
 static const char *const ifcfg_path =
     "/files/etc/sysconfig/network/*";
 
@@ -86,7 +88,8 @@ static const struct augeas_pv augeas_xfm_common_pv[] = {
     { "/augeas/load/Persist_Net_Rules/excl[5]", "*~" },
     /* Routes files */
     { "/augeas/load/Routes/lens", "Routes.lns" },
-    { "/augeas/load/Routes/incl", "/etc/sysconfig/network/routes" },
+    { "/augeas/load/Routes/incl[1]", "/etc/sysconfig/network/routes" },
+    { "/augeas/load/Routes/incl[2]", "/etc/sysconfig/network/ifroute-*" },
     { "/augeas/load/Routes/excl[1]", "*.augnew" },
     { "/augeas/load/Routes/excl[2]", "*.augsave" },
     { "/augeas/load/Routes/excl[3]", "*.rpmsave" },
@@ -121,22 +124,68 @@ static const struct augeas_xfm_table augeas_xfm_common =
     { .size = ARRAY_CARDINALITY(augeas_xfm_common_pv),
       .pv = augeas_xfm_common_pv };
 
-/* Entries in a ifcfg file that tell us that the interface
- * is not a toplevel interface
- */
-static const char *const subif_paths[] = {
-    "BONDING_MASTER", "BRIDGE"
+/* Return true if NAME is one of the whitespace separated words in LIST */
+static bool name_listed(const char *list, const char *name) {
+    size_t len = strlen(name);
+
+    while (*list != '\0') {
+        size_t n;
+
+        list += strspn(list, " \t");
+        n = strcspn(list, " \t");
+        if (n == len && STREQLEN(list, name, len))
+            return true;
+        list += n;
+    }
+    return false;
+}
+
+/* The ifcfg files of bridges and bonds name the interfaces that are not
+ * toplevel interfaces: a bridge with BRIDGE=yes lists all its ports in
+ * BRIDGE_PORTS, a bond with BONDING_MASTER=yes has a BONDING_SLAVE_N entry
+ * for each slave */
+static const struct {
+    const char *master;
+    const char *slaves;
+} subif_paths[] = {
+    { "BRIDGE", "BRIDGE_PORTS" },
+    { "BONDING_MASTER", "BONDING_SLAVE" }
 };
 
+/* Return 1 if the interface INTF is a port of a bridge or a slave of a
+ * bond, 0 if it is not, and -1 on error */
 static int is_slave(struct netcf *ncf, const char *intf) {
-    for (int s = 0; s < ARRAY_CARDINALITY(subif_paths); s++) {
-        int r;
-        r = aug_fmt_match(ncf, NULL, "%s%s/ifcfg-%s/%s",
-                          aug_files, network_scripts_path, intf, subif_paths[s]);
-        if (r != 0)
-            return r;
+    struct augeas *aug;
+    char **matches = NULL;
+    int nmatches = 0, result = 0;
+
+    aug = get_augeas(ncf);
+    ERR_BAIL(ncf);
+
+    for (int s = 0; s < ARRAY_CARDINALITY(subif_paths) && !result; s++) {
+        const char *slaves = subif_paths[s].slaves;
+
+        nmatches = aug_fmt_match(ncf, &matches, "%s[%s = 'yes']/*",
+                                 ifcfg_path, subif_paths[s].master);
+        ERR_BAIL(ncf);
+        for (int i = 0; i < nmatches && !result; i++) {
+            const char *label = strrchr(matches[i], '/') + 1;
+            const char *list = NULL;
+            int r;
+
+            if (!STREQLEN(label, slaves, strlen(slaves)))
+                continue;
+            r = aug_get(aug, matches[i], &list);
+            ERR_COND_BAIL(r < 0, ncf, EOTHER);
+            if (list != NULL && name_listed(list, intf))
+                result = 1;
+        }
+        free_matches(nmatches, &matches);
     }
-    return 0;
+    return result;
+ error:
+    free_matches(nmatches, &matches);
+    return -1;
 }
 
 static bool has_ifcfg_file(struct netcf *ncf, const char *name) {
@@ -151,7 +200,8 @@ static bool has_ifcfg_file(struct netcf *ncf, const char *name) {
     r = xasprintf(&path, "%s/%s/ifcfg-%s", aug_files, network_scripts_path, name);
     ERR_NOMEM(r < 0, ncf);
 
-    nmatches = aug_match(aug, path, NULL);
+    STAT_TIMED(ncf, NETCF_STAT_AUG_MATCH,
+               nmatches = aug_match(aug, path, NULL));
     ERR_COND_BAIL(nmatches < 0, ncf, EOTHER);
 
     FREE(path);
@@ -160,120 +210,275 @@ error:
     return nmatches > 0;
 }
 
-static int cmpstrp(const void *p1, const void *p2) {
-    const char *s1 = * (const char **)p1;
-    const char *s2 = * (const char **)p2;
-    return strcmp(s1, s2);
-}
-
+/* Put the name of the interface with an ifcfg file for NAME into *INTF,
+ * the way FIND_IFCFG_FILES does. Returns 1 if there is such a file, 0 if
+ * there isn't, and -1 on error */
 static int
 find_ifcfg_file_by_name(struct netcf *ncf, const char *name, char ***intf)
 {
-    DIR *dp;
-    struct dirent *ent;
-    const char *ifprefix = "ifcfg-";
-    const char *ifdir = network_scripts_path;
-    int found=-1, result=0, r=0;
-
-    dp = opendir (ifdir);
-    ERR_COND_BAIL(dp == NULL, ncf, EOTHER);
-    r = ALLOC_N(*intf, 1);
-    while ((ent = readdir (dp)))
-        if (ent->d_type == DT_REG &&
-            !strncmp(ifprefix, ent->d_name, strlen(ifprefix)) &&
-            strlen(ent->d_name + strlen(ifprefix)) == strlen(name) &&
-            !strncmp((ent->d_name + strlen(ifprefix)),name, strlen(name))) {
-            result = xasprintf( &(*intf)[0], "%s",
-                                ent->d_name + strlen(ifprefix));
-            ERR_NOMEM(result < 0, ncf);
-            found = 1;
-        }
-    closedir (dp);
+    struct ifcfg_index *index;
+    char *fname = NULL;
+    int r, result = 0;
+
+    *intf = NULL;
+    index = ifcfg_index_get(ncf, &ncf->driver->ifcfg_index,
+                            network_scripts_dir, true);
+    ERR_BAIL(ncf);
 
-    return found;
+    r = xasprintf(&fname, "%s%s", ifcfg_prefix, name);
+    ERR_NOMEM(r < 0, ncf);
+    if (ifcfg_index_find(index, fname) != NULL) {
+        r = ALLOC_N(*intf, 1);
+        ERR_NOMEM(r < 0, ncf);
+        (*intf)[0] = strdup(name);
+        ERR_NOMEM((*intf)[0] == NULL, ncf);
+        result = 1;
+    }
+    FREE(fname);
+    return result;
 
 error:
-    FREE((*intf)[0]);
-    FREE((*intf));
+    if (*intf != NULL)
+        FREE((*intf)[0]);
+    FREE(*intf);
+    FREE(fname);
     return -1;
 }
 
+/* Put the names of all interfaces that have an ifcfg file into *INTF,
+ * sorted, and return their number, or -1 on error. The names come from
+ * the ifcfg index, which excludes the same backup files as the Ifcfg
+ * transform and only rescans the directory under NCF->ROOT when its
+ * mtime changes */
 static int
 find_ifcfg_files(struct netcf *ncf, char ***intf)
 {
-    DIR *dp;
-    struct dirent *ent;
-    const char *ifprefix = "ifcfg-";
-    const char *ifdir = network_scripts_path;
-    int count = 0, result =0, r =0;;
-
-    dp = opendir (ifdir);
-    ERR_COND_BAIL(dp == NULL, ncf, EOTHER);
-    while ((ent = readdir (dp)))
-        if (ent->d_type == DT_REG &&
-            !strncmp(ifprefix, ent->d_name, strlen(ifprefix))) {
-            count++;
-        }
-    closedir (dp);
+    struct ifcfg_index *index;
+    int count = 0, r;
+
+    *intf = NULL;
+    index = ifcfg_index_get(ncf, &ncf->driver->ifcfg_index,
+                            network_scripts_dir, true);
+    ERR_BAIL(ncf);
 
-    dp = opendir (ifdir);
-    ERR_COND_BAIL(dp == NULL, ncf, EOTHER);
-    r = ALLOC_N(*intf, count);
+    r = ALLOC_N(*intf, index->nfiles);
     ERR_NOMEM(r < 0, ncf);
-    count = 0;
-    while ((ent = readdir (dp))) {
-        if (ent->d_type == DT_REG &&
-            !strncmp(ifprefix, ent->d_name, strlen(ifprefix))) {
-            result = xasprintf( &(*intf)[count], "%s",
-                                ent->d_name + strlen(ifprefix));
-            ERR_NOMEM(result < 0, ncf);
-            count++;
-        }
-    }
-    closedir (dp);
+    for (count = 0; count < index->nfiles; count++) {
+        const char *fname = index->files[count].name;
 
-    qsort(*intf, count, sizeof(**intf), cmpstrp);
+        (*intf)[count] = strdup(fname + strlen(ifcfg_prefix));
+        ERR_NOMEM((*intf)[count] == NULL, ncf);
+    }
 
     return count;
 
 error:
-    for(;count>=0;count--)
-        FREE((*intf)[count]);
-    FREE((*intf));
+    free_matches(count, intf);
     return -1;
 }
 
-/* Find the mac address given the interface name in the udev persistent
- * netrule file.
- */
-static int find_hwaddr_by_device(struct netcf *ncf, const char *name,
-                                 const char **addr) {
-    int nmatches = 0, r;
-    char **matches = NULL;
-    struct augeas *aug = NULL;
-    char *path = NULL;
+/* The rules in the udev persistent net rules file, indexed both by the
+ * NAME they give a device and by the ATTR{address} they match on. The
+ * index is built from the Augeas tree once per load; NETRULE_INDEX_STALE
+ * throws it away when we change the rules in the tree */
+struct netrule {
+    char *name;
+    char *address;                  /* NULL if the rule has none */
+    int   count;                    /* number of rules for NAME */
+};
+
+struct netrule_index {
+    unsigned int     gen;           /* CONFIG_GEN it was built from */
+    int              nrules;
+    struct netrule  *rules;         /* sorted by name */
+    int              naddrs;
+    struct netrule **by_address;    /* rules with an address, sorted by it */
+};
+
+static void netrule_index_free(struct netrule_index *index) {
+    if (index == NULL)
+        return;
+    for (int i=0; i < index->nrules; i++) {
+        free(index->rules[i].name);
+        free(index->rules[i].address);
+    }
+    free(index->rules);
+    free(index->by_address);
+    free(index);
+}
+
+static void netrule_index_stale(struct netcf *ncf) {
+    netrule_index_free(ncf->driver->netrule_index);
+    ncf->driver->netrule_index = NULL;
+}
+
+static int netrule_cmp_name(const void *p1, const void *p2) {
+    const struct netrule *r1 = p1, *r2 = p2;
+    return strcmp(r1->name, r2->name);
+}
+
+static int netrule_cmp_address(const void *p1, const void *p2) {
+    const struct netrule *r1 = * (const struct netrule **) p1;
+    const struct netrule *r2 = * (const struct netrule **) p2;
+    return strcasecmp(r1->address, r2->address);
+}
+
+/* Return the index of the udev rules in the current Augeas tree, building
+ * it if the tree was reread or saved since the last time */
+static struct netrule_index *netrule_index_get(struct netcf *ncf) {
+    struct netrule_index *index = NULL;
+    struct augeas *aug;
+    char **matches = NULL, *path = NULL;
+    int nmatches = 0, n, r;
 
     aug = get_augeas(ncf);
     ERR_BAIL(ncf);
+    if (ncf->driver->netrule_index != NULL
+        && config_gen_current(ncf, ncf->driver->netrule_index->gen))
+        return ncf->driver->netrule_index;
+    netrule_index_stale(ncf);
+
+    r = ALLOC(index);
+    ERR_NOMEM(r < 0, ncf);
+    index->gen = ncf->config_gen;
+
+    nmatches = aug_fmt_match(ncf, &matches, "%s%s/*",
+                             aug_files, udev_netrule_path);
+    ERR_BAIL(ncf);
+    r = ALLOC_N(index->rules, nmatches);
+    ERR_NOMEM(r < 0, ncf);
 
-    nmatches = aug_fmt_match(ncf, &matches, "%s/%s/*[ NAME = '%s']",
-                             aug_files, udev_netrule_path, name);
-    ERR_COND_BAIL(nmatches < 0 , ncf, EOTHER);
+    for (int i=0; i < nmatches; i++) {
+        struct netrule *rule = index->rules + index->nrules;
+        const char *label = strrchr(matches[i], '/') + 1;
+        const char *addr = NULL;
+
+        if (label[0] == '#')
+            continue;
+        /* Several rules for the same name show up as NAME[N] */
+        rule->name = strndup(label, strcspn(label, "["));
+        ERR_NOMEM(rule->name == NULL, ncf);
+        rule->count = 1;
+        index->nrules += 1;
 
-    if (nmatches == 1 ) {
-        r = xasprintf(&path, "%s/%s", matches[0], "ATTR{address}");
+        r = xasprintf(&path, "%s/ATTR{address}", matches[i]);
         ERR_NOMEM(r < 0, ncf);
-        *addr = NULL; /* ensure that addr is NULL */
-        r = aug_get(aug, path, addr);
+        r = aug_get(aug, path, &addr);
+        ERR_THROW(r < 0, ncf, EOTHER, "aug_get of '%s' failed", path);
         FREE(path);
-    } else
-        goto error;
-
+        if (addr != NULL) {
+            rule->address = strdup(addr);
+            ERR_NOMEM(rule->address == NULL, ncf);
+        }
+    }
     free_matches(nmatches, &matches);
-    return nmatches;
+
+    /* Collapse the rules for the same name into one; which address such
+     * a name gets from udev is anybody's guess, so it gets none here */
+    qsort(index->rules, index->nrules, sizeof(*index->rules),
+          netrule_cmp_name);
+    n = 0;
+    for (int i=0; i < index->nrules; i++) {
+        struct netrule *rule = index->rules + i;
+
+        if (n > 0 && STREQ(index->rules[n-1].name, rule->name)) {
+            index->rules[n-1].count += 1;
+            FREE(index->rules[n-1].address);
+            FREE(rule->name);
+            FREE(rule->address);
+        } else {
+            index->rules[n++] = *rule;
+        }
+    }
+    index->nrules = n;
+
+    r = ALLOC_N(index->by_address, index->nrules);
+    ERR_NOMEM(r < 0, ncf);
+    for (int i=0; i < index->nrules; i++)
+        if (index->rules[i].address != NULL)
+            index->by_address[index->naddrs++] = index->rules + i;
+    qsort(index->by_address, index->naddrs, sizeof(*index->by_address),
+          netrule_cmp_address);
+
+    ncf->driver->netrule_index = index;
+    return index;
  error:
     free_matches(nmatches, &matches);
+    FREE(path);
+    netrule_index_free(index);
+    return NULL;
+}
+
+static const struct netrule *netrule_by_name(const struct netrule_index *index,
+                                             const char *name) {
+    struct netrule key = { .name = (char *) name };
+
+    return bsearch(&key, index->rules, index->nrules, sizeof(key),
+                   netrule_cmp_name);
+}
+
+static const struct netrule *
+netrule_by_address(const struct netrule_index *index, const char *address) {
+    struct netrule key = { .address = (char *) address };
+    const struct netrule *pkey = &key;
+    struct netrule **r;
+
+    r = bsearch(&pkey, index->by_address, index->naddrs,
+                sizeof(*index->by_address), netrule_cmp_address);
+    return r == NULL ? NULL : *r;
+}
+
+/* Find the mac address given the interface name in the udev persistent
+ * netrule file. Returns 1 and sets *ADDR if there is exactly one rule for
+ * NAME, 0 otherwise. *ADDR is only good until the tree changes */
+static int find_hwaddr_by_device(struct netcf *ncf, const char *name,
+                                 const char **addr) {
+    struct netrule_index *index;
+    const struct netrule *rule;
+
+    *addr = NULL;
+    index = netrule_index_get(ncf);
+    ERR_BAIL(ncf);
+
+    rule = netrule_by_name(index, name);
+    if (rule == NULL || rule->count != 1 || rule->address == NULL)
+        return 0;
+    *addr = rule->address;
+    return 1;
+ error:
+    return 0;
+}
+
+/* Find the default gateway of the interface NAME, from its ifroute file
+ * or, failing that, a default route through NAME in the global routes
+ * file. Returns 1 and sets *GATEWAY if there is one, 0 if not, and -1 on
+ * error */
+static int find_gateway_by_device(struct netcf *ncf, const char *name,
+                                  const char **gateway) {
+    static const char *const fmts[] = {
+        "%s%s/ifroute-%s/default/gateway",
+        "%s%s/routes/default[device = '%s']/gateway"
+    };
+    struct augeas *aug;
+    char *path = NULL;
+    int r;
+
+    *gateway = NULL;
+    aug = get_augeas(ncf);
+    ERR_BAIL(ncf);
+
+    for (int i=0; i < ARRAY_CARDINALITY(fmts); i++) {
+        r = xasprintf(&path, fmts[i], aug_files, network_scripts_path, name);
+        ERR_NOMEM(r < 0, ncf);
+        r = aug_get(aug, path, gateway);
+        FREE(path);
+        if (r == 1 && *gateway != NULL)
+            return 1;
+    }
+    *gateway = NULL;
     return 0;
+ error:
+    return -1;
 }
 
 /* Find the path to the ifcfg file that has the configuration for
@@ -292,7 +497,8 @@ static char *find_ifcfg_path(struct netcf *ncf, const char *name) {
     r = xasprintf(&path, "%s/%s/ifcfg-%s", aug_files, network_scripts_path, name);
     ERR_NOMEM(r < 0, ncf);
 
-    nmatches = aug_match(aug, path, NULL);
+    STAT_TIMED(ncf, NETCF_STAT_AUG_MATCH,
+               nmatches = aug_match(aug, path, NULL));
     ERR_COND_BAIL(nmatches < 0, ncf, EOTHER);
 
     if (nmatches == 1)
@@ -346,20 +552,14 @@ int drv_init(struct netcf *ncf) {
     if (r < 0)
         goto error;
 
-    // FIXME: Check for errors
-
-    xsltInit();
-    exsltStrRegister();
-    ncf->driver->get = parse_stylesheet(ncf, "suse-get.xsl");
-    ncf->driver->put = parse_stylesheet(ncf, "suse-put.xsl");
-    ERR_BAIL(ncf);
+    /* parsed by load_stylesheets when they are first needed */
+    ncf->driver->get_xsl = "suse-get.xsl";
+    ncf->driver->put_xsl = "suse-put.xsl";
 
     /* open a socket for interface ioctls */
     ncf->driver->ioctl_fd = init_ioctl_fd(ncf);
     if (ncf->driver->ioctl_fd < 0)
         goto error;
-    if (netlink_init(ncf) < 0)
-        goto error;
     return 0;
 
  error:
@@ -372,16 +572,20 @@ void drv_close(struct netcf *ncf) {
         return;
     xsltFreeStylesheet(ncf->driver->get);
     xsltFreeStylesheet(ncf->driver->put);
+    events_close(ncf);
     netlink_close(ncf);
     if (ncf->driver->ioctl_fd >= 0)
         close(ncf->driver->ioctl_fd);
     aug_close(ncf->driver->augeas);
     FREE(ncf->driver->augeas_xfm_tables);
+    ifcfg_index_free(ncf->driver->ifcfg_index);
+    netrule_index_free(ncf->driver->netrule_index);
     FREE(ncf->driver);
 }
 
 void drv_entry(struct netcf *ncf) {
-    ncf->driver->load_augeas = 1;
+    if (NCF_CACHE_REFRESH(ncf, NETCF_CACHE_CONFIG))
+        ncf->driver->load_augeas = 1;
 }
 
 static int list_interface_ids(struct netcf *ncf,
@@ -445,6 +649,12 @@ struct netcf_if *drv_lookup_by_name(struct netcf *ncf, const char *name) {
     char *name_dup = NULL;
     struct augeas *aug;
 
+    /* Found since the tree was last reread or saved */
+    nif = find_netcf_if(ncf, name);
+    if (nif != NULL && config_gen_current(ncf, nif->lookup_gen))
+        return nif;
+    unref(nif, netcf_if);
+
     aug = get_augeas(ncf);
     ERR_BAIL(ncf);
 
@@ -459,6 +669,7 @@ struct netcf_if *drv_lookup_by_name(struct netcf *ncf, const char *name) {
 
     nif = make_netcf_if(ncf, name_dup);
     ERR_BAIL(ncf);
+    nif->lookup_gen = ncf->config_gen;
     goto done;
 
  error:
@@ -520,6 +731,18 @@ static xmlDocPtr aug_get_xml(struct netcf_if *nif, int nint, char **intf) {
                 xmlNewProp(node, BAD_CAST "value", BAD_CAST mac);
             }
         }
+        {
+            const char *gateway = NULL;
+            r = find_gateway_by_device(ncf, nif->name, &gateway);
+            ERR_BAIL(ncf);
+            if (r > 0) {
+                xmlNodePtr node = xmlNewChild(tree, NULL,
+                                              BAD_CAST "node", NULL);
+                xmlNewProp(node, BAD_CAST "label",
+                           BAD_CAST "GATEWAY" );
+                xmlNewProp(node, BAD_CAST "value", BAD_CAST gateway);
+            }
+        }
         free_matches(nmatches, &matches);
     }
 
@@ -531,19 +754,35 @@ static xmlDocPtr aug_get_xml(struct netcf_if *nif, int nint, char **intf) {
     return NULL;
 }
 
-/* Write the XML doc in the simple Augeas format into the Augeas tree */
-static int aug_put_xml(struct netcf *ncf, xmlDocPtr xml) {
+/* Entries of the ifcfg files that aug_put_xml does not write there */
+static const char *const ifcfg_skip[] = { "DEVICE", "HWADDR", "GATEWAY", NULL };
+
+/* Entries of the ifcfg files that suse-get.xsl can write; a redefine
+ * leaves all others alone */
+static const char *const ifcfg_managed[] = {
+    "BONDING_MASTER", "BONDING_OPTS", "BONDING_SLAVE_", "BOOTPROTO",
+    "BRIDGE", "BRIDGE_FORWARDDELAY", "BRIDGE_PORTS", "BRIDGE_STP",
+    "DEVICE", "DHCPV6", "ETHERDEVICE", "GATEWAY", "HWADDR", "IPADDR",
+    "IPV6ADDR", "IPV6ADDR_SECONDARIES", "IPV6INIT", "IPV6_AUTOCONF",
+    "IPV6_DEFAULTGW", "MTU", "NETMASK", "PEERDNS", "STARTMODE", "VLAN",
+    NULL
+};
+
+/* Write the XML doc in the simple Augeas format into the Augeas tree,
+ * touching only the entries that differ from what is there already. If a
+ * udev rule or a route file for the device is written, its name is
+ * returned in RULE_DEVICE or ROUTE_DEVICE, which the caller must free */
+static int aug_put_xml(struct netcf *ncf, xmlDocPtr xml, char **rule_device,
+                       char **route_device) {
     xmlNodePtr forest;
-    char *path = NULL, *lpath = NULL, *label = NULL, *value = NULL;
+    char *lpath = NULL, *label = NULL, *value = NULL;
     char *device = NULL, *mac = NULL, *gateway = NULL;
-    char **rules = NULL;
-    struct augeas *aug = NULL;
-    int result = -1, nrules = 0, ethphysical = 0;
+    int result = -1, ethphysical = 0;
     int toplevel = 1;
     int r;
 
-    aug = get_augeas(ncf);
-    ERR_BAIL(ncf);
+    *rule_device = NULL;
+    *route_device = NULL;
 
     forest = xmlDocGetRootElement(xml);
     ERR_THROW(forest == NULL, ncf, EINTERNAL, "missing root element");
@@ -551,14 +790,9 @@ static int aug_put_xml(struct netcf *ncf, xmlDocPtr xml) {
               EINTERNAL, "expected root node labeled 'forest', not '%s'",
               forest->name);
     list_for_each(tree, forest->children) {
-        ERR_THROW(! xmlStrEqual(tree->name, BAD_CAST "tree"), ncf,
-                  EINTERNAL, "expected node labeled 'tree', not '%s'",
-                  tree->name);
-        path = xml_prop(tree, "path");
-        /*int toplevel = 1;*/
-        /* This is a little drastic, since it clears out the file entirely */
-        r = aug_rm(aug, path);
-        ERR_THROW(r < 0, ncf, EINTERNAL, "aug_rm of '%s' failed", path);
+        aug_put_tree(ncf, tree, ifcfg_skip, ifcfg_managed);
+        ERR_BAIL(ncf);
+
         list_for_each(node, tree->children) {
             label = xml_prop(node, "label");
             value = xml_prop(node, "value");
@@ -567,155 +801,117 @@ static int aug_put_xml(struct netcf *ncf, xmlDocPtr xml) {
                 toplevel = 0;
             }
             if (STREQ(label, "DEVICE")) {
-		device = value;
+                xmlFree(device);
+                device = value;
                 if(!strchr(value, '.') && !strncmp("eth", value, strlen("eth")))
                    ethphysical = 1;
-                xmlFree(label);
             } else if(STREQ(label, "HWADDR")) {
-		mac = value;
-                xmlFree(label);
-		//continue;
+                xmlFree(mac);
+                mac = value;
             } else if(STREQ(label, "GATEWAY")) {
-		gateway = value;
-                xmlFree(label);
-		//continue;
+                xmlFree(gateway);
+                gateway = value;
             } else {
-                r = xasprintf(&lpath, "%s/%s", path, label);
-                ERR_NOMEM(r < 0, ncf);
-
-                r = aug_set(aug, lpath, value);
-                ERR_THROW(r < 0, ncf, EOTHER,
-                          "aug_set of '%s' failed", lpath);
-                FREE(lpath);
-                xmlFree(label);
                 xmlFree(value);
             }
+            xmlFree(label);
             label = value = NULL;
         }
-        xmlFree(path);
-        path = NULL;
     }
     if( device && !mac && ethphysical && toplevel ){
         mac = malloc(20);
-        if( if_hwaddr(ncf, device, mac, 20) ){
+        if( if_hwaddr(ncf, device, (unsigned char *) mac, 20) ){
             free(mac);
             mac = NULL;
         }
     }
     if( device && gateway && ethphysical && toplevel ) {
+        struct augeas_pv route[] = {
+            { "gateway", gateway },
+            { "netmask", "-" },
+            { "device", device }
+        };
+
+        /* The default route goes into ifroute-DEVICE, which belongs to
+         * this interface alone. The global routes file is only changed
+         * to take out a default route through DEVICE, which moves here */
+        for (int i=0; i < ARRAY_CARDINALITY(route); i++) {
+            r = xasprintf(&lpath, "%s%s/ifroute-%s/default/%s", aug_files,
+                          network_scripts_path, device, route[i].path);
+            ERR_NOMEM(r < 0, ncf);
 
-        r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                       network_scripts_path, "routes/default", "gateway");
-        ERR_NOMEM(r < 0, ncf);
-
-        r = aug_set(aug, lpath, gateway);
-        ERR_THROW(r < 0, ncf, EOTHER,
-              "aug_set of '%s' failed", lpath);
-
-        FREE(lpath);
-
-        r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                       network_scripts_path, "routes/default", "netmask");
-        ERR_NOMEM(r < 0, ncf);
-
-        r = aug_set(aug, lpath, "-");
-        ERR_THROW(r < 0, ncf, EOTHER,
-              "aug_set of '%s' failed", lpath);
-
-        FREE(lpath);
-
-        r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                       network_scripts_path, "routes/default", "device");
-        ERR_NOMEM(r < 0, ncf);
-
-        r = aug_set(aug, lpath, device );
-        ERR_THROW(r < 0, ncf, EOTHER,
-              "aug_set of '%s' failed", lpath);
+            aug_update(ncf, lpath, route[i].value);
+            ERR_BAIL(ncf);
+            FREE(lpath);
+        }
+        r = aug_fmt_rm(ncf, "%s%s/routes/default[device = '%s']",
+                       aug_files, network_scripts_path, device);
+        ERR_BAIL(ncf);
 
-        FREE(lpath);
+        *route_device = strdup(device);
+        ERR_NOMEM(*route_device == NULL, ncf);
     }
     if( device && mac && ethphysical && toplevel ) {
-
-        r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                       udev_netrule_path, device, "SUBSYSTEM");
-        ERR_NOMEM(r < 0, ncf);
-
-        r = aug_set(aug, lpath, "net");
-        ERR_THROW(r < 0, ncf, EOTHER,
-              "aug_set of '%s' failed", lpath);
-
-        FREE(lpath);
-
-        r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                       udev_netrule_path, device, "ACTION");
-        ERR_NOMEM(r < 0, ncf);
-
-        r = aug_set(aug, lpath, "add");
-        ERR_THROW(r < 0, ncf, EOTHER,
-              "aug_set of '%s' failed", lpath);
-
-        FREE(lpath);
-
-        r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                       udev_netrule_path, device, "DRIVERS");
-        ERR_NOMEM(r < 0, ncf);
-
-        r = aug_set(aug, lpath, "?*");
-        ERR_THROW(r < 0, ncf, EOTHER,
-              "aug_set of '%s' failed", lpath);
-
-        FREE(lpath);
-
-        r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                       udev_netrule_path, device, "ATTR{address}");
-        ERR_NOMEM(r < 0, ncf);
-
-        r = aug_set(aug, lpath, mac);
-        ERR_THROW(r < 0, ncf, EOTHER,
-                  "aug_set of '%s' failed", lpath);
-
-        FREE(lpath);
-
+        /* In the order the Persist_Net_Rules lens expects them */
+        struct augeas_pv rule[] = {
+            { "SUBSYSTEM", "net" },
+            { "ACTION", "add" },
+            { "DRIVERS", "?*" },
+            { "ATTR{address}", mac },
 #ifdef OS113
-        r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                       udev_netrule_path, device, "ATTR{dev_id}");
-        ERR_NOMEM(r < 0, ncf);
-
-        r = aug_set(aug, lpath, "0x0");
-        ERR_THROW(r < 0, ncf, EOTHER,
-                  "aug_set of '%s' failed", lpath);
-
-        FREE(lpath);
+            { "ATTR{dev_id}", "0x0" },
 #endif
+            { "ATTR{type}", "1" },
+            { "KERNEL", "eth*" }
+        };
 
-            r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                           udev_netrule_path, device, "ATTR{type}");
-            ERR_NOMEM(r < 0, ncf);
+        struct netrule_index *index;
+        const struct netrule *old;
 
-            r = aug_set(aug, lpath, "1");
-            ERR_THROW(r < 0, ncf, EOTHER,
-                  "aug_set of '%s' failed", lpath);
+        index = netrule_index_get(ncf);
+        ERR_BAIL(ncf);
 
-            FREE(lpath);
+        /* Updating one of several rules for the same device in place is
+         * ambiguous; start over with a single one */
+        old = netrule_by_name(index, device);
+        if (old != NULL && old->count > 1) {
+            r = aug_fmt_rm(ncf, "%s%s/%s",
+                           aug_files, udev_netrule_path, device);
+            ERR_BAIL(ncf);
+        }
+
+        /* A rule that gives the same address another name would fight
+         * with ours over what the device is called */
+        old = netrule_by_address(index, mac);
+        if (old != NULL && STRNEQ(old->name, device)) {
+            r = aug_fmt_rm(ncf, "%s%s/%s",
+                           aug_files, udev_netrule_path, old->name);
+            ERR_BAIL(ncf);
+        }
+        netrule_index_stale(ncf);
 
+        /* aug_update leaves keys that are already right alone, so that
+         * the file is only written when the rule actually changed */
+        for (int i=0; i < ARRAY_CARDINALITY(rule); i++) {
             r = xasprintf(&lpath, "%s%s/%s/%s", aug_files,
-                           udev_netrule_path, device, "KERNEL");
+                          udev_netrule_path, device, rule[i].path);
             ERR_NOMEM(r < 0, ncf);
 
-            r = aug_set(aug, lpath, "eth*");
-            ERR_THROW(r < 0, ncf, EOTHER,
-                  "aug_set of '%s' failed", lpath);
-
+            aug_update(ncf, lpath, rule[i].value);
+            ERR_BAIL(ncf);
             FREE(lpath);
+        }
+
+        *rule_device = strdup(device);
+        ERR_NOMEM(*rule_device == NULL, ncf);
     }
+    result = 0;
+ error:
     xmlFree(device);
     xmlFree(mac);
     xmlFree(gateway);
-    result = 0;
- error:
     xmlFree(label);
     xmlFree(value);
-    xmlFree(path);
     FREE(lpath);
     return result;
 }
@@ -750,6 +946,8 @@ char *drv_xml_desc(struct netcf_if *nif) {
     aug_xml = aug_get_xml_for_nif(nif);
     ERR_BAIL(ncf);
 
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
     result = apply_stylesheet_to_string(ncf, ncf->driver->put, aug_xml);
 
  error:
@@ -762,7 +960,6 @@ char *drv_xml_desc(struct netcf_if *nif) {
 
 char *drv_xml_state(struct netcf_if *nif) {
     char *result = NULL;
-    int r, result_len;
     struct netcf *ncf;
     xmlDocPtr ncf_xml = NULL;
     xmlNodePtr root;
@@ -782,9 +979,8 @@ char *drv_xml_state(struct netcf_if *nif) {
     add_state_to_xml_doc(nif, ncf_xml);
     ERR_BAIL(ncf);
 
-    r = xsltSaveResultToString((xmlChar **)&result, &result_len,
-                               ncf_xml, ncf->driver->put);
-    ERR_NOMEM(r < 0, ncf);
+    result = xml_doc_to_string(ncf, ncf_xml);
+    ERR_BAIL(ncf);
 
  done:
     xmlFreeDoc(ncf_xml);
@@ -795,6 +991,20 @@ char *drv_xml_state(struct netcf_if *nif) {
     goto done;
 }
 
+/* return the live state of all toplevel interfaces matching FLAGS */
+char *drv_all_xml_state(struct netcf *ncf, unsigned int flags) {
+    return all_xml_state(ncf, flags);
+}
+
+int drv_get_event_fd(struct netcf *ncf) {
+    return events_get_fd(ncf);
+}
+
+int drv_read_events(struct netcf *ncf, struct netcf_event *events,
+                    int maxevents) {
+    return events_read(ncf, events, maxevents);
+}
+
 /* Report various status info about the interface as bits in
  * "flags". Returns 0 on success, -1 on failure
  */
@@ -813,6 +1023,14 @@ error:
     return -1;
 }
 
+int drv_if_stats(struct netcf_if *nif, struct netcf_if_stats *stats) {
+    ERR_THROW(stats == NULL, nif->ncf, EOTHER,
+              "NULL pointer for stats in ncf_if_stats");
+    return if_stats(nif->ncf, nif->name, stats);
+error:
+    return -1;
+}
+
 /* Get the content of /interface/@name. Result must be freed with xmlFree()
  *
  * The name on VLAN interfaces is optional; if there is no
@@ -854,18 +1072,17 @@ static char *device_name_from_xml(struct netcf *ncf, xmlDocPtr ncf_xml) {
     return result;
 }
 
-/* The device NAME is a bond if it is mentioned as the MASTER in sopme
- * other devices config file
- */
+/* The device NAME is a bond if its ifcfg file has BONDING_MASTER=yes */
 static bool is_bond(struct netcf *ncf, const char *name) {
     int nmatches = 0;
 
     nmatches = aug_fmt_match(ncf, NULL,
-                             "%s[ BONDING_MASTER = '%s']", ifcfg_path, name);
+                             "%s%s/ifcfg-%s[ BONDING_MASTER = 'yes' ]",
+                             aug_files, network_scripts_path, name);
     return nmatches > 0;
 }
 
-/* The device NAME is a bridge if it has an entry TYPE=Bridge */
+/* The device NAME is a bridge if it has an entry BRIDGE=yes */
 static bool is_bridge(struct netcf *ncf, const char *name) {
     int nmatches = 0;
 
@@ -875,41 +1092,56 @@ static bool is_bridge(struct netcf *ncf, const char *name) {
     return nmatches > 0;
 }
 
+/* Put the ports listed in the BRIDGE_PORTS of the bridge NAME into
+ * *SLAVES and return their number, or -1 on error */
 static int bridge_slaves(struct netcf *ncf, const char *name, char ***slaves) {
     struct augeas *aug = NULL;
+    const char *ports = NULL;
+    char *path = NULL;
     int r, nslaves = 0;
 
+    *slaves = NULL;
     aug = get_augeas(ncf);
     ERR_BAIL(ncf);
 
-    nslaves = aug_fmt_match(ncf, slaves,
-                            "%s[ BRIDGE = '%s' ]/DEVICE", ifcfg_path, name);
-    ERR_BAIL(ncf);
-    for (int i=0; i < nslaves; i++) {
-        char *p = (*slaves)[i];
-        const char *dev;
-        r = aug_get(aug, p, &dev);
-        ERR_COND_BAIL(r < 0, ncf, EOTHER);
+    r = xasprintf(&path, "%s%s/ifcfg-%s/BRIDGE_PORTS",
+                  aug_files, network_scripts_path, name);
+    ERR_NOMEM(r < 0, ncf);
+    r = aug_get(aug, path, &ports);
+    ERR_COND_BAIL(r < 0, ncf, EOTHER);
 
-        (*slaves)[i] = strdup(dev);
-        free(p);
-        ERR_NOMEM(slaves[i] == NULL, ncf);
+    while (ports != NULL && *ports != '\0') {
+        size_t n;
+
+        ports += strspn(ports, " \t");
+        n = strcspn(ports, " \t");
+        if (n == 0)
+            break;
+        r = REALLOC_N(*slaves, nslaves + 1);
+        ERR_NOMEM(r < 0, ncf);
+        (*slaves)[nslaves] = strndup(ports, n);
+        ERR_NOMEM((*slaves)[nslaves] == NULL, ncf);
+        nslaves += 1;
+        ports += n;
     }
+    FREE(path);
     return nslaves;
  error:
+    FREE(path);
     free_matches(nslaves, slaves);
     return -1;
 }
 
 
 /* For an interface NAME, remove the ifcfg-* files for that interface and
- * all its slaves. */
-static void rm_interface(struct netcf *ncf, const char *name) {
+ * all its slaves, unless AUG_XML, which may be NULL, has a tree for it,
+ * its udev rules, unless KEEP_RULE is true, and the default route in its
+ * ifroute file, unless KEEP_ROUTE is true. */
+static void rm_interface(struct netcf *ncf, const char *name,
+                         xmlDocPtr aug_xml, bool keep_rule, bool keep_route) {
     int r;
     char *path = NULL;
-    char **rules = NULL;
     struct augeas *aug = NULL;
-    int nrules = 0;
 
     aug = get_augeas(ncf);
     ERR_BAIL(ncf);
@@ -920,30 +1152,57 @@ static void rm_interface(struct netcf *ncf, const char *name) {
                   aug_files, network_scripts_path, name);
     ERR_NOMEM(r < 0, ncf);
 
-    r = aug_rm(aug, path);
-    ERR_COND_BAIL(r < 0, ncf, EOTHER);
+    if (! forest_has_tree(aug_xml, path)) {
+        r = aug_rm(aug, path);
+        ERR_COND_BAIL(r < 0, ncf, EOTHER);
+    }
 
-    nrules = aug_fmt_match(ncf, &rules, "%s/%s/%s",
+    if (! keep_rule) {
+        struct netrule_index *index = netrule_index_get(ncf);
+        ERR_BAIL(ncf);
+
+        if (netrule_by_name(index, name) != NULL) {
+            r = aug_fmt_rm(ncf, "%s%s/%s",
                            aug_files, udev_netrule_path, name);
-    ERR_COND_BAIL(nrules < 0, ncf, EINTERNAL);
+            ERR_BAIL(ncf);
+            netrule_index_stale(ncf);
+        }
+    }
 
-    while(nrules > 0) {
-        nrules--;
-        r = aug_rm(aug, rules[nrules]);
+    /* Admins keep the static routes of an interface in its ifroute file
+     * too; only the default route is ours, and the file only goes when
+     * that was all there was in it */
+    if (! keep_route) {
+        r = aug_fmt_rm(ncf, "%s%s/ifroute-%s/default",
+                       aug_files, network_scripts_path, name);
+        ERR_BAIL(ncf);
+        if (r > 0) {
+            r = aug_fmt_match(ncf, NULL, "%s%s/ifroute-%s/*",
+                              aug_files, network_scripts_path, name);
+            ERR_BAIL(ncf);
+            if (r == 0) {
+                aug_fmt_rm(ncf, "%s%s/ifroute-%s",
+                           aug_files, network_scripts_path, name);
+                ERR_BAIL(ncf);
+            }
+        }
     }
-    free_matches(nrules, &rules);
 
  error:
     FREE(path);
 }
 
-/* Remove all interfaces and their slaves mentioned in NCF_XML.  We need to
+/* Remove all interfaces and their slaves mentioned in NCF_XML that are
+ * not part of AUG_XML any more, and the udev rules and route files of all
+ * of them except those of RULE_DEVICE and ROUTE_DEVICE.  We need to
  * remove interfaces one by one when we define an interface, since what
  * will become a subinterface may not be related to the new toplevel
  * interface, and calling RM_INTERFACE on the toplevel interface is
  * therefore not enough.
  */
-static void rm_all_interfaces(struct netcf *ncf, xmlDocPtr ncf_xml) {
+static void rm_all_interfaces(struct netcf *ncf, xmlDocPtr ncf_xml,
+                              xmlDocPtr aug_xml, const char *rule_device,
+                              const char *route_device) {
     xmlXPathContextPtr context = NULL;
 	xmlXPathObjectPtr obj = NULL;
 
@@ -958,7 +1217,10 @@ static void rm_all_interfaces(struct netcf *ncf, xmlDocPtr ncf_xml) {
     for (int i=0; i < ns->nodeNr; i++) {
         xmlChar *name = xmlGetProp(ns->nodeTab[i], BAD_CAST "name");
         ERR_NOMEM(name == NULL, ncf);
-        rm_interface(ncf, (char *) name);
+        rm_interface(ncf, (char *) name, aug_xml,
+                     rule_device != NULL && STREQ((char *) name, rule_device),
+                     route_device != NULL
+                     && STREQ((char *) name, route_device));
         xmlFree(name);
         ERR_BAIL(ncf);
 	}
@@ -1002,71 +1264,133 @@ static void bond_setup(struct netcf *ncf, const char *name, bool alias) {
     return;
 }
 
-struct netcf_if *drv_define(struct netcf *ncf, const char *xml_str) {
-    xmlDocPtr ncf_xml = NULL, aug_xml = NULL;
-    char *name = NULL;
-    struct netcf_if *result = NULL;
-    int r;
-    struct augeas *aug = get_augeas(ncf);
+/* Parse, validate and transform the interface definition XML_STR into
+ * DEFN. None of this depends on the root */
+static int prepare_interface(struct netcf *ncf, const char *xml_str,
+                             struct if_defn *defn) {
+    defn->ncf_xml = parse_xml(ncf, xml_str);
+    ERR_BAIL(ncf);
 
+    rng_validate(ncf, defn->ncf_xml);
     ERR_BAIL(ncf);
 
-    ncf_xml = parse_xml(ncf, xml_str);
+    defn->name = device_name_from_xml(ncf, defn->ncf_xml);
+    ERR_COND_BAIL(defn->name == NULL, ncf, EINTERNAL);
+
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
+    defn->aug_xml = apply_stylesheet(ncf, ncf->driver->get, defn->ncf_xml);
     ERR_BAIL(ncf);
 
-    rng_validate(ncf, ncf_xml);
+    return 0;
+ error:
+    return -1;
+}
+
+/* Put the prepared DEFN into the Augeas tree, without saving it */
+static int put_prepared_interface(struct netcf *ncf,
+                                  const struct if_defn *defn) {
+    char *rule_device = NULL, *route_device = NULL;
+    int result = -1;
+
+    get_augeas(ncf);
     ERR_BAIL(ncf);
 
-    name = device_name_from_xml(ncf, ncf_xml);
-    ERR_COND_BAIL(name == NULL, ncf, EINTERNAL);
+    /* Update the files that stay in place, then remove the ones the new
+     * config does not use anymore; files that do not change are not
+     * written */
+    aug_put_xml(ncf, defn->aug_xml, &rule_device, &route_device);
+    ERR_BAIL(ncf);
 
-    rm_all_interfaces(ncf, ncf_xml);
+    rm_all_interfaces(ncf, defn->ncf_xml, defn->aug_xml, rule_device,
+                      route_device);
     ERR_BAIL(ncf);
 
-    aug_xml = apply_stylesheet(ncf, ncf->driver->get, ncf_xml);
+    bond_setup(ncf, defn->name, true);
     ERR_BAIL(ncf);
 
-    aug_put_xml(ncf, aug_xml);
+    result = 0;
+ error:
+    FREE(rule_device);
+    FREE(route_device);
+    return result;
+}
+
+/* Put the definition of an interface from XML_STR into the Augeas tree
+ * without saving it, and return the name of the interface */
+static char *put_interface(struct netcf *ncf, const char *xml_str) {
+    struct if_defn defn;
+    char *name = NULL;
+
+    MEMZERO(&defn, 1);
+
+    prepare_interface(ncf, xml_str, &defn);
     ERR_BAIL(ncf);
 
-    bond_setup(ncf, name, true);
+    put_prepared_interface(ncf, &defn);
     ERR_BAIL(ncf);
 
-    r = aug_save(aug);
-    if (r < 0 && NCF_DEBUG(ncf)) {
-        fprintf(stderr, "Errors from aug_save:\n");
-        aug_print(aug, stderr, "/augeas//error");
-    }
-    ERR_THROW(r < 0, ncf, EOTHER, "aug_save failed");
+    name = defn.name;
+    defn.name = NULL;
+ error:
+    if_defn_clear(&defn);
+    return name;
+}
+
+struct netcf_if *drv_define(struct netcf *ncf, const char *xml_str) {
+    char *name = NULL;
+    struct netcf_if *result = NULL;
+
+    name = put_interface(ncf, xml_str);
+    ERR_BAIL(ncf);
+
+    save_augeas(ncf);
+    ERR_BAIL(ncf);
 
     result = make_netcf_if(ncf, name);
     ERR_BAIL(ncf);
 
- done:
-    xmlFreeDoc(ncf_xml);
-    xmlFreeDoc(aug_xml);
     return result;
  error:
+    if (result == NULL)
+        FREE(name);
     unref(result, netcf_if);
-    goto done;
+    return NULL;
+}
+
+char *drv_define_preview(struct netcf *ncf, const char *xml_str) {
+    char *name = NULL, *result = NULL;
+
+    name = put_interface(ncf, xml_str);
+    ERR_BAIL(ncf);
+
+    result = preview_augeas(ncf);
+ error:
+    FREE(name);
+    return result;
+}
+
+int drv_define_roots(struct netcf *ncf, int nxml, const char *const *xmls,
+                     int nroots, const char *const *roots, int nthreads,
+                     netcf_errcode_t *errcodes, char **errdetails) {
+    return define_roots(ncf, nxml, xmls, nroots, roots, nthreads, errcodes,
+                        errdetails, prepare_interface, put_prepared_interface);
 }
 
 int drv_undefine(struct netcf_if *nif) {
-    struct augeas *aug = NULL;
     struct netcf *ncf = nif->ncf;
-    int r;
 
-    aug = get_augeas(ncf);
+    get_augeas(ncf);
     ERR_BAIL(ncf);
 
     bond_setup(ncf, nif->name, false);
     ERR_BAIL(ncf);
 
-    rm_interface(ncf, nif->name);
+    rm_interface(ncf, nif->name, NULL, false, false);
     ERR_BAIL(ncf);
 
-    r = aug_save(aug);
-    ERR_COND_BAIL(r < 0, ncf, EOTHER);
+    save_augeas(ncf);
+    ERR_BAIL(ncf);
 
     return 0;
  error:
@@ -1077,7 +1401,7 @@ int drv_lookup_by_mac_string(struct netcf *ncf, const char *mac,
                              int maxifaces, struct netcf_if **ifaces)
 {
     struct augeas *aug = NULL;
-    char *path = NULL, *ifcfg = NULL;
+    char *path = NULL;
     const char **names = NULL;
     int nmatches = 0;
     char **matches = NULL;
@@ -1103,12 +1427,8 @@ int drv_lookup_by_mac_string(struct netcf *ncf, const char *mac,
     for (int i = 0; i < nmatches; i++) {
         if (!has_ifcfg_file(ncf, matches[i]))
             continue;
-        r = xasprintf(&ifcfg, "%s[DEVICE = '%s']", ifcfg_path, matches[i]);
-        ERR_NOMEM(r < 0, ncf);
-
-        if (! is_slave(ncf, ifcfg))
+        if (! is_slave(ncf, matches[i]))
             names[cnt++] = matches[i];
-        FREE(ifcfg);
     }
     for (int i=0; i < cnt && i < maxifaces; i++) {
         char *name = strdup(names[i]);
@@ -1124,7 +1444,6 @@ int drv_lookup_by_mac_string(struct netcf *ncf, const char *mac,
         unref(ifaces[i], netcf_if);
  done:
     free(names);
-    free(ifcfg);
     free(path);
     free_matches(nmatches, &matches);
     return result;
@@ -1136,6 +1455,10 @@ const char *drv_mac_string(struct netcf_if *nif) {
     char *path = NULL;
     int r;
 
+    /* The tree has not been reread or saved since we last looked */
+    if (config_gen_current(ncf, nif->mac_gen))
+        return nif->mac;
+
     r = aug_get_mac(ncf, nif->name, &mac);
     ERR_THROW(r < 0, ncf, EOTHER, "could not lookup MAC of %s", nif->name);
 
@@ -1148,6 +1471,7 @@ const char *drv_mac_string(struct netcf_if *nif) {
     } else {
         FREE(nif->mac);
     }
+    nif->mac_gen = ncf->config_gen;
     /* fallthrough intentional */
  error:
     FREE(path);
@@ -1158,7 +1482,7 @@ const char *drv_mac_string(struct netcf_if *nif) {
  * Bringing interfaces up/down
  */
 
-int drv_if_up(struct netcf_if *nif) {
+int drv_if_up(struct netcf_if *nif, int timeout_ms, unsigned int flags) {
     static const char *const ifup = "ifup";
     struct netcf *ncf = nif->ncf;
     char **slaves = NULL;
@@ -1177,9 +1501,8 @@ int drv_if_up(struct netcf_if *nif) {
     }
     run1(ncf, ifup, nif->name);
     ERR_BAIL(ncf);
-    ERR_THROW(!if_is_active(ncf, nif->name), ncf, EOTHER,
-              "interface %s failed to become active - "
-              "possible disconnected cable.", nif->name);
+    if_wait_active(ncf, nif->name, timeout_ms, flags);
+    ERR_BAIL(ncf);
     result = 0;
  error:
     free_matches(nslaves, &slaves);
@@ -1236,6 +1559,9 @@ drv_change_rollback(struct netcf *ncf, unsigned int flags)
     ERR_THROW(flags != 0, ncf, EOTHER, "unsupported flags value %d", flags);
     run1(ncf, NETCF_TRANSACTION, "change-rollback");
     ERR_BAIL(ncf);
+    /* The files we wrote were restored, most likely in place */
+    sync_flush(ncf);
+    ERR_BAIL(ncf);
     result = 0;
 error:
     return result;
@@ -1247,6 +1573,9 @@ drv_change_commit(struct netcf *ncf, unsigned int flags)
     int result = -1;
 
     ERR_THROW(flags != 0, ncf, EOTHER, "unsupported flags value %d", flags);
+    /* The changes must be on disk before the snapshot goes away */
+    sync_flush(ncf);
+    ERR_BAIL(ncf);
     run1(ncf, NETCF_TRANSACTION, "change-commit");
     ERR_BAIL(ncf);
     result = 0;
@@ -1267,6 +1596,8 @@ static int drv_get_aug(struct netcf *ncf, const char *ncf_xml, char **aug_xml) {
     rng_validate(ncf, ncf_doc);
     ERR_BAIL(ncf);
 
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
     *aug_xml = apply_stylesheet_to_string(ncf, ncf->driver->get, ncf_doc);
     ERR_BAIL(ncf);
 
@@ -1286,6 +1617,8 @@ static int drv_put_aug(struct netcf *ncf, const char *aug_xml, char **ncf_xml) {
     aug_doc = parse_xml(ncf, aug_xml);
     ERR_BAIL(ncf);
 
+    load_stylesheets(ncf);
+    ERR_BAIL(ncf);
     *ncf_xml = apply_stylesheet_to_string(ncf, ncf->driver->put, aug_doc);
     ERR_BAIL(ncf);
 
@@ -1301,15 +1634,21 @@ static int drv_put_aug(struct netcf *ncf, const char *aug_xml, char **ncf_xml) {
  * Test interface
  */
 int ncf_get_aug(struct netcf *ncf, const char *ncf_xml, char **aug_xml) {
-    API_ENTRY(ncf);
+    int result;
 
-    return drv_get_aug(ncf, ncf_xml, aug_xml);
+    API_ENTRY(ncf);
+    result = drv_get_aug(ncf, ncf_xml, aug_xml);
+    API_EXIT(ncf);
+    return result;
 }
 
 int ncf_put_aug(struct netcf *ncf, const char *aug_xml, char **ncf_xml) {
-    API_ENTRY(ncf);
+    int result;
 
-    return drv_put_aug(ncf, aug_xml, ncf_xml);
+    API_ENTRY(ncf);
+    result = drv_put_aug(ncf, aug_xml, ncf_xml);
+    API_EXIT(ncf);
+    return result;
 }
 
 /*
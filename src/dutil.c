@@ -31,6 +31,11 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include "safe-alloc.h"
 #include "ref.h"
@@ -41,37 +46,116 @@
 #include <libxml/parser.h>
 #include <libxml/relaxng.h>
 #include <libxml/tree.h>
+#include <libxml/xmlIO.h>
 #include <libxslt/xslt.h>
 #include <libxslt/xsltInternals.h>
 #include <libxslt/transform.h>
 #include <libxslt/xsltutils.h>
 
-/* Create a new netcf if instance for interface NAME */
+unsigned int name_hash(const char *name) {
+    unsigned int h = 2166136261u;
+
+    for (const char *c = name; *c != '\0'; c++)
+        h = (h ^ (unsigned char) *c) * 16777619u;
+    return h;
+}
+
+/* The slot of NAME in the intern table of NCF: either the one holding
+ * its netcf_if, or the empty one where it belongs */
+static struct netcf_if **interned_slot(struct netcf *ncf, const char *name) {
+    unsigned int mask = ncf->interned_slots - 1;
+    unsigned int i;
+
+    for (i = name_hash(name) & mask; ncf->interned[i] != NULL;
+         i = (i + 1) & mask) {
+        if (STREQ(ncf->interned[i]->name, name))
+            break;
+    }
+    return ncf->interned + i;
+}
+
+/* Make room for one more entry in the intern table, keeping it at most
+ * half full */
+static int interned_grow(struct netcf *ncf) {
+    struct netcf_if **old = ncf->interned;
+    unsigned int nold = ncf->interned_slots;
+    unsigned int nslots = nold == 0 ? 16 : nold;
+
+    while (2 * (ncf->ninterned + 1) > nslots)
+        nslots *= 2;
+    if (nslots == nold)
+        return 0;
+
+    if (ALLOC_N(ncf->interned, nslots) < 0) {
+        ncf->interned = old;
+        return -1;
+    }
+    ncf->interned_slots = nslots;
+    for (unsigned int i=0; i < nold; i++) {
+        if (old[i] != NULL)
+            *interned_slot(ncf, old[i]->name) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+struct netcf_if *find_netcf_if(struct netcf *ncf, const char *name) {
+    struct netcf_if *nif;
+
+    if (ncf->interned_slots == 0)
+        return NULL;
+    nif = *interned_slot(ncf, name);
+    if (nif == NULL)
+        return NULL;
+    /* A handle nobody holds gets its reference to NCF back */
+    if (nif->ref == 0)
+        nif->ncf = ref(ncf);
+    return ref(nif);
+}
+
 struct netcf_if *make_netcf_if(struct netcf *ncf, char *name) {
     int r;
     struct netcf_if *result = NULL;
 
+    result = find_netcf_if(ncf, name);
+    if (result != NULL) {
+        free(name);
+        return result;
+    }
+
+    r = interned_grow(ncf);
+    ERR_NOMEM(r < 0, ncf);
+
     r = make_ref(result);
     ERR_NOMEM(r < 0, ncf);
     result->ncf = ref(ncf);
     result->name = name;
+    *interned_slot(ncf, name) = result;
+    ncf->ninterned += 1;
     return result;
 
  error:
-    unref(result, netcf_if);
-    return result;
+    return NULL;
+}
+
+static void free_interned_if(struct netcf_if *nif) {
+    free(nif->name);
+    free(nif->mac);
+    free(nif);
 }
 
 /* never call this directly. Only call it via "unref(nif, netcf_if)" */
 void free_netcf_if(struct netcf_if *nif) {
+    struct netcf *ncf;
+
     if (nif == NULL)
         return;
 
     assert(nif->ref == 0);
-    unref(nif->ncf, netcf);
-    free(nif->name);
-    free(nif->mac);
-    free(nif);
+    /* The handle stays in the intern table until NCF is freed; it only
+     * drops its reference, since NCF can not be closed while it is held */
+    ncf = nif->ncf;
+    unref(ncf, netcf);
 }
 
 /* never call this directly. Only call it via "unref(ncf, netcf)" */
@@ -80,6 +164,14 @@ void free_netcf(struct netcf *ncf) {
         return;
 
     assert(ncf->ref == 0);
+    for (unsigned int i=0; i < ncf->interned_slots; i++) {
+        if (ncf->interned[i] != NULL)
+            free_interned_if(ncf->interned[i]);
+    }
+    free(ncf->interned);
+    for (int i=0; i < ncf->nsync_paths; i++)
+        free(ncf->sync_paths[i]);
+    free(ncf->sync_paths);
     free(ncf->root);
     free(ncf);
 }
@@ -127,6 +219,239 @@ argv_to_string(const char *const *argv) {
     return ret;
 }
 
+/*
+ * Unified diffs
+ */
+#define DIFF_CONTEXT 3
+/* Beyond this many cells in the LCS table, the changed part of a file is
+ * shown as removed and added as a whole */
+#define DIFF_MAX_TABLE (4 * 1024 * 1024)
+
+struct diff_line {
+    const char *text;
+    size_t      len;
+    bool        eol;          /* line ends with a newline */
+};
+
+static int split_lines(const char *text, struct diff_line **lines) {
+    int nlines = 0;
+
+    *lines = NULL;
+    if (text == NULL || *text == '\0')
+        return 0;
+
+    for (const char *p = text; *p != '\0'; p++)
+        if (*p == '\n')
+            nlines += 1;
+    if (text[strlen(text) - 1] != '\n')
+        nlines += 1;
+
+    if (ALLOC_N(*lines, nlines) < 0)
+        return -1;
+
+    const char *p = text;
+    for (int i=0; i < nlines; i++) {
+        const char *eol = strchr(p, '\n');
+        (*lines)[i].text = p;
+        (*lines)[i].eol = (eol != NULL);
+        (*lines)[i].len = (eol != NULL) ? (size_t) (eol - p) : strlen(p);
+        p += (*lines)[i].len + 1;
+    }
+    return nlines;
+}
+
+static bool line_eq(const struct diff_line *a, const struct diff_line *b) {
+    return a->len == b->len && a->eol == b->eol
+        && memcmp(a->text, b->text, a->len) == 0;
+}
+
+ATTRIBUTE_FORMAT(printf, 2, 3)
+static int diff_append(char **buf, const char *fmt, ...) {
+    va_list ap;
+    char *s = NULL;
+    size_t len;
+    int r;
+
+    va_start(ap, fmt);
+    r = vasprintf(&s, fmt, ap);
+    va_end(ap);
+    if (r < 0)
+        return -1;
+
+    len = (*buf == NULL) ? 0 : strlen(*buf);
+    if (REALLOC_N(*buf, len + r + 1) < 0) {
+        free(s);
+        return -1;
+    }
+    memcpy(*buf + len, s, r + 1);
+    free(s);
+    return 0;
+}
+
+static int diff_append_line(char **buf, char tag,
+                            const struct diff_line *line) {
+    int r;
+
+    r = diff_append(buf, "%c%.*s\n", tag, (int) line->len, line->text);
+    if (r == 0 && !line->eol)
+        r = diff_append(buf, "\\ No newline at end of file\n");
+    return r;
+}
+
+int unified_diff(char **diff, const char *old_label, const char *old_text,
+                 const char *new_label, const char *new_text) {
+    struct diff_line *a = NULL, *b = NULL;
+    unsigned int *lcs = NULL;
+    char *ops = NULL;
+    int *aidx = NULL, *bidx = NULL;
+    int n, m, pre = 0, suf = 0, rows, cols, nops = 0, i, j;
+    bool headers = false;
+    int result = -1;
+
+    n = split_lines(old_text, &a);
+    m = split_lines(new_text, &b);
+    if (n < 0 || m < 0)
+        goto done;
+
+    /* Only compute the LCS of the part between common prefix and suffix */
+    while (pre < n && pre < m && line_eq(a + pre, b + pre))
+        pre += 1;
+    while (suf < n - pre && suf < m - pre
+           && line_eq(a + n - suf - 1, b + m - suf - 1))
+        suf += 1;
+    rows = n - pre - suf + 1;
+    cols = m - pre - suf + 1;
+
+    if ((long long) rows * cols <= DIFF_MAX_TABLE) {
+        if (ALLOC_N(lcs, rows * cols) < 0)
+            goto done;
+        for (i = rows - 2; i >= 0; i--) {
+            for (j = cols - 2; j >= 0; j--) {
+                unsigned int *c = lcs + i * cols + j;
+                if (line_eq(a + pre + i, b + pre + j))
+                    *c = c[cols + 1] + 1;
+                else
+                    *c = (c[cols] > c[1]) ? c[cols] : c[1];
+            }
+        }
+    }
+#define LCS(i, j) (lcs == NULL ? 0 : lcs[((i) - pre) * cols + (j) - pre])
+
+    if (ALLOC_N(ops, n + m) < 0 || ALLOC_N(aidx, n + m + 1) < 0
+        || ALLOC_N(bidx, n + m + 1) < 0)
+        goto done;
+    i = j = 0;
+    while (i < n || j < m) {
+        aidx[nops] = i;
+        bidx[nops] = j;
+        if (i < pre || (i >= n - suf && j >= m - suf)
+            || (i < n - suf && j < m - suf
+                && lcs != NULL && line_eq(a + i, b + j))) {
+            ops[nops++] = '=';
+            i++, j++;
+        } else if (i < n - suf
+                   && (j == m - suf || LCS(i + 1, j) >= LCS(i, j + 1))) {
+            ops[nops++] = '-';
+            i++;
+        } else {
+            ops[nops++] = '+';
+            j++;
+        }
+    }
+    aidx[nops] = i;
+    bidx[nops] = j;
+#undef LCS
+
+    for (int k = 0; k < nops; ) {
+        int start, end, stop, olen = 0, nlen = 0;
+
+        while (k < nops && ops[k] == '=')
+            k++;
+        if (k == nops)
+            break;
+
+        /* Changes closer than twice the context go into the same hunk */
+        start = (k > DIFF_CONTEXT) ? k - DIFF_CONTEXT : 0;
+        end = k;
+        for (int q = k; q < nops; ) {
+            int r = q;
+            while (r < nops && ops[r] == '=')
+                r++;
+            if (r == nops || r - q > 2 * DIFF_CONTEXT)
+                break;
+            while (r < nops && ops[r] != '=')
+                r++;
+            end = r - 1;
+            q = r;
+        }
+        stop = (end + DIFF_CONTEXT + 1 < nops) ? end + DIFF_CONTEXT + 1 : nops;
+
+        for (int q = start; q < stop; q++) {
+            olen += (ops[q] != '+');
+            nlen += (ops[q] != '-');
+        }
+
+        if (! headers) {
+            if (diff_append(diff, "--- %s\n+++ %s\n",
+                            old_label, new_label) < 0)
+                goto done;
+            headers = true;
+        }
+        if (diff_append(diff, "@@ -%d,%d +%d,%d @@\n",
+                        aidx[start] + (olen > 0), olen,
+                        bidx[start] + (nlen > 0), nlen) < 0)
+            goto done;
+        for (int q = start; q < stop; q++) {
+            int r;
+            if (ops[q] == '+')
+                r = diff_append_line(diff, '+', b + bidx[q]);
+            else
+                r = diff_append_line(diff, ops[q] == '=' ? ' ' : '-',
+                                     a + aidx[q]);
+            if (r < 0)
+                goto done;
+        }
+        k = stop;
+    }
+    result = 0;
+
+ done:
+    free(a);
+    free(b);
+    free(lcs);
+    free(ops);
+    free(aidx);
+    free(bidx);
+    return result;
+}
+
+unsigned long long stat_start(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void stat_stop(struct netcf *ncf, netcf_stat_t stat,
+               unsigned long long start) {
+    unsigned long long now = stat_start();
+
+    ncf->stat_count[stat] += 1;
+    /* The fallback clock is not monotonic */
+    if (now > start)
+        ncf->stat_usecs[stat] += now - start;
+}
+
+void stat_count(struct netcf *ncf, netcf_stat_t stat, unsigned long long n) {
+    ncf->stat_count[stat] += n;
+}
+
 void report_error(struct netcf *ncf, netcf_errcode_t errcode,
                   const char *format, ...) {
     va_list ap;
@@ -151,12 +476,143 @@ void vreport_error(struct netcf *ncf, netcf_errcode_t errcode,
 }
 
 
+#ifdef NETCF_EMBED_DATA
+/* Embedded files are parsed with a base URL of EMBEDDED_URL followed by
+ * their name, so that the <xsl:import> of util-get.xsl and util-put.xsl
+ * resolves to another embedded file through the input callbacks below */
+#define EMBEDDED_URL "netcf-embedded:///"
+
+struct embedded_input {
+    const struct embedded_file *file;
+    size_t                      pos;
+};
+
+static const struct embedded_file *embedded_find(const struct netcf *ncf,
+                                                 const char *name) {
+    for (const struct embedded_file *f = ncf->embedded; f->name; f++)
+        if (STREQ(f->name, name))
+            return f;
+    return NULL;
+}
+
+static int embedded_input_match(const char *uri) {
+    return STREQLEN(uri, EMBEDDED_URL, strlen(EMBEDDED_URL));
+}
+
+static void *embedded_input_open(const char *uri) {
+    struct embedded_input *in;
+
+    uri += strlen(EMBEDDED_URL);
+    for (const struct embedded_file *f = embedded_files; f->name; f++) {
+        if (STREQ(f->name, uri)) {
+            if (ALLOC(in) < 0)
+                return NULL;
+            in->file = f;
+            return in;
+        }
+    }
+    return NULL;
+}
+
+static int embedded_input_read(void *context, char *buf, int len) {
+    struct embedded_input *in = context;
+    size_t left = in->file->size - in->pos;
+
+    if ((size_t) len > left)
+        len = left;
+    memcpy(buf, in->file->data + in->pos, len);
+    in->pos += len;
+    return len;
+}
+
+static int embedded_input_close(void *context) {
+    struct embedded_input *in = context;
+
+    FREE(in);
+    return 0;
+}
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t embedded_input_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Make sure our input callbacks are registered. This is checked before
+ * every parse rather than once, since xmlCleanupParser, which the
+ * application may call at any time, throws all input callbacks away */
+static void embedded_input_register(void) {
+    xmlParserInputBufferPtr probe;
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&embedded_input_lock);
+#endif
+    /* Only our callbacks can open an embedded file */
+    probe = xmlParserInputBufferCreateFilename(EMBEDDED_URL "xml/util-get.xsl",
+                                               XML_CHAR_ENCODING_NONE);
+    if (probe != NULL) {
+        xmlFreeParserInputBuffer(probe);
+    } else {
+        /* libxml2 does not add its default handlers for files and URLs
+         * once another handler is registered, unless the parser is
+         * initialized */
+        xmlInitParser();
+        xmlRegisterInputCallbacks(embedded_input_match, embedded_input_open,
+                                  embedded_input_read, embedded_input_close);
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&embedded_input_lock);
+#endif
+}
+
+static xsltStylesheetPtr parse_embedded_stylesheet(struct netcf *ncf,
+                                                   const char *fname) {
+    xsltStylesheetPtr result = NULL;
+    const struct embedded_file *file;
+    xmlDocPtr doc = NULL;
+    char *name = NULL, *url = NULL;
+    int r;
+
+    embedded_input_register();
+
+    r = xasprintf(&name, "xml/%s", fname);
+    ERR_NOMEM(r < 0, ncf);
+    r = xasprintf(&url, EMBEDDED_URL "%s", name);
+    ERR_NOMEM(r < 0, ncf);
+
+    file = embedded_find(ncf, name);
+    ERR_THROW(file == NULL, ncf, EFILE,
+              "Stylesheet %s is not compiled into the library", fname);
+
+    doc = xmlReadMemory((const char *) file->data, file->size, url, NULL,
+                        XSLT_PARSE_OPTIONS);
+    stat_count(ncf, NETCF_STAT_FILES_PARSED, 1);
+    ERR_THROW(doc == NULL, ncf, EFILE,
+              "Could not parse embedded stylesheet %s", fname);
+
+    /* On success, the stylesheet owns DOC */
+    result = xsltParseStylesheetDoc(doc);
+    ERR_THROW(result == NULL, ncf, EFILE,
+              "Could not parse embedded stylesheet %s", fname);
+    doc = NULL;
+
+ error:
+    xmlFreeDoc(doc);
+    free(url);
+    free(name);
+    return result;
+}
+#endif /* NETCF_EMBED_DATA */
+
 xsltStylesheetPtr parse_stylesheet(struct netcf *ncf,
                                           const char *fname) {
     xsltStylesheetPtr result = NULL;
     char *path = NULL;
     int r;
 
+#ifdef NETCF_EMBED_DATA
+    if (ncf->embedded != NULL)
+        return parse_embedded_stylesheet(ncf, fname);
+#endif
+
     r = xasprintf(&path, "%s/xml/%s", ncf->data_dir, fname);
     ERR_NOMEM(r < 0, ncf);
 
@@ -168,6 +624,7 @@ xsltStylesheetPtr parse_stylesheet(struct netcf *ncf,
     }
 
     result = xsltParseStylesheetFile(BAD_CAST path);
+    stat_count(ncf, NETCF_STAT_FILES_PARSED, 1);
     ERR_THROW(result == NULL, ncf, EFILE,
               "Could not parse stylesheet %s", path);
 
@@ -192,6 +649,8 @@ xmlDocPtr apply_stylesheet(struct netcf *ncf, xsltStylesheetPtr style,
     xmlDocPtr res = NULL;
     int r;
 
+    TRACE_BEGIN(ncf, "apply_stylesheet");
+
     ctxt = xsltNewTransformContext(style, doc);
     ERR_NOMEM(ctxt == NULL, ncf);
 
@@ -200,7 +659,9 @@ xmlDocPtr apply_stylesheet(struct netcf *ncf, xsltStylesheetPtr style,
     r = xslt_register_exts(ctxt);
     ERR_NOMEM(r < 0, ncf);
 
-    res = xsltApplyStylesheetUser(style, doc, NULL, NULL, NULL, ctxt);
+    STAT_TIMED(ncf, NETCF_STAT_XSLT,
+               res = xsltApplyStylesheetUser(style, doc, NULL, NULL, NULL,
+                                             ctxt));
     if ((ctxt->state == XSLT_STATE_ERROR) ||
         (ctxt->state == XSLT_STATE_STOPPED)) {
         xmlFreeDoc(res);
@@ -211,6 +672,7 @@ xmlDocPtr apply_stylesheet(struct netcf *ncf, xsltStylesheetPtr style,
 
 error:
     xsltFreeTransformContext(ctxt);
+    TRACE_END(ncf, "apply_stylesheet");
     return res;
 }
 
@@ -234,6 +696,21 @@ char *apply_stylesheet_to_string(struct netcf *ncf, xsltStylesheetPtr style,
     return NULL;
 }
 
+char *xml_doc_to_string(struct netcf *ncf, xmlDocPtr doc) {
+    xmlChar *xml = NULL;
+    char *result = NULL;
+    int len;
+
+    xmlDocDumpFormatMemory(doc, &xml, &len, 1);
+    ERR_NOMEM(xml == NULL, ncf);
+    /* the caller frees with free(), not xmlFree() */
+    result = strdup((char *) xml);
+    ERR_NOMEM(result == NULL, ncf);
+ error:
+    xmlFree(xml);
+    return result;
+}
+
 /* Callback for reporting RelaxNG errors */
 void rng_error(void *ctx, const char *format, ...) {
     struct netcf *ncf = ctx;
@@ -244,12 +721,31 @@ void rng_error(void *ctx, const char *format, ...) {
     va_end(ap);
 }
 
-xmlRelaxNGPtr rng_parse(struct netcf *ncf, const char *fname) {
-    char *path = NULL;
-    xmlRelaxNGPtr result = NULL;
+/* Make a parser context for the schema FNAME, from its embedded copy or
+ * from the file in the data dir */
+static xmlRelaxNGParserCtxtPtr rng_parser_ctxt(struct netcf *ncf,
+                                               const char *fname) {
     xmlRelaxNGParserCtxtPtr ctxt = NULL;
+    char *path = NULL;
     int r;
 
+#ifdef NETCF_EMBED_DATA
+    if (ncf->embedded != NULL) {
+        const struct embedded_file *file;
+
+        r = xasprintf(&path, "xml/%s", fname);
+        ERR_NOMEM(r < 0, ncf);
+
+        file = embedded_find(ncf, path);
+        ERR_THROW(file == NULL, ncf, EFILE,
+                  "Schema %s is not compiled into the library", fname);
+        ctxt = xmlRelaxNGNewMemParserCtxt((const char *) file->data,
+                                          file->size);
+        free(path);
+        return ctxt;
+    }
+#endif
+
     r = xasprintf(&path, "%s/xml/%s", ncf->data_dir, fname);
     ERR_NOMEM(r < 0, ncf);
 
@@ -260,13 +756,26 @@ xmlRelaxNGPtr rng_parse(struct netcf *ncf, const char *fname) {
     }
 
     ctxt = xmlRelaxNGNewParserCtxt(path);
+
+ error:
+    free(path);
+    return ctxt;
+}
+
+xmlRelaxNGPtr rng_parse(struct netcf *ncf, const char *fname) {
+    xmlRelaxNGPtr result = NULL;
+    xmlRelaxNGParserCtxtPtr ctxt = NULL;
+
+    ctxt = rng_parser_ctxt(ncf, fname);
+    if (ctxt == NULL)
+        goto error;
     xmlRelaxNGSetParserErrors(ctxt, rng_error, rng_error, ncf);
 
     result = xmlRelaxNGParse(ctxt);
+    stat_count(ncf, NETCF_STAT_FILES_PARSED, 1);
 
  error:
     xmlRelaxNGFreeParserCtxt(ctxt);
-    free(path);
     return result;
 }
 
@@ -274,15 +783,29 @@ void rng_validate(struct netcf *ncf, xmlDocPtr doc) {
 	xmlRelaxNGValidCtxtPtr ctxt;
 	int r;
 
+    if (ncf->rng == NULL) {
+        ncf->rng = rng_parse(ncf, "interface.rng");
+        if (ncf->rng == NULL) {
+            if (ncf->errcode == NETCF_NOERROR)
+                report_error(ncf, NETCF_EXMLINVALID,
+                             "failed to parse interface.rng");
+            return;
+        }
+    }
+
+    TRACE_BEGIN(ncf, "rng_validate");
+
 	ctxt = xmlRelaxNGNewValidCtxt(ncf->rng);
 	xmlRelaxNGSetValidErrors(ctxt, rng_error, rng_error, ncf);
 
-    r = xmlRelaxNGValidateDoc(ctxt, doc);
+    STAT_TIMED(ncf, NETCF_STAT_RNG_VALIDATE,
+               r = xmlRelaxNGValidateDoc(ctxt, doc));
     if (r != 0 && ncf->errcode == NETCF_NOERROR)
         report_error(ncf, NETCF_EXMLINVALID,
            "Interface definition fails to validate");
 
 	xmlRelaxNGFreeValidCtxt(ctxt);
+    TRACE_END(ncf, "rng_validate");
 }
 
 /* Called from SAX on parsing errors in the XML. */
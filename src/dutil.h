@@ -24,9 +24,18 @@
 #define DUTIL_H_
 
 
-/* Create a new netcf if instance for interface NAME */
+/* Return the netcf_if for interface NAME, taking ownership of NAME. The
+ * handle comes from the intern table of NCF if there is one for NAME
+ * already, and is created and added to the table otherwise */
 struct netcf_if *make_netcf_if(struct netcf *ncf, char *name);
 
+/* Return the netcf_if for NAME from the intern table of NCF with a new
+ * reference, or NULL if there is none */
+struct netcf_if *find_netcf_if(struct netcf *ncf, const char *name);
+
+/* A hash of the string NAME, for tables keyed by interface name */
+unsigned int name_hash(const char *name);
+
 /* never call these directly. Only call via, eg, "unref(ncf, netcf)" */
 void free_netcf(struct netcf *ncf);
 void free_netcf_if(struct netcf_if *nif);
@@ -41,6 +50,37 @@ int xasprintf(char **strp, const char *format, ...);
  */
 char *argv_to_string(const char *const *argv);
 
+/* Append a unified diff with three lines of context that turns OLD_TEXT
+ * into NEW_TEXT to *DIFF, which must be NULL or allocated with malloc.
+ * A NULL text stands for a file that does not exist. OLD_LABEL and
+ * NEW_LABEL are used in the header lines. Nothing is appended if the
+ * texts are the same. Returns 0 on success, -1 if allocation failed.
+ */
+int unified_diff(char **diff, const char *old_label, const char *old_text,
+                 const char *new_label, const char *new_text);
+
+/*
+ * Operation statistics, see ncf_get_stats
+ */
+
+/* Return the current time in microseconds from a monotonic clock */
+unsigned long long stat_start(void);
+
+/* Count one operation STAT for NCF that started at START, as returned by
+ * STAT_START */
+void stat_stop(struct netcf *ncf, netcf_stat_t stat, unsigned long long start);
+
+/* Count N operations STAT for NCF without accounting any time to them */
+void stat_count(struct netcf *ncf, netcf_stat_t stat, unsigned long long n);
+
+/* Run the statement STMT and account it as one operation STAT */
+#define STAT_TIMED(ncf, stat, stmt)                                \
+    do {                                                            \
+        unsigned long long stat_start_ = stat_start();              \
+        stmt;                                                       \
+        stat_stop(ncf, stat, stat_start_);                          \
+    } while(0)
+
 /*
  * Error reporting
  */
@@ -55,7 +95,20 @@ void vreport_error(struct netcf *ncf, netcf_errcode_t errcode,
 /* XSLT extension functions in xslt_ext.c */
 int xslt_register_exts(xsltTransformContextPtr ctxt);
 
-/* Parse an XSLT stylesheet residing in the file NCF->data_dir/xml/FNAME */
+/* A data file compiled into the library by embed-data.sh */
+struct embedded_file {
+    const char          *name;   /* path relative to the data dir */
+    const unsigned char *data;
+    size_t               size;
+};
+
+#ifdef NETCF_EMBED_DATA
+/* All embedded files, terminated by an entry with a NULL name */
+extern const struct embedded_file embedded_files[];
+#endif
+
+/* Parse an XSLT stylesheet residing in the file NCF->data_dir/xml/FNAME,
+ * or its embedded copy if NCF->EMBEDDED is set */
 xsltStylesheetPtr parse_stylesheet(struct netcf *ncf, const char *fname);
 
 /* Apply an XSLT stylesheet to a document with our extensions */
@@ -67,13 +120,20 @@ xmlDocPtr apply_stylesheet(struct netcf *ncf, xsltStylesheetPtr style,
 char *apply_stylesheet_to_string(struct netcf *ncf, xsltStylesheetPtr style,
                                  xmlDocPtr doc);
 
+/* Serialize DOC with indentation, the same way as the <xsl:output> of
+ * our stylesheets does, but without having to parse one of them. The
+ * result must be freed by the caller; returns NULL on error */
+char *xml_doc_to_string(struct netcf *ncf, xmlDocPtr doc);
+
 /* Callback for reporting RelaxNG errors */
 void rng_error(void *ctx, const char *format, ...);
 
-/* Initialize a rng pointer from the file NCF->data_dir/xml/FNAME */
+/* Initialize a rng pointer from the file NCF->data_dir/xml/FNAME, or its
+ * embedded copy if NCF->EMBEDDED is set */
 xmlRelaxNGPtr rng_parse(struct netcf *ncf, const char *fname);
 
-/* Validate the xml document doc using the previously initialized rng pointer */
+/* Validate the xml document doc against interface.rng, which is parsed
+ * into NCF->RNG the first time it is needed */
 void rng_validate(struct netcf *ncf, xmlDocPtr doc);
 
 /* Called from SAX on parsing errors in the XML. */
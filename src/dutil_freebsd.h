@@ -33,6 +33,7 @@
 #include <internal.h>
 
 #include "dutil.h"
+#include "dutil_posix.h"
 
 struct driver {
     struct augeas     *augeas;
@@ -48,15 +49,8 @@ struct driver {
     const struct augeas_xfm_table **augeas_xfm_tables;
 };
 
-/* run an external program */
-int run_program(struct netcf *ncf, const char *const *argv, char **output);
-void run1(struct netcf *ncf, const char *prog, const char *arg);
-
 /* Free matches from aug_match (or aug_submatch) */
 void free_matches(int nint, char ***intf);
 
 /* Check if the interface INTF is up using an ioctl call */
 int if_is_active(struct netcf *ncf, const char *intf);
-
-/* Get a file descriptor to a ioctl socket */
-int init_ioctl_fd(struct netcf *ncf);
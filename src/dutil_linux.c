@@ -36,6 +36,7 @@
 #include <errno.h>
 
 #include <dirent.h>
+#include <fnmatch.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <c-ctype.h>
@@ -44,6 +45,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -54,6 +58,11 @@
 #include <sys/sockio.h> // For SIOCGIADDR
 #endif
 
+#include <libxml/tree.h>
+#include <libxslt/xslt.h>
+#include <libxslt/xsltutils.h>
+#include <libexslt/exslt.h>
+
 #include "safe-alloc.h"
 #include "read-file.h"
 #include "ref.h"
@@ -61,6 +70,7 @@
 #include "netcf.h"
 #include "dutil.h"
 #include "dutil_linux.h"
+#include "dutil_posix.h"
 
 #ifndef __FreeBSD__
 #ifndef HAVE_LIBNL3
@@ -68,8 +78,19 @@
 #endif
 #include <netlink/socket.h>
 #include <netlink/cache.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/route/rtnl.h>
 #include <netlink/route/addr.h>
 #include <netlink/route/link.h>
+#include <netlink/route/route.h>
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <linux/rtnetlink.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
 #endif
 
 #ifndef __FreeBSD__
@@ -82,29 +103,16 @@
 extern int rtnl_link_vlan_get_id(struct rtnl_link *link);
 #endif
 
-static struct nl_cache *__rtnl_link_alloc_cache(struct nl_sock *sk)
-{
-    struct nl_cache *cache;
-
-#ifdef HAVE_LIBNL3
-    if (rtnl_link_alloc_cache(sk, AF_UNSPEC, &cache) < 0)
-        return NULL;
-#elif HAVE_LIBNL
-    cache = rtnl_link_alloc_cache(sk);
-#endif
-
-    return cache;
-}
-
-static struct nl_cache *__rtnl_addr_alloc_cache(struct nl_sock *sk)
+/* An empty cache for netlink objects of KIND, e.g. "route/link" */
+static struct nl_cache *netlink_cache_alloc(const char *kind)
 {
     struct nl_cache *cache;
 
 #ifdef HAVE_LIBNL3
-    if (rtnl_addr_alloc_cache(sk, &cache) < 0)
+    if (nl_cache_alloc_name(kind, &cache) < 0)
         return NULL;
 #elif HAVE_LIBNL
-    cache = rtnl_addr_alloc_cache(sk);
+    cache = nl_cache_alloc_name(kind);
 #endif
 
     return cache;
@@ -160,11 +168,91 @@ int remove_augeas_xfm_table(struct netcf *ncf,
     return 0;
 }
 
+struct augeas_xfm_table *make_augeas_xfm_table(struct netcf *ncf,
+                                               const char *xfm,
+                                               const char *lens,
+                                               int nfiles, char **files) {
+    struct augeas_xfm_table *table = NULL;
+    struct augeas_pv *pv = NULL;
+    char *path = NULL, *value = NULL;
+    int r;
+
+    r = ALLOC(table);
+    ERR_NOMEM(r < 0, ncf);
+    r = ALLOC_N(pv, nfiles + 1);
+    ERR_NOMEM(r < 0, ncf);
+    table->pv = pv;
+
+    /* The members of struct augeas_pv are const, so entries can only be
+     * copied into place */
+    for (int i=0; i <= nfiles; i++) {
+        if (i == 0)
+            r = xasprintf(&path, "/augeas/load/%s/lens", xfm);
+        else
+            r = xasprintf(&path, "/augeas/load/%s/incl[%d]", xfm, i);
+        ERR_NOMEM(r < 0, ncf);
+        value = strdup(i == 0 ? lens : files[i - 1]);
+        ERR_NOMEM(value == NULL, ncf);
+        memcpy(pv + i, &(struct augeas_pv) { path, value }, sizeof(*pv));
+        path = value = NULL;
+        table->size = i + 1;
+    }
+    return table;
+ error:
+    FREE(path);
+    FREE(value);
+    free_augeas_xfm_table(table);
+    return NULL;
+}
+
+void free_augeas_xfm_table(struct augeas_xfm_table *table) {
+    if (table == NULL)
+        return;
+    for (int i=0; i < table->size; i++) {
+        free((char *) table->pv[i].path);
+        free((char *) table->pv[i].value);
+    }
+    free((struct augeas_pv *) table->pv);
+    free(table);
+}
+
+int load_stylesheets(struct netcf *ncf) {
+    if (ncf->driver->get != NULL && ncf->driver->put != NULL)
+        return 0;
+
+    // FIXME: Check for errors
+    xsltInit();
+    exsltStrRegister();
+    if (ncf->driver->get == NULL)
+        ncf->driver->get = parse_stylesheet(ncf, ncf->driver->get_xsl);
+    ERR_BAIL(ncf);
+    if (ncf->driver->put == NULL)
+        ncf->driver->put = parse_stylesheet(ncf, ncf->driver->put_xsl);
+    ERR_BAIL(ncf);
+    return 0;
+ error:
+    return -1;
+}
+
+bool config_gen_current(struct netcf *ncf, unsigned int gen) {
+    return ncf->driver->augeas != NULL && !ncf->driver->load_augeas
+        && gen == ncf->config_gen;
+}
+
 /* Get the Augeas instance; if we already initialized it, just return
  * it. Otherwise, create a new one and return that.
  */
 struct augeas *get_augeas(struct netcf *ncf) {
     int r;
+    /* Only trace calls that have to set up or load the tree */
+    bool traced = ncf->driver->augeas == NULL
+        || ncf->driver->copy_augeas_xfm || ncf->driver->load_augeas;
+    /* Swapping transforms for narrow_augeas and widen_augeas reloads
+     * the same files; only a load someone asked for may see new ones */
+    bool reread = ncf->driver->augeas == NULL || ncf->driver->load_augeas;
+
+    if (traced)
+        TRACE_BEGIN(ncf, "get_augeas");
 
     if (ncf->driver->augeas == NULL) {
         struct augeas *aug;
@@ -205,8 +293,13 @@ struct augeas *get_augeas(struct netcf *ncf) {
     if (ncf->driver->load_augeas) {
         struct augeas *aug = ncf->driver->augeas;
 
-        r = aug_load(aug);
+        STAT_TIMED(ncf, NETCF_STAT_AUG_LOAD, r = aug_load(aug));
+        if (reread)
+            ncf->config_gen += 1;
         ERR_THROW(r < 0, ncf, EOTHER, "failed to load config files");
+        r = aug_match(aug, "/augeas/files//path", NULL);
+        if (r > 0)
+            stat_count(ncf, NETCF_STAT_FILES_PARSED, r);
 
         /* FIXME: we need to produce _much_ better diagnostics here - need
          * to analyze what came back in /augeas//error; ultimately, we need
@@ -222,10 +315,14 @@ struct augeas *get_augeas(struct netcf *ncf) {
         ERR_THROW(r > 0, ncf, EOTHER, "errors in loading some config files");
         ncf->driver->load_augeas = 0;
     }
+    if (traced)
+        TRACE_END(ncf, "get_augeas");
     return ncf->driver->augeas;
  error:
     aug_close(ncf->driver->augeas);
     ncf->driver->augeas = NULL;
+    if (traced)
+        TRACE_END(ncf, "get_augeas");
     return NULL;
 }
 
@@ -329,7 +426,7 @@ int aug_fmt_match(struct netcf *ncf, char ***matches, const char *fmt, ...) {
         ERR_NOMEM(1, ncf);
     }
 
-    r = aug_match(aug, path, matches);
+    STAT_TIMED(ncf, NETCF_STAT_AUG_MATCH, r = aug_match(aug, path, matches));
     ERR_COND_BAIL(r < 0, ncf, EOTHER);
 
     free(path);
@@ -338,6 +435,601 @@ int aug_fmt_match(struct netcf *ncf, char ***matches, const char *fmt, ...) {
     free(path);
     return -1;
 }
+
+int aug_update(struct netcf *ncf, const char *path, const char *value) {
+    struct augeas *aug = NULL;
+    const char *old = NULL;
+    int r;
+
+    aug = get_augeas(ncf);
+    ERR_BAIL(ncf);
+
+    r = aug_match(aug, path, NULL);
+    ERR_THROW(r < 0, ncf, EOTHER, "invalid path '%s'", path);
+    if (r == 1) {
+        r = aug_get(aug, path, &old);
+        ERR_THROW(r < 0, ncf, EOTHER, "aug_get of '%s' failed", path);
+        if (old == NULL ? value == NULL : value != NULL && STREQ(old, value))
+            return 0;
+    } else if (r > 1) {
+        /* Duplicate entries; only keep one */
+        r = aug_rm(aug, path);
+        ERR_THROW(r < 0, ncf, EOTHER, "aug_rm of '%s' failed", path);
+    }
+
+    r = aug_set(aug, path, value);
+    ERR_THROW(r < 0, ncf, EOTHER, "aug_set of '%s' failed", path);
+    stat_count(ncf, NETCF_STAT_KEYS_WRITTEN, 1);
+    return 1;
+ error:
+    return -1;
+}
+
+/* Return true if LABEL, which may have a trailing [N] from aug_match, is
+ * in the NULL-terminated list LABELS. An entry of LABELS that ends in '_'
+ * matches all labels that start with it */
+static bool label_listed(const char *label, const char *const *labels) {
+    size_t len = strcspn(label, "[");
+
+    for (int i=0; labels != NULL && labels[i] != NULL; i++) {
+        size_t l = strlen(labels[i]);
+        bool prefix = l > 0 && labels[i][l-1] == '_';
+
+        if ((prefix ? l <= len : l == len)
+            && STREQLEN(labels[i], label, l))
+            return true;
+    }
+    return false;
+}
+
+/* Return true if LABEL, which may have a trailing [N] from aug_match, is
+ * the label of one of the nodes of the forest TREE that is not in SKIP */
+static bool tree_has_label(xmlNodePtr tree, const char *label,
+                           const char *const *skip) {
+    size_t len = strcspn(label, "[");
+    bool found = false;
+
+    if (label_listed(label, skip))
+        return false;
+
+    list_for_each(node, tree->children) {
+        char *l = xml_prop(node, "label");
+        found = l != NULL && strlen(l) == len && STREQLEN(l, label, len);
+        xmlFree(l);
+        if (found)
+            break;
+    }
+    return found;
+}
+
+int aug_put_tree(struct netcf *ncf, xmlNodePtr tree,
+                 const char *const *skip, const char *const *managed) {
+    struct augeas *aug = NULL;
+    char *path = NULL, *lpath = NULL, *label = NULL, *value = NULL;
+    char **matches = NULL;
+    int nmatches = 0, changed = 0, r;
+
+    aug = get_augeas(ncf);
+    ERR_BAIL(ncf);
+
+    ERR_THROW(! xmlStrEqual(tree->name, BAD_CAST "tree"), ncf,
+              EINTERNAL, "expected node labeled 'tree', not '%s'",
+              tree->name);
+    path = xml_prop(tree, "path");
+    ERR_THROW(path == NULL, ncf, EINTERNAL, "tree without a path");
+
+    /* Remove the entries the new config does not have, but leave
+     * comments, blank lines and entries netcf knows nothing about alone */
+    nmatches = aug_fmt_match(ncf, &matches, "%s/*", path);
+    ERR_BAIL(ncf);
+    for (int i=0; i < nmatches; i++) {
+        const char *l = strrchr(matches[i], '/') + 1;
+        if (l[0] == '#' || ! label_listed(l, managed)
+            || tree_has_label(tree, l, skip))
+            continue;
+        r = aug_rm(aug, matches[i]);
+        ERR_THROW(r < 0, ncf, EINTERNAL, "aug_rm of '%s' failed",
+                  matches[i]);
+        stat_count(ncf, NETCF_STAT_KEYS_WRITTEN, 1);
+        changed += 1;
+    }
+
+    list_for_each(node, tree->children) {
+        label = xml_prop(node, "label");
+        value = xml_prop(node, "value");
+        if (! label_listed(label, skip)) {
+            r = xasprintf(&lpath, "%s/%s", path, label);
+            ERR_NOMEM(r < 0, ncf);
+            r = aug_update(ncf, lpath, value);
+            ERR_BAIL(ncf);
+            changed += r;
+            FREE(lpath);
+        }
+        xmlFree(label);
+        xmlFree(value);
+        label = value = NULL;
+    }
+
+ done:
+    free_matches(nmatches, &matches);
+    xmlFree(label);
+    xmlFree(value);
+    xmlFree(path);
+    FREE(lpath);
+    return changed;
+ error:
+    changed = -1;
+    goto done;
+}
+
+bool forest_has_tree(xmlDocPtr forest, const char *path) {
+    xmlNodePtr root = xmlDocGetRootElement(forest);
+    bool found = false;
+
+    if (root == NULL)
+        return false;
+    list_for_each(tree, root->children) {
+        char *p = xml_prop(tree, "path");
+        found = p != NULL && STREQ(p, path);
+        xmlFree(p);
+        if (found)
+            break;
+    }
+    return found;
+}
+
+/* Add a copy of PATH to the list PATHS unless it is already in it */
+static int add_unique_path(struct netcf *ncf, char ***paths, int *npaths,
+                            const char *path) {
+    for (int i=0; i < *npaths; i++)
+        if (STREQ((*paths)[i], path))
+            return 0;
+    if (REALLOC_N(*paths, *npaths + 1) < 0)
+        goto error;
+    (*paths)[*npaths] = strdup(path);
+    if ((*paths)[*npaths] == NULL)
+        goto error;
+    *npaths += 1;
+    return 0;
+ error:
+    report_error(ncf, NETCF_ENOMEM, NULL);
+    return -1;
+}
+
+int save_augeas(struct netcf *ncf) {
+    struct augeas *aug = NULL;
+    char **matches = NULL, **paths = NULL;
+    char *fname = NULL;
+    const char *value = NULL;
+    int nmatches = 0, npaths = 0, r;
+
+    aug = get_augeas(ncf);
+    ERR_BAIL(ncf);
+
+    /* Augeas does not tell us which files it deletes, so remember the
+     * files whose tree is gone before saving */
+    if (ncf->durability != NETCF_DURABILITY_NONE) {
+        nmatches = aug_match(aug, "/augeas/files//path", &matches);
+        ERR_THROW(nmatches < 0, ncf, EOTHER, "no list of loaded files");
+        for (int i=0; i < nmatches; i++) {
+            if (aug_get(aug, matches[i], &value) == 1 && value != NULL
+                && aug_match(aug, value, NULL) == 0) {
+                add_unique_path(ncf, &paths, &npaths, value);
+                ERR_BAIL(ncf);
+            }
+        }
+        free_matches(nmatches, &matches);
+    }
+
+    STAT_TIMED(ncf, NETCF_STAT_AUG_SAVE, r = aug_save(aug));
+    ncf->config_gen += 1;
+    if (r < 0 && NCF_DEBUG(ncf)) {
+        fprintf(stderr, "Errors from aug_save:\n");
+        aug_print(aug, stderr, "/augeas//error");
+    }
+    ERR_THROW(r < 0, ncf, EOTHER, "aug_save failed");
+
+    /* Augeas only writes the files whose tree was modified and records
+     * each of them here */
+    nmatches = aug_match(aug, "/augeas/events/saved", &matches);
+    if (nmatches > 0)
+        stat_count(ncf, NETCF_STAT_FILES_WRITTEN, nmatches);
+
+    if (ncf->durability != NETCF_DURABILITY_NONE) {
+        for (int i=0; i < nmatches; i++) {
+            if (aug_get(aug, matches[i], &value) == 1 && value != NULL) {
+                add_unique_path(ncf, &paths, &npaths, value);
+                ERR_BAIL(ncf);
+            }
+        }
+        for (int i=0; i < npaths; i++) {
+            r = xasprintf(&fname, "%s%s", ncf->root,
+                          paths[i] + strlen("/files/"));
+            ERR_NOMEM(r < 0, ncf);
+            r = sync_file_written(ncf, fname);
+            ERR_BAIL(ncf);
+            FREE(fname);
+        }
+        r = sync_end(ncf);
+        ERR_BAIL(ncf);
+    }
+    free_matches(nmatches, &matches);
+    free_matches(npaths, &paths);
+    return 0;
+ error:
+    FREE(fname);
+    free_matches(nmatches, &matches);
+    free_matches(npaths, &paths);
+    return -1;
+}
+
+void if_defn_clear(struct if_defn *defn) {
+    FREE(defn->name);
+    xmlFreeDoc(defn->ncf_xml);
+    defn->ncf_xml = NULL;
+    xmlFreeDoc(defn->aug_xml);
+    defn->aug_xml = NULL;
+}
+
+/* The work shared by the threads of define_roots. Everything but NEXT,
+ * and the results of the roots, is read-only while the threads run */
+struct define_roots_job {
+    struct netcf          *ncf;
+    int                    ndefns;
+    const struct if_defn  *defns;
+    int                    nroots;
+    const char *const     *roots;
+    netcf_errcode_t       *errcodes;    /* may be NULL */
+    char                 **errdetails;  /* may be NULL */
+    if_defn_put_t          put;
+    int                    next;        /* the next root to work on */
+    int                    nfailed;
+    int                    first_failed;  /* index of the first root that
+                                           * failed, or -1 */
+    netcf_errcode_t        first_errcode;
+    char                  *first_details;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t        lock;
+#endif
+};
+
+static void define_roots_lock(struct define_roots_job *job) {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&job->lock);
+#endif
+}
+
+static void define_roots_unlock(struct define_roots_job *job) {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&job->lock);
+#endif
+}
+
+/* Put all definitions of JOB into the root with index I with a handle of
+ * its own, and record the outcome. Only the handle for the root is
+ * changed; JOB->NCF only while holding the lock */
+static void define_root(struct define_roots_job *job, int i) {
+    struct netcf *ncf = NULL;
+    netcf_errcode_t errcode = NETCF_ENOMEM;
+    const char *errmsg = "out of memory", *details = NULL;
+
+    if (ncf_init(&ncf, job->roots[i]) == 0) {
+        ncf->durability = job->ncf->durability;
+        for (int d=0; d < job->ndefns && ncf->errcode == NETCF_NOERROR; d++)
+            job->put(ncf, job->defns + d);
+        if (ncf->errcode == NETCF_NOERROR)
+            save_augeas(ncf);
+    }
+    if (ncf != NULL)
+        errcode = ncf_error(ncf, &errmsg, &details);
+
+    define_roots_lock(job);
+    if (ncf != NULL) {
+        for (int s=0; s < NETCF_STAT_LAST; s++) {
+            job->ncf->stat_count[s] += ncf->stat_count[s];
+            job->ncf->stat_usecs[s] += ncf->stat_usecs[s];
+        }
+    }
+    if (job->errcodes != NULL)
+        job->errcodes[i] = errcode;
+    if (errcode != NETCF_NOERROR) {
+        if (details == NULL)
+            details = errmsg;
+        if (job->errdetails != NULL)
+            job->errdetails[i] = strdup(details);
+        job->nfailed += 1;
+        if (job->first_failed < 0 || i < job->first_failed) {
+            job->first_failed = i;
+            job->first_errcode = errcode;
+            FREE(job->first_details);
+            job->first_details = strdup(details);
+        }
+    }
+    define_roots_unlock(job);
+
+    ncf_close(ncf);
+}
+
+static void *define_roots_worker(void *data) {
+    struct define_roots_job *job = data;
+    int i;
+
+    for (;;) {
+        define_roots_lock(job);
+        i = job->next++;
+        define_roots_unlock(job);
+        if (i >= job->nroots)
+            break;
+        define_root(job, i);
+    }
+    return NULL;
+}
+
+int define_roots(struct netcf *ncf, int nxml, const char *const *xmls,
+                 int nroots, const char *const *roots, int nthreads,
+                 netcf_errcode_t *errcodes, char **errdetails,
+                 if_defn_prepare_t prepare, if_defn_put_t put) {
+    struct define_roots_job job;
+    struct if_defn *defns = NULL;
+#ifdef HAVE_PTHREAD_H
+    pthread_t *threads = NULL;
+    int nstarted = 0;
+#endif
+    int r, result = -1;
+
+    MEMZERO(&job, 1);
+    job.first_failed = -1;
+    /* so that the caller can free them even if no root is worked on */
+    for (int i=0; errdetails != NULL && i < nroots; i++)
+        errdetails[i] = NULL;
+
+    r = ALLOC_N(defns, nxml);
+    ERR_NOMEM(r < 0, ncf);
+    for (int d=0; d < nxml; d++) {
+        prepare(ncf, xmls[d], defns + d);
+        ERR_BAIL(ncf);
+    }
+
+    job.ncf = ncf;
+    job.ndefns = nxml;
+    job.defns = defns;
+    job.nroots = nroots;
+    job.roots = roots;
+    job.errcodes = errcodes;
+    job.errdetails = errdetails;
+    job.put = put;
+
+    if (nthreads == 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > nroots)
+        nthreads = nroots;
+
+#ifdef HAVE_PTHREAD_H
+    r = pthread_mutex_init(&job.lock, NULL);
+    ERR_THROW(r != 0, ncf, EOTHER, "failed to initialize mutex");
+
+    /* The calling thread is one of the workers; if we can not start as
+     * many others as asked for, we just get done more slowly */
+    if (nthreads > 1 && ALLOC_N(threads, nthreads - 1) == 0) {
+        while (nstarted < nthreads - 1) {
+            r = pthread_create(threads + nstarted, NULL,
+                               define_roots_worker, &job);
+            if (r != 0)
+                break;
+            nstarted += 1;
+        }
+    }
+    define_roots_worker(&job);
+    for (int t=0; t < nstarted; t++)
+        pthread_join(threads[t], NULL);
+    FREE(threads);
+    pthread_mutex_destroy(&job.lock);
+#else
+    define_roots_worker(&job);
+#endif
+
+    if (job.nfailed > 0) {
+        report_error(ncf, job.first_errcode,
+                     "%d of %d roots failed, the first one %s: %s",
+                     job.nfailed, nroots, roots[job.first_failed],
+                     job.first_details != NULL ? job.first_details : "");
+        goto error;
+    }
+    result = 0;
+
+ error:
+    FREE(job.first_details);
+    for (int d=0; defns != NULL && d < nxml; d++)
+        if_defn_clear(defns + d);
+    FREE(defns);
+    return result;
+}
+
+#ifdef HAVE_AUG_TEXT_RETRIEVE
+/* Return true if one of the incl or excl patterns, depending on KIND, of
+ * the transform XFM matches FPATH. Like Augeas, match patterns without a
+ * '/' against the file name only */
+static bool xfm_filter_matches(struct augeas *aug, const char *xfm,
+                               const char *kind, const char *fpath) {
+    char **globs = NULL;
+    char *path = NULL;
+    int nglobs = 0;
+    bool result = false;
+
+    if (xasprintf(&path, "%s/%s", xfm, kind) < 0)
+        return false;
+    nglobs = aug_match(aug, path, &globs);
+    for (int i=0; i < nglobs && !result; i++) {
+        const char *glob = NULL, *name = fpath;
+
+        if (aug_get(aug, globs[i], &glob) != 1 || glob == NULL)
+            continue;
+        if (strchr(glob, '/') == NULL)
+            name = strrchr(fpath, '/') + 1;
+        result = (fnmatch(glob, name, 0) == 0);
+    }
+    free_matches(nglobs, &globs);
+    FREE(path);
+    return result;
+}
+
+/* The name of the lens Augeas uses for the file FPATH, or NULL */
+static char *lens_for_file(struct augeas *aug, const char *fpath) {
+    char **xfms = NULL;
+    char *result = NULL;
+    int nxfms;
+
+    nxfms = aug_match(aug, "/augeas/load/*", &xfms);
+    for (int i=0; i < nxfms; i++) {
+        char *path = NULL;
+        const char *lens = NULL;
+
+        if (! xfm_filter_matches(aug, xfms[i], "incl", fpath)
+            || xfm_filter_matches(aug, xfms[i], "excl", fpath))
+            continue;
+        if (xasprintf(&path, "%s/lens", xfms[i]) < 0)
+            break;
+        if (aug_get(aug, path, &lens) == 1 && lens != NULL)
+            result = strdup(lens);
+        FREE(path);
+        break;
+    }
+    free_matches(nxfms, &xfms);
+    return result;
+}
+
+static int cmpstrp(const void *p1, const void *p2) {
+    return strcmp(*(const char *const *) p1, *(const char *const *) p2);
+}
+
+char *preview_augeas(struct netcf *ncf) {
+    static const char *const text_in = "/netcf-preview/in";
+    static const char *const text_out = "/netcf-preview/out";
+    struct augeas *aug = NULL;
+    char **matches = NULL, **paths = NULL;
+    char *result = NULL, *mode = NULL, *fname = NULL, *old_text = NULL;
+    char *lens = NULL, *old_label = NULL, *new_label = NULL;
+    const char *value = NULL;
+    int nmatches = 0, npaths = 0, r;
+    size_t length;
+
+    aug = get_augeas(ncf);
+    ERR_BAIL(ncf);
+
+    /* Let Augeas tell us which files it would write */
+    r = aug_get(aug, "/augeas/save", &value);
+    mode = strdup((r == 1 && value != NULL) ? value : "overwrite");
+    ERR_NOMEM(mode == NULL, ncf);
+    r = aug_set(aug, "/augeas/save", "noop");
+    ERR_THROW(r < 0, ncf, EOTHER, "could not set save mode");
+    STAT_TIMED(ncf, NETCF_STAT_AUG_SAVE, r = aug_save(aug));
+    aug_set(aug, "/augeas/save", mode);
+    if (r < 0 && NCF_DEBUG(ncf)) {
+        fprintf(stderr, "Errors from aug_save:\n");
+        aug_print(aug, stderr, "/augeas//error");
+    }
+    ERR_THROW(r < 0, ncf, EOTHER, "aug_save failed");
+
+    nmatches = aug_match(aug, "/augeas/events/saved", &matches);
+    ERR_THROW(nmatches < 0, ncf, EOTHER, "no list of saved files");
+    for (int i=0; i < nmatches; i++) {
+        if (aug_get(aug, matches[i], &value) == 1 && value != NULL) {
+            add_unique_path(ncf, &paths, &npaths, value);
+            ERR_BAIL(ncf);
+        }
+    }
+    free_matches(nmatches, &matches);
+
+    /* and which ones it would delete */
+    nmatches = aug_match(aug, "/augeas/files//path", &matches);
+    ERR_THROW(nmatches < 0, ncf, EOTHER, "no list of loaded files");
+    for (int i=0; i < nmatches; i++) {
+        if (aug_get(aug, matches[i], &value) == 1 && value != NULL
+            && aug_match(aug, value, NULL) == 0) {
+            add_unique_path(ncf, &paths, &npaths, value);
+            ERR_BAIL(ncf);
+        }
+    }
+    free_matches(nmatches, &matches);
+    qsort(paths, npaths, sizeof(*paths), cmpstrp);
+
+    for (int i=0; i < npaths; i++) {
+        const char *fpath = paths[i] + strlen("/files");
+        const char *new_text = NULL;
+
+        r = xasprintf(&fname, "%s%s", ncf->root, fpath + 1);
+        ERR_NOMEM(r < 0, ncf);
+        old_text = read_file(fname, &length);
+
+        if (aug_match(aug, paths[i], NULL) > 0) {
+            lens = lens_for_file(aug, fpath);
+            ERR_THROW(lens == NULL, ncf, EINTERNAL,
+                      "no lens for %s", fpath);
+            r = aug_set(aug, text_in, old_text == NULL ? "" : old_text);
+            ERR_THROW(r < 0, ncf, EOTHER, "aug_set of %s failed", text_in);
+            r = aug_text_retrieve(aug, lens, text_in, paths[i], text_out);
+            if (r < 0 && NCF_DEBUG(ncf)) {
+                fprintf(stderr, "Errors from aug_text_retrieve:\n");
+                aug_print(aug, stderr, "/augeas/text//error");
+            }
+            ERR_THROW(r < 0, ncf, EOTHER, "could not render %s", fpath);
+            r = aug_get(aug, text_out, &new_text);
+            ERR_THROW(r != 1, ncf, EOTHER, "could not render %s", fpath);
+            FREE(lens);
+        }
+
+        if (old_text == NULL)
+            r = xasprintf(&old_label, "/dev/null");
+        else
+            r = xasprintf(&old_label, "a%s", fpath);
+        ERR_NOMEM(r < 0, ncf);
+        if (new_text == NULL)
+            r = xasprintf(&new_label, "/dev/null");
+        else
+            r = xasprintf(&new_label, "b%s", fpath);
+        ERR_NOMEM(r < 0, ncf);
+
+        r = unified_diff(&result, old_label, old_text, new_label, new_text);
+        ERR_NOMEM(r < 0, ncf);
+
+        FREE(fname);
+        FREE(old_text);
+        FREE(old_label);
+        FREE(new_label);
+    }
+
+    if (result == NULL) {
+        result = strdup("");
+        ERR_NOMEM(result == NULL, ncf);
+    }
+
+ done:
+    /* Throw the changes away; removing the trees of the changed files
+     * makes the next aug_load read them afresh */
+    for (int i=0; i < npaths; i++)
+        aug_rm(aug, paths[i]);
+    aug_rm(aug, "/netcf-preview");
+    free_matches(npaths, &paths);
+    free_matches(nmatches, &matches);
+    FREE(mode);
+    FREE(fname);
+    FREE(old_text);
+    FREE(lens);
+    FREE(old_label);
+    FREE(new_label);
+    return result;
+ error:
+    FREE(result);
+    goto done;
+}
+#else
+char *preview_augeas(struct netcf *ncf) {
+    ERR_THROW(1 == 1, ncf, EOTHER,
+              "previewing changes requires Augeas 1.2.0 or newer");
+ error:
+    return NULL;
+}
+#endif
 #endif
 
 void free_matches(int nint, char ***intf) {
@@ -425,7 +1117,8 @@ void modprobed_alias_bond(struct netcf *ncf, const char *name) {
            in Augeas, it's too convoluted */
         r = xasprintf(&path, "/files/etc/modprobe.d/netcf.conf/alias[last()]");
         ERR_NOMEM(r < 0, ncf);
-        nmatches = aug_match(aug, path, NULL);
+        STAT_TIMED(ncf, NETCF_STAT_AUG_MATCH,
+                   nmatches = aug_match(aug, path, NULL));
         if (nmatches > 0) {
             r = aug_insert(aug, path, "alias", 0);
             ERR_COND_BAIL(r < 0, ncf, EOTHER);
@@ -472,69 +1165,282 @@ void modprobed_unalias_bond(struct netcf *ncf, const char *name) {
 
 int if_is_active(struct netcf *ncf, const char *intf) {
     struct ifreq ifr;
+    int r;
 
     MEMZERO(&ifr, 1);
     strncpy(ifr.ifr_name, intf, sizeof(ifr.ifr_name));
     ifr.ifr_name[sizeof(ifr.ifr_name) - 1] = '\0';
-    if (ioctl(ncf->driver->ioctl_fd, SIOCGIFFLAGS, &ifr))  {
+    STAT_TIMED(ncf, NETCF_STAT_IOCTL,
+               r = ioctl(ncf->driver->ioctl_fd, SIOCGIFFLAGS, &ifr));
+    if (r)  {
         return 0;
     }
     return ((ifr.ifr_flags & (IFF_UP|IFF_RUNNING)) == (IFF_UP|IFF_RUNNING));
 }
 
-netcf_if_type_t if_type(struct netcf *ncf, const char *intf) {
-    char *path;
-    struct stat stats;
-    netcf_if_type_t ret = NETCF_IFACE_TYPE_NONE;
-
-    xasprintf(&path, "/proc/net/vlan/%s", intf);
-    ERR_NOMEM(path == NULL, ncf);
-    if ((stat (path, &stats) == 0) && S_ISREG (stats.st_mode)) {
-        ret = NETCF_IFACE_TYPE_VLAN;
-    }
-    FREE(path);
+#ifndef __FreeBSD__
+/*
+ * Links by name and ifindex, and their addresses
+ *
+ * libnl finds links by name, and the addresses of a link, by going over
+ * the whole cache. The link index hashes each link by name and by
+ * ifindex, and groups the addresses by the ifindex of their link, so
+ * that getting the state of all interfaces does not take time
+ * quadratic in the number of links. It is built from the link and
+ * address caches the first time it is needed after they were refilled.
+ */
+struct link_ref {
+    int               ifindex;     /* 0 for an empty slot */
+    struct rtnl_link *link;
+    int               first_addr;  /* index into ADDRS */
+    int               naddrs;
+};
 
-    if (ret == NETCF_IFACE_TYPE_NONE) {
-        xasprintf(&path, "/sys/class/net/%s/bridge", intf);
-        ERR_NOMEM(path == NULL, ncf);
-        if (stat (path, &stats) == 0 && S_ISDIR (stats.st_mode))
-            ret = NETCF_IFACE_TYPE_BRIDGE;
-        FREE(path);
-    }
-    if (ret == NETCF_IFACE_TYPE_NONE) {
-        xasprintf(&path, "/sys/class/net/%s/bonding", intf);
-        ERR_NOMEM(path == NULL, ncf);
-        if (stat (path, &stats) == 0 && S_ISDIR (stats.st_mode))
-            ret = NETCF_IFACE_TYPE_BOND;
-        FREE(path);
-    }
-    if (ret == NETCF_IFACE_TYPE_NONE)
-        ret = NETCF_IFACE_TYPE_ETHERNET;
+struct link_index {
+    unsigned int       nslots;     /* a power of two, and more than twice
+                                    * the number of links */
+    struct link_ref   *by_ifindex; /* open addressing on the ifindex */
+    struct link_ref  **by_name;    /* open addressing on the name, points
+                                    * into BY_IFINDEX */
+    int                naddrs;
+    struct rtnl_addr **addrs;      /* grouped by ifindex, in cache order */
+};
 
-error:
-    FREE(path);
-    return ret;
+static void link_index_free(struct link_index *index) {
+    if (index == NULL)
+        return;
+    free(index->by_ifindex);
+    free(index->by_name);
+    free(index->addrs);
+    free(index);
 }
 
-/* Given a netcf_if_type_t, return a const char * representation */
-const char *if_type_str(netcf_if_type_t type) {
-    switch (type) {
-        case NETCF_IFACE_TYPE_ETHERNET:
-            return "ethernet";
-        case NETCF_IFACE_TYPE_BOND:
-            return "bond";
-        case NETCF_IFACE_TYPE_BRIDGE:
-            return "bridge";
-        case NETCF_IFACE_TYPE_VLAN:
-            return "vlan";
-        default:
-            return NULL;
+static struct link_ref *link_index_by_ifindex(struct link_index *index,
+                                              int ifindex) {
+    unsigned int mask = index->nslots - 1;
+
+    if (ifindex <= 0)
+        return NULL;
+    for (unsigned int i = ifindex & mask; index->by_ifindex[i].ifindex != 0;
+         i = (i + 1) & mask) {
+        if (index->by_ifindex[i].ifindex == ifindex)
+            return index->by_ifindex + i;
     }
+    return NULL;
 }
 
+static struct link_ref *link_index_by_name(struct link_index *index,
+                                           const char *name) {
+    unsigned int mask = index->nslots - 1;
 
-static size_t format_mac_addr(unsigned char *buf, int buflen,
-                                const unsigned char *addr, int len)
+    for (unsigned int i = name_hash(name) & mask; index->by_name[i] != NULL;
+         i = (i + 1) & mask) {
+        const char *n = rtnl_link_get_name(index->by_name[i]->link);
+        if (n != NULL && STREQ(n, name))
+            return index->by_name[i];
+    }
+    return NULL;
+}
+
+static struct link_index *link_index_get(struct netcf *ncf) {
+    struct link_index *index = ncf->driver->link_index;
+    struct nl_object *obj;
+    unsigned int mask;
+    int nlinks, r;
+
+    if (index != NULL)
+        return index;
+
+    r = ALLOC(index);
+    ERR_NOMEM(r < 0, ncf);
+
+    nlinks = nl_cache_nitems(ncf->driver->link_cache);
+    for (index->nslots = 16; index->nslots <= 2 * nlinks; index->nslots *= 2);
+    mask = index->nslots - 1;
+    r = ALLOC_N(index->by_ifindex, index->nslots);
+    ERR_NOMEM(r < 0, ncf);
+    r = ALLOC_N(index->by_name, index->nslots);
+    ERR_NOMEM(r < 0, ncf);
+
+    for (obj = nl_cache_get_first(ncf->driver->link_cache); obj != NULL;
+         obj = nl_cache_get_next(obj)) {
+        struct rtnl_link *link = (struct rtnl_link *) obj;
+        int ifindex = rtnl_link_get_ifindex(link);
+        const char *name = rtnl_link_get_name(link);
+        unsigned int i;
+
+        if (ifindex <= 0 || link_index_by_ifindex(index, ifindex) != NULL)
+            continue;
+        for (i = ifindex & mask; index->by_ifindex[i].ifindex != 0;
+             i = (i + 1) & mask);
+        index->by_ifindex[i].ifindex = ifindex;
+        index->by_ifindex[i].link = link;
+
+        if (name == NULL)
+            continue;
+        for (unsigned int j = name_hash(name) & mask;;
+             j = (j + 1) & mask) {
+            if (index->by_name[j] == NULL) {
+                index->by_name[j] = index->by_ifindex + i;
+                break;
+            }
+        }
+    }
+
+    /* Count the addresses of each link, then put each of them at the end
+     * of the group of its link */
+    for (obj = nl_cache_get_first(ncf->driver->addr_cache); obj != NULL;
+         obj = nl_cache_get_next(obj)) {
+        struct link_ref *ref =
+            link_index_by_ifindex(index,
+                                  rtnl_addr_get_ifindex((struct rtnl_addr *) obj));
+        if (ref != NULL) {
+            ref->naddrs += 1;
+            index->naddrs += 1;
+        }
+    }
+    r = ALLOC_N(index->addrs, index->naddrs);
+    ERR_NOMEM(r < 0 && index->naddrs > 0, ncf);
+    for (unsigned int i = 0, first = 0; i < index->nslots; i++) {
+        index->by_ifindex[i].first_addr = first;
+        first += index->by_ifindex[i].naddrs;
+        index->by_ifindex[i].naddrs = 0;
+    }
+    for (obj = nl_cache_get_first(ncf->driver->addr_cache); obj != NULL;
+         obj = nl_cache_get_next(obj)) {
+        struct rtnl_addr *addr = (struct rtnl_addr *) obj;
+        struct link_ref *ref =
+            link_index_by_ifindex(index, rtnl_addr_get_ifindex(addr));
+        if (ref != NULL) {
+            index->addrs[ref->first_addr + ref->naddrs] = addr;
+            ref->naddrs += 1;
+        }
+    }
+
+    ncf->driver->link_index = index;
+    return index;
+ error:
+    link_index_free(index);
+    return NULL;
+}
+
+/* Return the ifindex of the link NAME, or RTNL_LINK_NOT_FOUND */
+static int link_name2i(struct netcf *ncf, const char *name) {
+    struct link_index *index;
+    struct link_ref *ref;
+
+    index = link_index_get(ncf);
+    if (index == NULL)
+        return RTNL_LINK_NOT_FOUND;
+    ref = link_index_by_name(index, name);
+    return (ref == NULL) ? RTNL_LINK_NOT_FOUND : ref->ifindex;
+}
+
+/* Return the link with IFINDEX, or NULL. The link belongs to the cache */
+static struct rtnl_link *link_by_ifindex(struct netcf *ncf, int ifindex) {
+    struct link_index *index;
+    struct link_ref *ref;
+
+    index = link_index_get(ncf);
+    if (index == NULL)
+        return NULL;
+    ref = link_index_by_ifindex(index, ifindex);
+    return (ref == NULL) ? NULL : ref->link;
+}
+
+/* Determine the type of INTF from the link kind the kernel reports in
+ * the link cache. Returns NETCF_IFACE_TYPE_NONE if the link is not in
+ * the cache, or the kernel does not tell us its kind.
+ */
+static netcf_if_type_t if_type_from_cache(struct netcf *ncf,
+                                          const char *intf) {
+    struct rtnl_link *link;
+    const char *kind;
+    netcf_if_type_t ret = NETCF_IFACE_TYPE_NONE;
+
+    if (ncf->driver->link_cache == NULL)
+        return NETCF_IFACE_TYPE_NONE;
+
+    link = link_by_ifindex(ncf, link_name2i(ncf, intf));
+    if (link == NULL)
+        return NETCF_IFACE_TYPE_NONE;
+
+    kind = rtnl_link_get_type(link);
+    if (kind == NULL)
+        ret = NETCF_IFACE_TYPE_NONE;
+    else if (STREQ(kind, "vlan"))
+        ret = NETCF_IFACE_TYPE_VLAN;
+    else if (STREQ(kind, "bridge"))
+        ret = NETCF_IFACE_TYPE_BRIDGE;
+    else if (STREQ(kind, "bond"))
+        ret = NETCF_IFACE_TYPE_BOND;
+    else
+        ret = NETCF_IFACE_TYPE_ETHERNET;
+    return ret;
+}
+#endif
+
+netcf_if_type_t if_type(struct netcf *ncf, const char *intf) {
+    char *path = NULL;
+    struct stat stats;
+    netcf_if_type_t ret = NETCF_IFACE_TYPE_NONE;
+
+#ifndef __FreeBSD__
+    /* Avoid poking around in /proc and /sys if the kernel already told
+     * us what kind of link this is */
+    ret = if_type_from_cache(ncf, intf);
+    if (ret != NETCF_IFACE_TYPE_NONE)
+        return ret;
+#endif
+
+    xasprintf(&path, "/proc/net/vlan/%s", intf);
+    ERR_NOMEM(path == NULL, ncf);
+    if ((stat (path, &stats) == 0) && S_ISREG (stats.st_mode)) {
+        ret = NETCF_IFACE_TYPE_VLAN;
+    }
+    FREE(path);
+
+    if (ret == NETCF_IFACE_TYPE_NONE) {
+        xasprintf(&path, "/sys/class/net/%s/bridge", intf);
+        ERR_NOMEM(path == NULL, ncf);
+        if (stat (path, &stats) == 0 && S_ISDIR (stats.st_mode))
+            ret = NETCF_IFACE_TYPE_BRIDGE;
+        FREE(path);
+    }
+    if (ret == NETCF_IFACE_TYPE_NONE) {
+        xasprintf(&path, "/sys/class/net/%s/bonding", intf);
+        ERR_NOMEM(path == NULL, ncf);
+        if (stat (path, &stats) == 0 && S_ISDIR (stats.st_mode))
+            ret = NETCF_IFACE_TYPE_BOND;
+        FREE(path);
+    }
+    if (ret == NETCF_IFACE_TYPE_NONE)
+        ret = NETCF_IFACE_TYPE_ETHERNET;
+
+error:
+    FREE(path);
+    return ret;
+}
+
+/* Given a netcf_if_type_t, return a const char * representation */
+const char *if_type_str(netcf_if_type_t type) {
+    switch (type) {
+        case NETCF_IFACE_TYPE_ETHERNET:
+            return "ethernet";
+        case NETCF_IFACE_TYPE_BOND:
+            return "bond";
+        case NETCF_IFACE_TYPE_BRIDGE:
+            return "bridge";
+        case NETCF_IFACE_TYPE_VLAN:
+            return "vlan";
+        default:
+            return NULL;
+    }
+}
+
+
+static size_t format_mac_addr(unsigned char *buf, int buflen,
+                                const unsigned char *addr, int len)
 {
         int i;
         char *cp = (char *)buf;
@@ -560,11 +1466,13 @@ int if_hwaddr(struct netcf *ncf, const char *intf,
     strncpy(ifr.ifr_name, intf, sizeof(ifr.ifr_name));
     ifr.ifr_name[sizeof(ifr.ifr_name) - 1] = '\0';
 #ifdef __FreeBSD__
-    ret = ioctl(ncf->driver->ioctl_fd, SIOCGIFADDR, &ifr);
+    STAT_TIMED(ncf, NETCF_STAT_IOCTL,
+               ret = ioctl(ncf->driver->ioctl_fd, SIOCGIFADDR, &ifr));
     memcpy(mac,ifr.ifr_addr.sa_data,6);
     format_mac_addr(mac,buflen, (unsigned char *)ifr.ifr_addr.sa_data,6);
 #else
-    ret = ioctl(ncf->driver->ioctl_fd, SIOCGIFHWADDR, &ifr);
+    STAT_TIMED(ncf, NETCF_STAT_IOCTL,
+               ret = ioctl(ncf->driver->ioctl_fd, SIOCGIFHWADDR, &ifr));
     memcpy(mac,ifr.ifr_hwaddr.sa_data,6);
     format_mac_addr(mac,buflen, (unsigned char *)ifr.ifr_hwaddr.sa_data,6);
 #endif
@@ -573,56 +1481,325 @@ int if_hwaddr(struct netcf *ncf, const char *intf,
 
 
 #ifndef __FreeBSD__
-static int if_bridge_phys_name(struct netcf *ncf,
-                               const char *intf, char ***phys_names) {
-    /* We can learn the name of the physical interface associated with
-     * this bridge by looking for the names of the links in
-     * /sys/class/net/$ifname/brif.
-     *
-     * The caller of this function must free the array of strings that is
-     * returned.
-     *
-     */
-    int r, ii, ret = 0;
-    char *dirpath = NULL;
-    DIR *dir = NULL;
+/*
+ * Members of bonds and bridges
+ *
+ * The index lists all links that have a master, sorted by the ifindex of
+ * the master, so that the slaves of a bond or the ports of a bridge can
+ * be found without going over the whole link cache. Like the route
+ * index, it is built the first time it is needed after a refill.
+ */
+struct member_ref {
+    int               master;
+    int               seq;         /* position in the cache */
+    struct rtnl_link *link;
+};
+
+struct member_index {
+    int                nmembers;
+    struct member_ref *members;    /* sorted by master */
+};
 
-    *phys_names = NULL;
+static void member_index_free(struct member_index *index) {
+    if (index == NULL)
+        return;
+    free(index->members);
+    free(index);
+}
 
-    xasprintf(&dirpath, "/sys/class/net/%s/brif", intf);
-    ERR_NOMEM(dirpath == NULL, ncf);
+static int member_ref_cmp(const void *p1, const void *p2) {
+    const struct member_ref *m1 = p1, *m2 = p2;
 
-    dir = opendir(dirpath);
-    if (dir != NULL) {
-        struct dirent *d;
+    if (m1->master != m2->master)
+        return m1->master < m2->master ? -1 : 1;
+    return m1->seq - m2->seq;
+}
 
-        while ((d = readdir (dir)) != NULL) {
-            if (STRNEQ(d->d_name, ".") && STRNEQ(d->d_name, "..")) {
-                r = REALLOC_N(*phys_names, ret + 1);
-                ERR_NOMEM(r < 0, ncf);
-                ret++;
-                xasprintf(&((*phys_names)[ret - 1]), "%s", d->d_name);
-                ERR_NOMEM((*phys_names)[ret - 1] == NULL, ncf);
-            }
+static struct member_index *member_index_get(struct netcf *ncf) {
+    struct member_index *index = ncf->driver->member_index;
+    struct nl_object *obj;
+    int alloc = 0, seq = 0, r;
+
+    if (index != NULL)
+        return index;
+
+    r = ALLOC(index);
+    ERR_NOMEM(r < 0, ncf);
+    for (obj = nl_cache_get_first(ncf->driver->link_cache); obj != NULL;
+         obj = nl_cache_get_next(obj), seq++) {
+        struct rtnl_link *link = (struct rtnl_link *) obj;
+        int master = rtnl_link_get_master(link);
+
+        if (master <= 0)
+            continue;
+        if (index->nmembers == alloc) {
+            alloc = (alloc == 0) ? 16 : 2 * alloc;
+            r = REALLOC_N(index->members, alloc);
+            ERR_NOMEM(r < 0, ncf);
         }
+        index->members[index->nmembers].master = master;
+        index->members[index->nmembers].seq = seq;
+        index->members[index->nmembers].link = link;
+        index->nmembers += 1;
     }
-    goto done;
+    qsort(index->members, index->nmembers, sizeof(*index->members),
+          member_ref_cmp);
 
-error:
-    for (ii = 0; ii < ret; ii++)
-        FREE((*phys_names)[ii]);
-    FREE(*phys_names);
-    *phys_names = NULL;
-    ret = -1;
-
-done:
-    if (dir)
-        closedir (dir);
-    FREE(dirpath);
-    return ret;
+    ncf->driver->member_index = index;
+    return index;
+ error:
+    member_index_free(index);
+    return NULL;
+}
+
+/* Return the first link enslaved to MASTER, and the number of them in
+ * *NMEMBERS */
+static struct member_ref *member_index_find(struct member_index *index,
+                                            int master, int *nmembers) {
+    int lo = 0, hi = index->nmembers, end;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index->members[mid].master < master)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (end = lo; end < index->nmembers
+             && index->members[end].master == master; end++);
+    *nmembers = end - lo;
+    return index->members + lo;
+}
+
+/*
+ * Routes by output interface
+ *
+ * The route cache is a flat list of all routes; the index sorts the
+ * routes we report by the ifindex of their nexthops, so that the routes
+ * of one interface can be found without looking at all the others. It
+ * is built the first time it is needed after the cache was refilled.
+ */
+struct route_ref {
+    int                ifindex;
+    int                seq;        /* position in the cache, keeps the
+                                    * kernel's order for each ifindex */
+    struct rtnl_route *route;
+    struct nl_addr    *gateway;    /* gateway of the nexthop, or NULL */
+};
+
+struct route_index {
+    int               nroutes;
+    struct route_ref *routes;      /* sorted by ifindex */
+};
+
+static void route_index_free(struct route_index *index) {
+    if (index == NULL)
+        return;
+    free(index->routes);
+    free(index);
+}
+
+static int route_ref_cmp(const void *p1, const void *p2) {
+    const struct route_ref *r1 = p1, *r2 = p2;
+
+    if (r1->ifindex != r2->ifindex)
+        return r1->ifindex < r2->ifindex ? -1 : 1;
+    return r1->seq - r2->seq;
+}
+
+/* Routes that are configuration, rather than a consequence of an address
+ * on the interface, which the <ip> elements already show */
+static bool reported_route(struct rtnl_route *route) {
+    int family = rtnl_route_get_family(route);
+
+    return (family == AF_INET || family == AF_INET6)
+        && rtnl_route_get_table(route) == RT_TABLE_MAIN
+        && rtnl_route_get_type(route) == RTN_UNICAST
+        && rtnl_route_get_protocol(route) != RTPROT_KERNEL;
+}
+
+static int route_index_add(struct route_index *index, int *alloc,
+                           struct rtnl_route *route, int ifindex,
+                           struct nl_addr *gateway) {
+    struct route_ref *ref;
+
+    if (ifindex <= 0)
+        return 0;
+    if (index->nroutes == *alloc) {
+        *alloc = (*alloc == 0) ? 16 : 2 * *alloc;
+        if (REALLOC_N(index->routes, *alloc) < 0)
+            return -1;
+    }
+    ref = index->routes + index->nroutes;
+    ref->ifindex = ifindex;
+    ref->seq = index->nroutes;
+    ref->route = route;
+    ref->gateway = gateway;
+    index->nroutes += 1;
+    return 0;
+}
+
+static struct route_index *route_index_get(struct netcf *ncf) {
+    struct route_index *index = ncf->driver->route_index;
+    struct nl_object *obj;
+    int alloc = 0, r;
+
+    if (index != NULL)
+        return index;
+
+    r = ALLOC(index);
+    ERR_NOMEM(r < 0, ncf);
+    for (obj = nl_cache_get_first(ncf->driver->route_cache); obj != NULL;
+         obj = nl_cache_get_next(obj)) {
+        struct rtnl_route *route = (struct rtnl_route *) obj;
+
+        if (!reported_route(route))
+            continue;
+#ifdef HAVE_LIBNL3
+        /* A multipath route shows up on each of its interfaces */
+        for (int i=0; i < rtnl_route_get_nnexthops(route); i++) {
+            struct rtnl_nexthop *nh = rtnl_route_nexthop_n(route, i);
+
+            r = route_index_add(index, &alloc, route,
+                                rtnl_route_nh_get_ifindex(nh),
+                                rtnl_route_nh_get_gateway(nh));
+            ERR_NOMEM(r < 0, ncf);
+        }
+#else
+        r = route_index_add(index, &alloc, route, rtnl_route_get_oif(route),
+                            rtnl_route_get_gateway(route));
+        ERR_NOMEM(r < 0, ncf);
+#endif
+    }
+    qsort(index->routes, index->nroutes, sizeof(*index->routes),
+          route_ref_cmp);
 
+    ncf->driver->route_index = index;
+    return index;
+ error:
+    route_index_free(index);
+    return NULL;
+}
+
+/* Return the first route through IFINDEX in INDEX, and the number of
+ * routes through it in *NROUTES */
+static struct route_ref *route_index_find(struct route_index *index,
+                                          int ifindex, int *nroutes) {
+    int lo = 0, hi = index->nroutes, end;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index->routes[mid].ifindex < ifindex)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (end = lo; end < index->nroutes
+             && index->routes[end].ifindex == ifindex; end++);
+    *nroutes = end - lo;
+    return index->routes + lo;
+}
+
+/* Receive buffer for the netlink socket unless NCF_SET_NETLINK_RCVBUF
+ * says otherwise. libnl asks for 32k, which a dump of a host with many
+ * addresses overruns in no time. */
+#define NETLINK_RCVBUF_DEFAULT (1024 * 1024)
+
+/* How often a dump that the kernel interrupted or that overran the
+ * receive buffer is tried again, and how long to wait before the first
+ * retry; the wait doubles with each retry */
+#define NETLINK_DUMP_RETRIES 5
+#define NETLINK_DUMP_BACKOFF_USECS 1000
+
+/* Give the netlink socket the receive buffer NCF asks for, if it does not
+ * have it yet */
+static void netlink_set_rcvbuf(struct netcf *ncf) {
+    int size = ncf->nl_rcvbuf > 0 ? ncf->nl_rcvbuf : NETLINK_RCVBUF_DEFAULT;
+    int fd = nl_socket_get_fd(ncf->driver->nl_sock);
+
+    if (fd < 0 || size == ncf->driver->nl_rcvbuf)
+        return;
+    /* Only root can go beyond net.core.rmem_max; for everybody else, the
+     * kernel silently caps the size there */
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    ncf->driver->nl_rcvbuf = size;
+}
+
+/* Throw away whatever is left of a failed dump, so that the next request
+ * does not read its stale replies */
+static void netlink_drain(struct netcf *ncf) {
+    char buf[4096];
+    int fd = nl_socket_get_fd(ncf->driver->nl_sock);
+
+    if (fd < 0)
+        return;
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT|MSG_TRUNC) >= 0
+           || errno == EINTR);
+}
+
+/* Return true if a dump that failed with libnl error CODE has a chance
+ * of succeeding when it is done again right away */
+static bool netlink_dump_retryable(int code) {
+#ifdef HAVE_LIBNL3
+    /* libnl reports ENOBUFS from the socket as NLE_NOMEM */
+    return code == -NLE_DUMP_INTR || code == -NLE_NOMEM
+        || code == -NLE_SEQ_MISMATCH;
+#else
+    return code == -ENOBUFS || code == -EINTR || code == -EBUSY;
+#endif
 }
 
+/* Fill CACHE with the reply to one dump request of type REQUEST. Unlike
+ * nl_cache_refill, which starts over by itself when the dump gets
+ * interrupted, this hands every error back, so that netlink_dump can
+ * count and pace the retries */
+static int netlink_dump_once(struct nl_sock *sk, struct nl_cache *cache,
+                             int request) {
+    int code;
+
+    nl_cache_clear(cache);
+    code = nl_rtgen_request(sk, request, AF_UNSPEC, NLM_F_DUMP);
+    if (code < 0)
+        return code;
+    return nl_cache_pickup(sk, cache);
+}
+
+/* Fill *CACHE with a dump of the netlink objects of KIND, which the
+ * kernel sends in reply to REQUEST, allocating the cache first if it is
+ * NULL. A dump that the kernel marked as interrupted
+ * because the links or addresses changed while it was running, or that
+ * overran the receive buffer, is done again after a short wait, up to
+ * NETLINK_DUMP_RETRIES times. Returns 0 on success, or the libnl error
+ * of the last attempt.
+ */
+static int netlink_dump(struct netcf *ncf, struct nl_cache **cache,
+                        const char *kind, int request) {
+    struct nl_sock *sk = ncf->driver->nl_sock;
+    int code;
+
+    if (*cache == NULL) {
+        *cache = netlink_cache_alloc(kind);
+        if (*cache == NULL)
+#ifdef HAVE_LIBNL3
+            return -NLE_NOMEM;
+#else
+            return -ENOMEM;
+#endif
+    }
+
+    for (int attempt = 0; ; attempt++) {
+        STAT_TIMED(ncf, NETCF_STAT_NETLINK_DUMP,
+                   code = netlink_dump_once(sk, *cache, request));
+        if (code >= 0 || !netlink_dump_retryable(code)
+            || attempt == NETLINK_DUMP_RETRIES)
+            return code;
+
+        stat_count(ncf, NETCF_STAT_NETLINK_RETRY, 1);
+        netlink_drain(ncf);
+        usleep(NETLINK_DUMP_BACKOFF_USECS << attempt);
+    }
+}
 
 int netlink_init(struct netcf *ncf) {
 
@@ -631,17 +1808,27 @@ int netlink_init(struct netcf *ncf) {
         goto error;
     if (nl_connect(ncf->driver->nl_sock, NETLINK_ROUTE) < 0)
         goto error;
+    netlink_set_rcvbuf(ncf);
+#ifdef HAVE_LIBNL3
+    /* Size each read by peeking at the next message, rather than
+     * truncating messages larger than a page */
+    nl_socket_enable_msg_peek(ncf->driver->nl_sock);
+#endif
 
-    ncf->driver->link_cache = __rtnl_link_alloc_cache(ncf->driver->nl_sock);
-    if (ncf->driver->link_cache == NULL)
+    if (netlink_dump(ncf, &ncf->driver->link_cache,
+                     "route/link", RTM_GETLINK) < 0)
         goto error;
     nl_cache_mngt_provide(ncf->driver->link_cache);
 
-    ncf->driver->addr_cache = __rtnl_addr_alloc_cache(ncf->driver->nl_sock);
-    if (ncf->driver->addr_cache == NULL)
+    if (netlink_dump(ncf, &ncf->driver->addr_cache,
+                     "route/addr", RTM_GETADDR) < 0)
         goto error;
     nl_cache_mngt_provide(ncf->driver->addr_cache);
 
+    if (netlink_dump(ncf, &ncf->driver->route_cache,
+                     "route/route", RTM_GETROUTE) < 0)
+        goto error;
+
     int netlink_fd = nl_socket_get_fd(ncf->driver->nl_sock);
     if (netlink_fd >= 0)
         fcntl(netlink_fd, F_SETFD, FD_CLOEXEC);
@@ -652,8 +1839,24 @@ error:
     return -1;
 }
 
+/* Forget the indexes into the netlink caches; they are rebuilt from the
+ * caches the next time they are needed */
+static void netlink_drop_indexes(struct netcf *ncf) {
+    link_index_free(ncf->driver->link_index);
+    ncf->driver->link_index = NULL;
+    member_index_free(ncf->driver->member_index);
+    ncf->driver->member_index = NULL;
+    route_index_free(ncf->driver->route_index);
+    ncf->driver->route_index = NULL;
+}
+
 int netlink_close(struct netcf *ncf) {
 
+    netlink_drop_indexes(ncf);
+    if (ncf->driver->route_cache) {
+        nl_cache_free(ncf->driver->route_cache);
+        ncf->driver->route_cache = NULL;
+    }
     if (ncf->driver->addr_cache) {
         nl_cache_free(ncf->driver->addr_cache);
         ncf->driver->addr_cache = NULL;
@@ -686,47 +1889,19 @@ struct nl_ip_callback_data {
     struct netcf *ncf;
 };
 
-/* add all ip addresses for the given interface to the xml document
-*/
-static void add_ip_info_cb(struct nl_object *obj, void *arg) {
-    struct nl_ip_callback_data *cb_data = arg;
-    struct rtnl_addr *addr = (struct rtnl_addr *)obj;
-    struct netcf *ncf = cb_data->ncf;
-
-    struct nl_addr *local_addr;
-    int family, prefix;
-    const char *family_str;
-    char ip_str[48];
-    char prefix_str[16];
-    xmlNodePtr *proto, ip_node, cur;
+/* Return the <protocol> element for FAMILY_STR under ROOT, creating it if
+ * it does not exist yet. *PROTO caches the result between calls. */
+static xmlNodePtr protocol_node(struct netcf *ncf, xmlDocPtr doc,
+                                xmlNodePtr root, xmlNodePtr *proto,
+                                const char *family_str) {
+    xmlNodePtr cur;
     xmlAttrPtr prop = NULL;
 
-    local_addr = rtnl_addr_get_local(addr);
-    family = nl_addr_get_family(local_addr);
-    switch (family) {
-    case AF_INET:
-        family_str = "ipv4";
-        proto = &cb_data->protov4;
-        break;
-    case AF_INET6:
-        family_str = "ipv6";
-        proto = &cb_data->protov6;
-        break;
-
-    default:
-        /* Nothing that interests us in this entry */
-        return;
-    }
-
-    inet_ntop(family, nl_addr_get_binary_addr(local_addr),
-              ip_str, sizeof(ip_str));
-    prefix = nl_addr_get_prefixlen(local_addr);
-
     if (*proto == NULL) {
         /* We haven't dont anything with this proto yet. Search for an
          * existing node.
          */
-        for (cur = cb_data->root->children; cur != NULL; cur = cur->next) {
+        for (cur = root->children; cur != NULL; cur = cur->next) {
             if ((cur->type == XML_ELEMENT_NODE) &&
                 xmlStrEqual(cur->name, BAD_CAST "protocol")) {
                 xmlChar *node_family = xmlGetProp(cur, BAD_CAST "family");
@@ -745,129 +1920,214 @@ static void add_ip_info_cb(struct nl_object *obj, void *arg) {
     if (*proto == NULL) {
         /* No node exists for this protocol family. Create one.
          */
-        *proto = xml_new_node(cb_data->doc, cb_data->root, "protocol");
+        *proto = xml_new_node(doc, root, "protocol");
         ERR_NOMEM(*proto == NULL, ncf);
         prop = xmlSetProp(*proto, BAD_CAST "family", BAD_CAST family_str);
         ERR_NOMEM(prop == NULL, ncf);
-
     }
-
-    /* Create a new ip node for this address/prefix, and set the
-     * properties
-     */
-    ip_node = xml_new_node(cb_data->doc, *proto, "ip");
-    ERR_NOMEM(ip_node == NULL, ncf);
-    prop = xmlSetProp(ip_node, BAD_CAST "address", BAD_CAST ip_str);
-    ERR_NOMEM(prop == NULL, ncf);
-    snprintf(prefix_str, sizeof(prefix_str), "%d", prefix);
-    prop = xmlSetProp(ip_node, BAD_CAST "prefix", BAD_CAST prefix_str);
-    ERR_NOMEM(prop == NULL, ncf);
+    return *proto;
 
 error:
-    return;
+    return NULL;
 }
 
-static void add_ip_info(struct netcf *ncf,
-                        const char *ifname ATTRIBUTE_UNUSED, int ifindex,
-                        xmlDocPtr doc, xmlNodePtr root) {
-    struct nl_ip_callback_data cb_data
-        = { doc, root, NULL, NULL, ncf };
-    struct rtnl_addr *filter_addr = NULL;
+/* add the ip address ADDR to the xml document
+*/
+static void add_ip_info_addr(struct nl_ip_callback_data *cb_data,
+                             struct rtnl_addr *addr) {
+    struct netcf *ncf = cb_data->ncf;
 
-    filter_addr = rtnl_addr_alloc();
-    ERR_NOMEM(filter_addr == NULL, ncf);
+    struct nl_addr *local_addr;
+    int family, prefix;
+    const char *family_str;
+    char ip_str[48];
+    char prefix_str[16];
+    xmlNodePtr *proto, ip_node;
+    xmlAttrPtr prop = NULL;
 
-    rtnl_addr_set_ifindex(filter_addr, ifindex);
-    nl_cache_foreach_filter(ncf->driver->addr_cache,
-                            OBJ_CAST(filter_addr), add_ip_info_cb,
-                            &cb_data);
-error:
-    if (filter_addr)
-        rtnl_addr_put(filter_addr);
+    local_addr = rtnl_addr_get_local(addr);
+    family = nl_addr_get_family(local_addr);
+    switch (family) {
+    case AF_INET:
+        family_str = "ipv4";
+        proto = &cb_data->protov4;
+        break;
+    case AF_INET6:
+        family_str = "ipv6";
+        proto = &cb_data->protov6;
+        break;
+
+    default:
+        /* Nothing that interests us in this entry */
+        return;
+    }
+
+    inet_ntop(family, nl_addr_get_binary_addr(local_addr),
+              ip_str, sizeof(ip_str));
+    prefix = nl_addr_get_prefixlen(local_addr);
+
+    protocol_node(ncf, cb_data->doc, cb_data->root, proto, family_str);
+    ERR_BAIL(ncf);
+
+    /* Create a new ip node for this address/prefix, and set the
+     * properties
+     */
+    ip_node = xml_new_node(cb_data->doc, *proto, "ip");
+    ERR_NOMEM(ip_node == NULL, ncf);
+    prop = xmlSetProp(ip_node, BAD_CAST "address", BAD_CAST ip_str);
+    ERR_NOMEM(prop == NULL, ncf);
+    snprintf(prefix_str, sizeof(prefix_str), "%d", prefix);
+    prop = xmlSetProp(ip_node, BAD_CAST "prefix", BAD_CAST prefix_str);
+    ERR_NOMEM(prop == NULL, ncf);
+
+error:
     return;
 }
 
+static void add_ip_info(struct netcf *ncf,
+                        const char *ifname ATTRIBUTE_UNUSED, int ifindex,
+                        xmlDocPtr doc, xmlNodePtr root) {
+    struct nl_ip_callback_data cb_data
+        = { doc, root, NULL, NULL, ncf };
+    struct link_index *index;
+    struct link_ref *ref;
 
-struct nl_ethernet_callback_data {
-    xmlDocPtr doc;
-    xmlNodePtr root;
-    xmlNodePtr mac;
-    struct netcf *ncf;
-};
+    index = link_index_get(ncf);
+    ERR_BAIL(ncf);
+    ref = link_index_by_ifindex(index, ifindex);
+    if (ref == NULL)
+        return;
 
-static void add_ethernet_info_cb(struct nl_object *obj, void *arg) {
-    struct nl_ethernet_callback_data *cb_data = arg;
-    struct rtnl_link *iflink = (struct rtnl_link *)obj;
-    struct netcf *ncf = cb_data->ncf;
+    for (int i=0; i < ref->naddrs; i++) {
+        add_ip_info_addr(&cb_data, index->addrs[ref->first_addr + i]);
+        ERR_BAIL(ncf);
+    }
+error:
+    return;
+}
 
-    struct nl_addr *addr;
-    xmlAttrPtr prop = NULL;
+/* Format the address ADDR as a string into BUF; the prefix length is
+ * added if WITH_PREFIX is true */
+static void route_addr_str(struct nl_addr *addr, bool with_prefix,
+                           char *buf, size_t buflen) {
+    char ip_str[INET6_ADDRSTRLEN];
 
-    if ((cb_data->mac == NULL)
-        && ((addr = rtnl_link_get_addr(iflink)) != NULL)
-        && !nl_addr_iszero(addr)) {
+    inet_ntop(nl_addr_get_family(addr), nl_addr_get_binary_addr(addr),
+              ip_str, sizeof(ip_str));
+    if (with_prefix)
+        snprintf(buf, buflen, "%s/%u", ip_str, nl_addr_get_prefixlen(addr));
+    else
+        snprintf(buf, buflen, "%s", ip_str);
+}
 
-        char mac_str[64];
+/* add the routes through the given interface to the xml document as
+ * <route destination="10.0.0.0/8" gateway="192.168.0.2"/>, leaving out
+ * the destination for the default route, and the gateway for routes to
+ * a directly connected network
+ */
+static void add_route_info(struct netcf *ncf,
+                           const char *ifname ATTRIBUTE_UNUSED, int ifindex,
+                           xmlDocPtr doc, xmlNodePtr root) {
+    struct route_index *index;
+    struct route_ref *refs;
+    xmlNodePtr protov4 = NULL, protov6 = NULL;
+    int nroutes;
+
+    if (ifindex <= 0)
+        return;
 
-        nl_addr2str(addr, mac_str, sizeof(mac_str));
-        cb_data->mac = xml_node(cb_data->doc, cb_data->root, "mac");
-        ERR_NOMEM(cb_data->mac == NULL, ncf);
-        prop = xmlSetProp(cb_data->mac, BAD_CAST "address", BAD_CAST mac_str);
-        ERR_NOMEM(prop == NULL, ncf);
+    index = route_index_get(ncf);
+    ERR_BAIL(ncf);
+
+    refs = route_index_find(index, ifindex, &nroutes);
+    for (int i=0; i < nroutes; i++) {
+        struct rtnl_route *route = refs[i].route;
+        struct nl_addr *dst = rtnl_route_get_dst(route);
+        char addr_str[INET6_ADDRSTRLEN + 8];
+        char metric_str[16];
+        xmlNodePtr proto, route_node;
+        xmlAttrPtr prop;
+
+        if (rtnl_route_get_family(route) == AF_INET)
+            proto = protocol_node(ncf, doc, root, &protov4, "ipv4");
+        else
+            proto = protocol_node(ncf, doc, root, &protov6, "ipv6");
+        ERR_BAIL(ncf);
+
+        route_node = xml_new_node(doc, proto, "route");
+        ERR_NOMEM(route_node == NULL, ncf);
+        if (dst != NULL && nl_addr_get_prefixlen(dst) > 0) {
+            route_addr_str(dst, true, addr_str, sizeof(addr_str));
+            prop = xmlSetProp(route_node, BAD_CAST "destination",
+                              BAD_CAST addr_str);
+            ERR_NOMEM(prop == NULL, ncf);
+        }
+        if (refs[i].gateway != NULL) {
+            route_addr_str(refs[i].gateway, false,
+                           addr_str, sizeof(addr_str));
+            prop = xmlSetProp(route_node, BAD_CAST "gateway",
+                              BAD_CAST addr_str);
+            ERR_NOMEM(prop == NULL, ncf);
+        }
+        if (rtnl_route_get_priority(route) > 0) {
+            snprintf(metric_str, sizeof(metric_str), "%u",
+                     rtnl_route_get_priority(route));
+            prop = xmlSetProp(route_node, BAD_CAST "metric",
+                              BAD_CAST metric_str);
+            ERR_NOMEM(prop == NULL, ncf);
+        }
     }
 error:
     return;
 }
 
+
 static void add_ethernet_info(struct netcf *ncf,
                               const char *ifname ATTRIBUTE_UNUSED, int ifindex,
                               xmlDocPtr doc, xmlNodePtr root) {
-    struct nl_ethernet_callback_data cb_data
-        = { doc, root, NULL, ncf };
-    struct rtnl_link *filter_link = NULL;
+    struct rtnl_link *iflink;
+    struct nl_addr *addr;
+    xmlNodePtr mac;
+    xmlAttrPtr prop = NULL;
 
     /* if interface isn't currently available, nothing to add */
-    if (ifindex == RTNL_LINK_NOT_FOUND)
+    iflink = link_by_ifindex(ncf, ifindex);
+    if (iflink == NULL)
         return;
 
-    filter_link = rtnl_link_alloc();
-    ERR_NOMEM(filter_link == NULL, ncf);
+    if (((addr = rtnl_link_get_addr(iflink)) != NULL)
+        && !nl_addr_iszero(addr)) {
+
+        char mac_str[64];
 
-    rtnl_link_set_ifindex(filter_link, ifindex);
-    nl_cache_foreach_filter(ncf->driver->link_cache,
-                            OBJ_CAST(filter_link), add_ethernet_info_cb,
-                            &cb_data);
+        nl_addr2str(addr, mac_str, sizeof(mac_str));
+        mac = xml_node(doc, root, "mac");
+        ERR_NOMEM(mac == NULL, ncf);
+        prop = xmlSetProp(mac, BAD_CAST "address", BAD_CAST mac_str);
+        ERR_NOMEM(prop == NULL, ncf);
+    }
 error:
-    if (filter_link)
-        rtnl_link_put(filter_link);
     return;
 }
 
-struct nl_vlan_callback_data {
-    xmlDocPtr doc;
-    xmlNodePtr root;
-    xmlNodePtr vlan;
-    struct netcf *ncf;
-};
-
-static void add_vlan_info_cb(struct nl_object *obj, void *arg) {
-    struct nl_vlan_callback_data *cb_data = arg;
-    struct rtnl_link *iflink = (struct rtnl_link *)obj;
-    struct netcf *ncf = cb_data->ncf;
-
-    struct rtnl_link *master_link;
-    char *master_name = NULL;
-    int l_link, vlan_id, master_ifindex;
+static void add_vlan_info(struct netcf *ncf,
+                          const char *ifname ATTRIBUTE_UNUSED, int ifindex,
+                          xmlDocPtr doc, xmlNodePtr root) {
+    struct rtnl_link *iflink, *master_link;
+    const char *master_name = NULL;
+    int l_link, vlan_id;
     char vlan_id_str[16];
     char *link_type;
-    xmlNodePtr interface_node;
+    xmlNodePtr vlan, interface_node;
     xmlAttrPtr prop = NULL;
 
-    /* If this really is a vlan link, get the master interface and vlan id.
-     */
-    if (cb_data->vlan != NULL)
+    /* if interface isn't currently available, nothing to add */
+    iflink = link_by_ifindex(ncf, ifindex);
+    if (iflink == NULL)
         return;
 
+    /* If this really is a vlan link, get the master interface and vlan id.
+     */
     link_type = rtnl_link_get_type(iflink);
     if ((link_type == NULL) || STRNEQ(link_type, "vlan"))
         return;
@@ -876,7 +2136,7 @@ static void add_vlan_info_cb(struct nl_object *obj, void *arg) {
     if (l_link == RTNL_LINK_NOT_FOUND)
         return;
 
-    master_link = rtnl_link_get(nl_object_get_cache(obj), l_link);
+    master_link = link_by_ifindex(ncf, l_link);
     if (master_link == NULL)
         return;
 
@@ -884,60 +2144,30 @@ static void add_vlan_info_cb(struct nl_object *obj, void *arg) {
     if (master_name == NULL)
         return;
 
-
-    cb_data->vlan = xml_node(cb_data->doc, cb_data->root, "vlan");
-    ERR_NOMEM(cb_data->vlan == NULL, ncf);
+    vlan = xml_node(doc, root, "vlan");
+    ERR_NOMEM(vlan == NULL, ncf);
 
     vlan_id = rtnl_link_vlan_get_id(iflink);
     snprintf(vlan_id_str, sizeof(vlan_id_str), "%d", vlan_id);
-    prop = xmlSetProp(cb_data->vlan, BAD_CAST "tag", BAD_CAST vlan_id_str);
+    prop = xmlSetProp(vlan, BAD_CAST "tag", BAD_CAST vlan_id_str);
     ERR_NOMEM(prop == NULL, ncf);
 
-    interface_node = xml_new_node(cb_data->doc, cb_data->vlan, "interface");
+    interface_node = xml_new_node(doc, vlan, "interface");
     ERR_NOMEM(interface_node == NULL, ncf);
 
     /* Add in type-specific info of master interface */
-    master_ifindex = rtnl_link_name2i(ncf->driver->link_cache, master_name);
-    ERR_THROW((master_ifindex == RTNL_LINK_NOT_FOUND), ncf, ENETLINK,
-              "couldn't find ifindex for vlan master interface `%s`",
-              master_name);
-    add_type_specific_info(ncf, master_name, master_ifindex,
-                           cb_data->doc, interface_node);
-
-error:
-    return;
-}
-
-static void add_vlan_info(struct netcf *ncf,
-                          const char *ifname ATTRIBUTE_UNUSED, int ifindex,
-                          xmlDocPtr doc, xmlNodePtr root) {
-    struct nl_vlan_callback_data cb_data
-        = { doc, root, NULL, ncf };
-    struct rtnl_link *filter_link = NULL;
-
-    /* if interface isn't currently available, nothing to add */
-    if (ifindex == RTNL_LINK_NOT_FOUND)
-        return;
-
-    filter_link = rtnl_link_alloc();
-    ERR_NOMEM(filter_link == NULL, ncf);
+    add_type_specific_info(ncf, master_name, l_link, doc, interface_node);
 
-    rtnl_link_set_ifindex(filter_link, ifindex);
-    nl_cache_foreach_filter(ncf->driver->link_cache,
-                            OBJ_CAST(filter_link), add_vlan_info_cb,
-                            &cb_data);
-    ERR_BAIL(ncf);
 error:
-    if (filter_link)
-        rtnl_link_put(filter_link);
     return;
 }
 
 static void add_bridge_info(struct netcf *ncf,
-                            const char *ifname, int ifindex ATTRIBUTE_UNUSED,
+                            const char *ifname ATTRIBUTE_UNUSED, int ifindex,
                             xmlDocPtr doc, xmlNodePtr root) {
-    char **phys_names = NULL;
-    int  nphys = 0, ii;
+    struct member_index *index;
+    struct member_ref *ports;
+    int nports;
     xmlNodePtr bridge_node = NULL, interface_node = NULL;
 
     /* The <bridge> element is required by the grammar, so always add
@@ -946,95 +2176,206 @@ static void add_bridge_info(struct netcf *ncf,
     bridge_node = xml_node(doc, root, "bridge");
     ERR_NOMEM(bridge_node == NULL, ncf);
 
-    nphys = if_bridge_phys_name(ncf, ifname, &phys_names);
-    if (nphys <= 0)
+    if (ifindex == RTNL_LINK_NOT_FOUND)
         return;
 
-    for (ii = 0; ii < nphys; ii++) {
-        int   phys_ifindex;
+    index = member_index_get(ncf);
+    ERR_BAIL(ncf);
+
+    ports = member_index_find(index, ifindex, &nports);
+    for (int i = 0; i < nports; i++) {
+        struct rtnl_link *port = ports[i].link;
 
         interface_node = xml_new_node(doc, bridge_node, "interface");
         ERR_NOMEM(interface_node == NULL, ncf);
 
         /* Add in type-specific info of physical interface */
-        phys_ifindex =
-            rtnl_link_name2i(ncf->driver->link_cache, phys_names[ii]);
-        /* We ignore an error return here, because that usually just
-         * means the interface isn't currently running. The
-         * type-specific functions will recognize this from the
-         * invalid ifindex we pass to them, and "do the right thing"
-         * (which is usually, but not always, to silently return).
-         */
-        add_type_specific_info(ncf, phys_names[ii], phys_ifindex, doc,
+        add_type_specific_info(ncf, rtnl_link_get_name(port),
+                               rtnl_link_get_ifindex(port), doc,
                                interface_node);
+        ERR_BAIL(ncf);
     }
 
 error:
-    for (ii = 0; ii < nphys; ii++)
-        FREE(phys_names[ii]);
-    FREE(phys_names);
+    return;
 }
 
 
-struct nl_bond_callback_data {
-    xmlDocPtr doc;
-    xmlNodePtr root;
-    xmlNodePtr bond;
-    int master_ifindex;
-    struct netcf *ncf;
+#ifdef IFLA_BOND_MAX
+/* The names of the IFLA_BOND_MODE values, which are the same as the
+ * mode attribute of <bond> */
+static const char *const bond_modes[] = {
+    "balance-rr", "active-backup", "balance-xor", "broadcast",
+    "802.3ad", "balance-tlb", "balance-alb"
 };
 
-static void add_bond_info_cb(struct nl_object *obj,
-                             void *arg ATTRIBUTE_UNUSED) {
-    struct nl_bond_callback_data *cb_data = arg;
-    struct rtnl_link *iflink = (struct rtnl_link *)obj;
-    struct netcf *ncf = cb_data->ncf;
-
-    xmlNodePtr interface_node;
+static const char *const bond_arp_validate[] = {
+    "none", "active", "backup", "all"
+};
 
-    /* If this is a slave link, and the master is master_ifindex, add the
-     * interface info to the bond.
-     */
+/* Ask the kernel for the IFLA_BOND attributes of the bond IFINDEX and
+ * add them to BOND. libnl does not keep the link type specific data of
+ * bonds in its cache, so this takes a separate request; failing to get
+ * them is not an error, the bond is simply described without them.
+ */
+static void add_bond_params(struct netcf *ncf, int ifindex,
+                            xmlDocPtr doc, xmlNodePtr bond) {
+    struct ifinfomsg ifi;
+    struct sockaddr_nl nla;
+    struct nlmsghdr *nh;
+    struct nlattr *tb[IFLA_MAX + 1];
+    struct nlattr *linkinfo[IFLA_INFO_MAX + 1];
+    struct nlattr *bd[IFLA_BOND_MAX + 1];
+    unsigned char *buf = NULL;
+    char num_str[16], ip_str[INET_ADDRSTRLEN];
+    xmlNodePtr node;
+    xmlAttrPtr prop;
+    int len;
 
-    if (!(rtnl_link_get_flags(iflink) & IFF_SLAVE)
-        || rtnl_link_get_master(iflink) != cb_data->master_ifindex)
+    MEMZERO(&ifi, 1);
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = ifindex;
+    if (nl_send_simple(ncf->driver->nl_sock, RTM_GETLINK, 0,
+                       &ifi, sizeof(ifi)) < 0)
         return;
+    len = nl_recv(ncf->driver->nl_sock, &nla, &buf, NULL);
+    if (len <= 0)
+        goto error;
 
-    cb_data->bond = xml_node(cb_data->doc, cb_data->root, "bond");
-    ERR_NOMEM(cb_data->bond == NULL, ncf);
+    nh = (struct nlmsghdr *) buf;
+    if (!nlmsg_ok(nh, len) || nh->nlmsg_type != RTM_NEWLINK)
+        goto error;
+    if (nlmsg_parse(nh, sizeof(ifi), tb, IFLA_MAX, NULL) < 0
+        || tb[IFLA_LINKINFO] == NULL)
+        goto error;
+    if (nla_parse_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO],
+                         NULL) < 0
+        || linkinfo[IFLA_INFO_DATA] == NULL)
+        goto error;
+    if (nla_parse_nested(bd, IFLA_BOND_MAX, linkinfo[IFLA_INFO_DATA],
+                         NULL) < 0)
+        goto error;
 
-    /* XXX - if we learn where to get bridge "mode" property, set it here */
+    if (bd[IFLA_BOND_MODE] != NULL) {
+        uint8_t mode = nla_get_u8(bd[IFLA_BOND_MODE]);
 
-    /* XXX - need to add node like one of these:
-     *
-     *    <miimon freq="100" updelay="10" carrier="ioctl"/>
-     *        or
-     *    <arpmode interval='something' target='something'>
-     */
+        if (mode < ARRAY_CARDINALITY(bond_modes)) {
+            prop = xmlSetProp(bond, BAD_CAST "mode", BAD_CAST bond_modes[mode]);
+            ERR_NOMEM(prop == NULL, ncf);
+        }
+    }
 
-    /* add a new interface node */
-    interface_node = xml_new_node(cb_data->doc, cb_data->bond, "interface");
-    ERR_NOMEM(interface_node == NULL, ncf);
+    /* The grammar allows either the MII or the ARP monitor */
+    if (bd[IFLA_BOND_MIIMON] != NULL && nla_get_u32(bd[IFLA_BOND_MIIMON]) > 0) {
+        node = xml_node(doc, bond, "miimon");
+        ERR_NOMEM(node == NULL, ncf);
+        snprintf(num_str, sizeof(num_str), "%u",
+                 nla_get_u32(bd[IFLA_BOND_MIIMON]));
+        prop = xmlSetProp(node, BAD_CAST "freq", BAD_CAST num_str);
+        ERR_NOMEM(prop == NULL, ncf);
+        if (bd[IFLA_BOND_DOWNDELAY] != NULL) {
+            snprintf(num_str, sizeof(num_str), "%u",
+                     nla_get_u32(bd[IFLA_BOND_DOWNDELAY]));
+            prop = xmlSetProp(node, BAD_CAST "downdelay", BAD_CAST num_str);
+            ERR_NOMEM(prop == NULL, ncf);
+        }
+        if (bd[IFLA_BOND_UPDELAY] != NULL) {
+            snprintf(num_str, sizeof(num_str), "%u",
+                     nla_get_u32(bd[IFLA_BOND_UPDELAY]));
+            prop = xmlSetProp(node, BAD_CAST "updelay", BAD_CAST num_str);
+            ERR_NOMEM(prop == NULL, ncf);
+        }
+        if (bd[IFLA_BOND_USE_CARRIER] != NULL) {
+            const char *carrier =
+                nla_get_u8(bd[IFLA_BOND_USE_CARRIER]) ? "netif" : "ioctl";
+            prop = xmlSetProp(node, BAD_CAST "carrier", BAD_CAST carrier);
+            ERR_NOMEM(prop == NULL, ncf);
+        }
+    } else if (bd[IFLA_BOND_ARP_INTERVAL] != NULL
+               && nla_get_u32(bd[IFLA_BOND_ARP_INTERVAL]) > 0
+               && bd[IFLA_BOND_ARP_IP_TARGET] != NULL) {
+        struct nlattr *target = nla_data(bd[IFLA_BOND_ARP_IP_TARGET]);
+        uint32_t addr;
+
+        /* Only the first target fits the grammar */
+        if (nla_len(bd[IFLA_BOND_ARP_IP_TARGET]) < NLA_HDRLEN + 4)
+            goto error;
+        addr = nla_get_u32(target);
+        inet_ntop(AF_INET, &addr, ip_str, sizeof(ip_str));
+
+        node = xml_node(doc, bond, "arpmon");
+        ERR_NOMEM(node == NULL, ncf);
+        snprintf(num_str, sizeof(num_str), "%u",
+                 nla_get_u32(bd[IFLA_BOND_ARP_INTERVAL]));
+        prop = xmlSetProp(node, BAD_CAST "interval", BAD_CAST num_str);
+        ERR_NOMEM(prop == NULL, ncf);
+        prop = xmlSetProp(node, BAD_CAST "target", BAD_CAST ip_str);
+        ERR_NOMEM(prop == NULL, ncf);
+        if (bd[IFLA_BOND_ARP_VALIDATE] != NULL) {
+            uint32_t validate = nla_get_u32(bd[IFLA_BOND_ARP_VALIDATE]);
+
+            if (validate < ARRAY_CARDINALITY(bond_arp_validate)) {
+                prop = xmlSetProp(node, BAD_CAST "validate",
+                                  BAD_CAST bond_arp_validate[validate]);
+                ERR_NOMEM(prop == NULL, ncf);
+            }
+        }
+    }
 
-    /* Add in type-specific info of this slave interface */
-    add_type_specific_info(ncf, rtnl_link_get_name(iflink),
-                           rtnl_link_get_ifindex(iflink),
-                           cb_data->doc, interface_node);
 error:
-    return;
+    free(buf);
+}
+#else
+static void add_bond_params(struct netcf *ncf ATTRIBUTE_UNUSED,
+                            int ifindex ATTRIBUTE_UNUSED,
+                            xmlDocPtr doc ATTRIBUTE_UNUSED,
+                            xmlNodePtr bond ATTRIBUTE_UNUSED) {
 }
+#endif
 
 static void add_bond_info(struct netcf *ncf,
                           const char *ifname ATTRIBUTE_UNUSED, int ifindex,
                           xmlDocPtr doc, xmlNodePtr root) {
-    struct nl_bond_callback_data cb_data
-        = { doc, root, NULL, ifindex, ncf };
+    struct member_index *index;
+    struct member_ref *slaves;
+    xmlNodePtr bond = NULL, interface_node;
+    int nslaves;
 
     /* if interface isn't currently available, nothing to add */
     if (ifindex == RTNL_LINK_NOT_FOUND)
         return;
 
-    nl_cache_foreach(ncf->driver->link_cache, add_bond_info_cb, &cb_data);
+    index = member_index_get(ncf);
+    ERR_BAIL(ncf);
+
+    slaves = member_index_find(index, ifindex, &nslaves);
+    for (int i = 0; i < nslaves; i++) {
+        struct rtnl_link *iflink = slaves[i].link;
+
+        /* Links can have the bond as their master without being one of
+         * its slaves */
+        if (!(rtnl_link_get_flags(iflink) & IFF_SLAVE))
+            continue;
+
+        if (bond == NULL) {
+            bond = xml_node(doc, root, "bond");
+            ERR_NOMEM(bond == NULL, ncf);
+            add_bond_params(ncf, ifindex, doc, bond);
+            ERR_BAIL(ncf);
+        }
+
+        /* add a new interface node */
+        interface_node = xml_new_node(doc, bond, "interface");
+        ERR_NOMEM(interface_node == NULL, ncf);
+
+        /* Add in type-specific info of this slave interface */
+        add_type_specific_info(ncf, rtnl_link_get_name(iflink),
+                               rtnl_link_get_ifindex(iflink),
+                               doc, interface_node);
+        ERR_BAIL(ncf);
+    }
+error:
+    return;
 }
 
 
@@ -1079,42 +2420,982 @@ error:
 #endif
 
 #ifndef __FreeBSD__
-void add_state_to_xml_doc(struct netcf_if *nif, xmlDocPtr doc) {
-    xmlNodePtr root;
-    int ifindex, code;
-
-    root = xmlDocGetRootElement(doc);
-    ERR_THROW((root == NULL), nif->ncf, EINTERNAL,
-              "failed to get document root element");
-    ERR_THROW(!xmlStrEqual(root->name, BAD_CAST "interface"),
-              nif->ncf, EINTERNAL, "root document is not an interface");
+int netlink_refill(struct netcf *ncf) {
+    int code;
+
+    if (ncf->driver->nl_sock == NULL) {
+        ncf->stale &= ~NETCF_CACHE_STATE;
+        code = netlink_init(ncf);
+        ERR_THROW((code < 0), ncf, ENETLINK,
+                  "failed to read the links and addresses from netlink");
+        return 0;
+    }
+    if (!NCF_CACHE_REFRESH(ncf, NETCF_CACHE_STATE))
+        return 0;
 
-    /* Update the caches with any recent changes */
-    code = nl_cache_refill(nif->ncf->driver->nl_sock,
-                           nif->ncf->driver->link_cache);
-    ERR_THROW((code < 0), nif->ncf, ENETLINK,
+    netlink_drop_indexes(ncf);
+    netlink_set_rcvbuf(ncf);
+    code = netlink_dump(ncf, &ncf->driver->link_cache,
+                        "route/link", RTM_GETLINK);
+    ERR_THROW((code < 0), ncf, ENETLINK,
               "failed to refill interface index cache");
-    code = nl_cache_refill(nif->ncf->driver->nl_sock,
-                           nif->ncf->driver->addr_cache);
-    ERR_THROW((code < 0), nif->ncf, ENETLINK,
+    code = netlink_dump(ncf, &ncf->driver->addr_cache,
+                        "route/addr", RTM_GETADDR);
+    ERR_THROW((code < 0), ncf, ENETLINK,
               "failed to refill interface address cache");
+    code = netlink_dump(ncf, &ncf->driver->route_cache,
+                        "route/route", RTM_GETROUTE);
+    ERR_THROW((code < 0), ncf, ENETLINK,
+              "failed to refill route cache");
+    return 0;
+ error:
+    ncf->stale |= NETCF_CACHE_STATE;
+    return -1;
+}
 
-    ifindex = rtnl_link_name2i(nif->ncf->driver->link_cache, nif->name);
+/* Get speed and duplex of INTF from its driver. Netlink does not carry
+ * them, and links without a physical layer, like bridges or loopback,
+ * have none, so failure just leaves them unknown. */
+static void link_speed_duplex(struct netcf *ncf, const char *intf,
+                              struct netcf_if_stats *stats) {
+    struct ethtool_cmd ecmd;
+    struct ifreq ifr;
+    uint32_t speed;
+    int r;
+
+    MEMZERO(&ecmd, 1);
+    MEMZERO(&ifr, 1);
+    strncpy(ifr.ifr_name, intf, sizeof(ifr.ifr_name));
+    ifr.ifr_name[sizeof(ifr.ifr_name) - 1] = '\0';
+    ecmd.cmd = ETHTOOL_GSET;
+    ifr.ifr_data = (void *) &ecmd;
+    STAT_TIMED(ncf, NETCF_STAT_IOCTL,
+               r = ioctl(ncf->driver->ioctl_fd, SIOCETHTOOL, &ifr));
+    if (r < 0)
+        return;
+
+    speed = ethtool_cmd_speed(&ecmd);
+    if (speed != 0 && speed != (uint32_t) -1)
+        stats->speed = speed;
+    if (ecmd.duplex == DUPLEX_HALF)
+        stats->duplex = NETCF_DUPLEX_HALF;
+    else if (ecmd.duplex == DUPLEX_FULL)
+        stats->duplex = NETCF_DUPLEX_FULL;
+}
+
+/* Fill STATS for the link IFINDEX from the link cache as it is */
+static int link_stats(struct netcf *ncf, const char *intf, int ifindex,
+                      struct netcf_if_stats *stats) {
+    struct rtnl_link *link;
+
+    MEMZERO(stats, 1);
+    link = link_by_ifindex(ncf, ifindex);
+    ERR_BAIL(ncf);
+    ERR_THROW(link == NULL, ncf, EOTHER,
+              "interface %s does not exist", intf);
+
+    stats->rx_bytes = rtnl_link_get_stat(link, RTNL_LINK_RX_BYTES);
+    stats->rx_packets = rtnl_link_get_stat(link, RTNL_LINK_RX_PACKETS);
+    stats->rx_errors = rtnl_link_get_stat(link, RTNL_LINK_RX_ERRORS);
+    stats->rx_dropped = rtnl_link_get_stat(link, RTNL_LINK_RX_DROPPED);
+    stats->tx_bytes = rtnl_link_get_stat(link, RTNL_LINK_TX_BYTES);
+    stats->tx_packets = rtnl_link_get_stat(link, RTNL_LINK_TX_PACKETS);
+    stats->tx_errors = rtnl_link_get_stat(link, RTNL_LINK_TX_ERRORS);
+    stats->tx_dropped = rtnl_link_get_stat(link, RTNL_LINK_TX_DROPPED);
+#ifdef HAVE_RTNL_LINK_GET_CARRIER_CHANGES
+    {
+        uint32_t changes;
+        if (rtnl_link_get_carrier_changes(link, &changes) == 0)
+            stats->carrier_changes = changes;
+    }
+#endif
+#ifdef HAVE_LIBNL3
+    stats->rx_queues = rtnl_link_get_num_rx_queues(link);
+    stats->tx_queues = rtnl_link_get_num_tx_queues(link);
+#endif
+    link_speed_duplex(ncf, intf, stats);
+    return 0;
+ error:
+    return -1;
+}
+
+int if_stats(struct netcf *ncf, const char *intf,
+             struct netcf_if_stats *stats) {
+    netlink_refill(ncf);
+    ERR_BAIL(ncf);
+    return link_stats(ncf, intf, link_name2i(ncf, intf), stats);
+ error:
+    return -1;
+}
+
+/* add the counters of the given interface to the xml document as
+ * <stats rx_bytes="..." .../>, leaving out link parameters that are
+ * unknown
+ */
+static void add_stats_info(struct netcf *ncf, const char *ifname,
+                           int ifindex, xmlDocPtr doc, xmlNodePtr root) {
+    struct netcf_if_stats stats;
+    xmlNodePtr node;
+    xmlAttrPtr prop;
+    char buf[32];
+
+    /* interfaces that are only configured have no counters */
+    if (ifindex <= 0)
+        return;
+    link_stats(ncf, ifname, ifindex, &stats);
+    ERR_BAIL(ncf);
+
+    const struct {
+        const char         *name;
+        unsigned long long  value;
+        bool                optional;
+    } attrs[] = {
+        { "rx_bytes", stats.rx_bytes, false },
+        { "rx_packets", stats.rx_packets, false },
+        { "rx_errors", stats.rx_errors, false },
+        { "rx_dropped", stats.rx_dropped, false },
+        { "tx_bytes", stats.tx_bytes, false },
+        { "tx_packets", stats.tx_packets, false },
+        { "tx_errors", stats.tx_errors, false },
+        { "tx_dropped", stats.tx_dropped, false },
+        { "carrier_changes", stats.carrier_changes, true },
+        { "speed", stats.speed, true },
+        { "rx_queues", stats.rx_queues, true },
+        { "tx_queues", stats.tx_queues, true }
+    };
+
+    node = xml_new_node(doc, root, "stats");
+    ERR_NOMEM(node == NULL, ncf);
+    for (int i=0; i < ARRAY_CARDINALITY(attrs); i++) {
+        if (attrs[i].optional && attrs[i].value == 0)
+            continue;
+        snprintf(buf, sizeof(buf), "%llu", attrs[i].value);
+        prop = xmlSetProp(node, BAD_CAST attrs[i].name, BAD_CAST buf);
+        ERR_NOMEM(prop == NULL, ncf);
+    }
+    if (stats.duplex != NETCF_DUPLEX_UNKNOWN) {
+        prop = xmlSetProp(node, BAD_CAST "duplex",
+                          BAD_CAST (stats.duplex == NETCF_DUPLEX_FULL ?
+                                    "full" : "half"));
+        ERR_NOMEM(prop == NULL, ncf);
+    }
+error:
+    return;
+}
+
+/* Add the state of the interface NAME to the <interface> element ROOT,
+ * using the link and address caches as they are */
+static void add_state_to_xml_node(struct netcf *ncf, const char *name,
+                                  xmlDocPtr doc, xmlNodePtr root) {
+    int ifindex;
+
+    ifindex = link_name2i(ncf, name);
+    ERR_BAIL(ncf);
     /* We ignore an error return here, because that usually just
      * means the interface isn't currently running. The
      * type-specific functions will recognize this from the
      * invalid ifindex we pass to them, and "do the right thing"
      * (which is usually, but not always, to silently return).
      */
-    add_type_specific_info(nif->ncf, nif->name, ifindex, doc, root);
+    add_type_specific_info(ncf, name, ifindex, doc, root);
+    ERR_BAIL(ncf);
+
+    add_ip_info(ncf, name, ifindex, doc, root);
+    ERR_BAIL(ncf);
+
+    add_route_info(ncf, name, ifindex, doc, root);
+    ERR_BAIL(ncf);
+
+    if (ncf->state_flags & NETCF_STATE_STATS) {
+        add_stats_info(ncf, name, ifindex, doc, root);
+        ERR_BAIL(ncf);
+    }
+
+error:
+    return;
+}
+
+void add_state_to_xml_doc(struct netcf_if *nif, xmlDocPtr doc) {
+    xmlNodePtr root;
+
+    TRACE_BEGIN(nif->ncf, "add_state_to_xml_doc");
+
+    root = xmlDocGetRootElement(doc);
+    ERR_THROW((root == NULL), nif->ncf, EINTERNAL,
+              "failed to get document root element");
+    ERR_THROW(!xmlStrEqual(root->name, BAD_CAST "interface"),
+              nif->ncf, EINTERNAL, "root document is not an interface");
+
+    netlink_refill(nif->ncf);
     ERR_BAIL(nif->ncf);
 
-    add_ip_info(nif->ncf, nif->name, ifindex, doc, root);
+    add_state_to_xml_node(nif->ncf, nif->name, doc, root);
     ERR_BAIL(nif->ncf);
 
 error:
+    TRACE_END(nif->ncf, "add_state_to_xml_doc");
     return;
 }
+
+char *all_xml_state(struct netcf *ncf, unsigned int flags) {
+    char **names = NULL;
+    int nint = 0, r;
+    xmlDocPtr doc = NULL;
+    xmlNodePtr root, node;
+    char *result = NULL;
+
+    nint = drv_num_of_interfaces(ncf, flags);
+    ERR_BAIL(ncf);
+    r = ALLOC_N(names, nint);
+    ERR_NOMEM(r < 0, ncf);
+    r = drv_list_interfaces(ncf, nint, names, flags);
+    ERR_BAIL(ncf);
+    if (r < nint)
+        nint = r;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    ERR_NOMEM(doc == NULL, ncf);
+    root = xmlNewNode(NULL, BAD_CAST "interfaces");
+    ERR_NOMEM(root == NULL, ncf);
+    xmlDocSetRootElement(doc, root);
+
+    TRACE_BEGIN(ncf, "add_state_to_xml_doc");
+    netlink_refill(ncf);
+    for (int i=0; i < nint && ncf->errcode == NETCF_NOERROR; i++) {
+        node = xml_new_node(doc, root, "interface");
+        if (node == NULL) {
+            report_error(ncf, NETCF_ENOMEM, NULL);
+            break;
+        }
+        add_state_to_xml_node(ncf, names[i], doc, node);
+    }
+    TRACE_END(ncf, "add_state_to_xml_doc");
+    ERR_BAIL(ncf);
+
+    result = xml_doc_to_string(ncf, doc);
+    ERR_BAIL(ncf);
+
+ done:
+    free_matches(nint, &names);
+    xmlFreeDoc(doc);
+    return result;
+ error:
+    FREE(result);
+    goto done;
+}
+
+/*
+ * Index of ifcfg files
+ */
+
+/* Backup and temporary files that are not interface configs */
+static const char *const ifcfg_excl[] = {
+    "*~", "*.bak", "*.orig", "*.rpmnew", "*.rpmorig", "*.rpmsave",
+    "*.augnew", "*.augsave"
+};
+
+static const char *const ifcfg_keys[IFCFG_KEY_LAST] = {
+    [IFCFG_DEVICE] = "DEVICE",
+    [IFCFG_BRIDGE] = "BRIDGE",
+    [IFCFG_MASTER] = "MASTER",
+    [IFCFG_HWADDR] = "HWADDR"
+};
+
+static void ifcfg_file_clear(struct ifcfg_file *file) {
+    FREE(file->name);
+    for (int k=0; k < IFCFG_KEY_LAST; k++)
+        FREE(file->keys[k]);
+}
+
+void ifcfg_index_free(struct ifcfg_index *index) {
+    if (index == NULL)
+        return;
+    for (int i=0; i < index->nfiles; i++)
+        ifcfg_file_clear(index->files + i);
+    free(index->files);
+    free(index->dir);
+    free(index);
+}
+
+static bool timespec_eq(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/* Read the keys we index from the file PATH into FILE. The files are
+ * shell fragments; we only understand KEY=VALUE with VALUE optionally in
+ * single or double quotes, which is all that ifup understands, too.
+ */
+static int ifcfg_file_read(struct netcf *ncf, const char *path,
+                           struct ifcfg_file *file) {
+    char *text = NULL, *line, *next;
+    size_t len;
+
+    text = read_file(path, &len);
+    ERR_THROW(text == NULL, ncf, EFILE, "failed to read %s", path);
+
+    for (line = text; line != NULL; line = next) {
+        char *value, *end;
+
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        while (c_isspace(*line))
+            line += 1;
+        value = strchr(line, '=');
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+        end = value + strlen(value);
+        while (end > value && c_isspace(end[-1]))
+            end -= 1;
+        if (end - value >= 2 && (*value == '"' || *value == '\'')
+            && end[-1] == *value) {
+            value += 1;
+            end -= 1;
+        }
+        *end = '\0';
+
+        for (int k=0; k < IFCFG_KEY_LAST; k++) {
+            if (STREQ(line, ifcfg_keys[k])) {
+                FREE(file->keys[k]);
+                file->keys[k] = strdup(value);
+                ERR_NOMEM(file->keys[k] == NULL, ncf);
+            }
+        }
+    }
+    FREE(text);
+    return 0;
+ error:
+    FREE(text);
+    return -1;
+}
+
+static int ifcfg_file_cmp(const void *p1, const void *p2) {
+    const struct ifcfg_file *f1 = p1, *f2 = p2;
+    return strcmp(f1->name, f2->name);
+}
+
+const struct ifcfg_file *ifcfg_index_find(const struct ifcfg_index *index,
+                                          const char *name) {
+    struct ifcfg_file key = { .name = (char *) name };
+
+    return bsearch(&key, index->files, index->nfiles, sizeof(key),
+                   ifcfg_file_cmp);
+}
+
+static bool ifcfg_file_wanted(const char *name) {
+    if (!STREQLEN(name, "ifcfg-", strlen("ifcfg-")))
+        return false;
+    for (int i=0; i < ARRAY_CARDINALITY(ifcfg_excl); i++)
+        if (fnmatch(ifcfg_excl[i], name, 0) == 0)
+            return false;
+    return true;
+}
+
+/* Make *FILE describe the file NAME in INDEX. If the index already has
+ * an entry for it that is still current, take its keys over. Returns 1
+ * if the file does not exist (anymore) */
+static int ifcfg_index_entry(struct netcf *ncf, struct ifcfg_index *index,
+                             const char *name, struct ifcfg_file *file) {
+    struct ifcfg_file *old;
+    struct stat st;
+    char *path = NULL;
+    int r;
+
+    MEMZERO(file, 1);
+    r = xasprintf(&path, "%s/%s", index->dir, name);
+    ERR_NOMEM(r < 0, ncf);
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+        FREE(path);
+        return 1;
+    }
+
+    file->name = strdup(name);
+    ERR_NOMEM(file->name == NULL, ncf);
+    file->mtime = st.st_mtim;
+
+    old = (struct ifcfg_file *) ifcfg_index_find(index, name);
+    if (old != NULL && timespec_eq(&old->mtime, &st.st_mtim)) {
+        memcpy(file->keys, old->keys, sizeof(file->keys));
+        MEMZERO(old->keys, IFCFG_KEY_LAST);
+    } else {
+        r = ifcfg_file_read(ncf, path, file);
+        if (r < 0)
+            goto error;
+    }
+    FREE(path);
+    return 0;
+ error:
+    ifcfg_file_clear(file);
+    FREE(path);
+    return -1;
+}
+
+/* Make *FILE an entry for the directory entry D that only has a name,
+ * unless D is known not to be a regular file or a symlink. Returns 1 if
+ * the entry is skipped */
+static int ifcfg_index_name(struct netcf *ncf, const struct dirent *d,
+                            struct ifcfg_file *file) {
+    MEMZERO(file, 1);
+    if (d->d_type != DT_UNKNOWN && d->d_type != DT_REG
+        && d->d_type != DT_LNK)
+        return 1;
+    file->name = strdup(d->d_name);
+    ERR_NOMEM(file->name == NULL, ncf);
+    return 0;
+ error:
+    return -1;
+}
+
+struct ifcfg_index *ifcfg_index_get(struct netcf *ncf,
+                                    struct ifcfg_index **index,
+                                    const char *dir, bool names_only) {
+    struct ifcfg_index *idx = *index;
+    struct ifcfg_file *files = NULL;
+    int nfiles = 0, r;
+    struct stat st;
+    DIR *dh = NULL;
+
+    if (idx == NULL) {
+        r = ALLOC(idx);
+        ERR_NOMEM(r < 0, ncf);
+        r = xasprintf(&idx->dir, "%s%s", ncf->root, dir);
+        ERR_NOMEM(r < 0, ncf);
+        idx->names_only = names_only;
+        idx->mtime.tv_sec = -1;
+        *index = idx;
+    }
+
+    if (stat(idx->dir, &st) < 0) {
+        /* No directory, no files */
+        for (int i=0; i < idx->nfiles; i++)
+            ifcfg_file_clear(idx->files + i);
+        FREE(idx->files);
+        idx->nfiles = 0;
+        idx->mtime.tv_sec = -1;
+        return idx;
+    }
+
+    if (timespec_eq(&idx->mtime, &st.st_mtim) && idx->names_only) {
+        /* Same set of names */
+        return idx;
+    } else if (timespec_eq(&idx->mtime, &st.st_mtim)) {
+        /* Same set of files; only reread the ones that changed */
+        r = ALLOC_N(files, idx->nfiles);
+        ERR_NOMEM(r < 0, ncf);
+        for (int i=0; i < idx->nfiles; i++) {
+            r = ifcfg_index_entry(ncf, idx, idx->files[i].name,
+                                  files + nfiles);
+            if (r < 0)
+                goto error;
+            if (r == 0)
+                nfiles += 1;
+        }
+    } else {
+        struct dirent *d;
+
+        dh = opendir(idx->dir);
+        ERR_THROW(dh == NULL, ncf, EFILE, "failed to open %s", idx->dir);
+        while ((d = readdir(dh)) != NULL) {
+            if (!ifcfg_file_wanted(d->d_name))
+                continue;
+            r = REALLOC_N(files, nfiles + 1);
+            ERR_NOMEM(r < 0, ncf);
+            if (idx->names_only)
+                r = ifcfg_index_name(ncf, d, files + nfiles);
+            else
+                r = ifcfg_index_entry(ncf, idx, d->d_name, files + nfiles);
+            if (r < 0)
+                goto error;
+            if (r == 0)
+                nfiles += 1;
+        }
+        closedir(dh);
+        dh = NULL;
+        qsort(files, nfiles, sizeof(*files), ifcfg_file_cmp);
+        idx->mtime = st.st_mtim;
+    }
+
+    for (int i=0; i < idx->nfiles; i++)
+        ifcfg_file_clear(idx->files + i);
+    free(idx->files);
+    idx->files = files;
+    idx->nfiles = nfiles;
+    return idx;
+
+ error:
+    if (dh != NULL)
+        closedir(dh);
+    for (int i=0; i < nfiles; i++)
+        ifcfg_file_clear(files + i);
+    free(files);
+    ifcfg_index_free(idx);
+    *index = NULL;
+    return NULL;
+}
+
+/*
+ * Change notification
+ */
+
+/* Directories under the root that hold the configuration of one of the
+ * drivers; the ones a distro doesn't use just don't exist */
+static const char *const event_dirs[] = {
+    "etc/sysconfig/network-scripts",
+    "etc/sysconfig/network",
+    "etc/network",
+    "etc/modprobe.d",
+    "etc/udev/rules.d"
+};
+
+/* Prefixes of the files that belong to a single interface; the rest of
+ * the file name is the name of the interface */
+static const char *const event_prefixes[] = {
+    "ifcfg-", "ifroute-", "route6-", "route-"
+};
+
+/* Suffixes of the temporary and backup files Augeas writes next to the
+ * files it changes */
+static const char *const event_ignore[] = {
+    ".augnew", ".augsave"
+};
+
+#define EVENT_DIR_MASK (IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|             \
+                        IN_MOVED_FROM|IN_MOVED_TO)
+
+struct event_watch {
+    int                 epoll_fd;
+    int                 inotify_fd;
+    int                 nl_fd;
+    int                 wds[ARRAY_CARDINALITY(event_dirs)];
+    /* Events read from the descriptors but not handed out yet */
+    struct netcf_event *pending;
+    int                 npending;
+};
+
+void events_close(struct netcf *ncf) {
+    struct event_watch *ew = ncf->driver->events;
+
+    if (ew == NULL)
+        return;
+    if (ew->epoll_fd >= 0)
+        close(ew->epoll_fd);
+    if (ew->inotify_fd >= 0)
+        close(ew->inotify_fd);
+    if (ew->nl_fd >= 0)
+        close(ew->nl_fd);
+    FREE(ew->pending);
+    FREE(ncf->driver->events);
+}
+
+int events_get_fd(struct netcf *ncf) {
+    struct event_watch *ew = ncf->driver->events;
+    struct sockaddr_nl addr;
+    struct epoll_event ev;
+    char errbuf[128];
+    int r;
+
+    if (ew != NULL)
+        return ew->epoll_fd;
+
+    r = ALLOC(ew);
+    ERR_NOMEM(r < 0, ncf);
+    ew->epoll_fd = ew->inotify_fd = ew->nl_fd = -1;
+    ncf->driver->events = ew;
+
+    ew->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ERR_THROW_STRERROR(ew->epoll_fd < 0, ncf, EOTHER,
+                       "failed to create event descriptor: %s", errbuf);
+
+    ew->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    ERR_THROW_STRERROR(ew->inotify_fd < 0, ncf, EFILE,
+                       "failed to initialize inotify: %s", errbuf);
+    for (int i=0; i < ARRAY_CARDINALITY(event_dirs); i++) {
+        char *path = NULL;
+
+        r = xasprintf(&path, "%s%s", ncf->root, event_dirs[i]);
+        ERR_NOMEM(r < 0, ncf);
+        ew->wds[i] = inotify_add_watch(ew->inotify_fd, path, EVENT_DIR_MASK);
+        FREE(path);
+    }
+
+    ew->nl_fd = socket(AF_NETLINK, SOCK_RAW|SOCK_NONBLOCK|SOCK_CLOEXEC,
+                       NETLINK_ROUTE);
+    ERR_THROW_STRERROR(ew->nl_fd < 0, ncf, ENETLINK,
+                       "failed to open netlink event socket: %s", errbuf);
+    MEMZERO(&addr, 1);
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK|RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR
+        |RTMGRP_IPV4_ROUTE|RTMGRP_IPV6_ROUTE;
+    r = bind(ew->nl_fd, (struct sockaddr *) &addr, sizeof(addr));
+    ERR_THROW_STRERROR(r < 0, ncf, ENETLINK,
+                       "failed to subscribe to netlink events: %s", errbuf);
+
+    MEMZERO(&ev, 1);
+    ev.events = EPOLLIN;
+    ev.data.fd = ew->inotify_fd;
+    r = epoll_ctl(ew->epoll_fd, EPOLL_CTL_ADD, ew->inotify_fd, &ev);
+    ERR_THROW_STRERROR(r < 0, ncf, EOTHER,
+                       "failed to watch inotify descriptor: %s", errbuf);
+    ev.data.fd = ew->nl_fd;
+    r = epoll_ctl(ew->epoll_fd, EPOLL_CTL_ADD, ew->nl_fd, &ev);
+    ERR_THROW_STRERROR(r < 0, ncf, EOTHER,
+                       "failed to watch netlink descriptor: %s", errbuf);
+
+    return ew->epoll_fd;
+ error:
+    events_close(ncf);
+    return -1;
+}
+
+/* Queue an event of KIND for the interface NAME, which may be empty.
+ * Repeats of the event queued last are dropped. */
+static int queue_event(struct netcf *ncf, netcf_event_kind_t kind,
+                       const char *name) {
+    struct event_watch *ew = ncf->driver->events;
+    struct netcf_event *ev;
+
+    if (kind == NETCF_EVENT_CONFIG_CHANGED
+        || kind == NETCF_EVENT_CONFIG_REMOVED)
+        ncf->stale |= NETCF_CACHE_CONFIG;
+    else
+        ncf->stale |= NETCF_CACHE_STATE;
+
+    if (ew->npending > 0) {
+        ev = ew->pending + ew->npending - 1;
+        if (ev->kind == kind && STREQLEN(ev->name, name, sizeof(ev->name)))
+            return 0;
+    }
+    if (REALLOC_N(ew->pending, ew->npending + 1) < 0) {
+        report_error(ncf, NETCF_ENOMEM, NULL);
+        return -1;
+    }
+    ev = ew->pending + ew->npending;
+    MEMZERO(ev, 1);
+    ev->kind = kind;
+    strncpy(ev->name, name, sizeof(ev->name) - 1);
+    ew->npending += 1;
+    return 0;
+}
+
+/* Turn the name of a file in one of EVENT_DIRS into an event */
+static int queue_file_event(struct netcf *ncf, uint32_t mask,
+                            const char *fname) {
+    netcf_event_kind_t kind = NETCF_EVENT_CONFIG_CHANGED;
+    const char *name = "";
+    size_t len = strlen(fname);
+
+    for (int i=0; i < ARRAY_CARDINALITY(event_ignore); i++) {
+        size_t slen = strlen(event_ignore[i]);
+        if (len >= slen && STREQ(fname + len - slen, event_ignore[i]))
+            return 0;
+    }
+    for (int i=0; i < ARRAY_CARDINALITY(event_prefixes); i++) {
+        size_t plen = strlen(event_prefixes[i]);
+        if (len > plen && STREQLEN(fname, event_prefixes[i], plen)) {
+            name = fname + plen;
+            break;
+        }
+    }
+    if (mask & (IN_DELETE|IN_MOVED_FROM))
+        kind = NETCF_EVENT_CONFIG_REMOVED;
+    return queue_event(ncf, kind, name);
+}
+
+static int read_inotify_events(struct netcf *ncf) {
+    struct event_watch *ew = ncf->driver->events;
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t len = read(ew->inotify_fd, buf, sizeof(buf));
+
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return 0;
+
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ie = (struct inotify_event *) p;
+            int r = 0;
+
+            if (ie->mask & (IN_Q_OVERFLOW|IN_IGNORED))
+                r = queue_event(ncf, NETCF_EVENT_CONFIG_CHANGED, "");
+            else if (ie->len > 0)
+                r = queue_file_event(ncf, ie->mask, ie->name);
+            if (r < 0)
+                return -1;
+            p += sizeof(struct inotify_event) + ie->len;
+        }
+    }
+}
+
+/* Turn one RTM_NEWLINK, RTM_DELLINK, RTM_NEWADDR, RTM_DELADDR,
+ * RTM_NEWROUTE or RTM_DELROUTE message into an event */
+static int queue_netlink_event(struct netcf *ncf, struct nlmsghdr *nh) {
+    char ifname[IF_NAMESIZE] = "";
+    const char *name = ifname;
+    netcf_event_kind_t kind;
+
+    switch (nh->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK: {
+        struct ifinfomsg *ifi = NLMSG_DATA(nh);
+        int len = IFLA_PAYLOAD(nh);
+
+        kind = nh->nlmsg_type == RTM_NEWLINK ?
+            NETCF_EVENT_LINK_NEW : NETCF_EVENT_LINK_DEL;
+        for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+             rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == IFLA_IFNAME) {
+                name = RTA_DATA(rta);
+                break;
+            }
+        }
+        if (name == ifname)
+            if_indextoname(ifi->ifi_index, ifname);
+        break;
+    }
+    case RTM_NEWADDR:
+    case RTM_DELADDR: {
+        struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+
+        kind = nh->nlmsg_type == RTM_NEWADDR ?
+            NETCF_EVENT_ADDR_NEW : NETCF_EVENT_ADDR_DEL;
+        /* The link may be gone already, and then we can't tell */
+        if (if_indextoname(ifa->ifa_index, ifname) == NULL)
+            ifname[0] = '\0';
+        break;
+    }
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE: {
+        struct rtmsg *rtm = NLMSG_DATA(nh);
+        int len = RTM_PAYLOAD(nh);
+
+        /* The routes in other tables do not show up in the state */
+        if (rtm->rtm_table != RT_TABLE_MAIN)
+            return 0;
+        kind = nh->nlmsg_type == RTM_NEWROUTE ?
+            NETCF_EVENT_ROUTE_NEW : NETCF_EVENT_ROUTE_DEL;
+        /* Multipath routes have no RTA_OIF and affect several links */
+        for (struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, len);
+             rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == RTA_OIF) {
+                if (if_indextoname(*(int *) RTA_DATA(rta), ifname) == NULL)
+                    ifname[0] = '\0';
+                break;
+            }
+        }
+        break;
+    }
+    default:
+        return 0;
+    }
+    return queue_event(ncf, kind, name);
+}
+
+static int read_netlink_events(struct netcf *ncf) {
+    struct event_watch *ew = ncf->driver->events;
+    char buf[8192] __attribute__ ((aligned(NLMSG_ALIGNTO)));
+    char errbuf[128];
+
+    for (;;) {
+        ssize_t len = recv(ew->nl_fd, buf, sizeof(buf), 0);
+
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        /* The socket overran, and we can't tell what we missed */
+        if (len < 0 && errno == ENOBUFS) {
+            if (queue_event(ncf, NETCF_EVENT_LINK_NEW, "") < 0)
+                return -1;
+            continue;
+        }
+        ERR_THROW_STRERROR(len < 0, ncf, ENETLINK,
+                           "failed to read netlink events: %s", errbuf);
+
+        for (struct nlmsghdr *nh = (struct nlmsghdr *) buf;
+             NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (queue_netlink_event(ncf, nh) < 0)
+                return -1;
+        }
+    }
+ error:
+    return -1;
+}
+
+int events_read(struct netcf *ncf, struct netcf_event *events,
+                int maxevents) {
+    struct event_watch *ew = ncf->driver->events;
+    int nevents;
+
+    ERR_THROW(events == NULL || maxevents < 0, ncf, EOTHER,
+              "invalid event buffer");
+    ERR_THROW(ew == NULL, ncf, EINVALIDOP,
+              "ncf_get_event_fd must be called before reading events");
+
+    if (ew->npending < maxevents) {
+        if (read_inotify_events(ncf) < 0 || read_netlink_events(ncf) < 0)
+            goto error;
+    }
+
+    nevents = ew->npending < maxevents ? ew->npending : maxevents;
+    memcpy(events, ew->pending, nevents * sizeof(*events));
+    memmove(ew->pending, ew->pending + nevents,
+            (ew->npending - nevents) * sizeof(*events));
+    ew->npending -= nevents;
+    return nevents;
+ error:
+    return -1;
+}
+
+/*
+ * Waiting for interfaces to come up
+ */
+
+/* Whether the address is one that the interface can actually be reached
+ * at, rather than one that the kernel assigns on its own or that is
+ * still being checked for duplicates */
+static bool usable_address(int scope, unsigned int ifa_flags) {
+    return scope < RT_SCOPE_LINK && !(ifa_flags & IFA_F_TENTATIVE);
+}
+
+/* Does the link with IFINDEX have a usable address right now ? */
+static bool if_has_address(struct netcf *ncf, int ifindex) {
+    struct link_index *index;
+    struct link_ref *ref;
+
+    ncf->stale |= NETCF_CACHE_STATE;
+    if (netlink_refill(ncf) < 0)
+        return false;
+    index = link_index_get(ncf);
+    if (index == NULL)
+        return false;
+    ref = link_index_by_ifindex(index, ifindex);
+    for (int i=0; ref != NULL && i < ref->naddrs; i++) {
+        struct rtnl_addr *addr = index->addrs[ref->first_addr + i];
+
+        if (usable_address(rtnl_addr_get_scope(addr),
+                           rtnl_addr_get_flags(addr)))
+            return true;
+    }
+    return false;
+}
+
+/* Update *ACTIVE and *HAS_ADDR from the netlink message NH about some
+ * link or address. The link is identified by INTF; *IFINDEX is filled in
+ * once we learn it */
+static void wait_update(struct nlmsghdr *nh, const char *intf, int *ifindex,
+                        bool *active, bool *has_addr) {
+    if (nh->nlmsg_type == RTM_NEWLINK || nh->nlmsg_type == RTM_DELLINK) {
+        struct ifinfomsg *ifi = NLMSG_DATA(nh);
+        int len = IFLA_PAYLOAD(nh);
+        bool match = (ifi->ifi_index == *ifindex);
+
+        for (struct rtattr *rta = IFLA_RTA(ifi);
+             !match && RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == IFLA_IFNAME)
+                match = STREQLEN(RTA_DATA(rta), intf, RTA_PAYLOAD(rta));
+        }
+        if (!match)
+            return;
+        *ifindex = ifi->ifi_index;
+        *active = (nh->nlmsg_type == RTM_NEWLINK &&
+                   (ifi->ifi_flags & (IFF_UP|IFF_RUNNING))
+                   == (IFF_UP|IFF_RUNNING));
+    } else if (nh->nlmsg_type == RTM_NEWADDR) {
+        struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+
+        if (ifa->ifa_index == *ifindex &&
+            usable_address(ifa->ifa_scope, ifa->ifa_flags))
+            *has_addr = true;
+    }
+}
+
+int if_wait_active(struct netcf *ncf, const char *intf, int timeout_ms,
+                   unsigned int flags) {
+    bool want_addr = (flags & NETCF_UP_WAIT_ADDRESS) != 0;
+    bool active = false, has_addr = false;
+    unsigned long long deadline;
+    struct sockaddr_nl addr;
+    char errbuf[128];
+    int fd = -1, ifindex, r;
+
+    ERR_THROW(timeout_ms < 0, ncf, EOTHER,
+              "invalid timeout %d for interface %s", timeout_ms, intf);
+    deadline = stat_start() + timeout_ms * 1000ULL;
+
+    /* Subscribe before looking at the current state, so that we can't
+     * miss a change that happens in between */
+    if (timeout_ms > 0) {
+        fd = socket(AF_NETLINK, SOCK_RAW|SOCK_NONBLOCK|SOCK_CLOEXEC,
+                    NETLINK_ROUTE);
+        ERR_THROW_STRERROR(fd < 0, ncf, ENETLINK,
+                           "failed to open netlink socket: %s", errbuf);
+        MEMZERO(&addr, 1);
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK;
+        if (want_addr)
+            addr.nl_groups |= RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR;
+        r = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+        ERR_THROW_STRERROR(r < 0, ncf, ENETLINK,
+                           "failed to subscribe to netlink events: %s",
+                           errbuf);
+    }
+
+    ifindex = if_nametoindex(intf);
+    active = if_is_active(ncf, intf);
+    if (want_addr && ifindex > 0)
+        has_addr = if_has_address(ncf, ifindex);
+
+    while (fd >= 0 && !(active && (has_addr || !want_addr))) {
+        char buf[8192] __attribute__ ((aligned(NLMSG_ALIGNTO)));
+        unsigned long long now = stat_start();
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        ssize_t len;
+
+        if (now >= deadline)
+            break;
+        r = poll(&pfd, 1, (deadline - now + 999) / 1000);
+        if (r < 0 && errno == EINTR)
+            continue;
+        ERR_THROW_STRERROR(r < 0, ncf, ENETLINK,
+                           "failed to wait for netlink events: %s", errbuf);
+        if (r == 0)
+            continue;
+
+        len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0 && errno == ENOBUFS) {
+            /* We missed something; look at the state again */
+            ifindex = if_nametoindex(intf);
+            active = if_is_active(ncf, intf);
+            if (want_addr && ifindex > 0)
+                has_addr = if_has_address(ncf, ifindex);
+            continue;
+        }
+        if (len < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        ERR_THROW_STRERROR(len < 0, ncf, ENETLINK,
+                           "failed to read netlink events: %s", errbuf);
+        for (struct nlmsghdr *nh = (struct nlmsghdr *) buf;
+             NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+            wait_update(nh, intf, &ifindex, &active, &has_addr);
+    }
+
+    ERR_THROW(!active, ncf, EOTHER,
+              "interface %s failed to become active - "
+              "possible disconnected cable.", intf);
+    ERR_THROW(want_addr && !has_addr, ncf, EOTHER,
+              "interface %s did not get an address", intf);
+    if (fd >= 0)
+        close(fd);
+    return 0;
+ error:
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
 #endif
 
 /*
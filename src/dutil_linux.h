@@ -38,15 +38,26 @@
 struct driver {
     struct augeas     *augeas;
     xsltStylesheetPtr  put;
+    const char        *get_xsl;           /* files GET and PUT are parsed */
+    const char        *put_xsl;           /* from by load_stylesheets */
     xsltStylesheetPtr  get;
     int                ioctl_fd;
     struct nl_sock     *nl_sock;
+    int                nl_rcvbuf;         /* receive buffer of nl_sock */
     struct nl_cache   *link_cache;
     struct nl_cache   *addr_cache;
+    struct nl_cache   *route_cache;
+    struct route_index *route_index;
+    struct member_index *member_index;
+    struct link_index  *link_index;
     unsigned int       load_augeas : 1;
     unsigned int       copy_augeas_xfm : 1;
     unsigned int       augeas_xfm_num_tables;
     const struct augeas_xfm_table **augeas_xfm_tables;
+    struct event_watch *events;
+    struct ifcfg_index *ifcfg_index;
+    struct augeas_xfm_table *narrow_xfm;
+    struct netrule_index *netrule_index;  /* udev rules, SUSE only */
 };
 
 struct augeas_pv {
@@ -68,9 +79,28 @@ int add_augeas_xfm_table(struct netcf *ncf,
 int remove_augeas_xfm_table(struct netcf *ncf,
                             const struct augeas_xfm_table *table);
 
+/* Make a table of transformations that loads exactly the NFILES files in
+ * FILES (absolute paths inside the root) with LENS under the transform
+ * named XFM. The table must be freed with FREE_AUGEAS_XFM_TABLE.
+ */
+struct augeas_xfm_table *make_augeas_xfm_table(struct netcf *ncf,
+                                               const char *xfm,
+                                               const char *lens,
+                                               int nfiles, char **files);
+
+void free_augeas_xfm_table(struct augeas_xfm_table *table);
+
+/* Parse the stylesheets GET_XSL and PUT_XSL of NCF->DRIVER into GET and
+ * PUT, unless that already happened. Returns 0 on success, -1 on error */
+int load_stylesheets(struct netcf *ncf);
+
 /* Get or create the augeas instance from NCF */
 struct augeas *get_augeas(struct netcf *ncf);
 
+/* Return true if what was cached from the config tree at generation GEN
+ * is still good, i.e. get_augeas would not reread any files */
+bool config_gen_current(struct netcf *ncf, unsigned int gen);
+
 /* Define a node inside the augeas tree */
 ATTRIBUTE_FORMAT(printf, 4, 5)
 int defnode(struct netcf *ncf, const char *name, const char *value,
@@ -87,6 +117,64 @@ int aug_fmt_set(struct netcf *ncf, const char *value, const char *fmt, ...);
 ATTRIBUTE_FORMAT(printf, 2, 3)
 int aug_fmt_rm(struct netcf *ncf, const char *fmt, ...);
 
+/* Set PATH to VALUE, unless it already has that value. Returns 1 if the
+ * tree was changed, 0 if it was not, and -1 on error */
+int aug_update(struct netcf *ncf, const char *path, const char *value);
+
+/* Make the file described by TREE, a <tree> element in the simple Augeas
+ * format, have the entries listed in TREE, except for the labels in the
+ * NULL-terminated list SKIP, which may be NULL. Of the entries that are
+ * not in TREE, only those whose labels are in the NULL-terminated list
+ * MANAGED are removed; an entry of SKIP or MANAGED that ends in '_'
+ * stands for all labels starting with it. Only entries that differ are
+ * touched, and comments and entries netcf does not manage are kept, so
+ * that aug_save does not rewrite a file whose contents stay the same.
+ * Returns the number of entries set or removed, or -1 on error.
+ */
+int aug_put_tree(struct netcf *ncf, xmlNodePtr tree,
+                 const char *const *skip, const char *const *managed);
+
+/* Return true if the XML doc FOREST in the simple Augeas format has a
+ * tree for PATH */
+bool forest_has_tree(xmlDocPtr forest, const char *path);
+
+/* Save the Augeas tree, counting the files that were actually written */
+int save_augeas(struct netcf *ncf);
+
+/* Return a unified diff of the changes that saving the Augeas tree would
+ * make to the files on disk, without writing anything, and throw the
+ * changes away. The result is the empty string if nothing would change,
+ * and must be freed by the caller. */
+char *preview_augeas(struct netcf *ncf);
+
+/* An interface definition that a driver parsed, validated and transformed
+ * into the simple Augeas format. None of it depends on the root, so that
+ * it can be put into the Augeas trees of many roots.
+ */
+struct if_defn {
+    char      *name;        /* the device name */
+    xmlDocPtr  ncf_xml;     /* the <interface> document */
+    xmlDocPtr  aug_xml;     /* NCF_XML transformed by the GET stylesheet */
+};
+
+void if_defn_clear(struct if_defn *defn);
+
+/* Driver functions that fill DEFN from the XML in XML_STR, and that put
+ * DEFN into the Augeas tree of NCF without saving it */
+typedef int (*if_defn_prepare_t)(struct netcf *ncf, const char *xml_str,
+                                 struct if_defn *defn);
+typedef int (*if_defn_put_t)(struct netcf *ncf, const struct if_defn *defn);
+
+/* Implementation of ncf_define_roots: prepare the NXML definitions in
+ * XMLS once with PREPARE, then, for each of the NROOTS roots, open a
+ * handle, PUT all the definitions into its tree, and save it. Up to
+ * NTHREADS roots are worked on at the same time.
+ */
+int define_roots(struct netcf *ncf, int nxml, const char *const *xmls,
+                 int nroots, const char *const *roots, int nthreads,
+                 netcf_errcode_t *errcodes, char **errdetails,
+                 if_defn_prepare_t prepare, if_defn_put_t put);
+
 /* Free matches from aug_match (or aug_submatch) */
 void free_matches(int nint, char ***intf);
 
@@ -111,7 +199,7 @@ void modprobed_alias_bond(struct netcf *ncf, const char *name);
 /* Remove an 'alias NAME bonding' as created by modprobed_alias_bond */
 void modprobed_unalias_bond(struct netcf *ncf, const char *name);
 
-/* setup the netlink socket */
+/* setup the netlink socket and fill the caches */
 int netlink_init(struct netcf *ncf);
 
 /*shutdown the netlink socket and release its resources */
@@ -141,11 +229,98 @@ const char *if_type_str(netcf_if_type_t type);
 /* Retrieve the hw mac address of the interface INTF */
 int if_hwaddr(struct netcf *ncf, const char *intf, unsigned char *mac, int len);
 
+/* Wait up to TIMEOUT_MS for INTF to be up and running, and, if FLAGS
+ * contains NETCF_UP_WAIT_ADDRESS, to have a usable address. With a
+ * TIMEOUT_MS of 0, only look at the current state. Reports an error
+ * and returns -1 if the interface does not get there in time.
+ */
+int if_wait_active(struct netcf *ncf, const char *intf, int timeout_ms,
+                   unsigned int flags);
+
+/* Fill STATS with the counters of INTF from the link cache, after
+ * updating it, and its speed and duplex from the driver */
+int if_stats(struct netcf *ncf, const char *intf,
+             struct netcf_if_stats *stats);
+
+/* Update the link and address caches with any recent changes. The
+ * netlink socket is connected, and the caches filled, on the first
+ * call */
+int netlink_refill(struct netcf *ncf);
+
 /* Add the state of the interface (currently all addresses + netmasks)
  * to its xml document.
  */
 void add_state_to_xml_doc(struct netcf_if *nif, xmlDocPtr doc);
 
+/* Return a document with an <interfaces> root that contains the state of
+ * all toplevel interfaces matching FLAGS, taken from one snapshot of the
+ * link and address caches. The result is serialized with the stylesheet
+ * in NCF->DRIVER->PUT and must be freed by the caller.
+ */
+char *all_xml_state(struct netcf *ncf, unsigned int flags);
+
+/*
+ * Index of sysconfig style ifcfg-* files
+ *
+ * The index keeps the few keys of each file that tell which interface it
+ * configures and which other interfaces it refers to. It is much cheaper
+ * to keep current than the Augeas tree, and lets drivers figure out which
+ * files an operation needs before loading any of them.
+ */
+typedef enum {
+    IFCFG_DEVICE,
+    IFCFG_BRIDGE,
+    IFCFG_MASTER,
+    IFCFG_HWADDR,
+    IFCFG_KEY_LAST
+} ifcfg_key_t;
+
+struct ifcfg_file {
+    char           *name;        /* file name, e.g. "ifcfg-eth0" */
+    struct timespec mtime;
+    char           *keys[IFCFG_KEY_LAST];  /* values, or NULL if not set */
+};
+
+struct ifcfg_index {
+    char              *dir;      /* absolute path of the directory */
+    bool               names_only;
+    struct timespec    mtime;
+    int                nfiles;
+    struct ifcfg_file *files;    /* sorted by name */
+};
+
+/* Return the index of the ifcfg-* files in DIR, a directory relative to
+ * the root. *INDEX holds the index between calls; files are only read
+ * again when they changed since the last call. With NAMES_ONLY, which
+ * must be the same on every call for *INDEX, the files are neither read
+ * nor stat'ed, their keys stay NULL, and the index is only redone when
+ * the mtime of DIR changes. Returns NULL on error.
+ */
+struct ifcfg_index *ifcfg_index_get(struct netcf *ncf,
+                                    struct ifcfg_index **index,
+                                    const char *dir, bool names_only);
+
+/* Find the entry for the file NAME in INDEX, or return NULL */
+const struct ifcfg_file *ifcfg_index_find(const struct ifcfg_index *index,
+                                          const char *name);
+
+void ifcfg_index_free(struct ifcfg_index *index);
+
+/* Return a descriptor that becomes readable when files in the network
+ * configuration directories under NCF->ROOT change, or when links or
+ * addresses are added, changed or removed. The watches are set up on
+ * the first call, and torn down by EVENTS_CLOSE.
+ */
+int events_get_fd(struct netcf *ncf);
+
+/* Read up to MAXEVENTS changes without blocking and invalidate the caches
+ * they affect. Returns the number of events, or -1 on error.
+ */
+int events_read(struct netcf *ncf, struct netcf_event *events, int maxevents);
+
+/* Stop watching for changes */
+void events_close(struct netcf *ncf);
+
 #endif
 
 /*
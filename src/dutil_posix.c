@@ -198,6 +198,9 @@ int run_program(struct netcf *ncf, const char *const *argv, char **output)
     int outfd = -1;
     FILE *outfile = NULL;
     size_t outlen;
+    unsigned long long start = stat_start();
+
+    TRACE_BEGIN(ncf, "run_program");
 
     if (!output)
         output = &outtext;
@@ -261,6 +264,8 @@ error:
         close(outfd);
     FREE(outtext);
     FREE(argv_str);
+    stat_stop(ncf, NETCF_STAT_RUN_PROGRAM, start);
+    TRACE_END(ncf, "run_program");
     return ret;
 }
 
@@ -297,6 +302,145 @@ error:
     return -1;
 }
 
+/*
+ * Durability of config files, see ncf_set_durability
+ */
+
+/* fsync the file or directory PATH; a PATH that does not exist (anymore)
+ * is not an error */
+static int fsync_path(const char *path) {
+    int fd, r, saved_errno;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return (errno == ENOENT) ? 0 : -1;
+    r = fsync(fd);
+    /* Some filesystems can not fsync directories */
+    if (r < 0 && errno == EINVAL)
+        r = 0;
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return r;
+}
+
+/* Return the directory containing PATH in a newly allocated string */
+static char *dir_of(const char *path) {
+    char *dir, *slash;
+
+    dir = strdup(path);
+    if (dir == NULL)
+        return NULL;
+    slash = strrchr(dir, '/');
+    if (slash == dir)
+        slash[1] = '\0';
+    else if (slash != NULL)
+        *slash = '\0';
+    return dir;
+}
+
+/* fsync PATH and its directory, so that the rename that put PATH in
+ * place, or the unlink that removed it, is durable, too */
+static int fsync_file_and_dir(struct netcf *ncf, const char *path) {
+    char errbuf[128];
+    char *dir = NULL;
+    int r;
+
+    r = fsync_path(path);
+    ERR_THROW_STRERROR(r < 0, ncf, EFILE, "fsync of %s failed: %s",
+                       path, errbuf);
+
+    dir = dir_of(path);
+    ERR_NOMEM(dir == NULL, ncf);
+    r = fsync_path(dir);
+    ERR_THROW_STRERROR(r < 0, ncf, EFILE, "fsync of %s failed: %s",
+                       dir, errbuf);
+    FREE(dir);
+    return 0;
+ error:
+    FREE(dir);
+    return -1;
+}
+
+int sync_file_written(struct netcf *ncf, const char *path) {
+    switch (ncf->durability) {
+    case NETCF_DURABILITY_FSYNC:
+        return fsync_file_and_dir(ncf, path);
+    case NETCF_DURABILITY_BATCHED:
+        for (int i=0; i < ncf->nsync_paths; i++)
+            if (STREQ(ncf->sync_paths[i], path))
+                return 0;
+        ERR_NOMEM(REALLOC_N(ncf->sync_paths, ncf->nsync_paths + 1) < 0, ncf);
+        ncf->sync_paths[ncf->nsync_paths] = strdup(path);
+        ERR_NOMEM(ncf->sync_paths[ncf->nsync_paths] == NULL, ncf);
+        ncf->nsync_paths += 1;
+        return 0;
+    default:
+        return 0;
+    }
+ error:
+    return -1;
+}
+
+int sync_flush(struct netcf *ncf) {
+    char errbuf[128];
+    char *dir = NULL;
+    dev_t *devs = NULL;
+    int ndevs = 0, fd = -1, r;
+    int result = -1;
+
+    for (int i=0; i < ncf->nsync_paths; i++) {
+        struct stat st;
+        bool seen = false;
+
+        dir = dir_of(ncf->sync_paths[i]);
+        ERR_NOMEM(dir == NULL, ncf);
+        fd = open(dir, O_RDONLY);
+        ERR_THROW_STRERROR(fd < 0, ncf, EFILE, "could not open %s: %s",
+                           dir, errbuf);
+        r = fstat(fd, &st);
+        ERR_THROW_STRERROR(r < 0, ncf, EFILE, "could not stat %s: %s",
+                           dir, errbuf);
+        for (int j=0; j < ndevs && !seen; j++)
+            seen = (devs[j] == st.st_dev);
+        if (! seen) {
+            ERR_NOMEM(REALLOC_N(devs, ndevs + 1) < 0, ncf);
+            devs[ndevs++] = st.st_dev;
+#ifdef HAVE_SYNCFS
+            /* One flush for all the files on this filesystem */
+            r = syncfs(fd);
+            ERR_THROW_STRERROR(r < 0, ncf, EFILE, "syncfs of %s failed: %s",
+                               dir, errbuf);
+#endif
+        }
+#ifndef HAVE_SYNCFS
+        r = fsync_file_and_dir(ncf, ncf->sync_paths[i]);
+        ERR_BAIL(ncf);
+#endif
+        close(fd);
+        fd = -1;
+        FREE(dir);
+    }
+    result = 0;
+ error:
+    if (fd >= 0)
+        close(fd);
+    FREE(dir);
+    FREE(devs);
+    /* Whatever happened, do not try the same files again */
+    for (int i=0; i < ncf->nsync_paths; i++)
+        FREE(ncf->sync_paths[i]);
+    FREE(ncf->sync_paths);
+    ncf->nsync_paths = 0;
+    return result;
+}
+
+int sync_end(struct netcf *ncf) {
+    if (ncf->in_change)
+        return 0;
+    return sync_flush(ncf);
+}
+
 /*
  * Local variables:
  *  indent-tabs-mode: nil
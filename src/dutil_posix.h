@@ -44,6 +44,20 @@ void run1(struct netcf *ncf, const char *prog, const char *arg);
 /* Get a file descriptor to a ioctl socket */
 int init_ioctl_fd(struct netcf *ncf);
 
+/* Durability of config files, see ncf_set_durability. PATH is the
+ * absolute path, including the root, of a file that was just written or
+ * removed; depending on the durability mode of NCF, it is flushed to disk
+ * right away or remembered for SYNC_FLUSH */
+int sync_file_written(struct netcf *ncf, const char *path);
+
+/* Flush all files remembered by SYNC_FILE_WRITTEN */
+int sync_flush(struct netcf *ncf);
+
+/* Called when an operation is done writing files; flushes the files
+ * remembered by SYNC_FILE_WRITTEN unless a change started with
+ * ncf_change_begin is in progress */
+int sync_end(struct netcf *ncf);
+
 #endif
 
 /*
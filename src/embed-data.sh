@@ -0,0 +1,52 @@
+#! /bin/sh
+#
+# embed-data.sh: turn the stylesheets and schemas in data/xml into C
+# arrays so that they can be compiled into libnetcf
+#
+# Usage: embed-data.sh OUTPUT FILE...
+#
+# Each FILE is registered as xml/BASENAME, the same name it has relative
+# to the data directory. Only od and sed are used, so that this works
+# wherever the rest of the build does.
+
+set -e
+
+out=$1
+shift
+
+rm -f "$out-t" "$out"
+exec 3>"$out-t"
+
+cat >&3 <<EOF
+/* Generated by embed-data.sh from
+ *   $*
+ * Do not edit.
+ */
+
+#include <config.h>
+#include <internal.h>
+#include "dutil.h"
+
+EOF
+
+i=0
+for f in "$@"; do
+    printf 'static const unsigned char embedded_%d[] = {\n' $i >&3
+    od -An -v -tx1 "$f" | \
+        sed -e 's/ *\([0-9a-f][0-9a-f]\)/0x\1, /g' -e 's/, $/,/' \
+            -e 's/^/    /' >&3
+    printf '};\n\n' >&3
+    i=$((i + 1))
+done
+
+printf 'const struct embedded_file embedded_files[] = {\n' >&3
+i=0
+for f in "$@"; do
+    printf '    { "xml/%s", embedded_%d, sizeof(embedded_%d) },\n' \
+           "$(basename "$f")" $i $i >&3
+    i=$((i + 1))
+done
+printf '    { NULL, NULL, 0 }\n};\n' >&3
+
+exec 3>&-
+mv "$out-t" "$out"
@@ -143,42 +143,170 @@
     } while(0)
 
 
-/* Clear error code and details */
-#define API_ENTRY(ncf)                          \
-    do {                                        \
-        (ncf)->errcode = NETCF_NOERROR;         \
-        FREE((ncf)->errdetails);                \
-        if (ncf->driver != NULL)                \
-            drv_entry(ncf);                     \
+/*
+ * Tracing of public API calls and of the expensive stages inside them,
+ * see ncf_set_trace_callback. With --enable-probes, every event is also
+ * a static probe netcf:begin or netcf:end with the operation and
+ * interface name as arguments.
+ */
+#ifdef WITH_PROBES
+# include <sys/sdt.h>
+# define TRACE_PROBE(event, op, ifname)                          \
+    do {                                                        \
+        if ((event) == NETCF_TRACE_BEGIN)                       \
+            DTRACE_PROBE2(netcf, begin, op, ifname);            \
+        else                                                    \
+            DTRACE_PROBE2(netcf, end, op, ifname);              \
+    } while(0)
+#else
+# define TRACE_PROBE(event, op, ifname)
+#endif
+
+#define TRACE(ncf, event, op, ifname)                           \
+    do {                                                        \
+        TRACE_PROBE(event, op, ifname);                         \
+        if ((ncf)->trace_cb != NULL)                            \
+            trace_event(ncf, event, op, ifname);                \
+    } while(0)
+
+/* Trace the beginning and end of a stage OP inside a public call; the
+ * interface is the one the public call was made for */
+#define TRACE_BEGIN(ncf, op) \
+    TRACE(ncf, NETCF_TRACE_BEGIN, op, (ncf)->trace_ifname)
+#define TRACE_END(ncf, op) \
+    TRACE(ncf, NETCF_TRACE_END, op, (ncf)->trace_ifname)
+
+/* Clear error code and details, and trace the start of the public call
+ * in which it is used, made for the interface IFNAME or NULL. Every
+ * API_ENTRY needs a matching API_EXIT.
+ */
+#define API_ENTRY_NAME(ncf, ifname)                     \
+    do {                                                \
+        (ncf)->errcode = NETCF_NOERROR;                 \
+        FREE((ncf)->errdetails);                        \
+        (ncf)->trace_ifname = (ifname);                 \
+        TRACE(ncf, NETCF_TRACE_BEGIN, __func__, (ifname));      \
+        if ((ncf)->driver != NULL)                      \
+            drv_entry(ncf);                             \
     } while(0);
 
+#define API_ENTRY(ncf) API_ENTRY_NAME(ncf, NULL)
+#define API_IF_ENTRY(nif) API_ENTRY_NAME((nif)->ncf, (nif)->name)
+
+/* Trace the end of the public call in which it is used */
+#define API_EXIT(ncf)                                                   \
+    do {                                                                \
+        TRACE(ncf, NETCF_TRACE_END, __func__, (ncf)->trace_ifname);     \
+        (ncf)->trace_ifname = NULL;                                     \
+    } while(0)
+
 /*
  * netcf structures and internal API's
  */
 struct driver;
 
+/* Operations whose count and cumulative time are kept in each netcf
+ * instance and reported by ncf_get_stats. The names in NETCF_STAT_NAMES
+ * in netcf.c must be in the same order.
+ */
+typedef enum {
+    NETCF_STAT_AUG_LOAD = 0,     /* aug_load of the config files */
+    NETCF_STAT_AUG_MATCH,        /* path expressions evaluated by Augeas */
+    NETCF_STAT_AUG_SAVE,         /* aug_save of the config files */
+    NETCF_STAT_FILES_PARSED,     /* config files, stylesheets and schemas
+                                  * parsed; not timed */
+    NETCF_STAT_XSLT,             /* XSLT transformations */
+    NETCF_STAT_RNG_VALIDATE,     /* RelaxNG validations */
+    NETCF_STAT_NETLINK_DUMP,     /* netlink cache fills */
+    NETCF_STAT_NETLINK_RETRY,    /* netlink dumps done again because they
+                                  * were interrupted; not timed */
+    NETCF_STAT_IOCTL,            /* ioctl calls */
+    NETCF_STAT_RUN_PROGRAM,      /* external programs run */
+    NETCF_STAT_FILES_WRITTEN,    /* config files written by aug_save;
+                                  * not timed */
+    NETCF_STAT_KEYS_WRITTEN,     /* entries set or removed in the config
+                                  * files by define; not timed */
+    NETCF_STAT_LAST
+} netcf_stat_t;
+
 struct netcf {
     ref_t            ref;
     char            *root;                /* The filesystem root, always ends
                                            * with '/' */
     const char      *data_dir;            /* Where to find stylesheets etc. */
+    const struct embedded_file *embedded; /* Stylesheets and schemas
+                                           * compiled into the library, or
+                                           * NULL to read them from
+                                           * DATA_DIR */
     xmlRelaxNGPtr    rng;                 /* RNG of <interface> elements */
     netcf_errcode_t  errcode;
     char            *errdetails;          /* Error details */
     struct driver   *driver;              /* Driver specific data */
     unsigned int     debug;
+    unsigned long long stat_count[NETCF_STAT_LAST];
+    unsigned long long stat_usecs[NETCF_STAT_LAST];
+    unsigned int     caching;             /* NETCF_CACHE_* kept between
+                                           * calls, see ncf_set_caching */
+    unsigned int     stale;               /* NETCF_CACHE_* that need to be
+                                           * read afresh */
+    netcf_trace_callback_t trace_cb;      /* Set by ncf_set_trace_callback */
+    void            *trace_data;
+    const char      *trace_ifname;        /* Interface of the current public
+                                           * call, or NULL */
+    netcf_durability_t durability;        /* See ncf_set_durability */
+    unsigned int     in_change : 1;       /* Between ncf_change_begin and
+                                           * commit or rollback */
+    int              nsync_paths;         /* Files waiting to be flushed */
+    char           **sync_paths;
+    unsigned int     state_flags;         /* NETCF_STATE_* added to the live
+                                           * state, see ncf_set_state_flags */
+    int              nl_rcvbuf;           /* See ncf_set_netlink_rcvbuf */
+    unsigned int     config_gen;          /* Changed whenever the config
+                                           * tree is reread or saved; the
+                                           * attributes a netcf_if caches
+                                           * from it are only good while
+                                           * it stays the same */
+    unsigned int     ninterned;           /* The intern table of netcf_if,
+                                           * hashed by name */
+    unsigned int     interned_slots;      /* 0 or a power of two */
+    struct netcf_if **interned;
 };
 
+/* There is at most one netcf_if per name and netcf instance; they are
+ * kept in the intern table of the instance, so that looking up the same
+ * interface again returns the same handle with what it has cached. When
+ * the last reference to a handle goes away, it stays in the table, but
+ * lets go of its NCF, so that the instance can still be closed.
+ *
+ * The table never shrinks: handles are only freed with the instance, even
+ * after their interface is undefined. It holds one small entry for every
+ * name that was ever looked up or listed through the instance, which is
+ * bounded by the interfaces it has seen.
+ */
 struct netcf_if {
     ref_t         ref;
-    struct netcf *ncf;
+    struct netcf *ncf;                    /* Only referenced while REF > 0 */
     char         *name;                   /* The device name */
     char         *mac;                    /* The MAC address, filled by
                                              drv_mac_string */
+    unsigned int  mac_gen;                /* CONFIG_GEN of MAC */
+    unsigned int  lookup_gen;             /* CONFIG_GEN when a lookup by
+                                           * name last found the config
+                                           * of NAME */
 };
 
 #define NCF_DEBUG(ncf) ((ncf)->debug)
 
+/* Return true if the cache CACHE, one of NETCF_CACHE_*, needs to be read
+ * afresh, and consider it fresh from now on */
+#define NCF_CACHE_REFRESH(ncf, cache)                                   \
+    (((ncf)->caching & (cache)) == 0 || ((ncf)->stale & (cache)) ?      \
+     ((ncf)->stale &= ~(cache), 1) : 0)
+
+/* Pass a trace event to the callback of NCF */
+void trace_event(struct netcf *ncf, netcf_trace_event_t event,
+                 const char *op, const char *ifname);
+
 /* The interface to the driver (backend). The appropriate driver is
  * selected at build time from the available drivers in drv_*; each of
  * these files should include definitions for all the drv_* functions.
@@ -194,15 +322,24 @@ int drv_lookup_by_mac_string(struct netcf *, const char *mac,
                              int maxifaces, struct netcf_if **ifaces);
 char *drv_xml_desc(struct netcf_if *);
 char *drv_xml_state(struct netcf_if *);
+char *drv_all_xml_state(struct netcf *ncf, unsigned int flags);
 int drv_if_status(struct netcf_if *nif, unsigned int *flags);
+int drv_if_stats(struct netcf_if *nif, struct netcf_if_stats *stats);
+int drv_get_event_fd(struct netcf *ncf);
+int drv_read_events(struct netcf *ncf, struct netcf_event *events,
+                    int maxevents);
 int drv_change_begin(struct netcf *ncf, unsigned int flags);
 int drv_change_rollback(struct netcf *ncf, unsigned int flags);
 int drv_change_commit(struct netcf *ncf, unsigned int flags);
 
 const char *drv_mac_string(struct netcf_if *nif);
 struct netcf_if *drv_define(struct netcf *ncf, const char *xml);
+char *drv_define_preview(struct netcf *ncf, const char *xml);
+int drv_define_roots(struct netcf *ncf, int nxml, const char *const *xmls,
+                     int nroots, const char *const *roots, int nthreads,
+                     netcf_errcode_t *errcodes, char **errdetails);
 int drv_undefine(struct netcf_if *nif);
-int drv_if_up(struct netcf_if *nif);
+int drv_if_up(struct netcf_if *nif, int timeout_ms, unsigned int flags);
 int drv_if_down(struct netcf_if *nif);
 
 /*
@@ -35,18 +35,39 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <locale.h>
+#include <time.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#ifndef WIN32
+# define NCFTOOL_DAEMON 1
+# include <stdint.h>
+# include <signal.h>
+# include <poll.h>
+# include <fcntl.h>
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/time.h>
+# include <sys/un.h>
+# include <arpa/inet.h>
+#endif
 
 enum command_opt_tag {
     CMD_OPT_NONE,
     CMD_OPT_BOOL,
     CMD_OPT_ARG,       /* Mandatory argument */
-    CMD_OPT_PARAM      /* Optional argument  */
+    CMD_OPT_PARAM,     /* Optional argument  */
+    CMD_OPT_VALUE,     /* Option with a value, --name VALUE */
+    CMD_OPT_ARGS       /* One or more arguments, only after all others */
 };
 
 struct command_opt_def {
     enum command_opt_tag tag;
     const char          *name;
     const char          *help;
+    bool                 path;  /* A file name, made absolute before the
+                                 * command is sent to a daemon */
 };
 
 #define CMD_OPT_DEF_LAST { .tag = CMD_OPT_NONE, .name = NULL }
@@ -85,7 +106,7 @@ struct command_opt {
     /* Switched on def->tag */
     union {
         bool                    bvalue;  /* CMD_OPT_BOOL */
-        char                   *string;  /* CMD_OPT_ARG */
+        char                   *string;  /* all others */
     };
 };
 
@@ -96,9 +117,39 @@ static const struct command_def const *commands[];
 struct netcf *ncf;
 static const char *const progname = "ncftool";
 const char *root = NULL;
+static bool print_stats = false;
+static bool print_timing = false;
+static bool stop_on_error = false;
+static bool use_transaction = false;
+static const char *script = NULL;
+#ifdef NCFTOOL_DAEMON
+static const char *daemon_path = NULL;
+static const char *connect_path = NULL;
+/* Connection to the daemon in client mode, or -1 */
+static int client_fd = -1;
+#endif
+
+static int run_command_line(const char *line, int *cmdstatus);
 
 static bool opt_def_is_arg(const struct command_opt_def *def) {
-    return def->tag == CMD_OPT_ARG || def->tag == CMD_OPT_PARAM;
+    return def->tag == CMD_OPT_ARG || def->tag == CMD_OPT_PARAM
+        || def->tag == CMD_OPT_ARGS;
+}
+
+/* The definition of the argument in position N; all that are left over
+ * go to the list at the end. NULL if the command takes no such argument */
+static const struct command_opt_def *
+arg_def(const struct command_def *cmd_def, int n) {
+    const struct command_opt_def *def, *rest = NULL;
+    int i = 0;
+
+    for (def = cmd_def->opts; def->name != NULL; def++) {
+        if (opt_def_is_arg(def) && i++ == n)
+            return def;
+        if (def->tag == CMD_OPT_ARGS)
+            rest = def;
+    }
+    return rest;
 }
 
 static const struct command_def *lookup_cmd_def(const char *name) {
@@ -201,11 +252,38 @@ static const struct command_def cmd_list_def = {
 
 static int cmd_dump_xml(const struct command *cmd) {
     char *xml = NULL;
-    const char *name = arg_value(cmd, "name");
+    const char *name = param_value(cmd, "name");
     struct netcf_if *nif = NULL;
     int maxifaces;
     int result = CMD_RES_ERR;
 
+    if (opt_present(cmd, "stats")) {
+        if (!opt_present(cmd, "live")) {
+            fprintf(stderr, "--stats requires --live\n");
+            goto done;
+        }
+        if (ncf_set_state_flags(ncf, NETCF_STATE_STATS) < 0)
+            goto done;
+    }
+
+    if (opt_present(cmd, "all")) {
+        if (name != NULL || !opt_present(cmd, "live")) {
+            fprintf(stderr, "--all requires --live and no interface name\n");
+            goto done;
+        }
+        xml = ncf_all_xml_state(ncf, NETCF_IFACE_ACTIVE|NETCF_IFACE_INACTIVE);
+        if (xml == NULL)
+            goto done;
+        printf("%s\n", xml);
+        result = CMD_RES_OK;
+        goto done;
+    }
+
+    if (name == NULL) {
+        fprintf(stderr, "Not enough arguments for %s\n", cmd->def->name);
+        goto done;
+    }
+
     if (opt_present(cmd, "mac")) {
         maxifaces = ncf_lookup_by_mac_string(ncf, name, 1, &nif);
         if (maxifaces < 0) {
@@ -241,6 +319,9 @@ static int cmd_dump_xml(const struct command *cmd) {
     result= CMD_RES_OK;
 
  done:
+    /* the daemon keeps NCF across commands */
+    if (opt_present(cmd, "stats"))
+        ncf_set_state_flags(ncf, 0);
     free(xml);
     ncf_if_free(nif);
     return result;
@@ -251,7 +332,11 @@ static const struct command_opt_def cmd_dump_xml_opts[] = {
       .help = "interpret the name as a MAC address" },
     { .tag = CMD_OPT_BOOL, .name = "live",
       .help = "include information about the live interface" },
-    { .tag = CMD_OPT_ARG, .name = "name",
+    { .tag = CMD_OPT_BOOL, .name = "all",
+      .help = "with --live, dump the state of all toplevel interfaces" },
+    { .tag = CMD_OPT_BOOL, .name = "stats",
+      .help = "with --live, add the traffic counters of the interfaces" },
+    { .tag = CMD_OPT_PARAM, .name = "name",
       .help = "the name of the interface" },
     CMD_OPT_DEF_LAST
 };
@@ -266,9 +351,24 @@ static const struct command_def cmd_dump_xml_def = {
 
 static int cmd_if_up(const struct command *cmd) {
     const char *name = arg_value(cmd, "iface");
+    const char *timeout = param_value(cmd, "timeout");
     struct netcf_if *nif = NULL;
+    unsigned int flags = 0;
+    int timeout_ms = 0, r;
     int result = CMD_RES_ERR;
 
+    if (timeout != NULL) {
+        char *end;
+
+        timeout_ms = strtol(timeout, &end, 10);
+        if (*timeout == '\0' || *end != '\0' || timeout_ms < 0) {
+            fprintf(stderr, "Invalid timeout %s\n", timeout);
+            return result;
+        }
+    }
+    if (opt_present(cmd, "address"))
+        flags |= NETCF_UP_WAIT_ADDRESS;
+
     nif = ncf_lookup_by_name(ncf, name);
     if (nif == NULL) {
         fprintf(stderr,
@@ -277,7 +377,11 @@ static int cmd_if_up(const struct command *cmd) {
         goto done;
     }
 
-    if (ncf_if_up(nif) == 0) {
+    if (timeout != NULL || flags != 0)
+        r = ncf_if_up_wait(nif, timeout_ms, flags);
+    else
+        r = ncf_if_up(nif);
+    if (r == 0) {
         fprintf(stderr, "Interface %s successfully brought up\n", name);
         result= CMD_RES_OK;
     } else {
@@ -290,8 +394,12 @@ static int cmd_if_up(const struct command *cmd) {
 }
 
 static const struct command_opt_def cmd_if_up_opts[] = {
+    { .tag = CMD_OPT_BOOL, .name = "address",
+      .help = "also wait for the interface to get an address" },
     { .tag = CMD_OPT_ARG, .name = "iface",
       .help = "the name of the interface" },
+    { .tag = CMD_OPT_PARAM, .name = "timeout",
+      .help = "how many milliseconds to wait for the interface to become active" },
     CMD_OPT_DEF_LAST
 };
 
@@ -354,6 +462,15 @@ static int cmd_define(const struct command *cmd) {
         fprintf(stderr, "Failed to read %s\n", fname);
         goto done;
     }
+    if (opt_present(cmd, "dry-run")) {
+        char *diff = ncf_define_preview(ncf, xml);
+        if (diff == NULL)
+            goto done;
+        fputs(diff, stdout);
+        free(diff);
+        result = CMD_RES_OK;
+        goto done;
+    }
     nif = ncf_define(ncf, xml);
     if (nif == NULL)
         goto done;
@@ -367,7 +484,9 @@ static int cmd_define(const struct command *cmd) {
 }
 
 static const struct command_opt_def cmd_define_opts[] = {
-    { .tag = CMD_OPT_ARG, .name = "xmlfile",
+    { .tag = CMD_OPT_BOOL, .name = "dry-run",
+      .help = "only show the changes to the config files as a diff" },
+    { .tag = CMD_OPT_ARG, .name = "xmlfile", .path = true,
       .help = "file containing the XML description of the interface" },
     CMD_OPT_DEF_LAST
 };
@@ -380,6 +499,108 @@ static const struct command_def cmd_define_def = {
     .help = "define an interface from an XML file"
 };
 
+static int cmd_define_roots(const struct command *cmd) {
+    const char *rootsfile = arg_value(cmd, "rootsfile");
+    const char *jobs = param_value(cmd, "jobs");
+    char **xmls = NULL, *rootlist = NULL, *line, *save;
+    const char **roots = NULL;
+    netcf_errcode_t *errcodes = NULL;
+    char **errdetails = NULL;
+    int nxml = 0, nroots = 0, nthreads = 0, r;
+    size_t length;
+    int result = CMD_RES_ERR;
+
+    if (jobs != NULL) {
+        char *end;
+
+        nthreads = strtol(jobs, &end, 10);
+        if (*jobs == '\0' || *end != '\0' || nthreads < 0) {
+            fprintf(stderr, "Invalid number of jobs %s\n", jobs);
+            return result;
+        }
+    }
+
+    for (struct command_opt *o = cmd->opt; o != NULL; o = o->next) {
+        if (STRNEQ(o->def->name, "xmlfile"))
+            continue;
+        if (REALLOC_N(xmls, nxml + 1) < 0) {
+            result = CMD_RES_ENOMEM;
+            goto done;
+        }
+        xmls[nxml] = read_file(o->string, &length);
+        if (xmls[nxml] == NULL) {
+            fprintf(stderr, "Failed to read %s\n", o->string);
+            goto done;
+        }
+        nxml += 1;
+    }
+    rootlist = read_file(rootsfile, &length);
+    if (rootlist == NULL) {
+        fprintf(stderr, "Failed to read %s\n", rootsfile);
+        goto done;
+    }
+
+    /* One root per line; empty lines and comments are skipped */
+    for (line = strtok_r(rootlist, "\n", &save); line != NULL;
+         line = strtok_r(NULL, "\n", &save)) {
+        if (*line == '\0' || *line == '#')
+            continue;
+        if (REALLOC_N(roots, nroots + 1) < 0) {
+            result = CMD_RES_ENOMEM;
+            goto done;
+        }
+        roots[nroots++] = line;
+    }
+    if (ALLOC_N(errcodes, nroots) < 0 || ALLOC_N(errdetails, nroots) < 0) {
+        result = CMD_RES_ENOMEM;
+        goto done;
+    }
+
+    r = ncf_define_roots(ncf, nxml, (const char *const *) xmls,
+                         nroots, roots, nthreads, errcodes, errdetails);
+    for (int i=0; i < nroots; i++) {
+        if (errdetails[i] != NULL)
+            fprintf(stderr, "Failed to define the interfaces in %s: %s\n",
+                    roots[i], errdetails[i]);
+    }
+    if (r < 0)
+        goto done;
+    printf("Defined %d interfaces in %d roots\n", nxml, nroots);
+    result = CMD_RES_OK;
+
+ done:
+    for (int i=0; i < nxml; i++)
+        free(xmls[i]);
+    free(xmls);
+    for (int i=0; errdetails != NULL && i < nroots; i++)
+        free(errdetails[i]);
+    free(errdetails);
+    free(rootlist);
+    free(roots);
+    free(errcodes);
+    return result;
+}
+
+static const struct command_opt_def cmd_define_roots_opts[] = {
+    { .tag = CMD_OPT_VALUE, .name = "jobs",
+      .help = "how many roots to work on at the same time; "
+              "one per CPU by default" },
+    { .tag = CMD_OPT_ARG, .name = "rootsfile", .path = true,
+      .help = "file listing the roots to change, one per line" },
+    { .tag = CMD_OPT_ARGS, .name = "xmlfile", .path = true,
+      .help = "files containing the XML descriptions of the interfaces" },
+    CMD_OPT_DEF_LAST
+};
+
+static const struct command_def cmd_define_roots_def = {
+    .name = "define-roots",
+    .opts = cmd_define_roots_opts,
+    .handler = cmd_define_roots,
+    .synopsis = "define interfaces in many roots",
+    .help = "define interfaces from XML files in each of the roots "
+            "listed in a file, working on several of them in parallel"
+};
+
 static int cmd_undefine(const struct command *cmd) {
     int r;
     const char *name = arg_value(cmd, "iface");
@@ -505,6 +726,12 @@ static int cmd_help(const struct command *cmd) {
             case CMD_OPT_PARAM:
                 printf(" [<%s>]", odef->name);
                 break;
+            case CMD_OPT_VALUE:
+                printf(" [--%s <%s>]", odef->name, odef->name);
+                break;
+            case CMD_OPT_ARGS:
+                printf(" <%s>...", odef->name);
+                break;
             default:
                 fprintf(stderr,
                         "\ninternal error: illegal option definition %d\n",
@@ -519,7 +746,7 @@ static int cmd_help(const struct command *cmd) {
             const char *help = odef->help;
             if (help == NULL)
                 help = "";
-            if (odef->tag == CMD_OPT_BOOL) {
+            if (odef->tag == CMD_OPT_BOOL || odef->tag == CMD_OPT_VALUE) {
                 printf("    --%-8s %s\n", odef->name, help);
             } else {
                 char buf[100];
@@ -599,7 +826,7 @@ make_command_opt(struct command *cmd, const struct command_opt_def *def) {
 static int parseline(struct command *cmd, char *line) {
     char *tok;
     int narg = 0, nparam = 0;
-    const struct command_opt_def *def;
+    const struct command_opt_def *def, *rest = NULL;
 
     MEMZERO(cmd, 1);
     tok = nexttoken(&line);
@@ -609,7 +836,14 @@ static int parseline(struct command *cmd, char *line) {
         return -1;
     }
     for (def = cmd->def->opts; def->name != NULL; def ++) {
-        if (def->tag == CMD_OPT_ARG) {
+        if (opt_def_is_arg(def) && rest != NULL) {
+            fprintf(stderr,
+                    "internal error: argument after a list of arguments\n");
+            exit(2);
+        }
+        if (def->tag == CMD_OPT_ARGS)
+            rest = def;
+        if (def->tag == CMD_OPT_ARG || def->tag == CMD_OPT_ARGS) {
             if (nparam > 0) {
                 fprintf(stderr,
                     "internal error: mandatory argument after optional one\n");
@@ -635,6 +869,12 @@ static int parseline(struct command *cmd, char *line) {
                         return -1;
                     if (def->tag == CMD_OPT_BOOL) {
                         copt->bvalue = 1;
+                    } else if (def->tag == CMD_OPT_VALUE) {
+                        if (*line == '\0') {
+                            fprintf(stderr, "Option %s needs a value\n", tok);
+                            return -1;
+                        }
+                        copt->string = nexttoken(&line);
                     } else {
                         assert(0);
                     }
@@ -645,19 +885,17 @@ static int parseline(struct command *cmd, char *line) {
                 fprintf(stderr, "Illegal option %s\n", tok);
             }
         } else {
-            if (curarg >= narg + nparam) {
+            if (curarg >= narg + nparam && rest == NULL) {
                 fprintf(stderr,
                  "Too many arguments. Command %s takes only %d arguments\n",
                   cmd->def->name, narg + nparam);
                 return -1;
             }
-            for (def = cmd->def->opts;
-                 def->name != NULL && !opt_def_is_arg(def);
-                 def++);
-            for (int i=0; i < curarg; i++)
-                for (; def->name != NULL && !opt_def_is_arg(def); def++);
+            def = arg_def(cmd->def, curarg);
             struct command_opt *opt =
                 make_command_opt(cmd, def);
+            if (opt == NULL)
+                return -1;
             opt->string = tok;
             curarg += 1;
         }
@@ -675,6 +913,7 @@ static const struct command_def const *commands[] = {
     &cmd_list_def,
     &cmd_dump_xml_def,
     &cmd_define_def,
+    &cmd_define_roots_def,
     &cmd_undefine_def,
     &cmd_if_up_def,
     &cmd_if_down_def,
@@ -725,6 +964,29 @@ static void usage(void) {
             "  -r, --root ROOT    use ROOT as the root of the filesystem\n\n");
     fprintf(stderr,
             "  -d, --debug        Show debugging output\n\n");
+    fprintf(stderr,
+            "  -s, --stats        Show operation statistics after each command\n\n");
+    fprintf(stderr,
+            "  -f, --file FILE    Run the commands in FILE, one per line; read\n"
+            "                     them from standard input if FILE is '-'\n\n");
+    fprintf(stderr,
+            "  -e, --stop-on-error\n"
+            "                     Stop running commands after the first failure\n\n");
+    fprintf(stderr,
+            "  -t, --transaction  Run all commands from a file or standard input\n"
+            "                     between change-begin and change-commit, and\n"
+            "                     roll back if one of them fails\n\n");
+    fprintf(stderr,
+            "  -T, --timing       Show how long each command took\n\n");
+#ifdef NCFTOOL_DAEMON
+    fprintf(stderr,
+            "  -D, --daemon SOCKET\n"
+            "                     Keep running and serve commands to clients\n"
+            "                     connecting to the local socket SOCKET\n\n");
+    fprintf(stderr,
+            "  -c, --connect SOCKET\n"
+            "                     Run commands in the daemon listening on SOCKET\n\n");
+#endif
 
     exit(EXIT_FAILURE);
 }
@@ -735,11 +997,20 @@ static void parse_opts(int argc, char **argv) {
         { "help",      0, 0, 'h' },
         { "root",      1, 0, 'r' },
         { "debug",     0, 0, 'd' },
+        { "stats",     0, 0, 's' },
+        { "file",      1, 0, 'f' },
+        { "stop-on-error", 0, 0, 'e' },
+        { "transaction", 0, 0, 't' },
+        { "timing",    0, 0, 'T' },
+#ifdef NCFTOOL_DAEMON
+        { "daemon",    1, 0, 'D' },
+        { "connect",   1, 0, 'c' },
+#endif
         { 0, 0, 0, 0}
     };
     int idx;
 
-    while ((opt = getopt_long(argc, argv, "+dhr:", options, &idx)) != -1) {
+    while ((opt = getopt_long(argc, argv, "+dhr:sf:etTD:c:", options, &idx)) != -1) {
         switch(opt) {
         case 'd':
             setenv("NETCF_DEBUG", "1", 1);
@@ -750,6 +1021,29 @@ static void parse_opts(int argc, char **argv) {
         case 'r':
             root = optarg;
             break;
+        case 's':
+            print_stats = true;
+            break;
+        case 'f':
+            script = optarg;
+            break;
+        case 'e':
+            stop_on_error = true;
+            break;
+        case 't':
+            use_transaction = true;
+            break;
+        case 'T':
+            print_timing = true;
+            break;
+#ifdef NCFTOOL_DAEMON
+        case 'D':
+            daemon_path = optarg;
+            break;
+        case 'c':
+            connect_path = optarg;
+            break;
+#endif
         default:
             usage();
             break;
@@ -768,11 +1062,573 @@ static void print_netcf_error(void) {
     }
 }
 
+/* Print the statistics gathered while running the last command and
+ * start counting afresh */
+static void print_netcf_stats(void) {
+    struct netcf_stat *stats = NULL;
+    int nstats;
+
+    nstats = ncf_get_stats(ncf, NULL, 0);
+    if (nstats <= 0 || ALLOC_N(stats, nstats) < 0)
+        return;
+    nstats = ncf_get_stats(ncf, stats, nstats);
+    for (int i=0; i < nstats; i++) {
+        if (stats[i].count == 0)
+            continue;
+        fprintf(stderr, "stats: %-14s %8llu %10llu us\n",
+                stats[i].name, stats[i].count, stats[i].usecs);
+    }
+    free(stats);
+    ncf_reset_stats(ncf);
+}
+
+#ifdef NCFTOOL_DAEMON
+/*
+ * Daemon and client mode
+ *
+ * Clients and the daemon exchange messages over a local stream socket.
+ * Every message starts with a header of two 32 bit numbers in network
+ * byte order, a status and the length of the payload that follows. A
+ * request carries a command line as payload and a status of 0; the
+ * response carries everything the command printed and the
+ * enum command_result it returned as status.
+ */
+#define MAX_MSG_LEN (16 * 1024 * 1024)
+#define MAX_CLIENTS 64
+#define MSG_HDR_LEN (2 * sizeof(uint32_t))
+/* How long the daemon waits for a client to take its response */
+#define CLIENT_SEND_TIMEOUT 5
+
+/* What the daemon has read from a client so far; requests are read
+ * without blocking, so that a client that sends half a request can not
+ * hold up the others */
+struct client {
+    char   *buf;
+    size_t  len;
+    size_t  size;
+};
+
+static volatile sig_atomic_t daemon_quit = 0;
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_msg(int fd, uint32_t status, const char *data, size_t len) {
+    uint32_t hdr[2];
+
+    if (len > MAX_MSG_LEN)
+        return -1;
+    hdr[0] = htonl(status);
+    hdr[1] = htonl(len);
+    if (write_all(fd, hdr, sizeof(hdr)) < 0)
+        return -1;
+    return write_all(fd, data, len);
+}
+
+/* Read one message from FD. The payload is returned NUL-terminated in
+ * *DATA and must be freed by the caller. Returns 0 on success, -1 on
+ * error or when the other end closed the connection.
+ */
+static int recv_msg(int fd, uint32_t *status, char **data, size_t *len) {
+    uint32_t hdr[2];
+
+    *data = NULL;
+    if (read_all(fd, hdr, sizeof(hdr)) < 0)
+        return -1;
+    *status = ntohl(hdr[0]);
+    *len = ntohl(hdr[1]);
+    if (*len > MAX_MSG_LEN || ALLOC_N(*data, *len + 1) < 0)
+        return -1;
+    if (read_all(fd, *data, *len) < 0) {
+        FREE(*data);
+        return -1;
+    }
+    return 0;
+}
+
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+    MEMZERO(addr, 1);
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static int connect_daemon(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (unix_address(path, &addr) < 0)
+        return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Failed to connect to %s: %s\n", path,
+                strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Write the token DIR/TOK, or just TOK if DIR is NULL, to OUT so that
+ * nexttoken reads it back in one piece */
+static int write_token(FILE *out, const char *dir, const char *tok) {
+    const char *quot = "";
+    bool plain = *tok != '\0';
+    char first = dir != NULL ? *dir : *tok;
+
+    if (first == '\'' || first == '"')
+        plain = false;
+    for (const char *s = dir; plain && s != NULL && *s; s++)
+        plain = !isblank(*s);
+    for (const char *s = tok; plain && *s; s++)
+        plain = !isblank(*s);
+    if (! plain) {
+        if (strchr(tok, '\'') == NULL
+            && (dir == NULL || strchr(dir, '\'') == NULL))
+            quot = "'";
+        else if (strchr(tok, '"') == NULL
+                 && (dir == NULL || strchr(dir, '"') == NULL))
+            quot = "\"";
+        else
+            return -1;
+    }
+    fprintf(out, " %s%s%s%s%s", quot, dir != NULL ? dir : "",
+            dir != NULL ? "/" : "", tok, quot);
+    return 0;
+}
+
+/* The daemon has its own working directory; turn the relative file names
+ * in LINE into absolute ones so that they name the same files as they
+ * would for a local command. Sets *RESULT to the new line */
+static int absolute_paths(const char *line, char **result) {
+    const struct command_def *cmd_def;
+    const struct command_opt_def *def;
+    char *copy = NULL, *rest, *tok, *cwd = NULL, *buf = NULL;
+    size_t size;
+    FILE *out = NULL;
+    int curarg = 0, r = -1;
+
+    *result = NULL;
+    copy = strdup(line);
+    if (copy == NULL)
+        goto error;
+    rest = copy;
+    tok = nexttoken(&rest);
+    cmd_def = lookup_cmd_def(tok);
+    if (cmd_def == NULL) {
+        /* The daemon complains about that */
+        *result = copy;
+        copy = NULL;
+        strcpy(*result, line);
+        r = 0;
+        goto done;
+    }
+
+    cwd = getcwd(NULL, 0);
+    out = open_memstream(&buf, &size);
+    if (cwd == NULL || out == NULL)
+        goto error;
+    fputs(tok, out);
+    while (*rest != '\0') {
+        const char *dir = NULL;
+
+        tok = nexttoken(&rest);
+        if (tok[0] == '-') {
+            const char *opt = tok + (tok[1] == '-' ? 2 : 1);
+
+            if (write_token(out, NULL, tok) < 0)
+                goto quote;
+            for (def = cmd_def->opts; def->name != NULL; def++) {
+                if (STREQ(opt, def->name))
+                    break;
+            }
+            if (def->tag == CMD_OPT_VALUE && *rest != '\0') {
+                tok = nexttoken(&rest);
+                if (write_token(out, NULL, tok) < 0)
+                    goto quote;
+            }
+            continue;
+        }
+        def = arg_def(cmd_def, curarg++);
+        if (def != NULL && def->path && tok[0] != '/' && tok[0] != '\0')
+            dir = cwd;
+        if (write_token(out, dir, tok) < 0)
+            goto quote;
+    }
+    r = fclose(out);
+    out = NULL;
+    if (r != 0) {
+        r = -1;
+        goto error;
+    }
+    *result = buf;
+    buf = NULL;
+    goto done;
+
+ error:
+    fprintf(stderr, "Failed to make the file names absolute: %s\n",
+            strerror(errno));
+    goto done;
+ quote:
+    fprintf(stderr, "Can not pass %s on to the daemon\n", tok);
+ done:
+    if (out != NULL)
+        fclose(out);
+    free(buf);
+    free(cwd);
+    free(copy);
+    return r;
+}
+
+/* Run LINE in the daemon and print what it printed */
+static int run_remote_command(const char *line, int *cmdstatus) {
+    uint32_t status;
+    char *output = NULL, *request = NULL;
+    size_t len;
+
+    if (absolute_paths(line, &request) < 0) {
+        *cmdstatus = CMD_RES_ERR;
+        return -1;
+    }
+    if (send_msg(client_fd, 0, request, strlen(request)) < 0 ||
+        recv_msg(client_fd, &status, &output, &len) < 0) {
+        fprintf(stderr, "Lost connection to the daemon\n");
+        free(request);
+        *cmdstatus = CMD_RES_ERR;
+        return -1;
+    }
+    free(request);
+    fwrite(output, 1, len, stdout);
+    fflush(stdout);
+    free(output);
+
+    *cmdstatus = status;
+    return (status == CMD_RES_OK || status == CMD_RES_QUIT) ? 0 : -1;
+}
+
+/* Run LINE for a client and send it the response. Anything the command
+ * prints to stdout or stderr becomes part of the response */
+static int serve_command(int fd, const char *line) {
+    FILE *out = NULL;
+    char *output = NULL;
+    size_t len = 0;
+    int saved_stdout = -1, saved_stderr = -1;
+    int cmdstatus = CMD_RES_ERR, r = -1;
+
+    out = tmpfile();
+    if (out == NULL)
+        goto done;
+
+    fflush(stdout);
+    fflush(stderr);
+    saved_stdout = dup(STDOUT_FILENO);
+    saved_stderr = dup(STDERR_FILENO);
+    if (saved_stdout < 0 || saved_stderr < 0)
+        goto done;
+    dup2(fileno(out), STDOUT_FILENO);
+    dup2(fileno(out), STDERR_FILENO);
+
+    run_command_line(line, &cmdstatus);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_stdout, STDOUT_FILENO);
+    dup2(saved_stderr, STDERR_FILENO);
+
+    rewind(out);
+    output = fread_file(out, &len);
+    if (output == NULL)
+        goto done;
+    /* QUIT only ends the client's session, not the daemon */
+    r = send_msg(fd, cmdstatus, output, len);
+
+ done:
+    if (saved_stdout >= 0)
+        close(saved_stdout);
+    if (saved_stderr >= 0)
+        close(saved_stderr);
+    if (out != NULL)
+        fclose(out);
+    free(output);
+    return r;
+}
+
+/* Read the pending change events; reading them invalidates whatever
+ * they affect in netcf's caches */
+static void drain_events(void) {
+    struct netcf_event events[32];
+
+    while (ncf_read_events(ncf, events, ARRAY_CARDINALITY(events))
+           == ARRAY_CARDINALITY(events))
+        ;
+}
+
+static void daemon_signal(int sig ATTRIBUTE_UNUSED) {
+    daemon_quit = 1;
+}
+
+/* Read whatever FD has for us into CLIENT without blocking. Returns -1 if
+ * the client went away or sent something we can't make sense of */
+static int client_read(int fd, struct client *client) {
+    for (;;) {
+        ssize_t n;
+
+        if (client->size - client->len < 4096) {
+            if (client->size >= MSG_HDR_LEN + MAX_MSG_LEN + 1
+                || REALLOC_N(client->buf, client->size + 65536) < 0)
+                return -1;
+            client->size += 65536;
+        }
+        n = recv(fd, client->buf + client->len,
+                 client->size - client->len, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n <= 0)
+            return -1;
+        client->len += n;
+    }
+}
+
+/* If CLIENT has a complete request, take it out of its buffer and put its
+ * command line into *LINE. Returns 1 if there was a request, 0 if there
+ * is no complete one yet, and -1 on error */
+static int client_request(struct client *client, char **line) {
+    uint32_t hdr[2];
+    size_t len, msg_len;
+
+    if (client->len < MSG_HDR_LEN)
+        return 0;
+    memcpy(hdr, client->buf, MSG_HDR_LEN);
+    len = ntohl(hdr[1]);
+    if (len > MAX_MSG_LEN)
+        return -1;
+    msg_len = MSG_HDR_LEN + len;
+    if (client->len < msg_len)
+        return 0;
+
+    *line = strndup(client->buf + MSG_HDR_LEN, len);
+    if (*line == NULL)
+        return -1;
+    memmove(client->buf, client->buf + msg_len, client->len - msg_len);
+    client->len -= msg_len;
+    return 1;
+}
+
+/* Only serve clients running as our own user, or root */
+static bool client_allowed(int fd) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return false;
+    return cred.uid == 0 || cred.uid == geteuid();
+#else
+    /* The socket is only accessible to our user; see listen_unix */
+    return fd >= 0;
+#endif
+}
+
+/* Create a socket listening on PATH that only our user can connect to.
+ * A stale socket from an earlier daemon is removed, but anything else
+ * at PATH is left alone */
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    mode_t old_umask;
+    int fd, r;
+
+    if (unix_address(path, &addr) < 0)
+        return -1;
+
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            errno = EEXIST;
+            return -1;
+        }
+        if (unlink(path) < 0)
+            return -1;
+    } else if (errno != ENOENT) {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    old_umask = umask(S_IRWXG|S_IRWXO);
+    r = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    umask(old_umask);
+    if (r < 0 || chmod(path, S_IRUSR|S_IWUSR) < 0 || listen(fd, 16) < 0) {
+        if (r == 0)
+            unlink(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Serve commands to clients connecting to the socket PATH until we get
+ * SIGTERM or SIGINT. The configuration and live state are cached between
+ * commands and invalidated when we notice that they changed.
+ */
+static int run_daemon(const char *path) {
+    struct pollfd fds[2 + MAX_CLIENTS];
+    struct client clients[2 + MAX_CLIENTS];
+    struct sigaction sa;
+    int listen_fd = -1, event_fd;
+    int nclients = 0, ret = -1;
+
+    MEMZERO(clients, ARRAY_CARDINALITY(clients));
+
+    listen_fd = listen_unix(path);
+    if (listen_fd < 0)
+        goto error;
+
+    /* Only keep what we can tell has changed */
+    event_fd = ncf_get_event_fd(ncf);
+    if (event_fd < 0)
+        print_netcf_error();
+    else if (ncf_set_caching(ncf, NETCF_CACHE_CONFIG|NETCF_CACHE_STATE) < 0)
+        goto error;
+
+    MEMZERO(&sa, 1);
+    sa.sa_handler = daemon_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    fds[0].fd = listen_fd;
+    fds[1].fd = event_fd;
+    for (int i=0; i < 2; i++)
+        fds[i].events = POLLIN;
+
+    while (!daemon_quit) {
+        int r = poll(fds, 2 + nclients, -1);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            goto error;
+        }
+
+        /* Look at changes before serving anything, so that a client
+         * that changed something and then asks about it sees its change */
+        if (fds[1].revents & POLLIN)
+            drain_events();
+
+        for (int i = 2; i < 2 + nclients; i++) {
+            char *line = NULL;
+            bool drop;
+
+            if (fds[i].revents == 0)
+                continue;
+            drop = !(fds[i].revents & POLLIN)
+                || client_read(fds[i].fd, clients + i) < 0;
+            while (!drop && (r = client_request(clients + i, &line)) != 0) {
+                drop = r < 0 || serve_command(fds[i].fd, line) < 0;
+                FREE(line);
+            }
+            if (drop) {
+                close(fds[i].fd);
+                free(clients[i].buf);
+                fds[i] = fds[2 + nclients - 1];
+                clients[i] = clients[2 + nclients - 1];
+                MEMZERO(clients + 2 + nclients - 1, 1);
+                nclients -= 1;
+                i -= 1;
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            struct timeval tv = { .tv_sec = CLIENT_SEND_TIMEOUT };
+            int fd = accept(listen_fd, NULL, NULL);
+
+            if (fd >= 0 && nclients < MAX_CLIENTS && client_allowed(fd)
+                && setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO,
+                              &tv, sizeof(tv)) == 0) {
+                fds[2 + nclients].fd = fd;
+                fds[2 + nclients].events = POLLIN;
+                fds[2 + nclients].revents = 0;
+                nclients += 1;
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    ret = 0;
+
+ error:
+    if (ret < 0)
+        fprintf(stderr, "Daemon on %s failed: %s\n", path, strerror(errno));
+    for (int i = 2; i < 2 + nclients; i++) {
+        close(fds[i].fd);
+        free(clients[i].buf);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path);
+    }
+    return ret;
+}
+#endif /* NCFTOOL_DAEMON */
+
+static double now_msecs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 static int run_command_line(const char *line, int *cmdstatus)
 {
     struct command cmd;
     char *dup_line;
     int ret = 0;
+    double start = now_msecs();
+
+#ifdef NCFTOOL_DAEMON
+    if (client_fd >= 0) {
+        ret = run_remote_command(line, cmdstatus);
+        if (print_timing)
+            fprintf(stderr, "time: %s: %.3f ms\n", line, now_msecs() - start);
+        return ret;
+    }
+#endif
 
     MEMZERO(&cmd, 1);
 
@@ -800,6 +1656,11 @@ static int run_command_line(const char *line, int *cmdstatus)
             ret = 0;
             break;
         }
+        if (print_timing)
+            fprintf(stderr, "time: %s: %.3f ms\n", cmd.def->name,
+                    now_msecs() - start);
+        if (print_stats)
+            print_netcf_stats();
     } else {
         ret = -1;
         *cmdstatus = CMD_RES_UNKNOWN;
@@ -838,6 +1699,64 @@ static int main_loop(void) {
     }
 }
 
+/* Run the commands read from IN, one per line, all against the one netcf
+ * handle. Empty lines and lines starting with '#' are ignored. Returns 0
+ * if all commands succeeded, -1 otherwise.
+ */
+static int run_batch(FILE *in) {
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int ret = 0, cmdstatus;
+
+    if (use_transaction && run_command_line("change-begin", &cmdstatus) < 0)
+        return -1;
+
+    while ((len = getline(&line, &size, in)) != -1) {
+        char *cmd = line;
+
+        if (len > 0 && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+        while (isblank(*cmd))
+            cmd += 1;
+        if (*cmd == '\0' || *cmd == '#')
+            continue;
+
+        if (run_command_line(cmd, &cmdstatus) < 0) {
+            ret = -1;
+            if (stop_on_error)
+                break;
+        } else if (cmdstatus == CMD_RES_QUIT) {
+            break;
+        }
+    }
+    free(line);
+
+    if (use_transaction) {
+        if (run_command_line(ret == 0 ? "change-commit" : "change-rollback",
+                             &cmdstatus) < 0)
+            ret = -1;
+    }
+    return ret;
+}
+
+static int run_script(const char *path) {
+    FILE *in;
+    int r;
+
+    if (STREQ(path, "-"))
+        return run_batch(stdin);
+
+    in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    r = run_batch(in);
+    fclose(in);
+    return r;
+}
+
 int main(int argc, char **argv) {
     int r = 0;
 
@@ -845,6 +1764,18 @@ int main(int argc, char **argv) {
 
     parse_opts(argc, argv);
 
+#ifdef NCFTOOL_DAEMON
+    if (connect_path != NULL) {
+        /* All the work happens in the daemon, in its root */
+        if (root != NULL) {
+            fprintf(stderr, "--root can not be combined with --connect\n");
+            exit(EXIT_FAILURE);
+        }
+        client_fd = connect_daemon(connect_path);
+        if (client_fd < 0)
+            exit(EXIT_FAILURE);
+    } else
+#endif
     if (ncf_init(&ncf, root) < 0) {
         fprintf(stderr, "Failed to initialize netcf\n");
         if (ncf != NULL)
@@ -852,7 +1783,24 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
     readline_init();
-    if (optind < argc) {
+#ifdef NCFTOOL_DAEMON
+    if (daemon_path != NULL) {
+        if (optind < argc || script != NULL || connect_path != NULL) {
+            fprintf(stderr, "--daemon can not be combined with commands\n");
+            exit(EXIT_FAILURE);
+        }
+        r = run_daemon(daemon_path);
+        ncf_close(ncf);
+        return r == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+#endif
+    if (script != NULL) {
+        if (optind < argc) {
+            fprintf(stderr, "A command can not be given together with --file\n");
+            exit(EXIT_FAILURE);
+        }
+        r = run_script(script);
+    } else if (optind < argc) {
         /* Run a single command */
         int i, ignore_status;
         int cmdsize = 0;
@@ -876,6 +1824,9 @@ int main(int argc, char **argv) {
 
         r = run_command_line(cmd, &ignore_status);
         free(cmd);
+    } else if (!isatty(STDIN_FILENO)) {
+        /* Commands are piped in */
+        r = run_batch(stdin);
     } else {
         r = main_loop();
     }
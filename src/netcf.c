@@ -56,6 +56,22 @@ static const char *const errmsgs[] = {
     "Operation invalid in this state"     /* EINVALIDOP */
 };
 
+/* Names of the statistics. This array is indexed by NETCF_STAT_T */
+static const char *const stat_names[] = {
+    "aug_load",                           /* AUG_LOAD */
+    "aug_match",                          /* AUG_MATCH */
+    "aug_save",                           /* AUG_SAVE */
+    "files_parsed",                       /* FILES_PARSED */
+    "xslt",                               /* XSLT */
+    "rng_validate",                       /* RNG_VALIDATE */
+    "netlink_dump",                       /* NETLINK_DUMP */
+    "netlink_retry",                      /* NETLINK_RETRY */
+    "ioctl",                              /* IOCTL */
+    "run_program",                        /* RUN_PROGRAM */
+    "files_written",                      /* FILES_WRITTEN */
+    "keys_written"                        /* KEYS_WRITTEN */
+};
+
 int ncf_init(struct netcf **ncf, const char *root) {
     *ncf = NULL;
     if (make_ref(*ncf) < 0)
@@ -78,11 +94,21 @@ int ncf_init(struct netcf **ncf, const char *root) {
     if ((*ncf)->root == NULL)
         goto error;
     (*ncf)->data_dir = getenv("NETCF_DATADIR");
+#ifdef NETCF_EMBED_DATA
+    /* Setting NETCF_DATADIR makes us use the files in it instead of the
+     * compiled-in copies, so that stylesheets can be changed without
+     * rebuilding the library */
+    if ((*ncf)->data_dir == NULL)
+        (*ncf)->embedded = embedded_files;
+#endif
     if ((*ncf)->data_dir == NULL)
         (*ncf)->data_dir = NETCF_DATADIR "/netcf";
     (*ncf)->debug = getenv("NETCF_DEBUG") != NULL;
-    (*ncf)->rng = rng_parse(*ncf, "interface.rng");
-    ERR_BAIL(*ncf);
+    /* Nothing a netcf_if caches is good before the tree is loaded */
+    (*ncf)->config_gen = 1;
+    /* The schema, stylesheets and netlink caches are set up on first
+     * use, so that callers who only list interfaces or bring one down
+     * don't pay for them */
     return drv_init(*ncf);
 error:
     ncf_close(*ncf);
@@ -98,11 +124,13 @@ int ncf_close(struct netcf *ncf) {
 
     ERR_COND_BAIL(ncf->ref > 1, ncf, EINUSE);
 
+    API_EXIT(ncf);
     drv_close(ncf);
     xmlRelaxNGFree(ncf->rng);
     unref(ncf, netcf);
     return 0;
  error:
+    API_EXIT(ncf);
     return -1;
 }
 
@@ -113,8 +141,12 @@ int ncf_close(struct netcf *ncf) {
  * Maybe we should just list them as STRUCT NETCF_IF *
  */
 int ncf_num_of_interfaces(struct netcf *ncf, unsigned int flags) {
+    int result;
+
     API_ENTRY(ncf);
-    return drv_num_of_interfaces(ncf, flags);
+    result = drv_num_of_interfaces(ncf, flags);
+    API_EXIT(ncf);
+    return result;
 }
 
 int ncf_list_interfaces(struct netcf *ncf, int maxnames, char **names, unsigned int flags) {
@@ -126,19 +158,28 @@ int ncf_list_interfaces(struct netcf *ncf, int maxnames, char **names, unsigned
     if (result < 0)
         for (int i=0; i < maxnames; i++)
             FREE(names[i]);
+    API_EXIT(ncf);
     return result;
 }
 
 struct netcf_if * ncf_lookup_by_name(struct netcf *ncf, const char *name) {
-    API_ENTRY(ncf);
-    return drv_lookup_by_name(ncf, name);
+    struct netcf_if *result;
+
+    API_ENTRY_NAME(ncf, name);
+    result = drv_lookup_by_name(ncf, name);
+    API_EXIT(ncf);
+    return result;
 }
 
 int
 ncf_lookup_by_mac_string(struct netcf *ncf, const char *mac,
                          int maxifaces, struct netcf_if **ifaces) {
+    int result;
+
     API_ENTRY(ncf);
-    return drv_lookup_by_mac_string(ncf, mac, maxifaces, ifaces);
+    result = drv_lookup_by_mac_string(ncf, mac, maxifaces, ifaces);
+    API_EXIT(ncf);
+    return result;
 }
 
 /*
@@ -148,46 +189,112 @@ ncf_lookup_by_mac_string(struct netcf *ncf, const char *mac,
 /* Define a new interface */
 struct netcf_if *
 ncf_define(struct netcf *ncf, const char *xml) {
+    struct netcf_if *result;
+
     API_ENTRY(ncf);
-    return drv_define(ncf, xml);
+    result = drv_define(ncf, xml);
+    /* A failed define may leave a half-modified tree behind */
+    if (result == NULL)
+        ncf->stale |= NETCF_CACHE_CONFIG;
+    API_EXIT(ncf);
+    return result;
+}
+
+char *ncf_define_preview(struct netcf *ncf, const char *xml) {
+    char *result;
+
+    API_ENTRY(ncf);
+    result = drv_define_preview(ncf, xml);
+    /* The tree holds the previewed changes until it is reloaded */
+    ncf->stale |= NETCF_CACHE_CONFIG;
+    API_EXIT(ncf);
+    return result;
+}
+
+int ncf_define_roots(struct netcf *ncf, int nxml, const char *const *xmls,
+                     int nroots, const char *const *roots, int nthreads,
+                     netcf_errcode_t *errcodes, char **errdetails) {
+    int result = -1;
+
+    API_ENTRY(ncf);
+    ERR_THROW(nxml < 0 || nroots < 0 || nthreads < 0, ncf, EOTHER,
+              "negative count passed to ncf_define_roots");
+    result = drv_define_roots(ncf, nxml, xmls, nroots, roots, nthreads,
+                              errcodes, errdetails);
+ error:
+    API_EXIT(ncf);
+    return result;
 }
 
 const char *ncf_if_name(struct netcf_if *nif) {
-    API_ENTRY(nif->ncf);
+    API_IF_ENTRY(nif);
+    API_EXIT(nif->ncf);
     return nif->name;
 }
 
 const char *ncf_if_mac_string(struct netcf_if *nif) {
-    API_ENTRY(nif->ncf);
-    return drv_mac_string(nif);
+    const char *result;
+
+    API_IF_ENTRY(nif);
+    result = drv_mac_string(nif);
+    API_EXIT(nif->ncf);
+    return result;
 }
 
 /* Delete the definition */
 int ncf_if_undefine(struct netcf_if *nif) {
-    API_ENTRY(nif->ncf);
-    return drv_undefine(nif);
+    int result;
+
+    API_IF_ENTRY(nif);
+    result = drv_undefine(nif);
+    if (result < 0)
+        nif->ncf->stale |= NETCF_CACHE_CONFIG;
+    API_EXIT(nif->ncf);
+    return result;
 }
 
 /* Bring the interface up */
 int ncf_if_up(struct netcf_if *nif) {
+    int result;
+
     /* I'm a bit concerned that this assumes nif (and nif->ncf) is non-NULL) */
-    API_ENTRY(nif->ncf);
-    return drv_if_up(nif);
+    API_IF_ENTRY(nif);
+    result = drv_if_up(nif, 0, 0);
+    API_EXIT(nif->ncf);
+    return result;
+}
+
+/* Bring the interface up and wait for it to become active */
+int ncf_if_up_wait(struct netcf_if *nif, int timeout_ms, unsigned int flags) {
+    int result;
+
+    API_IF_ENTRY(nif);
+    result = drv_if_up(nif, timeout_ms, flags);
+    API_EXIT(nif->ncf);
+    return result;
 }
 
 /* Take it down */
 int ncf_if_down(struct netcf_if *nif) {
+    int result;
+
     /* I'm a bit concerned that this assumes nif (and nif->ncf) is non-NULL) */
-    API_ENTRY(nif->ncf);
-    return drv_if_down(nif);
+    API_IF_ENTRY(nif);
+    result = drv_if_down(nif);
+    API_EXIT(nif->ncf);
+    return result;
 }
 
 /* Produce an XML description for the interface, in the same format that
  * NCF_DEFINE expects
  */
 char *ncf_if_xml_desc(struct netcf_if *nif) {
-    API_ENTRY(nif->ncf);
-    return drv_xml_desc(nif);
+    char *result;
+
+    API_IF_ENTRY(nif);
+    result = drv_xml_desc(nif);
+    API_EXIT(nif->ncf);
+    return result;
 }
 
 /* Produce an XML description of the current live state of the
@@ -196,37 +303,79 @@ char *ncf_if_xml_desc(struct netcf_if *nif) {
  * the current IP address of an interface that uses DHCP)
  */
 char *ncf_if_xml_state(struct netcf_if *nif) {
-    API_ENTRY(nif->ncf);
-    return drv_xml_state(nif);
+    char *result;
+
+    API_IF_ENTRY(nif);
+    result = drv_xml_state(nif);
+    API_EXIT(nif->ncf);
+    return result;
+}
+
+char *ncf_all_xml_state(struct netcf *ncf, unsigned int flags) {
+    char *result;
+
+    API_ENTRY(ncf);
+    result = drv_all_xml_state(ncf, flags);
+    API_EXIT(ncf);
+    return result;
 }
 
 /* Report various status info about the interface as bits in
  * "flags". Returns 0 on success, -1 on failure
  */
 int ncf_if_status(struct netcf_if *nif, unsigned int *flags) {
-    API_ENTRY(nif->ncf);
-    return drv_if_status(nif, flags);
+    int result;
+
+    API_IF_ENTRY(nif);
+    result = drv_if_status(nif, flags);
+    API_EXIT(nif->ncf);
+    return result;
+}
+
+int ncf_if_stats(struct netcf_if *nif, struct netcf_if_stats *stats) {
+    int result;
+
+    API_IF_ENTRY(nif);
+    result = drv_if_stats(nif, stats);
+    API_EXIT(nif->ncf);
+    return result;
 }
 
 int
 ncf_change_begin(struct netcf *ncf, unsigned int flags)
 {
+    int result;
+
     API_ENTRY(ncf);
-    return drv_change_begin(ncf, flags);
+    result = drv_change_begin(ncf, flags);
+    if (result == 0)
+        ncf->in_change = 1;
+    API_EXIT(ncf);
+    return result;
 }
 
 int
 ncf_change_rollback(struct netcf *ncf, unsigned int flags)
 {
+    int result;
+
     API_ENTRY(ncf);
-    return drv_change_rollback(ncf, flags);
+    result = drv_change_rollback(ncf, flags);
+    ncf->in_change = 0;
+    API_EXIT(ncf);
+    return result;
 }
 
 int
 ncf_change_commit(struct netcf *ncf, unsigned int flags)
 {
+    int result;
+
     API_ENTRY(ncf);
-    return drv_change_commit(ncf, flags);
+    result = drv_change_commit(ncf, flags);
+    ncf->in_change = 0;
+    API_EXIT(ncf);
+    return result;
 }
 
 /* Release any resources used by this NETCF_IF; the pointer is invalid
@@ -251,6 +400,119 @@ int ncf_error(struct netcf *ncf, const char **errmsg, const char **details) {
     return errcode;
 }
 
+int ncf_get_stats(struct netcf *ncf, struct netcf_stat *stats, int nstats) {
+    API_ENTRY(ncf);
+
+    for (int i=0; i < nstats && i < NETCF_STAT_LAST; i++) {
+        stats[i].name = stat_names[i];
+        stats[i].count = ncf->stat_count[i];
+        stats[i].usecs = ncf->stat_usecs[i];
+    }
+    API_EXIT(ncf);
+    return NETCF_STAT_LAST;
+}
+
+int ncf_reset_stats(struct netcf *ncf) {
+    API_ENTRY(ncf);
+
+    MEMZERO(ncf->stat_count, NETCF_STAT_LAST);
+    MEMZERO(ncf->stat_usecs, NETCF_STAT_LAST);
+    API_EXIT(ncf);
+    return 0;
+}
+
+int ncf_set_caching(struct netcf *ncf, unsigned int flags) {
+    API_ENTRY(ncf);
+
+    /* Whatever we have cached so far may already be out of date */
+    ncf->stale |= flags & ~ncf->caching;
+    ncf->caching = flags;
+    API_EXIT(ncf);
+    return 0;
+}
+
+int ncf_invalidate(struct netcf *ncf, unsigned int flags) {
+    API_ENTRY(ncf);
+
+    ncf->stale |= flags;
+    API_EXIT(ncf);
+    return 0;
+}
+
+int ncf_set_durability(struct netcf *ncf, netcf_durability_t mode) {
+    API_ENTRY(ncf);
+
+    ERR_THROW(mode != NETCF_DURABILITY_NONE && mode != NETCF_DURABILITY_FSYNC
+              && mode != NETCF_DURABILITY_BATCHED, ncf, EOTHER,
+              "unknown durability mode %d", mode);
+    ncf->durability = mode;
+    API_EXIT(ncf);
+    return 0;
+ error:
+    API_EXIT(ncf);
+    return -1;
+}
+
+int ncf_set_netlink_rcvbuf(struct netcf *ncf, int bytes) {
+    API_ENTRY(ncf);
+
+    ERR_THROW(bytes < 0, ncf, EOTHER,
+              "invalid netlink receive buffer size %d", bytes);
+    ncf->nl_rcvbuf = bytes;
+    API_EXIT(ncf);
+    return 0;
+ error:
+    API_EXIT(ncf);
+    return -1;
+}
+
+int ncf_set_state_flags(struct netcf *ncf, unsigned int flags) {
+    API_ENTRY(ncf);
+
+    ERR_THROW(flags & ~NETCF_STATE_STATS, ncf, EOTHER,
+              "unknown state flags 0x%x", flags & ~NETCF_STATE_STATS);
+    ncf->state_flags = flags;
+    API_EXIT(ncf);
+    return 0;
+ error:
+    API_EXIT(ncf);
+    return -1;
+}
+
+int ncf_get_event_fd(struct netcf *ncf) {
+    int result;
+
+    API_ENTRY(ncf);
+    result = drv_get_event_fd(ncf);
+    API_EXIT(ncf);
+    return result;
+}
+
+int ncf_read_events(struct netcf *ncf, struct netcf_event *events,
+                    int maxevents) {
+    int result;
+
+    API_ENTRY(ncf);
+    result = drv_read_events(ncf, events, maxevents);
+    API_EXIT(ncf);
+    return result;
+}
+
+int ncf_set_trace_callback(struct netcf *ncf, netcf_trace_callback_t callback,
+                           void *data) {
+    API_ENTRY(ncf);
+
+    API_EXIT(ncf);
+    ncf->trace_cb = callback;
+    ncf->trace_data = data;
+    return 0;
+}
+
+void trace_event(struct netcf *ncf, netcf_trace_event_t event,
+                 const char *op, const char *ifname) {
+    ncf->trace_cb(ncf, event, stat_start(), op, ifname, ncf->trace_data);
+}
+
 /*
  * Local variables:
  *  indent-tabs-mode: nil
@@ -81,6 +81,115 @@ typedef enum {
     NETCF_IFACE_ACTIVE = 2,       /* match up interfaces */
 } netcf_if_flag_t;
 
+/* The events passed to the callback set with ncf_set_trace_callback */
+typedef enum {
+    NETCF_TRACE_BEGIN = 0,        /* an operation started */
+    NETCF_TRACE_END = 1           /* an operation finished */
+} netcf_trace_event_t;
+
+/* Callback for tracing. TIMESTAMP is in microseconds from a monotonic
+ * clock. OP is the name of the public function, like "ncf_define", or of
+ * a stage inside it, like "get_augeas", "apply_stylesheet",
+ * "rng_validate", "run_program" or "add_state_to_xml_doc". IFNAME is the
+ * name of the interface the public function was called for, or NULL.
+ * DATA is the pointer passed to ncf_set_trace_callback.
+ *
+ * The callback must not call back into netcf with the same NCF.
+ */
+typedef void (*netcf_trace_callback_t)(struct netcf *ncf,
+                                       netcf_trace_event_t event,
+                                       unsigned long long timestamp,
+                                       const char *op, const char *ifname,
+                                       void *data);
+
+/*
+ * flags accepted by ncf_set_caching and ncf_invalidate
+ */
+typedef enum {
+    NETCF_CACHE_CONFIG = 1,       /* the parsed configuration files */
+    NETCF_CACHE_STATE = 2,        /* the kernel's links and addresses */
+} netcf_cache_flag_t;
+
+/*
+ * modes accepted by ncf_set_durability
+ */
+typedef enum {
+    NETCF_DURABILITY_NONE = 0,    /* leave flushing to the OS */
+    NETCF_DURABILITY_FSYNC = 1,   /* flush every file as it is written */
+    NETCF_DURABILITY_BATCHED = 2, /* flush all files once, at the end */
+} netcf_durability_t;
+
+/*
+ * flags accepted by ncf_set_state_flags
+ */
+typedef enum {
+    NETCF_STATE_STATS = 1,        /* add a <stats> element with counters */
+} netcf_state_flag_t;
+
+/*
+ * flags accepted by ncf_if_up_wait
+ */
+typedef enum {
+    NETCF_UP_WAIT_ADDRESS = 1,    /* also wait for a usable address */
+} netcf_up_wait_flag_t;
+
+/* The kinds of changes reported by ncf_read_events */
+typedef enum {
+    NETCF_EVENT_CONFIG_CHANGED = 1, /* a configuration file was written */
+    NETCF_EVENT_CONFIG_REMOVED = 2, /* a configuration file was removed */
+    NETCF_EVENT_LINK_NEW = 3,       /* a link appeared or its flags changed */
+    NETCF_EVENT_LINK_DEL = 4,       /* a link disappeared */
+    NETCF_EVENT_ADDR_NEW = 5,       /* an address was added to a link */
+    NETCF_EVENT_ADDR_DEL = 6,       /* an address was removed from a link */
+    NETCF_EVENT_ROUTE_NEW = 7,      /* a route through a link was added */
+    NETCF_EVENT_ROUTE_DEL = 8       /* a route through a link was removed */
+} netcf_event_kind_t;
+
+#define NETCF_EVENT_NAME_LEN 64
+
+/* One change reported by ncf_read_events. NAME is the interface the
+ * change affects; it is empty if the change may affect any interface,
+ * e.g. when a file shared by all interfaces changed or when changes were
+ * lost because they happened faster than they were read.
+ */
+struct netcf_event {
+    netcf_event_kind_t kind;
+    char               name[NETCF_EVENT_NAME_LEN];
+};
+
+/* One entry of the statistics returned by ncf_get_stats */
+struct netcf_stat {
+    const char        *name;      /* name of the operation, e.g. "aug_load" */
+    unsigned long long count;     /* number of times it was performed */
+    unsigned long long usecs;     /* cumulative time spent in it, in
+                                   * microseconds */
+};
+
+/* The duplex of a link, as reported in struct netcf_if_stats */
+typedef enum {
+    NETCF_DUPLEX_UNKNOWN = 0,
+    NETCF_DUPLEX_HALF = 1,
+    NETCF_DUPLEX_FULL = 2
+} netcf_duplex_t;
+
+/* Counters and link parameters of one interface, see ncf_if_stats. The
+ * counters are those the kernel keeps since the link was created. */
+struct netcf_if_stats {
+    unsigned long long rx_bytes;
+    unsigned long long rx_packets;
+    unsigned long long rx_errors;
+    unsigned long long rx_dropped;
+    unsigned long long tx_bytes;
+    unsigned long long tx_packets;
+    unsigned long long tx_errors;
+    unsigned long long tx_dropped;
+    unsigned int       carrier_changes; /* 0 if the kernel does not say */
+    unsigned int       speed;           /* in Mb/s, 0 if unknown */
+    netcf_duplex_t     duplex;
+    unsigned int       rx_queues;       /* 0 if unknown */
+    unsigned int       tx_queues;       /* 0 if unknown */
+};
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -151,6 +260,43 @@ ncf_lookup_by_mac_string(struct netcf *, const char *mac,
 struct netcf_if *
 ncf_define(struct netcf *, const char *xml);
 
+/* Show what ncf_define would do with XML without changing anything on
+ * disk. Returns the changes to the config files as a unified diff, one
+ * per file, with paths relative to the root of the netcf instance. The
+ * string is empty if no file would change, and must be freed by the
+ * caller. Returns NULL on error.
+ */
+char *
+ncf_define_preview(struct netcf *, const char *xml);
+
+/* Define the NXML interfaces in XMLS in each of the NROOTS filesystem
+ * roots in ROOTS, for example a set of VM images, as if ncf_init had been
+ * called with each root and followed by ncf_define for every interface.
+ * The root of the NCF handle itself is not touched.
+ *
+ * Each definition is parsed, validated and transformed only once, with
+ * the schema and stylesheets of NCF, and the result is shared by all
+ * roots; only the configuration files of each root are read and written
+ * separately. Up to NTHREADS roots are worked on at the same time; with
+ * an NTHREADS of 0, one thread per online CPU is used.
+ *
+ * The definitions are saved in a root only when all of them could be put
+ * into it, with the durability set on NCF. If ERRCODES is not NULL, it
+ * must have room for NROOTS entries and receives NETCF_NOERROR for each
+ * root that was changed, and the error for each one that was not. In the
+ * same way, ERRDETAILS, if not NULL, receives the details of the error
+ * for each root that failed, and NULL for all others; the caller must
+ * free them.
+ *
+ * Returns 0 if every root was changed. Returns -1 if one of the
+ * definitions is invalid, in which case no root is changed, or if any of
+ * the roots failed; the error of NCF then describes the first of them.
+ */
+int
+ncf_define_roots(struct netcf *, int nxml, const char *const *xmls,
+                 int nroots, const char *const *roots, int nthreads,
+                 netcf_errcode_t *errcodes, char **errdetails);
+
 /* Return the name of the interface. The string can be used up until the
  * next call to a function that takes this NETCF_IF as argument
  */
@@ -163,6 +309,17 @@ const char *ncf_if_mac_string(struct netcf_if *);
 /* Bring the interface up */
 int ncf_if_up(struct netcf_if *);
 
+/* Bring the interface up like NCF_IF_UP, but give it up to TIMEOUT_MS
+ * milliseconds to become active, i.e. up and running, rather than
+ * failing if it isn't active right away, e.g. because carrier takes a
+ * moment to come up. If FLAGS contains NETCF_UP_WAIT_ADDRESS, also wait
+ * for it to have an address that is neither link-local nor tentative.
+ * Changes are noticed as the kernel announces them, without polling.
+ *
+ * Returns 0 on success, -1 on failure or when the deadline passed
+ */
+int ncf_if_up_wait(struct netcf_if *, int timeout_ms, unsigned int flags);
+
 /* Take it down */
 int ncf_if_down(struct netcf_if *);
 
@@ -181,12 +338,35 @@ char *ncf_if_xml_desc(struct netcf_if *);
  */
 char *ncf_if_xml_state(struct netcf_if *);
 
+/* Produce the XML description of the current live state of all toplevel
+ * interfaces matching FLAGS, a bitmask of NETCF_IF_FLAG_T, as one
+ * document with an <interfaces> root element. Each child is an
+ * <interface> element like the one NCF_IF_XML_STATE produces; the state
+ * of all of them is taken from the same snapshot of the kernel's links
+ * and addresses.
+ *
+ * Returns the document, which must be freed by the caller, or NULL on
+ * error.
+ */
+char *ncf_all_xml_state(struct netcf *, unsigned int flags);
+
 /* Report various status info about the interface as bits in
  * "flags". The meaning of the bits is in the enum type netcf_if_flag_t.
  * Returns 0 on success, -1 on failure
  */
 int ncf_if_status(struct netcf_if *nif, unsigned int *flags);
 
+/* Fill STATS with the traffic counters, carrier changes, speed, duplex
+ * and queue counts of the interface, without going through XML. The
+ * counters come from the same link cache as NCF_IF_XML_STATE, so that
+ * polling all interfaces costs one netlink dump; speed and duplex take
+ * one ioctl.
+ *
+ * Returns 0 on success, -1 on failure, e.g. when the interface does not
+ * exist in the kernel
+ */
+int ncf_if_stats(struct netcf_if *nif, struct netcf_if_stats *stats);
+
 /* Mark the beginning of a sequence of revertible changes to the
  * network interface configuration by saving a snapshot of all relevant
  * configuration information.
@@ -228,6 +408,121 @@ void ncf_if_free(struct netcf_if *);
  */
 int ncf_error(struct netcf *, const char **errmsg, const char **details);
 
+/* Report how often, and for how long, the netcf instance performed
+ * expensive operations, like loading config files, applying stylesheets
+ * or dumping netlink caches, since it was created or since the last call
+ * to NCF_RESET_STATS.
+ *
+ * Up to NSTATS entries are stored in the array STATS, which must be
+ * allocated by the caller. It is permissible to pass in NSTATS == 0, in
+ * which case STATS is ignored. The NAME of each entry is a static string.
+ *
+ * Returns the number of entries available, which can be larger than
+ * NSTATS, or -1 on error.
+ */
+int ncf_get_stats(struct netcf *, struct netcf_stat *stats, int nstats);
+
+/* By default, every call rereads the configuration files and asks the
+ * kernel for the current links and addresses as needed. FLAGS, a bitmask
+ * of NETCF_CACHE_FLAG_T, turns that off for the configuration, the live
+ * state, or both: they are then kept from one call to the next until
+ * NCF_INVALIDATE is called for them. This only makes sense for callers
+ * that watch for changes themselves, like a long-running daemon.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int ncf_set_caching(struct netcf *, unsigned int flags);
+
+/* Mark the caches in FLAGS, a bitmask of NETCF_CACHE_FLAG_T, as out of
+ * date so that the next call that needs them reads them afresh.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int ncf_invalidate(struct netcf *, unsigned int flags);
+
+/* Control how hard netcf tries to get changed configuration files onto
+ * disk before a call returns. Files are always replaced by writing a new
+ * file and renaming it over the old one, so that a crash leaves either
+ * the old or the new contents of each file, never a mix.
+ *
+ * With NETCF_DURABILITY_NONE, the default, nothing is flushed; after a
+ * crash, any of the files written by recent calls can still have their
+ * old contents, or be missing if they were new.
+ *
+ * With NETCF_DURABILITY_FSYNC, every file and the directory it lives in
+ * are flushed as soon as the file is written or removed, and everything
+ * NCF_DEFINE or NCF_IF_UNDEFINE changed is on disk when they return.
+ *
+ * With NETCF_DURABILITY_BATCHED, the files are flushed all at once, with
+ * one syncfs(2) per filesystem where that is available: at the end of
+ * NCF_DEFINE or NCF_IF_UNDEFINE, or, between NCF_CHANGE_BEGIN and
+ * NCF_CHANGE_COMMIT, only when the change is committed, before the
+ * snapshot is discarded. A crash during a change can therefore leave
+ * some of its files unwritten, but the snapshot to roll back to is kept.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int ncf_set_durability(struct netcf *, netcf_durability_t mode);
+
+/* Use a receive buffer of BYTES for the netlink socket that the kernel's
+ * links, addresses and routes are read from, starting with the next
+ * time they are read. A BYTES of 0 picks the default of 1MB. Dumps that
+ * overrun the buffer, or that the kernel interrupts because something
+ * changed while they ran, are retried a few times, and counted in the
+ * "netlink_retry" statistic; a host with many addresses that sees many
+ * retries needs a larger buffer. Unless the process may override
+ * net.core.rmem_max, the kernel caps the size there. On platforms
+ * without netlink, the size is ignored.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int ncf_set_netlink_rcvbuf(struct netcf *, int bytes);
+
+/* Choose what NCF_IF_XML_STATE and NCF_ALL_XML_STATE report beyond the
+ * addresses, routes and members of an interface. FLAGS is a bitmask of
+ * NETCF_STATE_FLAG_T; by default it is 0. With NETCF_STATE_STATS, each
+ * toplevel <interface> gets a <stats> element with the values that
+ * NCF_IF_STATS returns.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int ncf_set_state_flags(struct netcf *, unsigned int flags);
+
+/* Return a file descriptor that becomes readable when the interface
+ * configuration under the netcf root or the kernel's links and addresses
+ * change. Use NCF_READ_EVENTS to find out what changed. The descriptor
+ * belongs to NCF and is closed by NCF_CLOSE.
+ *
+ * Returns the descriptor, or -1 on failure
+ */
+int ncf_get_event_fd(struct netcf *);
+
+/* Read up to MAXEVENTS pending changes into EVENTS without blocking.
+ * Changes are noticed only after NCF_GET_EVENT_FD was called. Reading
+ * them also invalidates the affected caches (see NCF_INVALIDATE), so it
+ * is safe to enable caching with NCF_SET_CACHING when all changes are
+ * read.
+ *
+ * Returns the number of events stored in EVENTS, 0 if there were none,
+ * or -1 on failure
+ */
+int ncf_read_events(struct netcf *, struct netcf_event *events,
+                    int maxevents);
+
+/* Call CALLBACK with DATA at the beginning and end of every public call
+ * made with this netcf instance and of the expensive stages inside of
+ * it. Passing a NULL CALLBACK turns tracing off.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int ncf_set_trace_callback(struct netcf *, netcf_trace_callback_t callback,
+                           void *data);
+
+/* Set all counters reported by NCF_GET_STATS back to zero.
+ * Returns 0 on success, -1 on failure
+ */
+int ncf_reset_stats(struct netcf *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,176 @@
+/*
+ * mock-alloc.c: interpose the C allocator to count allocations
+ *
+ * Copyright (C) 2009 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __FreeBSD__
+#include <malloc_np.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "mock-alloc.h"
+
+/* dlsym may itself allocate before we know where the real allocator
+ * lives; those requests are served from this arena and never freed */
+#define BOOTSTRAP_SIZE 4096
+#define BOOTSTRAP_ALIGN 16
+static char bootstrap[BOOTSTRAP_SIZE]
+    __attribute__((aligned(BOOTSTRAP_ALIGN)));
+static size_t bootstrap_used;
+static int bootstrapping;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+static int tracking;
+static long long current;
+static struct alloc_usage usage;
+
+static void init_real(void) {
+    if (real_malloc != NULL)
+        return;
+    bootstrapping = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    bootstrapping = 0;
+    if (real_malloc == NULL || real_calloc == NULL ||
+        real_realloc == NULL || real_free == NULL)
+        abort();
+}
+
+static void *bootstrap_alloc(size_t size) {
+    void *p;
+
+    size = (size + BOOTSTRAP_ALIGN - 1) & ~((size_t) BOOTSTRAP_ALIGN - 1);
+    if (bootstrap_used + size > BOOTSTRAP_SIZE)
+        return NULL;
+    p = bootstrap + bootstrap_used;
+    bootstrap_used += size;
+    return p;
+}
+
+static int is_bootstrap(const void *p) {
+    return (const char *) p >= bootstrap
+        && (const char *) p < bootstrap + BOOTSTRAP_SIZE;
+}
+
+static void account_alloc(void *p) {
+    if (!tracking || p == NULL)
+        return;
+    usage.count += 1;
+    current += malloc_usable_size(p);
+    if (current > usage.peak)
+        usage.peak = current;
+}
+
+static void account_free(void *p) {
+    if (!tracking || p == NULL)
+        return;
+    /* Blocks allocated before tracking started can make this negative;
+     * that's fine since we only report the high water mark */
+    current -= malloc_usable_size(p);
+}
+
+void *malloc(size_t size) {
+    void *p;
+
+    if (bootstrapping)
+        return bootstrap_alloc(size);
+    init_real();
+    p = real_malloc(size);
+    account_alloc(p);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    void *p;
+
+    if (bootstrapping) {
+        if (size != 0 && nmemb > (size_t) -1 / size)
+            return NULL;
+        /* The arena is static, and therefore already zeroed */
+        return bootstrap_alloc(nmemb * size);
+    }
+    init_real();
+    p = real_calloc(nmemb, size);
+    account_alloc(p);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+    void *p;
+
+    if (bootstrapping || is_bootstrap(ptr)) {
+        p = malloc(size);
+        if (p != NULL && ptr != NULL) {
+            size_t avail = bootstrap + BOOTSTRAP_SIZE - (char *) ptr;
+            memcpy(p, ptr, size < avail ? size : avail);
+        }
+        return p;
+    }
+    init_real();
+    account_free(ptr);
+    p = real_realloc(ptr, size);
+    if (p == NULL && size > 0) {
+        /* The old block is still around */
+        if (tracking && ptr != NULL)
+            current += malloc_usable_size(ptr);
+        return NULL;
+    }
+    account_alloc(p);
+    return p;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL || is_bootstrap(ptr))
+        return;
+    init_real();
+    account_free(ptr);
+    real_free(ptr);
+}
+
+void alloc_track_begin(void) {
+    memset(&usage, 0, sizeof(usage));
+    current = 0;
+    tracking = 1;
+}
+
+void alloc_track_end(struct alloc_usage *u) {
+    tracking = 0;
+    *u = usage;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
+/* vim: set ts=4 sw=4 et: */
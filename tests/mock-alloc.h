@@ -0,0 +1,48 @@
+/*
+ * mock-alloc.h: count allocations made by the library under test
+ *
+ * Copyright (C) 2009 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef MOCK_ALLOC_H_
+#define MOCK_ALLOC_H_
+
+/* Linking mock-alloc.c into a test program interposes malloc, calloc,
+ * realloc and free for the whole process, including libnetcf and the
+ * libraries it uses. Between alloc_track_begin and alloc_track_end the
+ * number of allocations and the peak number of bytes held on top of
+ * what was held when tracking started are recorded.
+ */
+struct alloc_usage {
+    unsigned long long count;   /* malloc/calloc/realloc calls */
+    long long peak;             /* high water mark in bytes */
+};
+
+void alloc_track_begin(void);
+void alloc_track_end(struct alloc_usage *usage);
+
+#endif
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
+/* vim: set ts=4 sw=4 et: */
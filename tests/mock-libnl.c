@@ -0,0 +1,419 @@
+/*
+ * mock-libnl.c: serve synthetic link, address and route caches to libnetcf
+ *
+ * Copyright (C) 2009 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <netlink/netlink.h>
+#include <netlink/socket.h>
+#include <netlink/cache.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+#include <netlink/route/addr.h>
+#include <netlink/route/link.h>
+#include <netlink/route/route.h>
+#include <netlink/route/link/vlan.h>
+
+#include "internal.h"
+#include "safe-alloc.h"
+#include "mock-libnl.h"
+
+/* The links, addresses and routes are kept as libnl objects that are not part
+ * of any cache; filling a cache adds a clone of each of them */
+static struct nl_object **links = NULL;
+static int nlinks = 0;
+static struct nl_object **addrs = NULL;
+static int naddrs = 0;
+static struct nl_object **routes = NULL;
+static int nroutes = 0;
+
+static unsigned int refills = 0;
+static int fail_dumps = 0;
+static int fail_code = 0;
+
+/* The IFLA_BOND attributes of the bonds, and the link the last
+ * RTM_GETLINK asked for */
+struct mock_bond {
+    int      ifindex;
+    uint8_t  mode;
+    uint32_t miimon;
+    uint32_t arp_interval;
+    uint32_t arp_target;
+};
+static struct mock_bond *bonds = NULL;
+static int nbonds = 0;
+static int getlink_ifindex = 0;
+
+void mock_nl_reset(void) {
+    for (int i=0; i < nlinks; i++)
+        nl_object_put(links[i]);
+    for (int i=0; i < naddrs; i++)
+        nl_object_put(addrs[i]);
+    for (int i=0; i < nroutes; i++)
+        nl_object_put(routes[i]);
+    FREE(links);
+    FREE(addrs);
+    FREE(routes);
+    FREE(bonds);
+    nlinks = naddrs = nroutes = nbonds = 0;
+    refills = 0;
+    fail_dumps = 0;
+}
+
+int mock_nl_add_link(const char *name, const char *type, unsigned int flags,
+                     int master, int lower, int vlan_id) {
+    struct rtnl_link *link = NULL;
+    struct nl_addr *mac = NULL;
+    unsigned char hwaddr[6];
+    int ifindex = nlinks + 1;
+
+    if (REALLOC_N(links, nlinks + 1) < 0)
+        return -1;
+
+    link = rtnl_link_alloc();
+    if (link == NULL)
+        return -1;
+    rtnl_link_set_name(link, name);
+    rtnl_link_set_ifindex(link, ifindex);
+    rtnl_link_set_flags(link, flags);
+    rtnl_link_set_family(link, AF_UNSPEC);
+    if (master > 0)
+        rtnl_link_set_master(link, master);
+
+    /* A locally administered address derived from the ifindex */
+    hwaddr[0] = 0x02;
+    hwaddr[1] = 0x00;
+    hwaddr[2] = (ifindex >> 24) & 0xff;
+    hwaddr[3] = (ifindex >> 16) & 0xff;
+    hwaddr[4] = (ifindex >> 8) & 0xff;
+    hwaddr[5] = ifindex & 0xff;
+    mac = nl_addr_build(AF_LLC, hwaddr, sizeof(hwaddr));
+    if (mac == NULL)
+        goto error;
+    rtnl_link_set_addr(link, mac);
+    nl_addr_put(mac);
+
+    if (type != NULL) {
+        if (rtnl_link_set_type(link, type) < 0)
+            goto error;
+        if (strcmp(type, "vlan") == 0) {
+            rtnl_link_set_link(link, lower);
+            if (rtnl_link_vlan_set_id(link, vlan_id) < 0)
+                goto error;
+        }
+    }
+
+    links[nlinks++] = OBJ_CAST(link);
+    return ifindex;
+ error:
+    rtnl_link_put(link);
+    return -1;
+}
+
+int mock_nl_add_addr(int ifindex, const char *addr, int prefix) {
+    struct rtnl_addr *raddr = NULL;
+    struct nl_addr *local = NULL;
+    unsigned char buf[sizeof(struct in6_addr)];
+    int family;
+
+    if (REALLOC_N(addrs, naddrs + 1) < 0)
+        return -1;
+
+    if (inet_pton(AF_INET, addr, buf) == 1)
+        family = AF_INET;
+    else if (inet_pton(AF_INET6, addr, buf) == 1)
+        family = AF_INET6;
+    else
+        return -1;
+
+    local = nl_addr_build(family, buf, family == AF_INET ?
+                          sizeof(struct in_addr) : sizeof(struct in6_addr));
+    if (local == NULL)
+        return -1;
+    nl_addr_set_prefixlen(local, prefix);
+
+    raddr = rtnl_addr_alloc();
+    if (raddr == NULL)
+        goto error;
+    rtnl_addr_set_ifindex(raddr, ifindex);
+    rtnl_addr_set_family(raddr, family);
+    if (rtnl_addr_set_local(raddr, local) < 0)
+        goto error;
+    rtnl_addr_set_prefixlen(raddr, prefix);
+    nl_addr_put(local);
+
+    addrs[naddrs++] = OBJ_CAST(raddr);
+    return 0;
+ error:
+    nl_addr_put(local);
+    if (raddr != NULL)
+        rtnl_addr_put(raddr);
+    return -1;
+}
+
+/* Parse the IPv4 or IPv6 address STR into a new nl_addr */
+static struct nl_addr *build_addr(const char *str, int prefix) {
+    unsigned char buf[sizeof(struct in6_addr)];
+    struct nl_addr *addr;
+
+    if (inet_pton(AF_INET, str, buf) == 1)
+        addr = nl_addr_build(AF_INET, buf, sizeof(struct in_addr));
+    else if (inet_pton(AF_INET6, str, buf) == 1)
+        addr = nl_addr_build(AF_INET6, buf, sizeof(struct in6_addr));
+    else
+        return NULL;
+    if (addr != NULL)
+        nl_addr_set_prefixlen(addr, prefix);
+    return addr;
+}
+
+int mock_nl_add_route(int ifindex, const char *dst, int prefix,
+                      const char *gateway, int protocol) {
+    struct rtnl_route *route = NULL;
+    struct rtnl_nexthop *nh = NULL;
+    struct nl_addr *addr = NULL;
+
+    if (REALLOC_N(routes, nroutes + 1) < 0)
+        return -1;
+
+    route = rtnl_route_alloc();
+    if (route == NULL)
+        return -1;
+    addr = build_addr(dst, prefix);
+    if (addr == NULL)
+        goto error;
+    rtnl_route_set_family(route, nl_addr_get_family(addr));
+    rtnl_route_set_table(route, RT_TABLE_MAIN);
+    rtnl_route_set_type(route, RTN_UNICAST);
+    rtnl_route_set_protocol(route, protocol);
+    if (rtnl_route_set_dst(route, addr) < 0)
+        goto error;
+    nl_addr_put(addr);
+    addr = NULL;
+
+    nh = rtnl_route_nh_alloc();
+    if (nh == NULL)
+        goto error;
+    rtnl_route_nh_set_ifindex(nh, ifindex);
+    if (gateway != NULL) {
+        addr = build_addr(gateway, 0);
+        if (addr == NULL)
+            goto error;
+        rtnl_route_nh_set_gateway(nh, addr);
+        nl_addr_put(addr);
+        addr = NULL;
+    }
+    rtnl_route_add_nexthop(route, nh);
+
+    routes[nroutes++] = OBJ_CAST(route);
+    return 0;
+ error:
+    if (addr != NULL)
+        nl_addr_put(addr);
+    rtnl_route_put(route);
+    return -1;
+}
+
+int mock_nl_set_bond(int ifindex, int mode, int miimon,
+                     int arp_interval, const char *arp_target) {
+    struct mock_bond *bond;
+
+    if (REALLOC_N(bonds, nbonds + 1) < 0)
+        return -1;
+    bond = bonds + nbonds;
+    MEMZERO(bond, 1);
+    bond->ifindex = ifindex;
+    bond->mode = mode;
+    bond->miimon = miimon;
+    bond->arp_interval = arp_interval;
+    if (arp_target != NULL &&
+        inet_pton(AF_INET, arp_target, &bond->arp_target) != 1)
+        return -1;
+    nbonds += 1;
+    return 0;
+}
+
+int mock_nl_set_link_stats(int ifindex, unsigned long long rx_bytes,
+                           unsigned long long tx_bytes,
+                           unsigned long long rx_dropped, int queues) {
+    struct rtnl_link *link;
+
+    if (ifindex <= 0 || ifindex > nlinks)
+        return -1;
+    link = (struct rtnl_link *) links[ifindex - 1];
+    rtnl_link_set_stat(link, RTNL_LINK_RX_BYTES, rx_bytes);
+    rtnl_link_set_stat(link, RTNL_LINK_RX_PACKETS, rx_bytes / 100);
+    rtnl_link_set_stat(link, RTNL_LINK_RX_DROPPED, rx_dropped);
+    rtnl_link_set_stat(link, RTNL_LINK_TX_BYTES, tx_bytes);
+    rtnl_link_set_stat(link, RTNL_LINK_TX_PACKETS, tx_bytes / 100);
+    rtnl_link_set_num_rx_queues(link, queues);
+    rtnl_link_set_num_tx_queues(link, queues);
+    return 0;
+}
+
+void mock_nl_fail_dumps(int n, int code) {
+    fail_dumps = n;
+    fail_code = code;
+}
+
+unsigned int mock_nl_refills(void) {
+    return refills;
+}
+
+static int fill_cache(struct nl_cache *cache) {
+    struct nl_cache_ops *ops = nl_cache_get_ops(cache);
+    struct nl_object **objs;
+    int nobjs;
+
+    if (ops == nl_cache_ops_lookup("route/link")) {
+        objs = links;
+        nobjs = nlinks;
+    } else if (ops == nl_cache_ops_lookup("route/addr")) {
+        objs = addrs;
+        nobjs = naddrs;
+    } else if (ops == nl_cache_ops_lookup("route/route")) {
+        objs = routes;
+        nobjs = nroutes;
+    } else {
+        return -NLE_OPNOTSUPP;
+    }
+    if (fail_dumps > 0) {
+        fail_dumps -= 1;
+        return fail_code;
+    }
+
+    nl_cache_clear(cache);
+    for (int i=0; i < nobjs; i++) {
+        struct nl_object *obj = nl_object_clone(objs[i]);
+        int r;
+
+        if (obj == NULL)
+            return -NLE_NOMEM;
+        r = nl_cache_add(cache, obj);
+        nl_object_put(obj);
+        if (r < 0)
+            return r;
+    }
+    refills += 1;
+    return 0;
+}
+
+/*
+ * Replacements for libnl functions
+ */
+int nl_connect(struct nl_sock *sk ATTRIBUTE_UNUSED,
+               int protocol ATTRIBUTE_UNUSED) {
+    return 0;
+}
+
+int nl_rtgen_request(struct nl_sock *sk ATTRIBUTE_UNUSED,
+                     int type ATTRIBUTE_UNUSED, int family ATTRIBUTE_UNUSED,
+                     int flags ATTRIBUTE_UNUSED) {
+    return 0;
+}
+
+int nl_cache_pickup(struct nl_sock *sk ATTRIBUTE_UNUSED,
+                    struct nl_cache *cache) {
+    return fill_cache(cache);
+}
+
+/* Remember which link a RTM_GETLINK request is for; everything else is
+ * dropped */
+int nl_send_simple(struct nl_sock *sk ATTRIBUTE_UNUSED, int type,
+                   int flags ATTRIBUTE_UNUSED, void *buf, size_t size) {
+    if (type == RTM_GETLINK && size >= sizeof(struct ifinfomsg))
+        getlink_ifindex = ((struct ifinfomsg *) buf)->ifi_index;
+    return 0;
+}
+
+/* Answer the last RTM_GETLINK with the IFLA_BOND attributes of the link,
+ * or with ENODEV if it is not a bond set up with mock_nl_set_bond */
+int nl_recv(struct nl_sock *sk ATTRIBUTE_UNUSED,
+            struct sockaddr_nl *nla ATTRIBUTE_UNUSED,
+            unsigned char **buf, struct ucred **creds ATTRIBUTE_UNUSED) {
+    struct mock_bond *bond = NULL;
+    struct nl_msg *msg = NULL;
+    struct nlattr *linkinfo, *data, *targets;
+    struct ifinfomsg ifi;
+    struct nlmsgerr err;
+    int len = -NLE_NOMEM;
+
+    for (int i=0; i < nbonds; i++)
+        if (bonds[i].ifindex == getlink_ifindex)
+            bond = bonds + i;
+    getlink_ifindex = 0;
+
+    if (bond == NULL) {
+        msg = nlmsg_alloc_simple(NLMSG_ERROR, 0);
+        MEMZERO(&err, 1);
+        err.error = -ENODEV;
+        if (msg == NULL || nlmsg_append(msg, &err, sizeof(err), 0) < 0)
+            goto done;
+    } else {
+        msg = nlmsg_alloc_simple(RTM_NEWLINK, 0);
+        MEMZERO(&ifi, 1);
+        ifi.ifi_index = bond->ifindex;
+        if (msg == NULL || nlmsg_append(msg, &ifi, sizeof(ifi), 0) < 0)
+            goto done;
+        if ((linkinfo = nla_nest_start(msg, IFLA_LINKINFO)) == NULL
+            || nla_put_string(msg, IFLA_INFO_KIND, "bond") < 0
+            || (data = nla_nest_start(msg, IFLA_INFO_DATA)) == NULL
+            || nla_put_u8(msg, IFLA_BOND_MODE, bond->mode) < 0
+            || nla_put_u32(msg, IFLA_BOND_MIIMON, bond->miimon) < 0
+            || nla_put_u32(msg, IFLA_BOND_UPDELAY, 0) < 0
+            || nla_put_u32(msg, IFLA_BOND_DOWNDELAY, 0) < 0
+            || nla_put_u8(msg, IFLA_BOND_USE_CARRIER, 1) < 0
+            || nla_put_u32(msg, IFLA_BOND_ARP_INTERVAL,
+                           bond->arp_interval) < 0
+            || (targets = nla_nest_start(msg, IFLA_BOND_ARP_IP_TARGET)) == NULL
+            || (bond->arp_target != 0 &&
+                nla_put_u32(msg, 0, bond->arp_target) < 0)
+            || nla_nest_end(msg, targets) < 0
+            || nla_put_u32(msg, IFLA_BOND_ARP_VALIDATE, 0) < 0
+            || nla_nest_end(msg, data) < 0
+            || nla_nest_end(msg, linkinfo) < 0)
+            goto done;
+    }
+
+    len = nlmsg_hdr(msg)->nlmsg_len;
+    if (ALLOC_N(*buf, len) < 0) {
+        len = -NLE_NOMEM;
+        goto done;
+    }
+    memcpy(*buf, nlmsg_hdr(msg), len);
+ done:
+    nlmsg_free(msg);
+    return len;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
+/* vim: set ts=4 sw=4 et: */
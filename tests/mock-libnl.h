@@ -0,0 +1,95 @@
+/*
+ * mock-libnl.h: serve synthetic link and address caches to libnetcf
+ *
+ * Copyright (C) 2009 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef MOCK_LIBNL_H_
+#define MOCK_LIBNL_H_
+
+/* Linking mock-libnl.c into a test program replaces the parts of libnl
+ * that talk to the kernel: sockets never connect, and allocating or
+ * refilling a link, address or route cache fills it with the links,
+ * addresses and routes added with the functions below instead of
+ * dumping them from the kernel. A request for the attributes of a
+ * single link is answered with those set by mock_nl_set_bond.
+ * Everything else, including lookups and iteration over the caches, is
+ * the real libnl code.
+ */
+
+/* Forget all links, addresses and routes */
+void mock_nl_reset(void);
+
+/* Add a link named NAME. TYPE is the link kind reported by the kernel,
+ * like "vlan", "bond" or "bridge", or NULL for a plain ethernet
+ * device. MASTER is the ifindex of the bond or bridge the link is
+ * enslaved to, or 0; LOWER and VLAN_ID are only used for vlans. Returns
+ * the ifindex of the new link, or -1 on error.
+ */
+int mock_nl_add_link(const char *name, const char *type, unsigned int flags,
+                     int master, int lower, int vlan_id);
+
+/* Add the address ADDR/PREFIX to the link with IFINDEX. ADDR can be an
+ * IPv4 or IPv6 address. Returns 0 on success, -1 on error.
+ */
+int mock_nl_add_addr(int ifindex, const char *addr, int prefix);
+
+/* Add a route to DST/PREFIX in the main table through the link with
+ * IFINDEX, via GATEWAY, or directly if GATEWAY is NULL. A PREFIX of 0
+ * makes it the default route. PROTOCOL is one of the RTPROT_* constants.
+ * Returns 0 on success, -1 on error.
+ */
+int mock_nl_add_route(int ifindex, const char *dst, int prefix,
+                      const char *gateway, int protocol);
+
+/* Make the link IFINDEX report the IFLA_BOND attributes of a bond with
+ * MODE (the kernel's number for it, e.g. 1 for active-backup), and
+ * either the MII monitor running every MIIMON ms or the ARP monitor
+ * every ARP_INTERVAL ms checking ARP_TARGET. Returns 0 on success, -1
+ * on error.
+ */
+int mock_nl_set_bond(int ifindex, int mode, int miimon,
+                     int arp_interval, const char *arp_target);
+
+/* Give the link IFINDEX the byte counters RX_BYTES and TX_BYTES, one
+ * packet for every 100 bytes, RX_DROPPED dropped incoming packets and
+ * QUEUES receive and transmit queues. Returns 0 on success, -1 on
+ * error.
+ */
+int mock_nl_set_link_stats(int ifindex, unsigned long long rx_bytes,
+                           unsigned long long tx_bytes,
+                           unsigned long long rx_dropped, int queues);
+
+/* Make the next N dumps into a cache fail with the libnl error CODE,
+ * e.g. -NLE_DUMP_INTR, which nl_cache_pickup reports when the kernel
+ * flags the dump as inconsistent */
+void mock_nl_fail_dumps(int n, int code);
+
+/* Number of times a cache was (re)filled */
+unsigned int mock_nl_refills(void);
+
+#endif
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
+/* vim: set ts=4 sw=4 et: */
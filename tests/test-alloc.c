@@ -0,0 +1,328 @@
+/*
+ * test-alloc.c: check allocation budgets of the public API
+ *
+ * Copyright (C) 2009 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * Every public call exercised here runs against a fresh copy of
+ * tests/DRIVER/fsroot, and the number of allocations and the peak heap
+ * usage it causes are compared against tests/DRIVER/alloc-budget. A call
+ * that exceeds its budget, or has no budget at all, fails the test.
+ *
+ * If NETCF_ALLOC_BUDGET_OUTPUT is set, measurements are written to that
+ * file, with some headroom, instead of being checked; 'make alloc-budget'
+ * uses that to produce a fresh budget file.
+ */
+
+#include <config.h>
+#include "netcf.h"
+#include "internal.h"
+#include "cutest.h"
+#include "safe-alloc.h"
+#include "read-file.h"
+
+#include "tutil.h"
+#include "mock-alloc.h"
+
+#include <stdio.h>
+
+#ifndef TEST_DRIVER
+#error "TEST_DRIVER must be defined to the name of the driver under test"
+#endif
+
+extern const char *abs_top_srcdir;
+extern const char *abs_top_builddir;
+extern char *driver_name;
+extern char *root, *src_root;
+extern struct netcf *ncf;
+
+/* Budgets written by 'make alloc-budget' leave this much room, in percent,
+ * over what was measured */
+#define BUDGET_HEADROOM 20
+
+struct budget {
+    char *call;
+    unsigned long long count;
+    long long peak;
+};
+
+static struct budget *budgets = NULL;
+static int nbudgets = 0;
+static FILE *budget_output = NULL;
+
+static void read_budgets(const char *path) {
+    char *text, *line, *next;
+    size_t length;
+
+    text = read_file(path, &length);
+    if (text == NULL)
+        die("failed to read allocation budget");
+
+    for (line = text; line != NULL && *line != '\0'; line = next) {
+        char call[64];
+        unsigned long long count;
+        long long peak;
+
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        if (*line == '#' || *line == '\0')
+            continue;
+        if (sscanf(line, "%63s %llu %lld", call, &count, &peak) != 3)
+            die("malformed line in allocation budget");
+        if (REALLOC_N(budgets, nbudgets + 1) < 0)
+            die("allocation failed");
+        budgets[nbudgets].call = strdup(call);
+        if (budgets[nbudgets].call == NULL)
+            die("allocation failed");
+        budgets[nbudgets].count = count;
+        budgets[nbudgets].peak = peak;
+        nbudgets += 1;
+    }
+    free(text);
+}
+
+static void free_budgets(void) {
+    for (int i=0; i < nbudgets; i++)
+        free(budgets[i].call);
+    free(budgets);
+}
+
+static void check_budget(CuTest *tc, const char *call,
+                         const struct alloc_usage *usage) {
+    char *msg = NULL;
+
+    if (budget_output != NULL) {
+        fprintf(budget_output, "%-28s %10llu %12lld\n", call,
+                usage->count + usage->count * BUDGET_HEADROOM / 100 + 1,
+                usage->peak + usage->peak * BUDGET_HEADROOM / 100 + 1);
+        return;
+    }
+
+    for (int i=0; i < nbudgets; i++) {
+        if (STRNEQ(budgets[i].call, call))
+            continue;
+        if (usage->count > budgets[i].count) {
+            format_error(&msg, "%s: %llu allocations exceed budget of %llu",
+                         call, usage->count, budgets[i].count);
+            CuFail(tc, msg);
+        }
+        if (usage->peak > budgets[i].peak) {
+            format_error(&msg, "%s: peak of %lld bytes exceeds budget of %lld",
+                         call, usage->peak, budgets[i].peak);
+            CuFail(tc, msg);
+        }
+        return;
+    }
+    format_error(&msg, "%s: no allocation budget", call);
+    CuFail(tc, msg);
+}
+
+/* Run STMT with allocation tracking on and check the budget for CALL */
+#define MEASURE(tc, call, stmt)                                     \
+    do {                                                            \
+        struct alloc_usage usage_;                                  \
+        alloc_track_begin();                                        \
+        stmt;                                                       \
+        alloc_track_end(&usage_);                                   \
+        check_budget(tc, call, &usage_);                            \
+    } while(0)
+
+/* Return the name of some interface in the fsroot. */
+static char *first_interface(CuTest *tc) {
+    char *name = NULL;
+    int r;
+
+    r = ncf_list_interfaces(ncf, 1, &name,
+                            NETCF_IFACE_ACTIVE|NETCF_IFACE_INACTIVE);
+    CuAssertIntEquals(tc, 1, r);
+    CuAssertPtrNotNull(tc, name);
+    return name;
+}
+
+static void testInit(CuTest *tc) {
+    int r;
+
+    ncf_close(ncf);
+    ncf = NULL;
+
+    MEASURE(tc, "ncf_init", r = ncf_init(&ncf, root));
+    CuAssertIntEquals(tc, 0, r);
+}
+
+static void testListInterfaces(CuTest *tc) {
+    char **names = NULL;
+    int nint, r;
+
+    MEASURE(tc, "ncf_num_of_interfaces",
+            nint = ncf_num_of_interfaces(ncf, NETCF_IFACE_ACTIVE|
+                                         NETCF_IFACE_INACTIVE));
+    CuAssert(tc, "no interfaces", nint > 0);
+
+    if (ALLOC_N(names, nint) < 0)
+        die("allocation failed");
+    MEASURE(tc, "ncf_list_interfaces",
+            r = ncf_list_interfaces(ncf, nint, names,
+                                    NETCF_IFACE_ACTIVE|NETCF_IFACE_INACTIVE));
+    CuAssertIntEquals(tc, nint, r);
+    for (int i=0; i < nint; i++)
+        free(names[i]);
+    free(names);
+}
+
+static void testLookupByName(CuTest *tc) {
+    struct netcf_if *nif = NULL;
+    char *name;
+
+    name = first_interface(tc);
+    ncf_close(ncf);
+    CuAssertIntEquals(tc, 0, ncf_init(&ncf, root));
+
+    MEASURE(tc, "ncf_lookup_by_name", nif = ncf_lookup_by_name(ncf, name));
+    CuAssertPtrNotNull(tc, nif);
+    ncf_if_free(nif);
+    free(name);
+}
+
+static void testLookupByMAC(CuTest *tc) {
+    struct netcf_if *nif = NULL;
+    int r;
+
+    MEASURE(tc, "ncf_lookup_by_mac_string",
+            r = ncf_lookup_by_mac_string(ncf, "aa:bb:cc:dd:ee:ff", 1, &nif));
+    CuAssert(tc, "lookup by MAC failed", r >= 0);
+    if (nif != NULL)
+        ncf_if_free(nif);
+}
+
+static void testXmlDesc(CuTest *tc) {
+    struct netcf_if *nif = NULL;
+    char *name, *xml = NULL;
+
+    name = first_interface(tc);
+    nif = ncf_lookup_by_name(ncf, name);
+    CuAssertPtrNotNull(tc, nif);
+
+    MEASURE(tc, "ncf_if_xml_desc", xml = ncf_if_xml_desc(nif));
+    CuAssertPtrNotNull(tc, xml);
+
+    free(xml);
+    ncf_if_free(nif);
+    free(name);
+}
+
+static void testDefineUndefine(CuTest *tc) {
+    struct netcf_if *nif = NULL;
+    char *bridge_xml;
+    int r;
+
+    bridge_xml = read_test_file(tc, "interface/bridge42.xml");
+    CuAssertPtrNotNull(tc, bridge_xml);
+
+    MEASURE(tc, "ncf_define", nif = ncf_define(ncf, bridge_xml));
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+
+    MEASURE(tc, "ncf_if_undefine", r = ncf_if_undefine(nif));
+    CuAssertIntEquals(tc, 0, r);
+    assert_ncf_no_error(tc);
+
+    ncf_if_free(nif);
+    free(bridge_xml);
+}
+
+int main(void) {
+    char *output = NULL, *budget_path = NULL;
+    const char *outpath;
+    CuSuite* suite = CuSuiteNew();
+
+    abs_top_srcdir = getenv("abs_top_srcdir");
+    if (abs_top_srcdir == NULL)
+        die("env var abs_top_srcdir must be set");
+
+    abs_top_builddir = getenv("abs_top_builddir");
+    if (abs_top_builddir == NULL)
+        die("env var abs_top_builddir must be set");
+
+    if (asprintf(&src_root, "%s/tests/%s/fsroot",
+                 abs_top_srcdir, TEST_DRIVER) < 0) {
+        die("failed to set src_root");
+    }
+
+    if (asprintf(&driver_name, "alloc-%s", TEST_DRIVER) < 0) {
+        die("failed to set driver name");
+    }
+
+    outpath = getenv("NETCF_ALLOC_BUDGET_OUTPUT");
+    if (outpath != NULL) {
+        budget_output = fopen(outpath, "w");
+        if (budget_output == NULL)
+            die("failed to open budget output file");
+        fprintf(budget_output,
+                "# Allocation budget for the %s driver\n"
+                "#\n"
+                "# Each line gives the maximum number of allocations and the"
+                " maximum peak\n"
+                "# heap usage in bytes that a public call may cause when run"
+                " against a\n"
+                "# fresh copy of tests/%s/fsroot; that is what the call"
+                " used when this\n"
+                "# file was generated, plus %d%%.\n"
+                "#\n"
+                "# Regenerate with 'make -C tests alloc-budget' and review"
+                " the difference.\n"
+                "# call                         allocs   peak-bytes\n",
+                TEST_DRIVER, TEST_DRIVER, BUDGET_HEADROOM);
+    } else {
+        if (asprintf(&budget_path, "%s/tests/%s/alloc-budget",
+                     abs_top_srcdir, TEST_DRIVER) < 0)
+            die("failed to set budget path");
+        read_budgets(budget_path);
+        free(budget_path);
+    }
+
+    CuSuiteSetup(suite, setup, teardown);
+
+    SUITE_ADD_TEST(suite, testInit);
+    SUITE_ADD_TEST(suite, testListInterfaces);
+    SUITE_ADD_TEST(suite, testLookupByName);
+    SUITE_ADD_TEST(suite, testLookupByMAC);
+    SUITE_ADD_TEST(suite, testXmlDesc);
+    SUITE_ADD_TEST(suite, testDefineUndefine);
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, &output);
+    CuSuiteDetails(suite, &output);
+    printf("%s\n", output);
+    free(output);
+    free(driver_name);
+    free_budgets();
+    if (budget_output != NULL)
+        fclose(budget_output);
+    return suite->failCount;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
+/* vim: set ts=4 sw=4 et: */
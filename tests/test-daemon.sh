@@ -0,0 +1,134 @@
+#! /bin/sh
+#
+# test-daemon.sh: run commands through 'ncftool --daemon' and
+# 'ncftool --connect' and check that they print the same as when
+# ncftool runs them itself
+#
+
+set -e
+
+die() {
+    echo "$*" >&2
+    exit 1
+}
+
+root="$abs_top_builddir/build/test_daemon-$NETCF_DRIVER"
+sock="$root/ncftool.sock"
+daemon_pid=
+stall_pid=
+
+cleanup() {
+    [ -n "$stall_pid" ] && kill "$stall_pid" 2>/dev/null
+    if [ -n "$daemon_pid" ]; then
+        kill "$daemon_pid" 2>/dev/null || :
+        wait "$daemon_pid" 2>/dev/null || :
+    fi
+    chmod -R u+w "$root" 2>/dev/null || :
+    rm -rf "$root"
+}
+trap cleanup EXIT
+
+rm -rf "$root"
+mkdir -p "$root"
+cp -pr "$abs_top_srcdir/tests/$NETCF_DRIVER/fsroot/." "$root"
+chmod -R u+w "$root"
+
+# The daemon refuses to replace anything but a stale socket
+touch "$root/not-a-socket"
+if timeout 10 ncftool -r "$root" --daemon "$root/not-a-socket" 2>/dev/null; then
+    die "daemon started on a regular file"
+fi
+[ -f "$root/not-a-socket" ] || die "daemon removed a regular file"
+
+ncftool -r "$root" --daemon "$sock" &
+daemon_pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$sock" ] && break
+    sleep 1
+done
+[ -S "$sock" ] || die "daemon did not create $sock"
+[ "$(stat -c %a "$sock")" = 600 ] || die "$sock is accessible to others"
+
+for cmd in "list --all" "list --all --macs" "list --inactive" \
+           "dumpxml no-such-interface" "no-such-command"; do
+    exp_status=0
+    act_status=0
+    exp=$(ncftool -r "$root" $cmd 2>&1) || exp_status=$?
+    act=$(ncftool --connect "$sock" $cmd 2>&1) || act_status=$?
+    [ "$exp" = "$act" ] || \
+        die "'$cmd' printed '$act' through the daemon instead of '$exp'"
+    [ "$exp_status" = "$act_status" ] || \
+        die "'$cmd' exited with $act_status through the daemon," \
+            "not $exp_status"
+done
+
+# The daemon's root is the only one a client can use
+if ncftool -r "$root" --connect "$sock" list --all >/dev/null 2>&1; then
+    die "--root was accepted together with --connect"
+fi
+
+# Files named on the command line are found relative to the client
+mkdir "$root/client"
+cp "$abs_top_srcdir/tests/interface/ethernet-dhcp.xml" "$root/client/eth.xml"
+exp=$(cd "$root/client" && \
+      ncftool -r "$root" define --dry-run eth.xml 2>&1) || :
+act=$(cd "$root/client" && \
+      ncftool --connect "$sock" define --dry-run eth.xml 2>&1) || :
+[ "$exp" = "$act" ] || \
+    die "define of a relative path through the daemon printed '$act'"
+
+# A change to the config files shows up in the next command
+case "$NETCF_DRIVER" in
+    redhat)
+        printf 'DEVICE=eth9\nBOOTPROTO=dhcp\nONBOOT=yes\n' > \
+            "$root/etc/sysconfig/network-scripts/ifcfg-eth9" ;;
+    suse)
+        printf 'BOOTPROTO=dhcp\nSTARTMODE=auto\n' > \
+            "$root/etc/sysconfig/network/ifcfg-eth9" ;;
+    debian)
+        printf '\nauto eth9\niface eth9 inet dhcp\n' >> \
+            "$root/etc/network/interfaces" ;;
+    *)
+        die "no config file to change for $NETCF_DRIVER" ;;
+esac
+for cmd in "list --all" "dumpxml eth9"; do
+    exp=$(ncftool -r "$root" $cmd 2>&1) || die "'$cmd' failed"
+    act=$(ncftool --connect "$sock" $cmd 2>&1) || :
+    [ "$exp" = "$act" ] || \
+        die "'$cmd' printed '$act' through the daemon after a change," \
+            "not '$exp'"
+done
+case "$act" in
+    *eth9*) ;;
+    *) die "the daemon did not see the new interface eth9" ;;
+esac
+
+# Several commands over one connection
+exp=$(printf 'list --all\nlist --inactive\n' | \
+      ncftool -r "$root" -f - 2>&1) || :
+act=$(printf 'list --all\nlist --inactive\n' | \
+      ncftool --connect "$sock" -f - 2>&1) || :
+[ "$exp" = "$act" ] || die "batch through the daemon printed '$act'"
+
+# A client that sent half a request does not hold up the others
+if command -v python3 >/dev/null 2>&1; then
+    python3 -c '
+import socket, sys, time
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.send(b"\0\0")
+time.sleep(60)' "$sock" &
+    stall_pid=$!
+    sleep 1
+    act=$(timeout 10 ncftool --connect "$sock" list --all 2>&1) || :
+    exp=$(ncftool -r "$root" list --all 2>&1) || :
+    [ "$exp" = "$act" ] || die "a stalled client blocked the daemon"
+    kill "$stall_pid"
+    stall_pid=
+fi
+
+kill "$daemon_pid"
+wait "$daemon_pid" || die "daemon did not exit cleanly"
+daemon_pid=
+[ -e "$sock" ] && die "daemon left $sock behind"
+exit 0
@@ -0,0 +1,187 @@
+/*
+ * test-dutil.c: tests for the driver utilities that do not need a
+ *               netcf handle
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+#include "internal.h"
+#include "dutil.h"
+#include "cutest.h"
+#include "safe-alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* The lines "1\n" up to "N\n", with line I replaced by REPL[I] where
+ * that is not NULL; a replacement of "" drops the line */
+static char *numbered_lines(int n, const char *const *repl, int nrepl) {
+    char *text = NULL;
+    size_t len = 0;
+
+    if (ALLOC_N(text, n * 16 + 1) < 0)
+        return NULL;
+    for (int i=1; i <= n; i++) {
+        if (i < nrepl && repl[i] != NULL)
+            len += sprintf(text + len, "%s", repl[i]);
+        else
+            len += sprintf(text + len, "%d\n", i);
+    }
+    return text;
+}
+
+static void assert_diff(CuTest *tc, const char *exp,
+                        const char *old_text, const char *new_text) {
+    char *diff = NULL;
+    int r;
+
+    r = unified_diff(&diff, "a", old_text, "b", new_text);
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertStrEquals(tc, exp, diff);
+    free(diff);
+}
+
+static void testDiffSame(CuTest *tc) {
+    char *diff = NULL;
+    int r;
+
+    r = unified_diff(&diff, "a", "x\ny\n", "b", "x\ny\n");
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertPtrEquals(tc, NULL, diff);
+}
+
+static void testDiffNewFile(CuTest *tc) {
+    assert_diff(tc, "--- a\n+++ b\n@@ -0,0 +1,2 @@\n+x\n+y\n",
+                NULL, "x\ny\n");
+    assert_diff(tc, "--- a\n+++ b\n@@ -1,1 +1,1 @@\n-x\n"
+                "\\ No newline at end of file\n+x\n",
+                "x", "x\n");
+}
+
+/* Changes that are at most twice the context apart share a hunk */
+static void testDiffAdjacentHunks(CuTest *tc) {
+    static const char *const repl[] = {
+        [4] = "four\n", [11] = "eleven\n"
+    };
+    char *old_text = numbered_lines(20, NULL, 0);
+    char *new_text = numbered_lines(20, repl, ARRAY_CARDINALITY(repl));
+
+    assert_diff(tc,
+                "--- a\n+++ b\n"
+                "@@ -1,14 +1,14 @@\n"
+                " 1\n 2\n 3\n-4\n+four\n 5\n 6\n 7\n 8\n 9\n 10\n"
+                "-11\n+eleven\n 12\n 13\n 14\n",
+                old_text, new_text);
+    free(old_text);
+    free(new_text);
+}
+
+/* One more line between the changes and their contexts no longer
+ * overlap, so they go into separate hunks */
+static void testDiffSeparateHunks(CuTest *tc) {
+    static const char *const repl[] = {
+        [4] = "four\n", [12] = "twelve\n"
+    };
+    char *old_text = numbered_lines(20, NULL, 0);
+    char *new_text = numbered_lines(20, repl, ARRAY_CARDINALITY(repl));
+
+    assert_diff(tc,
+                "--- a\n+++ b\n"
+                "@@ -1,7 +1,7 @@\n"
+                " 1\n 2\n 3\n-4\n+four\n 5\n 6\n 7\n"
+                "@@ -9,7 +9,7 @@\n"
+                " 9\n 10\n 11\n-12\n+twelve\n 13\n 14\n 15\n",
+                old_text, new_text);
+    free(old_text);
+    free(new_text);
+}
+
+/* Removed and added lines whose contexts overlap, at both ends of the
+ * file */
+static void testDiffOverlappingHunks(CuTest *tc) {
+    static const char *const repl[] = {
+        [1] = "", [3] = "three\n", [8] = "", [9] = "nine\n"
+    };
+    char *old_text = numbered_lines(10, NULL, 0);
+    char *new_text = numbered_lines(10, repl, ARRAY_CARDINALITY(repl));
+
+    assert_diff(tc,
+                "--- a\n+++ b\n"
+                "@@ -1,10 +1,8 @@\n"
+                "-1\n 2\n-3\n+three\n 4\n 5\n 6\n 7\n-8\n-9\n+nine\n 10\n",
+                old_text, new_text);
+    free(old_text);
+    free(new_text);
+}
+
+/* When the changed part of the file is too big for the LCS table, it
+ * is shown as removed and added as a whole, even where lines match */
+static void testDiffOverLimit(CuTest *tc) {
+    /* The table needs (N+1)^2 cells, more than DIFF_MAX_TABLE */
+    static const int n = 2100;
+    static const char *const repl[] = { [1] = "first\n" };
+    char *old_text = numbered_lines(n, NULL, 0);
+    char *new_text = numbered_lines(n, repl, ARRAY_CARDINALITY(repl));
+    char *diff = NULL, *hdr = NULL;
+    int r;
+
+    /* Change the last line, too, so that only the first and the last
+     * line differ and everything between is the same */
+    new_text[strlen(new_text) - 1] = '\0';
+    r = unified_diff(&diff, "a", old_text, "b", new_text);
+    CuAssertIntEquals(tc, 0, r);
+    CuAssertPtrNotNull(tc, diff);
+
+    r = asprintf(&hdr, "--- a\n+++ b\n@@ -1,%d +1,%d @@\n-1\n-2\n", n, n);
+    CuAssertTrue(tc, r > 0);
+    CuAssertTrue(tc, strncmp(diff, hdr, strlen(hdr)) == 0);
+    CuAssertPtrNotNull(tc, strstr(diff, "\n-2100\n+first\n+2\n"));
+    CuAssertPtrEquals(tc, NULL, strstr(diff, "\n 2\n"));
+
+    free(hdr);
+    free(diff);
+    free(old_text);
+    free(new_text);
+}
+
+int main(void) {
+    char *output = NULL;
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, testDiffSame);
+    SUITE_ADD_TEST(suite, testDiffNewFile);
+    SUITE_ADD_TEST(suite, testDiffAdjacentHunks);
+    SUITE_ADD_TEST(suite, testDiffSeparateHunks);
+    SUITE_ADD_TEST(suite, testDiffOverlappingHunks);
+    SUITE_ADD_TEST(suite, testDiffOverLimit);
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, &output);
+    CuSuiteDetails(suite, &output);
+    printf("%s\n", output);
+    free(output);
+    return suite->failCount;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
+/* vim: set ts=4 sw=4 et: */
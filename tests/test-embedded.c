@@ -0,0 +1,146 @@
+/*
+ * test-embedded.c: check that the stylesheets and the schema compiled
+ *                  into the library are used when NETCF_DATADIR is unset
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+#include "netcf.h"
+#include "internal.h"
+#include "cutest.h"
+#include "safe-alloc.h"
+
+#include "tutil.h"
+
+#include <stdio.h>
+
+#include <libxml/parser.h>
+
+#ifndef TEST_DRIVER
+#error "TEST_DRIVER must be defined to the name of the driver under test"
+#endif
+
+extern const char *abs_top_srcdir;
+extern const char *abs_top_builddir;
+extern char *driver_name;
+extern char *root, *src_root;
+extern struct netcf *ncf;
+
+/* Transform interface/bridge.xml both ways and compare with the
+ * driver's schema/bridge.xml; this goes through the schema, both
+ * stylesheets and the stylesheets they import */
+static void assert_transforms(CuTest *tc) {
+    static const char *const ncf_fname = "interface/bridge.xml";
+    static const char *const aug_fname = TEST_DRIVER "/schema/bridge.xml";
+    char *aug_xml_exp = NULL, *ncf_xml_exp = NULL;
+    char *aug_xml_act = NULL, *ncf_xml_act = NULL;
+    int r;
+
+    aug_xml_exp = read_test_file(tc, aug_fname);
+    ncf_xml_exp = read_test_file(tc, ncf_fname);
+
+    r = ncf_get_aug(ncf, ncf_xml_exp, &aug_xml_act);
+    assert_ncf_no_error(tc);
+    CuAssertIntEquals(tc, 0, r);
+
+    r = ncf_put_aug(ncf, aug_xml_exp, &ncf_xml_act);
+    assert_ncf_no_error(tc);
+    CuAssertIntEquals(tc, 0, r);
+
+    assert_xml_equals(tc, ncf_fname, ncf_xml_exp, ncf_xml_act);
+    assert_xml_equals(tc, aug_fname, aug_xml_exp, aug_xml_act);
+
+    free(ncf_xml_exp);
+    free(ncf_xml_act);
+    free(aug_xml_exp);
+    free(aug_xml_act);
+}
+
+static void testEmbedded(CuTest *tc) {
+    CuAssertPtrNotNull(tc, ncf->embedded);
+}
+
+/* The schema is parsed from memory */
+static void testInvalid(CuTest *tc) {
+    char *aug_xml = NULL;
+    int r;
+
+    r = ncf_get_aug(ncf, "<interface type='ethernet'/>", &aug_xml);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, NETCF_EXMLINVALID, ncf_error(ncf, NULL, NULL));
+    free(aug_xml);
+}
+
+static void testTransforms(CuTest *tc) {
+    assert_transforms(tc);
+}
+
+/* xmlCleanupParser drops the input callbacks that resolve the imports of
+ * the embedded stylesheets; they have to come back on the next parse */
+static void testTransformsAfterCleanup(CuTest *tc) {
+    xmlCleanupParser();
+    assert_transforms(tc);
+}
+
+int main(void) {
+    char *output = NULL;
+    CuSuite* suite = CuSuiteNew();
+
+    abs_top_srcdir = getenv("abs_top_srcdir");
+    if (abs_top_srcdir == NULL)
+        die("env var abs_top_srcdir must be set");
+
+    abs_top_builddir = getenv("abs_top_builddir");
+    if (abs_top_builddir == NULL)
+        die("env var abs_top_builddir must be set");
+
+    if (asprintf(&src_root, "%s/tests/%s/fsroot",
+                 abs_top_srcdir, TEST_DRIVER) < 0) {
+        die("failed to set src_root");
+    }
+
+    if (asprintf(&driver_name, "embedded-%s", TEST_DRIVER) < 0) {
+        die("failed to set driver name");
+    }
+
+    /* Use the copies compiled into the library */
+    unsetenv("NETCF_DATADIR");
+
+    CuSuiteSetup(suite, setup, teardown);
+
+    SUITE_ADD_TEST(suite, testEmbedded);
+    SUITE_ADD_TEST(suite, testInvalid);
+    SUITE_ADD_TEST(suite, testTransforms);
+    SUITE_ADD_TEST(suite, testTransformsAfterCleanup);
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, &output);
+    CuSuiteDetails(suite, &output);
+    printf("%s\n", output);
+    free(output);
+    free(driver_name);
+    return suite->failCount;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
+/* vim: set ts=4 sw=4 et: */
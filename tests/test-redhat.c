@@ -30,6 +30,7 @@
 #include "tutil.h"
 
 #include <stdio.h>
+#include <unistd.h>
 
 #include <libxml/tree.h>
 
@@ -93,6 +94,120 @@ static void testLookupByNameDecoy(CuTest *tc) {
     CuAssertIntEquals(tc, 1, ncf->ref);
 }
 
+static unsigned long long stat_value(CuTest *tc, const char *name) {
+    struct netcf_stat stats[NETCF_STAT_LAST];
+    int n;
+
+    n = ncf_get_stats(ncf, stats, ARRAY_CARDINALITY(stats));
+    CuAssertIntEquals(tc, NETCF_STAT_LAST, n);
+    for (int i=0; i < n; i++)
+        if (STREQ(stats[i].name, name))
+            return stats[i].count;
+    CuFail(tc, "no such statistic");
+    return 0;
+}
+
+/* Looking up and describing an interface with its own ifcfg file only
+ * loads the files that make up its config; anything else still works
+ * by looking at all files */
+static void testNarrowLoad(CuTest *tc) {
+    struct netcf_if *nif;
+    char *xml;
+
+    ncf_reset_stats(ncf);
+    nif = ncf_lookup_by_name(ncf, "br0");
+    CuAssertPtrNotNull(tc, nif);
+    /* ifcfg-br0 and ifcfg-eth0 */
+    CuAssertTrue(tc, stat_value(tc, "files_parsed") == 2);
+
+    xml = ncf_if_xml_desc(nif);
+    CuAssertPtrNotNull(tc, xml);
+    CuAssertPtrNotNull(tc, strstr(xml, "name=\"eth0\""));
+    free(xml);
+    ncf_if_free(nif);
+
+    /* eth3 lives in ifcfg-by-device and needs the fallback */
+    nif = ncf_lookup_by_name(ncf, "eth3");
+    CuAssertPtrNotNull(tc, nif);
+    CuAssertStrEquals(tc, "eth3", nif->name);
+    ncf_if_free(nif);
+    CuAssertIntEquals(tc, 1, ncf->ref);
+}
+
+/* Bringing a bridge up or down also brings up or down its ports, even
+ * when a lookup of another interface narrowed the load since the bridge
+ * was looked up. The ifup and ifdown on the PATH only log their
+ * arguments; ncf_if_up still fails since br0 never becomes active */
+static void testIfUpDownAfterLookup(CuTest *tc) {
+    struct netcf_if *nif;
+    char *path = NULL, *log = NULL, *act = NULL;
+    const char *old_path = getenv("PATH");
+    size_t len;
+
+    run(tc, "mkdir -p %s/bin", root);
+    run(tc, "printf '#! /bin/sh\\necho \"${0##*/} $1\" >> %s/ifupdown.log\\n'"
+        " > %s/bin/ifup", root, root);
+    run(tc, "chmod +x %s/bin/ifup && ln -s ifup %s/bin/ifdown", root, root);
+    if (asprintf(&path, "%s/bin:%s", root, old_path) < 0)
+        CuFail(tc, "failed to format PATH");
+    if (asprintf(&log, "%s/ifupdown.log", root) < 0)
+        CuFail(tc, "failed to format log path");
+    setenv("PATH", path, 1);
+
+    nif = ncf_lookup_by_name(ncf, "br0");
+    CuAssertPtrNotNull(tc, nif);
+
+    /* eth0 is a port of br0, and not an interface of its own */
+    CuAssertPtrEquals(tc, NULL, ncf_lookup_by_name(ncf, "eth0"));
+    ncf_if_up(nif);
+
+    CuAssertPtrEquals(tc, NULL, ncf_lookup_by_name(ncf, "eth0"));
+    CuAssertIntEquals(tc, 0, ncf_if_down(nif));
+    assert_ncf_no_error(tc);
+
+    setenv("PATH", old_path, 1);
+    act = read_file(log, &len);
+    CuAssertPtrNotNull(tc, act);
+    CuAssertStrEquals(tc, "ifup eth0\nifup br0\nifdown br0\nifdown eth0\n",
+                      act);
+
+    ncf_if_free(nif);
+    free(act);
+    free(log);
+    free(path);
+}
+
+/* Looking up the same name again gives back the same handle; while the
+ * config is cached, that doesn't need to look at any files */
+static void testLookupInterned(CuTest *tc) {
+    struct netcf_if *nif1, *nif2;
+
+    ncf_set_caching(ncf, NETCF_CACHE_CONFIG);
+    nif1 = ncf_lookup_by_name(ncf, "br0");
+    CuAssertPtrNotNull(tc, nif1);
+    ncf_reset_stats(ncf);
+    nif2 = ncf_lookup_by_name(ncf, "br0");
+    CuAssertPtrEquals(tc, nif1, nif2);
+    CuAssertTrue(tc, stat_value(tc, "files_parsed") == 0);
+    ncf_if_free(nif1);
+    ncf_if_free(nif2);
+    CuAssertIntEquals(tc, 1, ncf->ref);
+
+    /* A dormant handle comes back to life */
+    nif2 = ncf_lookup_by_name(ncf, "br0");
+    CuAssertPtrEquals(tc, nif1, nif2);
+    ncf_if_free(nif2);
+
+    ncf_invalidate(ncf, NETCF_CACHE_CONFIG);
+    ncf_reset_stats(ncf);
+    nif2 = ncf_lookup_by_name(ncf, "br0");
+    CuAssertPtrNotNull(tc, nif2);
+    CuAssertTrue(tc, stat_value(tc, "files_parsed") > 0);
+    ncf_if_free(nif2);
+    ncf_set_caching(ncf, 0);
+    CuAssertIntEquals(tc, 1, ncf->ref);
+}
+
 static void testLookupByMAC(CuTest *tc) {
     static const char *const good_mac = "aa:bb:cc:dd:ee:ff";
     static const char *const good_mac_caps = "AA:bb:cc:DD:Ee:ff";
@@ -144,6 +259,170 @@ static void testDefineUndefine(CuTest *tc) {
     CuAssertPtrEquals(tc, NULL, nif);
 }
 
+/* Defining an interface again with the same config leaves its files
+ * alone; a define keeps comments and entries netcf knows nothing about */
+static void testRedefine(CuTest *tc) {
+    static const char *const ifcfg =
+        "etc/sysconfig/network-scripts/ifcfg-br42";
+    char *bridge_xml = NULL;
+    struct netcf_if *nif = NULL;
+    int r;
+
+    bridge_xml = read_test_file(tc, "interface/bridge42.xml");
+    CuAssertPtrNotNull(tc, bridge_xml);
+
+    /* A comment, an entry netcf knows nothing about, and one that the
+     * new config does not have */
+    run(tc, "printf '# Left by hand\\nDEVICE=br42\\nNM_CONTROLLED=no\\n"
+        "IPADDR=10.0.0.42\\n' > %s/%s", root, ifcfg);
+
+    ncf_reset_stats(ncf);
+    nif = ncf_define(ncf, bridge_xml);
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+    CuAssertTrue(tc, stat_value(tc, "files_written") > 0);
+    CuAssertTrue(tc, stat_value(tc, "keys_written") > 0);
+    ncf_if_free(nif);
+
+    ncf_reset_stats(ncf);
+    nif = ncf_define(ncf, bridge_xml);
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+    CuAssertTrue(tc, stat_value(tc, "files_written") == 0);
+    CuAssertTrue(tc, stat_value(tc, "keys_written") == 0);
+
+    run(tc, "grep -qx '# Left by hand' %s/%s", root, ifcfg);
+    run(tc, "grep -qx 'NM_CONTROLLED=no' %s/%s", root, ifcfg);
+    run(tc, "! grep -q '^IPADDR=' %s/%s", root, ifcfg);
+
+    r = ncf_if_undefine(nif);
+    CuAssertIntEquals(tc, 0, r);
+    ncf_if_free(nif);
+    free(bridge_xml);
+}
+
+/* Flushing files to disk does not change what gets written */
+static void testDurability(CuTest *tc) {
+    static const netcf_durability_t modes[] = {
+        NETCF_DURABILITY_FSYNC, NETCF_DURABILITY_BATCHED
+    };
+    char *bridge_xml = NULL;
+    struct netcf_if *nif = NULL;
+    int r;
+
+    bridge_xml = read_test_file(tc, "interface/bridge42.xml");
+    CuAssertPtrNotNull(tc, bridge_xml);
+
+    r = ncf_set_durability(ncf, 42);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, NETCF_EOTHER, ncf_error(ncf, NULL, NULL));
+
+    for (int i=0; i < ARRAY_CARDINALITY(modes); i++) {
+        r = ncf_set_durability(ncf, modes[i]);
+        CuAssertIntEquals(tc, 0, r);
+
+        nif = ncf_define(ncf, bridge_xml);
+        CuAssertPtrNotNull(tc, nif);
+        assert_ncf_no_error(tc);
+
+        r = ncf_if_undefine(nif);
+        CuAssertIntEquals(tc, 0, r);
+        assert_ncf_no_error(tc);
+        ncf_if_free(nif);
+    }
+
+    r = ncf_set_durability(ncf, NETCF_DURABILITY_NONE);
+    CuAssertIntEquals(tc, 0, r);
+    free(bridge_xml);
+}
+
+/* Defining an interface in several roots changes each of them, but not
+ * the root of the handle, and a root that fails leaves the others alone */
+static void testDefineRoots(CuTest *tc) {
+    enum { NROOTS = 4 };
+    char *bridge_xml = NULL, *path = NULL;
+    char *roots[NROOTS];
+    netcf_errcode_t errcodes[NROOTS];
+    char *errdetails[NROOTS];
+    struct netcf_if *nif = NULL;
+    int r;
+
+    bridge_xml = read_test_file(tc, "interface/bridge42.xml");
+    CuAssertPtrNotNull(tc, bridge_xml);
+
+    for (int i=0; i < NROOTS; i++) {
+        r = asprintf(&roots[i], "%s-roots/%d", root, i);
+        CuAssertTrue(tc, r > 0);
+        if (i == NROOTS - 1)
+            continue;
+        run(tc, "rm -rf %s && mkdir -p %s", roots[i], roots[i]);
+        run(tc, "cp -pr %s/* %s", src_root, roots[i]);
+        run(tc, "chmod -R u+w %s", roots[i]);
+    }
+    /* The last root does not exist */
+    run(tc, "rm -rf %s", roots[NROOTS - 1]);
+
+    r = ncf_define_roots(ncf, 1, (const char *const *) &bridge_xml,
+                         NROOTS, (const char *const *) roots, 2, errcodes,
+                         errdetails);
+    CuAssertIntEquals(tc, -1, r);
+    CuAssertIntEquals(tc, NETCF_EFILE, ncf_error(ncf, NULL, NULL));
+    CuAssertIntEquals(tc, NETCF_EFILE, errcodes[NROOTS - 1]);
+    CuAssertPtrNotNull(tc, errdetails[NROOTS - 1]);
+    free(errdetails[NROOTS - 1]);
+
+    for (int i=0; i < NROOTS - 1; i++) {
+        CuAssertIntEquals(tc, NETCF_NOERROR, errcodes[i]);
+        CuAssertPtrEquals(tc, NULL, errdetails[i]);
+        r = asprintf(&path, "%s/etc/sysconfig/network-scripts/ifcfg-br42",
+                     roots[i]);
+        CuAssertTrue(tc, r > 0);
+        CuAssertIntEquals(tc, 0, access(path, F_OK));
+        free(path);
+    }
+
+    nif = ncf_lookup_by_name(ncf, "br42");
+    CuAssertPtrEquals(tc, NULL, nif);
+
+    /* With only good roots, all of them succeed */
+    r = ncf_define_roots(ncf, 1, (const char *const *) &bridge_xml,
+                         NROOTS - 1, (const char *const *) roots, 0, NULL,
+                         NULL);
+    CuAssertIntEquals(tc, 0, r);
+    assert_ncf_no_error(tc);
+
+    for (int i=0; i < NROOTS; i++)
+        free(roots[i]);
+    free(bridge_xml);
+}
+
+#ifdef HAVE_AUG_TEXT_RETRIEVE
+/* A preview shows the new files, but leaves the disk and the interfaces
+ * netcf knows about alone */
+static void testDefinePreview(CuTest *tc) {
+    char *bridge_xml = NULL, *diff = NULL;
+    struct netcf_if *nif = NULL;
+
+    bridge_xml = read_test_file(tc, "interface/bridge42.xml");
+    CuAssertPtrNotNull(tc, bridge_xml);
+
+    ncf_reset_stats(ncf);
+    diff = ncf_define_preview(ncf, bridge_xml);
+    CuAssertPtrNotNull(tc, diff);
+    assert_ncf_no_error(tc);
+    CuAssertPtrNotNull(tc, strstr(diff,
+        "--- /dev/null\n+++ b/etc/sysconfig/network-scripts/ifcfg-br42\n"));
+    CuAssertPtrNotNull(tc, strstr(diff, "+DEVICE=br42\n"));
+    CuAssertTrue(tc, stat_value(tc, "files_written") == 0);
+
+    nif = ncf_lookup_by_name(ncf, "br42");
+    CuAssertPtrEquals(tc, NULL, nif);
+
+    free(diff);
+    free(bridge_xml);
+}
+#endif
+
 static void assert_transforms(CuTest *tc, const char *base) {
     char *aug_fname = NULL, *ncf_fname = NULL;
     char *aug_xml_exp = NULL, *ncf_xml_exp = NULL;
@@ -232,8 +511,17 @@ int main(void) {
     SUITE_ADD_TEST(suite, testListInterfaces);
     SUITE_ADD_TEST(suite, testLookupByName);
     SUITE_ADD_TEST(suite, testLookupByNameDecoy);
+    SUITE_ADD_TEST(suite, testNarrowLoad);
+    SUITE_ADD_TEST(suite, testIfUpDownAfterLookup);
+    SUITE_ADD_TEST(suite, testLookupInterned);
     SUITE_ADD_TEST(suite, testLookupByMAC);
     SUITE_ADD_TEST(suite, testDefineUndefine);
+    SUITE_ADD_TEST(suite, testRedefine);
+    SUITE_ADD_TEST(suite, testDurability);
+    SUITE_ADD_TEST(suite, testDefineRoots);
+#ifdef HAVE_AUG_TEXT_RETRIEVE
+    SUITE_ADD_TEST(suite, testDefinePreview);
+#endif
     SUITE_ADD_TEST(suite, testTransforms);
     SUITE_ADD_TEST(suite, testCorruptedSetup);
 
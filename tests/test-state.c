@@ -0,0 +1,879 @@
+/*
+ * test-state.c: check the live interface state against synthetic
+ *               netlink caches
+ *
+ * Copyright (C) 2009 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * The links and addresses the library sees come from mock-libnl.c, so
+ * that ncf_if_xml_state can be checked for vlans, bonds and bridges
+ * without creating any of them on the test machine.
+ *
+ * If NETCF_STATE_BENCH is set to a number N, a topology with N links is
+ * generated after the tests have run, and the time it takes to get the
+ * state of every interface in it is reported. If NETCF_INIT_BENCH is set
+ * to N, the time ncf_init and ncf_close take is reported, averaged over
+ * N rounds on a host with 4000 links.
+ */
+
+#include <config.h>
+#include "netcf.h"
+#include "internal.h"
+#include "cutest.h"
+#include "safe-alloc.h"
+#include "ref.h"
+
+#include "tutil.h"
+#include "mock-libnl.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <net/if.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/rtnetlink.h>
+#include <netlink/errno.h>
+
+#include <libxml/tree.h>
+#include <libxml/xpath.h>
+#include <libxml/relaxng.h>
+
+#ifndef TEST_DRIVER
+#error "TEST_DRIVER must be defined to the name of the driver under test"
+#endif
+
+#define IFF_ACTIVE (IFF_UP|IFF_RUNNING)
+
+extern const char *abs_top_srcdir;
+extern const char *abs_top_builddir;
+extern char *driver_name;
+extern char *root, *src_root;
+extern struct netcf *ncf;
+
+/* Make a netcf_if for NAME without consulting the configuration; the
+ * state is all we are interested in here */
+static struct netcf_if *state_if(const char *name) {
+    struct netcf_if *nif;
+
+    if (make_ref(nif) < 0)
+        die("allocation failed");
+    nif->ncf = ref(ncf);
+    nif->name = strdup(name);
+    if (nif->name == NULL)
+        die("allocation failed");
+    return nif;
+}
+
+static xmlDocPtr get_state(CuTest *tc, const char *name) {
+    struct netcf_if *nif;
+    xmlDocPtr doc;
+    char *xml;
+
+    nif = state_if(name);
+    xml = ncf_if_xml_state(nif);
+    CuAssertPtrNotNull(tc, xml);
+    assert_ncf_no_error(tc);
+    doc = parse_xml(xml);
+    free(xml);
+    ncf_if_free(nif);
+    return doc;
+}
+
+/* Assert that evaluating EXPR in DOC produces exactly COUNT nodes */
+static void assert_xpath(CuTest *tc, xmlDocPtr doc, const char *expr,
+                         int count) {
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr obj;
+    int found;
+
+    ctxt = xmlXPathNewContext(doc);
+    if (ctxt == NULL)
+        die("xmlXPathNewContext failed");
+    obj = xmlXPathEvalExpression(BAD_CAST expr, ctxt);
+    if (obj == NULL)
+        die("invalid XPath expression");
+    found = (obj->nodesetval == NULL) ? 0 : obj->nodesetval->nodeNr;
+    xmlXPathFreeObject(obj);
+    xmlXPathFreeContext(ctxt);
+
+    if (found != count) {
+        char *msg = NULL;
+        xmlChar *xml;
+        int len;
+
+        xmlDocDumpFormatMemory(doc, &xml, &len, 1);
+        format_error(&msg, "%s: expected %d nodes, found %d in\n%s",
+                     expr, count, found, xml);
+        xmlFree(xml);
+        CuFail(tc, msg);
+    }
+}
+
+static void testEthernetState(CuTest *tc) {
+    xmlDocPtr doc;
+    int ifindex;
+
+    mock_nl_reset();
+    ifindex = mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+    CuAssertIntEquals(tc, 1, ifindex);
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(ifindex, "192.168.7.2", 24));
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(ifindex, "192.168.8.2", 16));
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(ifindex, "2001:db8::2", 64));
+
+    doc = get_state(tc, "nct0");
+    assert_xpath(tc, doc, "/interface[@name = 'nct0'][@type = 'ethernet']", 1);
+    assert_xpath(tc, doc, "/interface/mac[@address = '02:00:00:00:00:01']", 1);
+    assert_xpath(tc, doc, "/interface/protocol", 2);
+    assert_xpath(tc, doc, "/interface/protocol[@family = 'ipv4']/ip", 2);
+    assert_xpath(tc, doc, "/interface/protocol[@family = 'ipv4']"
+                 "/ip[@address = '192.168.7.2'][@prefix = '24']", 1);
+    assert_xpath(tc, doc, "/interface/protocol[@family = 'ipv6']"
+                 "/ip[@address = '2001:db8::2'][@prefix = '64']", 1);
+    xmlFreeDoc(doc);
+}
+
+static void testVlanState(CuTest *tc) {
+    xmlDocPtr doc;
+    int lower, vlan;
+
+    mock_nl_reset();
+    lower = mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+    vlan = mock_nl_add_link("nct0.42", "vlan", IFF_ACTIVE, 0, lower, 42);
+    CuAssert(tc, "failed to add vlan", vlan > 0);
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(vlan, "10.0.42.1", 24));
+
+    doc = get_state(tc, "nct0.42");
+    assert_xpath(tc, doc, "/interface[@name = 'nct0.42'][@type = 'vlan']", 1);
+    assert_xpath(tc, doc, "/interface/vlan[@tag = '42']", 1);
+    assert_xpath(tc, doc, "/interface/vlan/interface"
+                 "[@name = 'nct0'][@type = 'ethernet']/mac", 1);
+    assert_xpath(tc, doc, "/interface/protocol[@family = 'ipv4']"
+                 "/ip[@address = '10.0.42.1']", 1);
+    xmlFreeDoc(doc);
+}
+
+static void testBondState(CuTest *tc) {
+    xmlDocPtr doc;
+    int bond;
+
+    mock_nl_reset();
+    bond = mock_nl_add_link("nctbond0", "bond", IFF_ACTIVE|IFF_MASTER,
+                            0, 0, 0);
+    mock_nl_add_link("nct1", NULL, IFF_ACTIVE|IFF_SLAVE, bond, 0, 0);
+    mock_nl_add_link("nct2", NULL, IFF_ACTIVE|IFF_SLAVE, bond, 0, 0);
+    /* Has the bond as master, but is not a slave */
+    mock_nl_add_link("nct3", NULL, IFF_ACTIVE, bond, 0, 0);
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(bond, "10.1.0.1", 8));
+    CuAssertIntEquals(tc, 0, mock_nl_set_bond(bond, 1, 100, 0, NULL));
+
+    doc = get_state(tc, "nctbond0");
+    assert_xpath(tc, doc, "/interface[@name = 'nctbond0'][@type = 'bond']", 1);
+    assert_xpath(tc, doc, "/interface/bond[@mode = 'active-backup']", 1);
+    assert_xpath(tc, doc, "/interface/bond/miimon"
+                 "[@freq = '100'][@carrier = 'netif']", 1);
+    assert_xpath(tc, doc, "/interface/bond/arpmon", 0);
+    assert_xpath(tc, doc, "/interface/bond/interface", 2);
+    assert_xpath(tc, doc, "/interface/bond/interface"
+                 "[@name = 'nct1'][@type = 'ethernet']", 1);
+    assert_xpath(tc, doc, "/interface/bond/interface"
+                 "[@name = 'nct2'][@type = 'ethernet']", 1);
+    assert_xpath(tc, doc, "/interface/protocol/ip[@address = '10.1.0.1']", 1);
+    xmlFreeDoc(doc);
+}
+
+static void testBridgeState(CuTest *tc) {
+    xmlDocPtr doc;
+    int bridge, bond;
+
+    mock_nl_reset();
+    bridge = mock_nl_add_link("nctbr0", "bridge", IFF_ACTIVE, 0, 0, 0);
+    mock_nl_add_link("nct1", NULL, IFF_ACTIVE, bridge, 0, 0);
+    bond = mock_nl_add_link("nctbond0", "bond", IFF_ACTIVE|IFF_MASTER,
+                            bridge, 0, 0);
+    mock_nl_add_link("nct2", NULL, IFF_ACTIVE|IFF_SLAVE, bond, 0, 0);
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(bridge, "172.16.0.1", 12));
+    CuAssertIntEquals(tc, 0, mock_nl_set_bond(bond, 0, 0, 200,
+                                              "172.16.0.254"));
+
+    doc = get_state(tc, "nctbr0");
+    assert_xpath(tc, doc, "/interface[@name = 'nctbr0'][@type = 'bridge']", 1);
+    assert_xpath(tc, doc, "/interface/bridge", 1);
+    assert_xpath(tc, doc, "/interface/bridge/interface", 2);
+    assert_xpath(tc, doc, "/interface/bridge/interface"
+                 "[@name = 'nct1'][@type = 'ethernet']", 1);
+    assert_xpath(tc, doc, "/interface/bridge/interface"
+                 "[@name = 'nctbond0'][@type = 'bond']"
+                 "/bond[@mode = 'balance-rr']/interface[@name = 'nct2']", 1);
+    assert_xpath(tc, doc, "/interface/bridge/interface/bond"
+                 "/arpmon[@interval = '200'][@target = '172.16.0.254']"
+                 "[@validate = 'none']", 1);
+    assert_xpath(tc, doc, "/interface/protocol/ip[@address = '172.16.0.1']", 1);
+    xmlFreeDoc(doc);
+}
+
+/* Routes show up on the interface they go out through, except for the
+ * ones the kernel adds for the addresses of the interface */
+static void testRouteState(CuTest *tc) {
+    xmlDocPtr doc;
+    int eth0, eth1;
+
+    mock_nl_reset();
+    eth0 = mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+    eth1 = mock_nl_add_link("nct1", NULL, IFF_ACTIVE, 0, 0, 0);
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(eth0, "192.168.7.2", 24));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth0, "0.0.0.0", 0,
+                                               "192.168.7.1", RTPROT_BOOT));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth0, "10.0.0.0", 8,
+                                               "192.168.7.254",
+                                               RTPROT_STATIC));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth0, "192.168.7.0", 24,
+                                               NULL, RTPROT_KERNEL));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth0, "::", 0,
+                                               "fe80::1", RTPROT_RA));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth1, "172.16.0.0", 12,
+                                               NULL, RTPROT_BOOT));
+
+    doc = get_state(tc, "nct0");
+    assert_xpath(tc, doc, "/interface/protocol", 2);
+    assert_xpath(tc, doc, "/interface/protocol[@family = 'ipv4']/route", 2);
+    assert_xpath(tc, doc, "/interface/protocol[@family = 'ipv4']"
+                 "/route[not(@destination)][@gateway = '192.168.7.1']", 1);
+    assert_xpath(tc, doc, "/interface/protocol[@family = 'ipv4']"
+                 "/route[@destination = '10.0.0.0/8']"
+                 "[@gateway = '192.168.7.254']", 1);
+    assert_xpath(tc, doc, "/interface/protocol[@family = 'ipv6']"
+                 "/route[not(@destination)][@gateway = 'fe80::1']", 1);
+    xmlFreeDoc(doc);
+
+    doc = get_state(tc, "nct1");
+    assert_xpath(tc, doc, "/interface/protocol/route", 1);
+    assert_xpath(tc, doc, "/interface/protocol[@family = 'ipv4']"
+                 "/route[@destination = '172.16.0.0/12'][not(@gateway)]", 1);
+    xmlFreeDoc(doc);
+}
+
+/* Assert that DOC is valid according to the interface schema */
+static void assert_valid(CuTest *tc, xmlDocPtr doc) {
+    xmlRelaxNGParserCtxtPtr pctxt;
+    xmlRelaxNGValidCtxtPtr vctxt;
+    xmlRelaxNGPtr rng;
+    char *path = NULL, *msg = NULL;
+    int r;
+
+    if (asprintf(&path, "%s/data/xml/interface.rng", abs_top_srcdir) < 0)
+        die("failed to format schema path");
+    pctxt = xmlRelaxNGNewParserCtxt(path);
+    rng = xmlRelaxNGParse(pctxt);
+    xmlRelaxNGFreeParserCtxt(pctxt);
+    if (rng == NULL)
+        die("failed to parse interface.rng");
+
+    vctxt = xmlRelaxNGNewValidCtxt(rng);
+    r = xmlRelaxNGValidateDoc(vctxt, doc);
+    xmlRelaxNGFreeValidCtxt(vctxt);
+    xmlRelaxNGFree(rng);
+    free(path);
+
+    if (r != 0) {
+        xmlChar *xml;
+        int len;
+
+        xmlDocDumpFormatMemory(doc, &xml, &len, 1);
+        format_error(&msg, "state does not match interface.rng:\n%s", xml);
+        xmlFree(xml);
+        CuFail(tc, msg);
+    }
+}
+
+/* The state of each kind of interface, with its routes, is a valid
+ * interface description. Only IPv6 allows more than one address per
+ * interface in a description */
+static void testStateValid(CuTest *tc) {
+    static const char *const names[] = {
+        "nct0", "nct0.42", "nctbond0", "nctbr0"
+    };
+    xmlDocPtr doc;
+    int eth0, vlan, bond, bridge;
+
+    mock_nl_reset();
+    eth0 = mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+    vlan = mock_nl_add_link("nct0.42", "vlan", IFF_ACTIVE, 0, eth0, 42);
+    bridge = mock_nl_add_link("nctbr0", "bridge", IFF_ACTIVE, 0, 0, 0);
+    bond = mock_nl_add_link("nctbond0", "bond", IFF_ACTIVE|IFF_MASTER,
+                            bridge, 0, 0);
+    mock_nl_add_link("nct1", NULL, IFF_ACTIVE|IFF_SLAVE, bond, 0, 0);
+    mock_nl_add_link("nct2", NULL, IFF_ACTIVE|IFF_SLAVE, bond, 0, 0);
+    CuAssertIntEquals(tc, 0, mock_nl_set_bond(bond, 1, 100, 0, NULL));
+
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(eth0, "192.168.7.2", 24));
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(eth0, "2001:db8::2", 64));
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(eth0, "2001:db8::3", 64));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth0, "0.0.0.0", 0,
+                                               "192.168.7.1", RTPROT_BOOT));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth0, "10.0.0.0", 8,
+                                               "192.168.7.254",
+                                               RTPROT_STATIC));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth0, "172.16.0.0", 12,
+                                               NULL, RTPROT_BOOT));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth0, "::", 0,
+                                               "fe80::1", RTPROT_RA));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(eth0, "2001:db8:1::", 48,
+                                               "fe80::2", RTPROT_STATIC));
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(vlan, "10.0.42.1", 24));
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(bridge, "172.17.0.1", 16));
+    CuAssertIntEquals(tc, 0, mock_nl_add_route(bridge, "192.168.100.0", 24,
+                                               "172.17.0.254", RTPROT_BOOT));
+
+    for (int i=0; i < ARRAY_CARDINALITY(names); i++) {
+        doc = get_state(tc, names[i]);
+        assert_valid(tc, doc);
+        xmlFreeDoc(doc);
+    }
+}
+
+/* An interface that the kernel does not know about has no state beyond
+ * its name and (guessed) type */
+static void testMissingState(CuTest *tc) {
+    xmlDocPtr doc;
+
+    mock_nl_reset();
+    mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+
+    doc = get_state(tc, "nct9");
+    assert_xpath(tc, doc, "/interface[@name = 'nct9']", 1);
+    assert_xpath(tc, doc, "/interface/mac", 0);
+    assert_xpath(tc, doc, "/interface/protocol", 0);
+    xmlFreeDoc(doc);
+}
+
+/* Counters are only reported when asked for, and ncf_if_stats returns
+ * the same values without XML */
+static void testLinkStats(CuTest *tc) {
+    struct netcf_if *nif;
+    struct netcf_if_stats stats;
+    xmlDocPtr doc;
+    int eth0;
+
+    mock_nl_reset();
+    eth0 = mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+    CuAssertIntEquals(tc, 0, mock_nl_set_link_stats(eth0, 123400, 5600,
+                                                    7, 4));
+
+    doc = get_state(tc, "nct0");
+    assert_xpath(tc, doc, "/interface/stats", 0);
+    xmlFreeDoc(doc);
+
+    CuAssertIntEquals(tc, -1, ncf_set_state_flags(ncf, 0x80));
+    CuAssertIntEquals(tc, NETCF_EOTHER, ncf_error(ncf, NULL, NULL));
+    CuAssertIntEquals(tc, 0, ncf_set_state_flags(ncf, NETCF_STATE_STATS));
+    doc = get_state(tc, "nct0");
+    assert_xpath(tc, doc, "/interface/stats[@rx_bytes = '123400']"
+                 "[@rx_packets = '1234'][@rx_dropped = '7'][@rx_errors = '0']"
+                 "[@tx_bytes = '5600'][@tx_packets = '56']"
+                 "[@rx_queues = '4'][@tx_queues = '4']", 1);
+    xmlFreeDoc(doc);
+    CuAssertIntEquals(tc, 0, ncf_set_state_flags(ncf, 0));
+
+    nif = state_if("nct0");
+    CuAssertIntEquals(tc, 0, ncf_if_stats(nif, &stats));
+    CuAssertTrue(tc, stats.rx_bytes == 123400);
+    CuAssertTrue(tc, stats.rx_packets == 1234);
+    CuAssertTrue(tc, stats.rx_dropped == 7);
+    CuAssertTrue(tc, stats.tx_bytes == 5600);
+    CuAssertTrue(tc, stats.tx_errors == 0);
+    CuAssertIntEquals(tc, 4, stats.tx_queues);
+    ncf_if_free(nif);
+
+    nif = state_if("nct9");
+    CuAssertIntEquals(tc, -1, ncf_if_stats(nif, &stats));
+    CuAssertIntEquals(tc, NETCF_EOTHER, ncf_error(ncf, NULL, NULL));
+    ncf_if_free(nif);
+}
+
+/* Return the entry for the statistic NAME */
+static struct netcf_stat find_stat(CuTest *tc, const char *name) {
+    struct netcf_stat stats[32];
+    int nstats;
+
+    nstats = ncf_get_stats(ncf, stats, ARRAY_CARDINALITY(stats));
+    CuAssert(tc, "ncf_get_stats failed", nstats > 0);
+    CuAssert(tc, "too many statistics",
+             nstats <= (int) ARRAY_CARDINALITY(stats));
+    for (int i=0; i < nstats; i++) {
+        if (STREQ(stats[i].name, name))
+            return stats[i];
+    }
+    CuFail(tc, "statistic not found");
+    return stats[0];
+}
+
+/* ncf_init sets nothing up that a call might not need */
+static void testLazyInit(CuTest *tc) {
+    xmlDocPtr doc;
+
+    mock_nl_reset();
+    mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+    CuAssertTrue(tc, find_stat(tc, "netlink_dump").count == 0);
+    CuAssertTrue(tc, find_stat(tc, "files_parsed").count == 0);
+    CuAssertIntEquals(tc, 0, mock_nl_refills());
+
+    /* the state needs netlink, but neither schema nor stylesheets */
+    doc = get_state(tc, "nct0");
+    assert_xpath(tc, doc, "/interface/mac", 1);
+    xmlFreeDoc(doc);
+    CuAssertTrue(tc, find_stat(tc, "netlink_dump").count == 3);
+    CuAssertTrue(tc, find_stat(tc, "files_parsed").count == 0);
+    CuAssertIntEquals(tc, 3, mock_nl_refills());
+}
+
+/* Every cache fill is counted as a netlink dump */
+static void testStats(CuTest *tc) {
+    xmlDocPtr doc;
+
+    mock_nl_reset();
+    mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+
+    CuAssertIntEquals(tc, 0, ncf_reset_stats(ncf));
+    CuAssertTrue(tc, find_stat(tc, "netlink_dump").count == 0);
+
+    doc = get_state(tc, "nct0");
+    xmlFreeDoc(doc);
+    CuAssertTrue(tc, find_stat(tc, "netlink_dump").count == mock_nl_refills());
+    CuAssertTrue(tc, find_stat(tc, "netlink_dump").count > 0);
+    CuAssertTrue(tc, find_stat(tc, "aug_save").count == 0);
+}
+
+/* Interrupted dumps are done again, and counted; other failures are
+ * reported right away */
+static void testDumpRetry(CuTest *tc) {
+    struct netcf_if *nif;
+    xmlDocPtr doc;
+
+    mock_nl_reset();
+    mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+    CuAssertIntEquals(tc, -1, ncf_set_netlink_rcvbuf(ncf, -1));
+    CuAssertIntEquals(tc, 0, ncf_set_netlink_rcvbuf(ncf, 4 * 1024 * 1024));
+
+    CuAssertIntEquals(tc, 0, ncf_reset_stats(ncf));
+    mock_nl_fail_dumps(2, -NLE_DUMP_INTR);
+    doc = get_state(tc, "nct0");
+    assert_xpath(tc, doc, "/interface/mac", 1);
+    xmlFreeDoc(doc);
+    CuAssertTrue(tc, find_stat(tc, "netlink_retry").count == 2);
+    CuAssertTrue(tc, find_stat(tc, "netlink_dump").count
+                 == mock_nl_refills() + 2);
+
+    mock_nl_fail_dumps(1, -NLE_NOMEM);
+    doc = get_state(tc, "nct0");
+    xmlFreeDoc(doc);
+    CuAssertTrue(tc, find_stat(tc, "netlink_retry").count == 3);
+
+    /* a dump that keeps getting interrupted is given up on eventually */
+    nif = state_if("nct0");
+    mock_nl_fail_dumps(100, -NLE_DUMP_INTR);
+    CuAssertPtrEquals(tc, NULL, ncf_if_xml_state(nif));
+    CuAssertIntEquals(tc, NETCF_ENETLINK, ncf_error(ncf, NULL, NULL));
+    CuAssertTrue(tc, find_stat(tc, "netlink_retry").count == 8);
+
+    mock_nl_fail_dumps(1, -NLE_PERM);
+    CuAssertPtrEquals(tc, NULL, ncf_if_xml_state(nif));
+    CuAssertIntEquals(tc, NETCF_ENETLINK, ncf_error(ncf, NULL, NULL));
+    CuAssertTrue(tc, find_stat(tc, "netlink_retry").count == 8);
+    ncf_if_free(nif);
+
+    mock_nl_fail_dumps(0, 0);
+    CuAssertIntEquals(tc, 0, ncf_set_netlink_rcvbuf(ncf, 0));
+}
+
+/* With state caching on, the caches are only refilled after
+ * ncf_invalidate */
+static void testCaching(CuTest *tc) {
+    xmlDocPtr doc;
+    unsigned int refills;
+
+    mock_nl_reset();
+    mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+
+    CuAssertIntEquals(tc, 0, ncf_set_caching(ncf, NETCF_CACHE_STATE));
+    doc = get_state(tc, "nct0");
+    xmlFreeDoc(doc);
+    refills = mock_nl_refills();
+    CuAssertTrue(tc, refills > 0);
+
+    /* Changes go unnoticed until the cache is invalidated */
+    mock_nl_add_addr(1, "192.168.7.2", 24);
+    doc = get_state(tc, "nct0");
+    assert_xpath(tc, doc, "/interface/protocol/ip", 0);
+    xmlFreeDoc(doc);
+    CuAssertIntEquals(tc, refills, mock_nl_refills());
+
+    CuAssertIntEquals(tc, 0, ncf_invalidate(ncf, NETCF_CACHE_STATE));
+    doc = get_state(tc, "nct0");
+    assert_xpath(tc, doc, "/interface/protocol/ip", 1);
+    xmlFreeDoc(doc);
+    CuAssertTrue(tc, mock_nl_refills() > refills);
+
+    /* Without caching, every call looks at the kernel again */
+    CuAssertIntEquals(tc, 0, ncf_set_caching(ncf, 0));
+    refills = mock_nl_refills();
+    doc = get_state(tc, "nct0");
+    xmlFreeDoc(doc);
+    CuAssertTrue(tc, mock_nl_refills() > refills);
+}
+
+/* Wait for events on FD and look for one of KIND for NAME among them */
+static bool saw_event(CuTest *tc, int fd, netcf_event_kind_t kind,
+                      const char *name) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct netcf_event events[16];
+    int n;
+
+    while (poll(&pfd, 1, 1000) > 0) {
+        n = ncf_read_events(ncf, events, ARRAY_CARDINALITY(events));
+        CuAssertTrue(tc, n >= 0);
+        for (int i=0; i < n; i++)
+            if (events[i].kind == kind && STREQ(events[i].name, name))
+                return true;
+    }
+    return false;
+}
+
+/* Config files written or removed under the root turn into events for the
+ * interface they belong to, and invalidate the parsed configuration */
+static void testEvents(CuTest *tc) {
+    static const char *const dirs[] = {
+        "etc/sysconfig/network-scripts", "etc/sysconfig/network", "etc/network"
+    };
+    char *path = NULL;
+    FILE *fp = NULL;
+    int fd;
+
+    fd = ncf_get_event_fd(ncf);
+    assert_ncf_no_error(tc);
+    CuAssertTrue(tc, fd >= 0);
+    CuAssertIntEquals(tc, fd, ncf_get_event_fd(ncf));
+
+    /* Use whichever of the config dirs the driver's fsroot has */
+    for (int i=0; i < ARRAY_CARDINALITY(dirs); i++) {
+        if (asprintf(&path, "%s/%s/ifcfg-nctev0", root, dirs[i]) < 0)
+            die("allocation failed");
+        fp = fopen(path, "w");
+        if (fp != NULL)
+            break;
+        FREE(path);
+    }
+    CuAssertPtrNotNull(tc, fp);
+    fputs("DEVICE=nctev0\n", fp);
+    fclose(fp);
+
+    CuAssertIntEquals(tc, 0, ncf_set_caching(ncf, NETCF_CACHE_CONFIG));
+    ncf->stale = 0;
+    CuAssertTrue(tc, saw_event(tc, fd, NETCF_EVENT_CONFIG_CHANGED, "nctev0"));
+    CuAssertTrue(tc, ncf->stale & NETCF_CACHE_CONFIG);
+
+    CuAssertIntEquals(tc, 0, unlink(path));
+    CuAssertTrue(tc, saw_event(tc, fd, NETCF_EVENT_CONFIG_REMOVED, "nctev0"));
+    free(path);
+}
+
+/* All toplevel interfaces end up in one document, filled from a single
+ * snapshot of the caches */
+static void testAllState(CuTest *tc) {
+    unsigned int flags = NETCF_IFACE_ACTIVE|NETCF_IFACE_INACTIVE;
+    char **names = NULL, *xml, *expr = NULL;
+    xmlDocPtr doc;
+    int nint, ifindex;
+
+    nint = ncf_num_of_interfaces(ncf, flags);
+    CuAssert(tc, "no interfaces", nint > 0);
+    if (ALLOC_N(names, nint) < 0)
+        die("allocation failed");
+    CuAssertIntEquals(tc, nint, ncf_list_interfaces(ncf, nint, names, flags));
+
+    mock_nl_reset();
+    ifindex = mock_nl_add_link(names[0], NULL, IFF_ACTIVE, 0, 0, 0);
+    CuAssertIntEquals(tc, 0, mock_nl_add_addr(ifindex, "192.168.7.2", 24));
+
+    xml = ncf_all_xml_state(ncf, flags);
+    CuAssertPtrNotNull(tc, xml);
+    assert_ncf_no_error(tc);
+    CuAssertIntEquals(tc, 3, mock_nl_refills());
+
+    doc = parse_xml(xml);
+    assert_xpath(tc, doc, "/interfaces/interface", nint);
+    for (int i=0; i < nint; i++) {
+        if (asprintf(&expr, "/interfaces/interface[@name = '%s']",
+                     names[i]) < 0)
+            die("allocation failed");
+        assert_xpath(tc, doc, expr, 1);
+        free(expr);
+    }
+    if (asprintf(&expr, "/interfaces/interface[@name = '%s']"
+                 "/protocol/ip[@address = '192.168.7.2']", names[0]) < 0)
+        die("allocation failed");
+    assert_xpath(tc, doc, expr, 1);
+    free(expr);
+
+    xmlFreeDoc(doc);
+    free(xml);
+    for (int i=0; i < nint; i++)
+        free(names[i]);
+    free(names);
+}
+
+struct trace_log {
+    int depth;
+    int nevents;
+    bool seen_state;
+    bool ifname_ok;
+    unsigned long long last;
+    bool monotonic;
+};
+
+static void trace_cb(struct netcf *tncf ATTRIBUTE_UNUSED,
+                     netcf_trace_event_t event, unsigned long long timestamp,
+                     const char *op, const char *ifname, void *data) {
+    struct trace_log *log = data;
+
+    log->nevents += 1;
+    log->depth += (event == NETCF_TRACE_BEGIN) ? 1 : -1;
+    if (timestamp < log->last)
+        log->monotonic = false;
+    log->last = timestamp;
+    if (STREQ(op, "add_state_to_xml_doc"))
+        log->seen_state = true;
+    if (STRNEQ(op, "ncf_set_trace_callback") &&
+        (ifname == NULL || STRNEQ(ifname, "nct0")))
+        log->ifname_ok = false;
+}
+
+/* Begin and end events are balanced and carry the interface name */
+static void testTrace(CuTest *tc) {
+    struct trace_log log = { .monotonic = true, .ifname_ok = true };
+    xmlDocPtr doc;
+
+    mock_nl_reset();
+    mock_nl_add_link("nct0", NULL, IFF_ACTIVE, 0, 0, 0);
+
+    CuAssertIntEquals(tc, 0, ncf_set_trace_callback(ncf, trace_cb, &log));
+    doc = get_state(tc, "nct0");
+    xmlFreeDoc(doc);
+    CuAssertIntEquals(tc, 0, ncf_set_trace_callback(ncf, NULL, NULL));
+
+    CuAssertIntEquals(tc, 0, log.depth);
+    CuAssertTrue(tc, log.nevents >= 4);
+    CuAssertTrue(tc, log.seen_state);
+    CuAssertTrue(tc, log.ifname_ok);
+    CuAssertTrue(tc, log.monotonic);
+}
+
+/* Generate a topology with roughly NLINKS links: ethernet devices,
+ * bonds of two ethernet devices each, bridges over a bond and a vlan,
+ * and two addresses and a static route on every top-level interface.
+ * The names of the top-level interfaces are stored in NAMES.
+ */
+static int bench_topology(int nlinks, char ***names) {
+    int n = 0, nnames = 0;
+    char name[32], addr[64];
+
+    mock_nl_reset();
+    if (ALLOC_N(*names, nlinks) < 0)
+        die("allocation failed");
+
+    for (int i=0; n + 6 <= nlinks; i++) {
+        int eth, bond, vlan, bridge, top[3];
+
+        snprintf(name, sizeof(name), "ncb%d", i);
+        bond = mock_nl_add_link(name, "bond", IFF_ACTIVE|IFF_MASTER,
+                                0, 0, 0);
+        for (int j=0; j < 2; j++) {
+            snprintf(name, sizeof(name), "nce%d.%d", i, j);
+            mock_nl_add_link(name, NULL, IFF_ACTIVE|IFF_SLAVE, bond, 0, 0);
+        }
+        snprintf(name, sizeof(name), "nce%d", i);
+        eth = mock_nl_add_link(name, NULL, IFF_ACTIVE, 0, 0, 0);
+        snprintf(name, sizeof(name), "nce%d.%d", i, 100 + i % 3000);
+        vlan = mock_nl_add_link(name, "vlan", IFF_ACTIVE, 0, eth,
+                                100 + i % 3000);
+        snprintf(name, sizeof(name), "ncbr%d", i);
+        bridge = mock_nl_add_link(name, "bridge", IFF_ACTIVE, 0, 0, 0);
+        n += 6;
+        if (bond < 0 || eth < 0 || vlan < 0 || bridge < 0)
+            die("failed to generate topology");
+
+        top[0] = bond;
+        top[1] = vlan;
+        top[2] = bridge;
+        for (int j=0; j < 3; j++) {
+            snprintf(addr, sizeof(addr), "10.%d.%d.1",
+                     (i >> 8) & 0xff, i & 0xff);
+            mock_nl_add_addr(top[j], addr, 24);
+            snprintf(addr, sizeof(addr), "fd00:%x::%x", i, j + 1);
+            mock_nl_add_addr(top[j], addr, 64);
+            snprintf(addr, sizeof(addr), "172.%d.%d.0",
+                     16 + j, i & 0xff);
+            mock_nl_add_route(top[j], addr, 24, NULL, RTPROT_BOOT);
+        }
+        snprintf(name, sizeof(name), "ncb%d", i);
+        (*names)[nnames++] = strdup(name);
+        snprintf(name, sizeof(name), "nce%d.%d", i, 100 + i % 3000);
+        (*names)[nnames++] = strdup(name);
+        snprintf(name, sizeof(name), "ncbr%d", i);
+        (*names)[nnames++] = strdup(name);
+    }
+    return nnames;
+}
+
+static double elapsed(const struct timespec *start,
+                      const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec)
+        + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void bench_state(int nlinks) {
+    struct timespec start, end;
+    char **names = NULL;
+    int nnames;
+    unsigned int refills;
+
+    nnames = bench_topology(nlinks, &names);
+
+    /* Getting the state never touches the config files, so the pristine
+     * fsroot will do */
+    if (ncf_init(&ncf, src_root) < 0)
+        die("ncf_init failed");
+
+    refills = mock_nl_refills();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i=0; i < nnames; i++) {
+        struct netcf_if *nif = state_if(names[i]);
+        char *xml = ncf_if_xml_state(nif);
+        if (xml == NULL)
+            die("ncf_if_xml_state failed");
+        free(xml);
+        ncf_if_free(nif);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("state of %d interfaces (%d links): %.3f s, %.1f us/interface, "
+           "%u cache refills\n",
+           nnames, nlinks, elapsed(&start, &end),
+           elapsed(&start, &end) * 1e6 / nnames,
+           mock_nl_refills() - refills);
+
+    ncf_close(ncf);
+    for (int i=0; i < nnames; i++)
+        free(names[i]);
+    free(names);
+}
+
+static void bench_init(int rounds) {
+    struct timespec start, end;
+    char **names = NULL;
+    int nnames;
+
+    /* None of these links should ever be dumped */
+    nnames = bench_topology(4000, &names);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i=0; i < rounds; i++) {
+        if (ncf_init(&ncf, src_root) < 0)
+            die("ncf_init failed");
+        ncf_close(ncf);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("ncf_init and ncf_close: %d rounds, %.1f us/round, "
+           "%u cache refills\n",
+           rounds, elapsed(&start, &end) * 1e6 / rounds, mock_nl_refills());
+
+    for (int i=0; i < nnames; i++)
+        free(names[i]);
+    free(names);
+}
+
+int main(void) {
+    char *output = NULL;
+    const char *bench;
+    CuSuite* suite = CuSuiteNew();
+    int failures;
+
+    abs_top_srcdir = getenv("abs_top_srcdir");
+    if (abs_top_srcdir == NULL)
+        die("env var abs_top_srcdir must be set");
+
+    abs_top_builddir = getenv("abs_top_builddir");
+    if (abs_top_builddir == NULL)
+        die("env var abs_top_builddir must be set");
+
+    if (asprintf(&src_root, "%s/tests/%s/fsroot",
+                 abs_top_srcdir, TEST_DRIVER) < 0) {
+        die("failed to set src_root");
+    }
+
+    if (asprintf(&driver_name, "state-%s", TEST_DRIVER) < 0) {
+        die("failed to set driver name");
+    }
+
+    CuSuiteSetup(suite, setup, teardown);
+
+    SUITE_ADD_TEST(suite, testEthernetState);
+    SUITE_ADD_TEST(suite, testVlanState);
+    SUITE_ADD_TEST(suite, testBondState);
+    SUITE_ADD_TEST(suite, testBridgeState);
+    SUITE_ADD_TEST(suite, testRouteState);
+    SUITE_ADD_TEST(suite, testStateValid);
+    SUITE_ADD_TEST(suite, testMissingState);
+    SUITE_ADD_TEST(suite, testLinkStats);
+    SUITE_ADD_TEST(suite, testAllState);
+    SUITE_ADD_TEST(suite, testLazyInit);
+    SUITE_ADD_TEST(suite, testStats);
+    SUITE_ADD_TEST(suite, testDumpRetry);
+    SUITE_ADD_TEST(suite, testTrace);
+    SUITE_ADD_TEST(suite, testCaching);
+    SUITE_ADD_TEST(suite, testEvents);
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, &output);
+    CuSuiteDetails(suite, &output);
+    printf("%s\n", output);
+    free(output);
+    failures = suite->failCount;
+
+    bench = getenv("NETCF_STATE_BENCH");
+    if (failures == 0 && bench != NULL)
+        bench_state(atoi(bench));
+    bench = getenv("NETCF_INIT_BENCH");
+    if (failures == 0 && bench != NULL)
+        bench_init(atoi(bench));
+
+    mock_nl_reset();
+    free(driver_name);
+    return failures;
+}
+
+/*
+ * Local variables:
+ *  indent-tabs-mode: nil
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  tab-width: 4
+ * End:
+ */
+/* vim: set ts=4 sw=4 et: */
@@ -39,6 +39,22 @@ extern char *driver_name;
 extern char *root, *src_root;
 extern struct netcf *ncf;
 
+static const char *const netrules =
+    "etc/udev/rules.d/70-persistent-net.rules";
+
+static unsigned long long stat_value(CuTest *tc, const char *name) {
+    struct netcf_stat stats[NETCF_STAT_LAST];
+    int n;
+
+    n = ncf_get_stats(ncf, stats, ARRAY_CARDINALITY(stats));
+    CuAssertIntEquals(tc, NETCF_STAT_LAST, n);
+    for (int i=0; i < n; i++)
+        if (STREQ(stats[i].name, name))
+            return stats[i].count;
+    CuFail(tc, "no such statistic");
+    return 0;
+}
+
 static void testListInterfaces(CuTest *tc) {
     int nint;
     char **names;
@@ -72,8 +88,8 @@ static void testLookupByName(CuTest *tc) {
     CuAssertIntEquals(tc, 1, ncf->ref);
 }
 
-/* Check that we get the right ifcfg- file when we have to
- * look it up indirectly by HWADDR
+/* Check that we read ifcfg-eth4, and not one of its backups, which
+ * have a different STARTMODE
  */
 static void testLookupByNameDecoy(CuTest *tc) {
     struct netcf_if *nif;
@@ -85,7 +101,7 @@ static void testLookupByNameDecoy(CuTest *tc) {
 
     xml = ncf_if_xml_desc(nif);
     CuAssertPtrNotNull(tc, xml);
-    loc = strstr(xml, "<mac address=\"00:00:00:00:00:01\"/>");
+    loc = strstr(xml, "<start mode=\"onboot\"/>");
     CuAssertPtrNotNull(tc, loc);
 
     free(xml);
@@ -93,6 +109,22 @@ static void testLookupByNameDecoy(CuTest *tc) {
     CuAssertIntEquals(tc, 1, ncf->ref);
 }
 
+/* The MAC address of an interface comes from its udev rule */
+static void testNetruleDesc(CuTest *tc) {
+    struct netcf_if *nif;
+    char *xml;
+
+    nif = ncf_lookup_by_name(ncf, "eth3");
+    CuAssertPtrNotNull(tc, nif);
+
+    xml = ncf_if_xml_desc(nif);
+    CuAssertPtrNotNull(tc, xml);
+    CuAssertPtrNotNull(tc, strstr(xml, "<mac address=\"00:00:00:00:00:03\"/>"));
+
+    free(xml);
+    ncf_if_free(nif);
+}
+
 static void testLookupByMAC(CuTest *tc) {
     static const char *const good_mac = "aa:bb:cc:dd:ee:ff";
     static const char *const good_mac_caps = "AA:bb:cc:DD:Ee:ff";
@@ -144,6 +176,163 @@ static void testDefineUndefine(CuTest *tc) {
     CuAssertPtrEquals(tc, NULL, nif);
 }
 
+/* Redefining an interface keeps the comments and the entries netcf knows
+ * nothing about in its ifcfg file, and drops the ones the new config
+ * does not have */
+static void testRedefine(CuTest *tc) {
+    static const char *const ifcfg = "etc/sysconfig/network/ifcfg-br42";
+    char *bridge_xml = NULL;
+    struct netcf_if *nif = NULL;
+    int r;
+
+    bridge_xml = read_test_file(tc, "interface/bridge42.xml");
+    CuAssertPtrNotNull(tc, bridge_xml);
+
+    run(tc, "printf '# Left by hand\\nBRIDGE=yes\\nUSERCONTROL=no\\n"
+        "IPADDR=10.0.0.42/24\\n' > %s/%s", root, ifcfg);
+
+    nif = ncf_define(ncf, bridge_xml);
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+    ncf_if_free(nif);
+
+    nif = ncf_define(ncf, bridge_xml);
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+
+    run(tc, "grep -qx '# Left by hand' %s/%s", root, ifcfg);
+    run(tc, "grep -qx 'USERCONTROL=no' %s/%s", root, ifcfg);
+    run(tc, "! grep -q '^IPADDR=' %s/%s", root, ifcfg);
+
+    r = ncf_if_undefine(nif);
+    CuAssertIntEquals(tc, 0, r);
+    ncf_if_free(nif);
+    free(bridge_xml);
+}
+
+/* Defining an ethernet interface writes its udev rule, and drops the
+ * rule that gives its address another name; defining it again leaves the
+ * rules file alone, and undefining it removes its rule */
+static void testNetruleDefineUndefine(CuTest *tc) {
+    static const char *const eth5_xml =
+        "<interface type='ethernet' name='eth5'>"
+        "  <start mode='onboot'/>"
+        "  <mac address='00:00:00:00:00:01'/>"
+        "  <protocol family='ipv4'><dhcp/></protocol>"
+        "</interface>";
+    struct netcf_if *nif = NULL;
+    int r;
+
+    ncf_reset_stats(ncf);
+    nif = ncf_define(ncf, eth5_xml);
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+    CuAssertTrue(tc, stat_value(tc, "files_written") > 0);
+    ncf_if_free(nif);
+
+    run(tc, "grep 'NAME=\"eth5\"' %s/%s | grep -q '00:00:00:00:00:01'",
+        root, netrules);
+    run(tc, "! grep -q 'NAME=\"eth4\"' %s/%s", root, netrules);
+    run(tc, "grep -q 'NAME=\"eth3\"' %s/%s", root, netrules);
+
+    ncf_reset_stats(ncf);
+    nif = ncf_define(ncf, eth5_xml);
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+    CuAssertTrue(tc, stat_value(tc, "files_written") == 0);
+
+    r = ncf_if_undefine(nif);
+    CuAssertIntEquals(tc, 0, r);
+    assert_ncf_no_error(tc);
+    ncf_if_free(nif);
+
+    run(tc, "! grep -q 'NAME=\"eth5\"' %s/%s", root, netrules);
+    run(tc, "grep -q 'NAME=\"eth3\"' %s/%s", root, netrules);
+    run(tc, "test ! -e %s/etc/sysconfig/network/ifcfg-eth5", root);
+}
+
+/* The default route of an interface goes into its ifroute-IFNAME file.
+ * The global routes file is only changed when it has the default route
+ * of the interface. Undefining the interface removes its default route,
+ * and its ifroute file if nothing else is left in it */
+static void testRoutes(CuTest *tc) {
+    static const char *const eth5_xml =
+        "<interface type='ethernet' name='eth5'>"
+        "  <start mode='onboot'/>"
+        "  <mac address='00:00:00:00:00:05'/>"
+        "  <protocol family='ipv4'>"
+        "    <ip address='192.168.0.5' prefix='24'/>"
+        "    <route gateway='192.168.0.1'/>"
+        "  </protocol>"
+        "</interface>";
+    static const char *const eth3_xml =
+        "<interface type='ethernet' name='eth3'>"
+        "  <start mode='onboot'/>"
+        "  <mac address='00:00:00:00:00:03'/>"
+        "  <protocol family='ipv4'>"
+        "    <ip address='192.168.0.3' prefix='24'/>"
+        "    <route gateway='192.168.0.254'/>"
+        "  </protocol>"
+        "</interface>";
+    static const char *const eth4_xml =
+        "<interface type='ethernet' name='eth4'>"
+        "  <start mode='onboot'/>"
+        "  <mac address='00:00:00:00:00:01'/>"
+        "  <protocol family='ipv4'>"
+        "    <ip address='192.168.0.4' prefix='24'/>"
+        "    <route gateway='192.168.0.1'/>"
+        "  </protocol>"
+        "</interface>";
+    static const char *const net = "etc/sysconfig/network";
+    struct netcf_if *nif = NULL;
+    int r;
+
+    nif = ncf_define(ncf, eth5_xml);
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+
+    run(tc, "grep -qx 'default 192.168.0.1 - eth5' %s/%s/ifroute-eth5",
+        root, net);
+    run(tc, "cmp -s %s/%s/routes %s/%s/routes", src_root, net, root, net);
+
+    r = ncf_if_undefine(nif);
+    CuAssertIntEquals(tc, 0, r);
+    assert_ncf_no_error(tc);
+    ncf_if_free(nif);
+
+    run(tc, "test ! -e %s/%s/ifroute-eth5", root, net);
+    run(tc, "cmp -s %s/%s/routes %s/%s/routes", src_root, net, root, net);
+
+    /* The default route of eth3 moves out of the routes file */
+    nif = ncf_define(ncf, eth3_xml);
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+    ncf_if_free(nif);
+
+    run(tc, "grep -qx 'default 192.168.0.254 - eth3' %s/%s/ifroute-eth3",
+        root, net);
+    run(tc, "! grep -q '^default' %s/%s/routes", root, net);
+    run(tc, "grep -q '^10.1.0.0/16 ' %s/%s/routes", root, net);
+
+    /* The static route in ifroute-eth4 stays through a redefine and an
+     * undefine */
+    nif = ncf_define(ncf, eth4_xml);
+    CuAssertPtrNotNull(tc, nif);
+    assert_ncf_no_error(tc);
+
+    run(tc, "grep -qx 'default 192.168.0.1 - eth4' %s/%s/ifroute-eth4",
+        root, net);
+    run(tc, "grep -q '^10.2.0.0/16 ' %s/%s/ifroute-eth4", root, net);
+
+    r = ncf_if_undefine(nif);
+    CuAssertIntEquals(tc, 0, r);
+    assert_ncf_no_error(tc);
+    ncf_if_free(nif);
+
+    run(tc, "! grep -q '^default' %s/%s/ifroute-eth4", root, net);
+    run(tc, "grep -q '^10.2.0.0/16 ' %s/%s/ifroute-eth4", root, net);
+}
+
 static void assert_transforms(CuTest *tc, const char *base) {
     char *aug_fname = NULL, *ncf_fname = NULL;
     char *aug_xml_exp = NULL, *ncf_xml_exp = NULL;
@@ -232,8 +421,12 @@ int main(void) {
     SUITE_ADD_TEST(suite, testListInterfaces);
     SUITE_ADD_TEST(suite, testLookupByName);
     SUITE_ADD_TEST(suite, testLookupByNameDecoy);
+    SUITE_ADD_TEST(suite, testNetruleDesc);
     SUITE_ADD_TEST(suite, testLookupByMAC);
     SUITE_ADD_TEST(suite, testDefineUndefine);
+    SUITE_ADD_TEST(suite, testRedefine);
+    SUITE_ADD_TEST(suite, testNetruleDefineUndefine);
+    SUITE_ADD_TEST(suite, testRoutes);
     SUITE_ADD_TEST(suite, testTransforms);
     SUITE_ADD_TEST(suite, testCorruptedSetup);
 